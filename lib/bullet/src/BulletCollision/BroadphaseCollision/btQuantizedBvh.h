@@ -453,6 +453,18 @@ public:
 	}
 
 
+	///Read-only access to the nodes of a non-quantized tree, e.g. for packet ray traversals
+	SIMD_FORCE_INLINE const NodeArray&	getContiguousNodeArray() const
+	{
+		return	m_contiguousNodes;
+	}
+
+	///Number of nodes in the tree
+	SIMD_FORCE_INLINE int	getNumNodes() const
+	{
+		return	m_curNodeIndex;
+	}
+
 	SIMD_FORCE_INLINE BvhSubtreeInfoArray&	getSubtreeInfoArray()
 	{
 		return m_SubtreeHeaders;
@@ -143,6 +143,11 @@ public:
 	static	void						Start_Profile( const char * name );
 	static	void						Stop_Profile( void );
 
+	///The profile tree is not thread safe: disable profiling while
+	///bullet code is executed on more than one thread.
+	static	void						Set_Enabled( bool enabled ) { Enabled = enabled; }
+	static	bool						Is_Enabled( void )			{ return Enabled; }
+
 	static	void						CleanupMemory(void)
 	{
 		Root.CleanupMemory();
@@ -169,6 +174,7 @@ private:
 	static	CProfileNode *			CurrentNode;
 	static	int						FrameCounter;
 	static	unsigned long int					ResetTime;
+	static	bool						Enabled;
 };
 
 
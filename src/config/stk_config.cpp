@@ -157,6 +157,8 @@ void STKConfig::load(const std::string &filename)
     CHECK_NEG(m_no_explosive_items_timeout,"powerup no-explosive-items-timeout"    );
     CHECK_NEG(m_max_moveable_objects,      "network max-moveable-objects");
     CHECK_NEG(m_network_steering_reduction,"network steering-reduction" );
+    CHECK_NEG(m_network_max_prediction_error,
+              "network max-prediction-error");
     CHECK_NEG(m_default_moveable_friction, "physics default-moveable-friction");
     CHECK_NEG(m_solver_iterations,         "physics: solver-iterations"       );
     CHECK_NEG(m_solver_split_impulse_thresh,"physics: solver-split-impulse-threshold");
@@ -212,6 +214,7 @@ void STKConfig::init_defaults()
     m_solver_set_flags           = 0;
     m_solver_reset_flags         = 0;
     m_network_steering_reduction = -100;
+    m_network_max_prediction_error = -100;
     m_title_music                = NULL;
     m_default_music              = NULL;
     m_solver_split_impulse       = false;
@@ -477,6 +480,8 @@ void STKConfig::getAllData(const XMLNode * root)
     {
         networking_node->get("max-moveable-objects", &m_max_moveable_objects);
         networking_node->get("steering-reduction", &m_network_steering_reduction);
+        networking_node->get("max-prediction-error",
+                             &m_network_max_prediction_error);
     }
 
     if(const XMLNode *replay_node = root->getNode("replay"))
@@ -98,6 +98,11 @@ public:
      *  steering adjustments. */
     float m_network_steering_reduction;
 
+    /** A client does not rewind if a state from the server differs by less
+     *  than this from the state it predicted (in m, m/s and radians).
+     *  Negative values disable this, i.e. the client always rewinds. */
+    float m_network_max_prediction_error;
+
     /** If the angle between a normal on a vertex and the normal of the
      *  triangle are more than this value, the physics will use the normal
      *  of the triangle in smoothing normal. */
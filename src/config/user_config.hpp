@@ -683,6 +683,16 @@ namespace UserConfigParams
     /** If gamepad debugging is enabled. */
     PARAM_PREFIX bool m_unit_testing PARAM_DEFAULT(false);
 
+    /** If micro benchmarks should be run. */
+    PARAM_PREFIX bool m_micro_benchmarks PARAM_DEFAULT(false);
+
+    /** If the precomputed shortest paths of all arenas should be written. */
+    PARAM_PREFIX bool m_generate_arena_paths PARAM_DEFAULT(false);
+
+    /** If the precomputed path tables of all drive graphs should be
+     *  written. */
+    PARAM_PREFIX bool m_generate_drive_paths PARAM_DEFAULT(false);
+
     /** If gamepad debugging is enabled. */
     PARAM_PREFIX bool m_gamepad_debug PARAM_DEFAULT( false );
 
@@ -708,6 +718,15 @@ namespace UserConfigParams
     /** True if physics debugging should be enabled. */
     PARAM_PREFIX bool m_physics_debug PARAM_DEFAULT( false );
 
+    /** Number of threads used to solve the physics islands and to cast the
+     *  wheel rays of all karts. For this and m_render_threads, 0 or 1 uses
+     *  the sequential code, so threads are only used if enabled. */
+    PARAM_PREFIX int m_physics_threads PARAM_DEFAULT( 0 );
+
+    /** Number of threads used to cull the scene and to compute the instance
+     *  data of all meshes. */
+    PARAM_PREFIX int m_render_threads PARAM_DEFAULT( 0 );
+
     /** True if fps should be printed each frame. */
     PARAM_PREFIX bool m_fps_debug PARAM_DEFAULT(false);
 
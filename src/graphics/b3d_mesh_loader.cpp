@@ -9,6 +9,7 @@
 #include "graphics/sp/sp_animation.hpp"
 #include "graphics/sp/sp_mesh.hpp"
 #include "graphics/sp/sp_mesh_buffer.hpp"
+#include "graphics/sp/sp_mesh_cache.hpp"
 #include "utils/mini_glm.hpp"
 
 #include <IVideoDriver.h>
@@ -16,6 +17,7 @@
 #include "../../lib/irrlicht/source/Irrlicht/os.h"
 
 #include <algorithm>
+#include <memory>
 
 int B3DMeshLoader::m_straight_frame = 0;
 
@@ -49,6 +51,19 @@ scene::IAnimatedMesh* B3DMeshLoader::createMesh(io::IReadFile* f)
     if (!f)
         return 0;
 
+#ifndef SERVER_ONLY
+    // Converted meshes are only cached for the SP renderer, the straight
+    // frame is the bind pose of the converted mesh
+    std::unique_ptr<SP::SPMeshCache> cache;
+    if (CVS->isGLSL())
+    {
+        cache.reset(new SP::SPMeshCache(f, m_straight_frame));
+        SP::SPMesh* spm = cache->load();
+        if (spm)
+            return spm;
+    }
+#endif
+
     m_texture_string.clear();
     B3DFile = f;
     AnimatedMesh = new scene::CSkinnedMesh();
@@ -69,8 +84,9 @@ scene::IAnimatedMesh* B3DMeshLoader::createMesh(io::IReadFile* f)
     if (CVS->isGLSL())
     {
         SP::SPMesh* spm = toSPM(static_cast<scene::CSkinnedMesh*>
-            (AnimatedMesh->getMesh(m_straight_frame)));
+            (AnimatedMesh->getMesh(m_straight_frame)), cache.get());
         m_texture_string.clear();
+        cache->save(spm);
         return spm;
     }
 #endif
@@ -78,7 +94,8 @@ scene::IAnimatedMesh* B3DMeshLoader::createMesh(io::IReadFile* f)
     return AnimatedMesh;
 }
 
-SP::SPMesh* B3DMeshLoader::toSPM(scene::CSkinnedMesh* mesh)
+SP::SPMesh* B3DMeshLoader::toSPM(scene::CSkinnedMesh* mesh,
+                                 SP::SPMeshCache* cache)
 {
     SP::SPMesh* spm = new SP::SPMesh();
     core::array<SSkinMeshBuffer*>& all_buf = mesh->getMeshBuffers();
@@ -195,8 +212,15 @@ SP::SPMesh* B3DMeshLoader::toSPM(scene::CSkinnedMesh* mesh)
             tex_name_1 = m_texture_string.at(all_buf[b]).first;
             tex_name_2 = m_texture_string.at(all_buf[b]).second;
         }
-        spmb->setSTKMaterial(material_manager->getMaterialSPM
-            (tex_name_1, tex_name_2));
+        Material* m = NULL;
+#ifndef SERVER_ONLY
+        // The cache remembers the names used to look up the material
+        if (cache)
+            m = cache->getMaterial(tex_name_1, tex_name_2);
+        else
+#endif
+            m = material_manager->getMaterialSPM(tex_name_1, tex_name_2);
+        spmb->setSTKMaterial(m);
         spm->addSPMeshBuffer(spmb);
     }
 
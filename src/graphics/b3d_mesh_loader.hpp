@@ -18,6 +18,7 @@ using namespace irr;
 namespace SP
 {
     class SPMesh;
+    class SPMeshCache;
 }
 
 
@@ -56,7 +57,7 @@ private:
     typedef core::array<core::array <core::array<JointInfluence> > >
         WeightInfluence;
 
-    SP::SPMesh* toSPM(scene::CSkinnedMesh* mesh);
+    SP::SPMesh* toSPM(scene::CSkinnedMesh* mesh, SP::SPMeshCache* cache);
 
     std::unordered_map<scene::IMeshBuffer*, std::pair<std::string, std::string> > m_texture_string;
 
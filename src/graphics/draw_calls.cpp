@@ -208,6 +208,7 @@ void DrawCalls::prepareDrawCalls(scene::ICameraSceneNode *camnode)
         irr_driver->getSceneManager()->getRootSceneNode()->getChildren(),
         camnode);
     SP::handleDynamicDrawCall();
+    SP::cullObjects();
     SP::updateModelMatrix();
     PROFILER_POP_CPU_MARKER();
 
@@ -86,9 +86,16 @@ Material* MaterialManager::getMaterialFor(video::ITexture* t,
 }
 
 //-----------------------------------------------------------------------------
+/** Returns the material of a SP mesh buffer with the given textures.
+ *  \param def_shader_name Shader of the default material, which is used if
+ *         no material for the textures exists.
+ *  \param create_default If false, NULL is returned instead of a default
+ *         material, so that no default material is created.
+ */
 Material* MaterialManager::getMaterialSPM(std::string lay_one_tex_lc,
                                           std::string lay_two_tex_lc,
-                                          const std::string& def_shader_name)
+                                          const std::string& def_shader_name,
+                                          bool create_default)
 {
     std::string original_layer_one = lay_one_tex_lc;
     core::stringc lc(lay_one_tex_lc.c_str());
@@ -143,6 +150,8 @@ Material* MaterialManager::getMaterialSPM(std::string lay_one_tex_lc,
             }
         }   // for i
     }
+    if (!create_default)
+        return NULL;
     return getDefaultSPMaterial(def_shader_name,
         is_full_path ?
         original_layer_one : StringUtils::getBasename(original_layer_one),
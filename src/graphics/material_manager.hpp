@@ -63,7 +63,8 @@ public:
     Material* getMaterialFor(video::ITexture* t);
     Material* getMaterialSPM(std::string lay_one_tex_lc,
                              std::string lay_two_tex_lc,
-                             const std::string& def_shader_name = "solid");
+                             const std::string& def_shader_name = "solid",
+                             bool create_default = true);
     void      setAllMaterialFlags(video::ITexture* t,
                                   scene::IMeshBuffer *mb);
     void      setAllUntexturedMaterialFlags(scene::IMeshBuffer *mb);
@@ -720,8 +720,10 @@ void ShaderBasedRenderer::render(float dt, bool is_loading)
 
     {
         PROFILER_PUSH_CPU_MARKER("Update scene", 0x0, 0xFF, 0x0);
+        SP::beginPoseBatch();
         static_cast<scene::CSceneManager *>(irr_driver->getSceneManager())
             ->OnAnimate(os::Timer::getTime());
+        SP::endPoseBatch();
         PROFILER_POP_CPU_MARKER();
     }
 
@@ -850,8 +852,10 @@ void ShaderBasedRenderer::renderToTexture(GL3RenderTarget *render_target,
     assert(m_rtts != NULL);
 
     irr_driver->getSceneManager()->setActiveCamera(camera);
+    SP::beginPoseBatch();
     static_cast<scene::CSceneManager *>(irr_driver->getSceneManager())
         ->OnAnimate(os::Timer::getTime());
+    SP::endPoseBatch();
     computeMatrixesAndCameras(camera, m_rtts->getWidth(), m_rtts->getHeight());
     if (CVS->isARBUniformBufferObjectUsable())
         uploadLightingData();
@@ -31,12 +31,14 @@
 #include "graphics/render_info.hpp"
 #include "graphics/rtts.hpp"
 #include "graphics/shaders.hpp"
+#include "graphics/sp/sp_culling.hpp"
 #include "graphics/sp/sp_dynamic_draw_call.hpp"
 #include "graphics/sp/sp_instanced_data.hpp"
 #include "graphics/sp/sp_per_object_uniform.hpp"
 #include "graphics/sp/sp_mesh.hpp"
 #include "graphics/sp/sp_mesh_buffer.hpp"
 #include "graphics/sp/sp_mesh_node.hpp"
+#include "graphics/sp/sp_pose_cache.hpp"
 #include "graphics/sp/sp_shader.hpp"
 #include "graphics/sp/sp_shader_manager.hpp"
 #include "graphics/sp/sp_texture.hpp"
@@ -48,6 +50,7 @@
 #include "utils/helpers.hpp"
 #include "utils/profiler.hpp"
 #include "utils/string_utils.hpp"
+#include "utils/worker_pool.hpp"
 
 #include <algorithm>
 #include <array>
@@ -77,11 +80,21 @@ SPShader* g_normal_visualizer = NULL;
 // ----------------------------------------------------------------------------
 SPShader* g_glow_shader = NULL;
 // ----------------------------------------------------------------------------
-// std::string is layer_1 and layer_2 texture name combined
-typedef std::unordered_map<SPShader*, std::unordered_map<std::string,
-    std::unordered_set<SPMeshBuffer*> > > DrawCall;
-
-DrawCall g_draw_calls[DCT_FOR_VAO];
+// The draw calls of each draw call type as packed keys, see addDrawCall().
+// They are sorted in updateModelMatrix().
+std::vector<uint64_t> g_draw_calls[DCT_FOR_VAO];
+// ----------------------------------------------------------------------------
+// Scratch buffer for radixSort()
+std::vector<uint64_t> g_sort_buffer;
+// ----------------------------------------------------------------------------
+// The shaders and mesh buffers used in the draw call keys of this frame,
+// indexed by their draw call index
+std::vector<SPShader*> g_draw_call_shaders;
+std::vector<SPMeshBuffer*> g_draw_call_mesh_buffers;
+// ----------------------------------------------------------------------------
+// Incremented for each frame, so that the draw call indices of shaders and
+// mesh buffers from an older frame are not used
+unsigned g_draw_call_frame = 0;
 // ----------------------------------------------------------------------------
 std::vector<std::pair<SPShader*, std::vector<std::pair<std::array<GLuint, 6>,
     std::vector<std::pair<SPMeshBuffer*, int/*material_id*/> > > > > >
@@ -105,6 +118,44 @@ std::vector<std::shared_ptr<SPDynamicDrawCall> > g_dy_dc;
 // ----------------------------------------------------------------------------
 float g_frustums[5][24] = { { } };
 // ----------------------------------------------------------------------------
+/** The bounding boxes of all objects added in a frame, which are culled in
+ *  one batch by cullObjects(). */
+SPCulling g_culling;
+// ----------------------------------------------------------------------------
+/** A mesh buffer added by addObject(). */
+struct CullingMeshBuffer
+{
+    SPMeshNode* m_node;
+    unsigned m_mesh_buffer;
+    /** The frustums to test, bit 0 is the camera, bits 1 to 4 are the
+     *  shadow cascades. */
+    uint8_t m_frustum_mask;
+};
+std::vector<CullingMeshBuffer> g_culling_mesh_buffers;
+// ----------------------------------------------------------------------------
+/** The dynamic draw calls added by handleDynamicDrawCall() with the index of
+ *  their box in g_culling. Their boxes are added before the boxes of the
+ *  mesh buffers. */
+std::vector<std::pair<SPDynamicDrawCall*, unsigned> > g_culling_dy_dc;
+// ----------------------------------------------------------------------------
+/** The indices in g_culling_mesh_buffers of the visible mesh buffers. */
+std::vector<unsigned> g_culling_visible;
+// ----------------------------------------------------------------------------
+/** The instance data of each visible mesh buffer in g_culling_visible. */
+std::vector<SPInstancedData> g_culling_instances;
+// ----------------------------------------------------------------------------
+/** Used to prepare the scene in parallel, NULL if only one thread is used. */
+WorkerPool* g_worker_pool = NULL;
+// ----------------------------------------------------------------------------
+/** The poses of the animated nodes of this frame, see beginPoseBatch(). */
+SPPoseCache g_pose_cache;
+// ----------------------------------------------------------------------------
+/** The nodes which requested a pose in g_pose_cache, in request order. */
+std::vector<SPMeshNode*> g_pose_nodes;
+// ----------------------------------------------------------------------------
+/** True between beginPoseBatch() and endPoseBatch(). */
+bool g_pose_batch = false;
+// ----------------------------------------------------------------------------
 unsigned sp_solid_poly_count = 0;
 // ----------------------------------------------------------------------------
 unsigned sp_shadow_poly_count = 0;
@@ -431,6 +482,11 @@ void init()
     }
 
     initSkinning();
+    if (UserConfigParams::m_render_threads > 1)
+    {
+        g_worker_pool =
+            new WorkerPool((unsigned)UserConfigParams::m_render_threads);
+    }
     for (unsigned i = 0; i < MAX_PLAYER_COUNT; i++)
     {
         for (int j = 0; j < 3; j++)
@@ -588,6 +644,8 @@ void init()
 void destroy()
 {
     g_dy_dc.clear();
+    delete g_worker_pool;
+    g_worker_pool = NULL;
     SPTextureManager::get()->stopThreads();
     SPShaderManager::destroy();
     g_glow_shader = NULL;
@@ -772,6 +830,16 @@ void prepareDrawCalls()
         mathPlaneFrustumf(g_frustums[4],
             g_stk_sbr->getShadowMatrices()->getSunOrthoMatrices()[3]);
     }
+    g_culling.clear(g_handle_shadow ? 5 : 1);
+    for (unsigned i = 0; i < (g_handle_shadow ? 5 : 1); i++)
+    {
+        g_culling.setFrustum(i, g_frustums[i]);
+    }
+    g_culling_mesh_buffers.clear();
+    g_culling_dy_dc.clear();
+    g_draw_call_frame++;
+    g_draw_call_shaders.clear();
+    g_draw_call_mesh_buffers.clear();
 
     for (auto& p : g_draw_calls)
     {
@@ -785,6 +853,80 @@ void prepareDrawCalls()
     g_instances.clear();
 }
 
+// ----------------------------------------------------------------------------
+/** Adds a draw call as a 64-bit key, from the highest to the lowest bits:
+ *  the drawing priority of the shader (8 bits), the index of the shader in
+ *  this frame (12 bits), the texture compare id (20 bits) and the index of
+ *  the mesh buffer in this frame (24 bits). Sorting the keys sorts the draw
+ *  calls by priority, and groups them by shader and textures.
+ */
+void addDrawCall(DrawCallType dct, SPShader* shader, uint32_t texture,
+                 SPMeshBuffer* mb)
+{
+    int shader_index = shader->getDrawCallIndex(g_draw_call_frame);
+    if (shader_index == -1)
+    {
+        shader_index = (int)g_draw_call_shaders.size();
+        shader->setDrawCallIndex(g_draw_call_frame, shader_index);
+        g_draw_call_shaders.push_back(shader);
+    }
+    int mb_index = mb->getDrawCallIndex(g_draw_call_frame);
+    if (mb_index == -1)
+    {
+        mb_index = (int)g_draw_call_mesh_buffers.size();
+        mb->setDrawCallIndex(g_draw_call_frame, mb_index);
+        g_draw_call_mesh_buffers.push_back(mb);
+    }
+    assert(shader_index < (1 << 12));
+    assert(texture < (1 << 20));
+    assert(mb_index < (1 << 24));
+    const uint64_t priority =
+        core::clamp(shader->getDrawingPriority() + 128, 0, 255);
+    g_draw_calls[dct].push_back(priority << 56 |
+        (uint64_t)shader_index << 44 | (uint64_t)texture << 24 |
+        (uint64_t)mb_index);
+}   // addDrawCall
+
+// ----------------------------------------------------------------------------
+/** Sorts keys with a least significant digit radix sort. Passes in which
+ *  all keys have the same digit are skipped.
+ */
+void radixSort(std::vector<uint64_t>* keys)
+{
+    const size_t n = keys->size();
+    g_sort_buffer.resize(n);
+    uint64_t* src = keys->data();
+    uint64_t* dst = g_sort_buffer.data();
+    for (unsigned shift = 0; shift < 64 && n > 1; shift += 8)
+    {
+        size_t count[256] = {};
+        for (size_t i = 0; i < n; i++)
+        {
+            count[(src[i] >> shift) & 0xff]++;
+        }
+        if (count[(src[0] >> shift) & 0xff] == n)
+        {
+            continue;
+        }
+        size_t offset = 0;
+        for (unsigned d = 0; d < 256; d++)
+        {
+            const size_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+    if (src != keys->data())
+    {
+        std::copy(src, src + n, keys->data());
+    }
+}   // radixSort
+
 // ----------------------------------------------------------------------------
 void addObject(SPMeshNode* node)
 {
@@ -798,166 +940,166 @@ void addObject(SPMeshNode* node)
         return;
     }
 
-    const core::matrix4& model_matrix = node->getAbsoluteTransformation();
-    bool added_for_skinning = false;
+    // The bounding boxes are computed and culled in cullObjects()
     for (unsigned m = 0; m < node->getSPM()->getMeshBufferCount(); m++)
     {
-        SPMeshBuffer* mb = node->getSPM()->getSPMeshBuffer(m);
         SPShader* shader = node->getShader(m);
         if (shader == NULL)
         {
             continue;
         }
-        core::aabbox3df bb = mb->getBoundingBox();
-        model_matrix.transformBoxEx(bb);
-        std::vector<bool> discard;
         const bool handle_shadow = node->isInShadowPass() &&
             g_handle_shadow && shader->hasShader(RP_SHADOW);
-        discard.resize((handle_shadow ? 5 : 1), false);
+        CullingMeshBuffer cmb = { node, m, uint8_t(handle_shadow ? 0x1f : 1) };
+        g_culling_mesh_buffers.push_back(cmb);
+    }
+}   // addObject
 
-        for (int dc_type = 0; dc_type < (handle_shadow ? 5 : 1); dc_type++)
+// ----------------------------------------------------------------------------
+/** Does the work for a visible mesh buffer that must be done on the main
+ *  thread in scene order: the GL mesh is uploaded and the skinning matrices
+ *  of the node are added.
+ *  \param added_for_skinning True if the skinning matrices of the node were
+ *         already added.
+ *  \return False if there is no space for the skinning matrices of the
+ *          node, in which case no mesh buffer of it should be added.
+ */
+bool prepareMeshBuffer(SPMeshNode* node, unsigned m,
+                       const core::aabbox3df& bb, bool added_for_skinning)
+{
+    SPMeshBuffer* mb = node->getSPM()->getSPMeshBuffer(m);
+
+    if (irr_driver->getBoundingBoxesViz())
+    {
+        addEdgeForViz(getCorner(bb, 0), getCorner(bb, 1));
+        addEdgeForViz(getCorner(bb, 1), getCorner(bb, 5));
+        addEdgeForViz(getCorner(bb, 5), getCorner(bb, 4));
+        addEdgeForViz(getCorner(bb, 4), getCorner(bb, 0));
+        addEdgeForViz(getCorner(bb, 2), getCorner(bb, 3));
+        addEdgeForViz(getCorner(bb, 3), getCorner(bb, 7));
+        addEdgeForViz(getCorner(bb, 7), getCorner(bb, 6));
+        addEdgeForViz(getCorner(bb, 6), getCorner(bb, 2));
+        addEdgeForViz(getCorner(bb, 0), getCorner(bb, 2));
+        addEdgeForViz(getCorner(bb, 1), getCorner(bb, 3));
+        addEdgeForViz(getCorner(bb, 5), getCorner(bb, 7));
+        addEdgeForViz(getCorner(bb, 4), getCorner(bb, 6));
+    }
+
+    mb->uploadGLMesh();
+    // For first frame only need the vbo to be initialized
+    if (!added_for_skinning && node->getAnimationState())
+    {
+        int skinning_offset = g_skinning_offset + node->getTotalJoints();
+        if (skinning_offset > int(stk_config->m_max_skinning_bones))
         {
-            for (int i = 0; i < 24; i += 4)
-            {
-                bool outside = true;
-                for (int j = 0; j < 8; j++)
-                {
-                    const float dist =
-                        getCorner(bb, j).X * g_frustums[dc_type][i] +
-                        getCorner(bb, j).Y * g_frustums[dc_type][i + 1] +
-                        getCorner(bb, j).Z * g_frustums[dc_type][i + 2] +
-                        g_frustums[dc_type][i + 3];
-                    outside = outside && dist < 0.0f;
-                    if (!outside)
-                    {
-                        break;
-                    }
-                }
-                if (outside)
-                {
-                    discard[dc_type] = true;
-                    break;
-                }
-            }
+            Log::error("SPBase", "No enough space to render skinned"
+                " mesh %s! Max joints can hold: %d",
+                node->getName(), stk_config->m_max_skinning_bones);
+            return false;
         }
-        if (handle_shadow ?
-            (discard[0] && discard[1] && discard[2] && discard[3] &&
-            discard[4]) : discard[0])
+        node->setSkinningOffset(g_skinning_offset);
+        g_skinning_mesh.push_back(node);
+        g_skinning_offset = skinning_offset;
+    }
+    return true;
+}   // prepareMeshBuffer
+
+// ----------------------------------------------------------------------------
+/** Returns the instance data of a mesh buffer. This can be called from any
+ *  thread once the skinning offset of the node is set.
+ */
+inline SPInstancedData getInstancedData(SPMeshNode* node, unsigned m)
+{
+    float hue = node->getRenderInfo(m) ?
+        node->getRenderInfo(m)->getHue() : 0.0f;
+    return SPInstancedData
+        (node->getAbsoluteTransformation(), node->getTextureMatrix(m)[0],
+        node->getTextureMatrix(m)[1], hue,
+        (short)node->getSkinningOffset());
+}   // getInstancedData
+
+// ----------------------------------------------------------------------------
+/** Adds the draw calls of a mesh buffer which is visible in at least one
+ *  frustum.
+ *  \param visible Bit mask of the frustums the mesh buffer is visible in.
+ *  \param id The instance data of the mesh buffer.
+ */
+void addMeshBuffer(SPMeshNode* node, unsigned m, uint8_t visible,
+                   const SPInstancedData& id)
+{
+    SPMeshBuffer* mb = node->getSPM()->getSPMeshBuffer(m);
+    SPShader* shader = node->getShader(m);
+    const bool handle_shadow = node->isInShadowPass() &&
+        g_handle_shadow && shader->hasShader(RP_SHADOW);
+
+    for (int dc_type = 0; dc_type < (handle_shadow ? 5 : 1); dc_type++)
+    {
+        if ((visible & (1 << dc_type)) == 0)
         {
             continue;
         }
-
-        if (irr_driver->getBoundingBoxesViz())
+        if (dc_type == 0)
         {
-            addEdgeForViz(getCorner(bb, 0), getCorner(bb, 1));
-            addEdgeForViz(getCorner(bb, 1), getCorner(bb, 5));
-            addEdgeForViz(getCorner(bb, 5), getCorner(bb, 4));
-            addEdgeForViz(getCorner(bb, 4), getCorner(bb, 0));
-            addEdgeForViz(getCorner(bb, 2), getCorner(bb, 3));
-            addEdgeForViz(getCorner(bb, 3), getCorner(bb, 7));
-            addEdgeForViz(getCorner(bb, 7), getCorner(bb, 6));
-            addEdgeForViz(getCorner(bb, 6), getCorner(bb, 2));
-            addEdgeForViz(getCorner(bb, 0), getCorner(bb, 2));
-            addEdgeForViz(getCorner(bb, 1), getCorner(bb, 3));
-            addEdgeForViz(getCorner(bb, 5), getCorner(bb, 7));
-            addEdgeForViz(getCorner(bb, 4), getCorner(bb, 6));
+            sp_solid_poly_count += mb->getIndexCount() / 3;
         }
-
-        mb->uploadGLMesh();
-        // For first frame only need the vbo to be initialized
-        if (!added_for_skinning && node->getAnimationState())
+        else
         {
-            added_for_skinning = true;
-            int skinning_offset = g_skinning_offset + node->getTotalJoints();
-            if (skinning_offset > int(stk_config->m_max_skinning_bones))
-            {
-                Log::error("SPBase", "No enough space to render skinned"
-                    " mesh %s! Max joints can hold: %d",
-                    node->getName(), stk_config->m_max_skinning_bones);
-                return;
-            }
-            node->setSkinningOffset(g_skinning_offset);
-            g_skinning_mesh.push_back(node);
-            g_skinning_offset = skinning_offset;
+            sp_shadow_poly_count += mb->getIndexCount() / 3;
         }
-
-        float hue = node->getRenderInfo(m) ?
-            node->getRenderInfo(m)->getHue() : 0.0f;
-        SPInstancedData id = SPInstancedData
-            (node->getAbsoluteTransformation(), node->getTextureMatrix(m)[0],
-            node->getTextureMatrix(m)[1], hue,
-            (short)node->getSkinningOffset());
-
-        for (int dc_type = 0; dc_type < (handle_shadow ? 5 : 1); dc_type++)
+        if (shader->isTransparent())
         {
-            if (discard[dc_type])
-            {
-                continue;
-            }
+            // Transparent shader should always uses mesh samplers
+            // All transparent draw calls go DCT_TRANSPARENT
             if (dc_type == 0)
             {
-                sp_solid_poly_count += mb->getIndexCount() / 3;
+                for (auto& p : mb->getTextureCompare())
+                {
+                    addDrawCall(DCT_TRANSPARENT, shader, p.first, mb);
+                }
+                mb->addInstanceData(id, DCT_TRANSPARENT);
             }
             else
             {
-                sp_shadow_poly_count += mb->getIndexCount() / 3;
+                continue;
             }
-            if (shader->isTransparent())
+        }
+        else
+        {
+            // Check if shader for render pass uses mesh samplers
+            const RenderPass check_pass =
+                dc_type == DCT_NORMAL ? RP_1ST : RP_SHADOW;
+            const bool sampler_less = shader->samplerLess(check_pass);
+            if (sampler_less)
             {
-                // Transparent shader should always uses mesh samplers
-                // All transparent draw calls go DCT_TRANSPARENT
-                if (dc_type == 0)
-                {
-                    auto& ret = g_draw_calls[DCT_TRANSPARENT][shader];
-                    for (auto& p : mb->getTextureCompare())
-                    {
-                        ret[p.first].insert(mb);
-                    }
-                    mb->addInstanceData(id, DCT_TRANSPARENT);
-                }
-                else
-                {
-                    continue;
-                }
+                addDrawCall((DrawCallType)dc_type, shader, 0, mb);
             }
             else
             {
-                // Check if shader for render pass uses mesh samplers
-                const RenderPass check_pass =
-                    dc_type == DCT_NORMAL ? RP_1ST : RP_SHADOW;
-                const bool sampler_less = shader->samplerLess(check_pass);
-                auto& ret = g_draw_calls[dc_type][shader];
-                if (sampler_less)
-                {
-                    ret[""].insert(mb);
-                }
-                else
+                for (auto& p : mb->getTextureCompare())
                 {
-                    for (auto& p : mb->getTextureCompare())
-                    {
-                        ret[p.first].insert(mb);
-                    }
+                    addDrawCall((DrawCallType)dc_type, shader, p.first,
+                        mb);
                 }
-                mb->addInstanceData(id, (DrawCallType)dc_type);
-                if (UserConfigParams::m_glow && node->hasGlowColor() &&
-                    CVS->isDeferredEnabled() && dc_type == DCT_NORMAL)
+            }
+            mb->addInstanceData(id, (DrawCallType)dc_type);
+            if (UserConfigParams::m_glow && node->hasGlowColor() &&
+                CVS->isDeferredEnabled() && dc_type == DCT_NORMAL)
+            {
+                video::SColorf gc = node->getGlowColor();
+                unsigned key = gc.toSColor().color;
+                auto ret = g_glow_meshes.find(key);
+                if (ret == g_glow_meshes.end())
                 {
-                    video::SColorf gc = node->getGlowColor();
-                    unsigned key = gc.toSColor().color;
-                    auto ret = g_glow_meshes.find(key);
-                    if (ret == g_glow_meshes.end())
-                    {
-                        g_glow_meshes[key] = std::make_pair(
-                            core::vector3df(gc.r, gc.g, gc.b),
-                            std::unordered_set<SPMeshBuffer*>());
-                    }
-                    g_glow_meshes.at(key).second.insert(mb);
+                    g_glow_meshes[key] = std::make_pair(
+                        core::vector3df(gc.r, gc.g, gc.b),
+                        std::unordered_set<SPMeshBuffer*>());
                 }
+                g_glow_meshes.at(key).second.insert(mb);
             }
-            g_instances.insert(mb);
         }
+        g_instances.insert(mb);
     }
-}
+}   // addMeshBuffer
 
 // ----------------------------------------------------------------------------
 void handleDynamicDrawCall()
@@ -980,41 +1122,132 @@ void handleDynamicDrawCall()
         SPShader* shader = dydc->getShader();
         core::aabbox3df bb = dydc->getBoundingBox();
         dydc->getAbsoluteTransformation().transformBoxEx(bb);
-        std::vector<bool> discard;
         const bool handle_shadow =
             g_handle_shadow && shader->hasShader(RP_SHADOW);
-        discard.resize((handle_shadow ? 5 : 1), false);
-        for (int dc_type = 0; dc_type < (handle_shadow ? 5 : 1); dc_type++)
+        g_culling_dy_dc.emplace_back(dydc,
+            g_culling.addBox(bb, handle_shadow ? 0x1f : 0x01));
+    }
+}   // handleDynamicDrawCall
+
+// ----------------------------------------------------------------------------
+/** Runs a job for the indices 0 ... count-1, in parallel if more than one
+ *  thread is used to prepare the scene.
+ */
+void runJobs(unsigned count, const WorkerPool::Job& job)
+{
+    if (g_worker_pool)
+    {
+        g_worker_pool->run(count, job);
+        return;
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        job(i, 0);
+    }
+}   // runJobs
+
+// ----------------------------------------------------------------------------
+/** Culls all mesh buffers and dynamic draw calls added in this frame as one
+ *  batch, and creates the draw calls of the visible ones. The bounding
+ *  boxes, the culling and the instance data are computed in parallel jobs
+ *  over ranges of mesh buffers. Uploading to GL, the skinning offsets and
+ *  adding the draw calls are done on this thread in scene order, so the
+ *  result does not depend on the number of threads.
+ */
+void cullObjects()
+{
+    if (!sp_culling)
+    {
+        return;
+    }
+
+    // The boxes of the dynamic draw calls were added first, so the box of
+    // mesh buffer i is box first_box + i.
+    const unsigned first_box = g_culling.getNumBoxes();
+    const unsigned num_mb = (unsigned)g_culling_mesh_buffers.size();
+    g_culling.resize(first_box + num_mb);
+
+    // Number of boxes (and mesh buffers) handled by one job
+    const unsigned job_size = 64 * SPCulling::BATCH_SIZE;
+    const unsigned num_jobs =
+        (g_culling.getNumBoxes() + job_size - 1) / job_size;
+    runJobs(num_jobs, [first_box, job_size](unsigned job, unsigned thread)
         {
-            for (int i = 0; i < 24; i += 4)
+            const unsigned first = job * job_size;
+            const unsigned end =
+                std::min(first + job_size, g_culling.getNumBoxes());
+            for (unsigned i = std::max(first, first_box); i < end; i++)
             {
-                bool outside = true;
-                for (int j = 0; j < 8; j++)
-                {
-                    const float dist =
-                        getCorner(bb, j).X * g_frustums[dc_type][i] +
-                        getCorner(bb, j).Y * g_frustums[dc_type][i + 1] +
-                        getCorner(bb, j).Z * g_frustums[dc_type][i + 2] +
-                        g_frustums[dc_type][i + 3];
-                    outside = outside && dist < 0.0f;
-                    if (!outside)
-                    {
-                        break;
-                    }
-                }
-                if (outside)
-                {
-                    discard[dc_type] = true;
-                    break;
-                }
+                const CullingMeshBuffer& cmb =
+                    g_culling_mesh_buffers[i - first_box];
+                core::aabbox3df bb = cmb.m_node->getSPM()
+                    ->getSPMeshBuffer(cmb.m_mesh_buffer)->getBoundingBox();
+                cmb.m_node->getAbsoluteTransformation().transformBoxEx(bb);
+                g_culling.setBox(i, bb, cmb.m_frustum_mask);
             }
+            g_culling.cull(first, job_size);
+        });
+
+    SPMeshNode* skinned_node = NULL;
+    SPMeshNode* skipped_node = NULL;
+    g_culling_visible.clear();
+    for (unsigned i = 0; i < num_mb; i++)
+    {
+        SPMeshNode* node = g_culling_mesh_buffers[i].m_node;
+        if (g_culling.getVisibleFrustums(first_box + i) == 0 ||
+            node == skipped_node)
+        {
+            continue;
+        }
+        // The skinning matrices are added with the first visible mesh
+        // buffer of a node
+        if (!prepareMeshBuffer(node, g_culling_mesh_buffers[i].m_mesh_buffer,
+            g_culling.getBox(first_box + i), node == skinned_node))
+        {
+            skipped_node = node;
+            continue;
         }
-        if (handle_shadow ?
-            (discard[0] && discard[1] && discard[2] && discard[3] &&
-            discard[4]) : discard[0])
+        skinned_node = node;
+        g_culling_visible.push_back(i);
+    }
+
+    const unsigned num_visible = (unsigned)g_culling_visible.size();
+    g_culling_instances.resize(num_visible);
+    runJobs((num_visible + job_size - 1) / job_size,
+        [num_visible, job_size](unsigned job, unsigned thread)
+        {
+            const unsigned end = std::min((job + 1) * job_size, num_visible);
+            for (unsigned i = job * job_size; i < end; i++)
+            {
+                const CullingMeshBuffer& cmb =
+                    g_culling_mesh_buffers[g_culling_visible[i]];
+                g_culling_instances[i] =
+                    getInstancedData(cmb.m_node, cmb.m_mesh_buffer);
+            }
+        });
+
+    for (unsigned i = 0; i < num_visible; i++)
+    {
+        const unsigned n = g_culling_visible[i];
+        addMeshBuffer(g_culling_mesh_buffers[n].m_node,
+            g_culling_mesh_buffers[n].m_mesh_buffer,
+            g_culling.getVisibleFrustums(first_box + n),
+            g_culling_instances[i]);
+    }
+
+    for (unsigned dc_num = 0; dc_num < g_culling_dy_dc.size(); dc_num++)
+    {
+        SPDynamicDrawCall* dydc = g_culling_dy_dc[dc_num].first;
+        const unsigned box = g_culling_dy_dc[dc_num].second;
+        const uint8_t visible = g_culling.getVisibleFrustums(box);
+        if (visible == 0)
         {
             continue;
         }
+        SPShader* shader = dydc->getShader();
+        const core::aabbox3df bb = g_culling.getBox(box);
+        const bool handle_shadow =
+            g_handle_shadow && shader->hasShader(RP_SHADOW);
 
         if (irr_driver->getBoundingBoxesViz())
         {
@@ -1034,7 +1267,7 @@ void handleDynamicDrawCall()
 
         for (int dc_type = 0; dc_type < (handle_shadow ? 5 : 1); dc_type++)
         {
-            if (discard[dc_type])
+            if ((visible & (1 << dc_type)) == 0)
             {
                 continue;
             }
@@ -1052,10 +1285,9 @@ void handleDynamicDrawCall()
                 // All transparent draw calls go DCT_TRANSPARENT
                 if (dc_type == 0)
                 {
-                    auto& ret = g_draw_calls[DCT_TRANSPARENT][shader];
                     for (auto& p : dydc->getTextureCompare())
                     {
-                        ret[p.first].insert(dydc);
+                        addDrawCall(DCT_TRANSPARENT, shader, p.first, dydc);
                     }
                 }
                 else
@@ -1069,22 +1301,70 @@ void handleDynamicDrawCall()
                 const RenderPass check_pass =
                     dc_type == DCT_NORMAL ? RP_1ST : RP_SHADOW;
                 const bool sampler_less = shader->samplerLess(check_pass);
-                auto& ret = g_draw_calls[dc_type][shader];
                 if (sampler_less)
                 {
-                    ret[""].insert(dydc);
+                    addDrawCall((DrawCallType)dc_type, shader, 0, dydc);
                 }
                 else
                 {
                     for (auto& p : dydc->getTextureCompare())
                     {
-                        ret[p.first].insert(dydc);
+                        addDrawCall((DrawCallType)dc_type, shader, p.first,
+                            dydc);
                     }
                 }
             }
         }
     }
-}
+}   // cullObjects
+
+// ----------------------------------------------------------------------------
+/** Starts collecting the poses of animated nodes, which are then evaluated
+ *  together in endPoseBatch() instead of one by one when the nodes are
+ *  animated.
+ */
+void beginPoseBatch()
+{
+    g_pose_cache.clear();
+    g_pose_nodes.clear();
+    g_pose_batch = true;
+}   // beginPoseBatch
+
+// ----------------------------------------------------------------------------
+/** Requests the pose of an animated node for its current frame. Returns
+ *  false if no batch was started, in which case the node has to evaluate
+ *  its pose itself.
+ */
+bool addPoseRequest(SPMeshNode* node)
+{
+    if (!g_pose_batch)
+    {
+        return false;
+    }
+    g_pose_cache.addPose(node->getSPM(), node->getFrameNr());
+    g_pose_nodes.push_back(node);
+    return true;
+}   // addPoseRequest
+
+// ----------------------------------------------------------------------------
+/** Evaluates the unique poses requested since beginPoseBatch() in parallel,
+ *  and sets them in the nodes.
+ */
+void endPoseBatch()
+{
+    g_pose_batch = false;
+    if (g_pose_nodes.empty())
+    {
+        return;
+    }
+    g_pose_cache.evaluate(g_worker_pool);
+    for (unsigned i = 0; i < g_pose_nodes.size(); i++)
+    {
+        g_pose_nodes[i]->setPose(g_pose_cache.getSkinningMatrices(i),
+            g_pose_cache.getWorldMatrices(i));
+    }
+    g_pose_nodes.clear();
+}   // endPoseBatch
 
 // ----------------------------------------------------------------------------
 void updateModelMatrix()
@@ -1099,47 +1379,42 @@ void updateModelMatrix()
 
     for (unsigned i = 0; i < DCT_FOR_VAO; i++)
     {
-        DrawCall* dc = &g_draw_calls[(DrawCallType)i];
         // Sort dc based on the drawing priority of shaders
         // The larger the drawing priority int, the last it will be drawn
-        using DrawCallPair = std::pair<SPShader*,
-            std::unordered_map<std::string,
-            std::unordered_set<SPMeshBuffer*> > >;
-        std::vector<DrawCallPair> sorted_dc;
-        for (auto& p : *dc)
+        std::vector<uint64_t>& keys = g_draw_calls[i];
+        radixSort(&keys);
+        // A mesh buffer can be added by several nodes
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        uint64_t shader_key = ~0ull;
+        uint64_t texture_key = ~0ull;
+        int material_id = -1;
+        for (uint64_t key : keys)
         {
-            sorted_dc.push_back(p);
-        }
-        std::sort(sorted_dc.begin(), sorted_dc.end(),
-            [](const DrawCallPair& a, const DrawCallPair& b)->bool
+            if (key >> 44 != shader_key)
             {
-                return a.first->getDrawingPriority() <
-                    b.first->getDrawingPriority();
-            });
-        for (unsigned dc = 0; dc < sorted_dc.size(); dc++)
-        {
-            auto& p = sorted_dc[dc];
-            g_final_draw_calls[i].emplace_back(p.first,
-            std::vector<std::pair<std::array<GLuint, 6>,
-                std::vector<std::pair<SPMeshBuffer*, int> > > >());
-
-            unsigned texture = 0;
-            for (auto& q : p.second)
+                shader_key = key >> 44;
+                texture_key = ~0ull;
+                g_final_draw_calls[i].emplace_back(
+                    g_draw_call_shaders[shader_key & 0xfff],
+                    std::vector<std::pair<std::array<GLuint, 6>,
+                    std::vector<std::pair<SPMeshBuffer*, int> > > >());
+            }
+            SPMeshBuffer* spmb = g_draw_call_mesh_buffers[key & 0xffffff];
+            const uint32_t texture = (uint32_t)(key >> 24) & 0xfffff;
+            if (key >> 24 != texture_key)
             {
-                if (q.second.empty())
-                {
-                    continue;
-                }
+                // The textures of the first mesh buffer are used for all
+                // mesh buffers with the same texture names
+                texture_key = key >> 24;
                 std::array<GLuint, 6> texture_names =
                     {{ 0, 0, 0, 0, 0, 0 }};
-                int material_id =
-                    (*(q.second.begin()))->getMaterialID(q.first);
+                material_id = spmb->getMaterialID(texture);
 
                 if (material_id != -1)
                 {
                     const std::array<std::shared_ptr<SPTexture>, 6>& textures =
-                        (*(q.second.begin()))->getSPTexturesByMaterialID
-                        (material_id);
+                        spmb->getSPTexturesByMaterialID(material_id);
                     texture_names =
                         {{
                             textures[0]->getOpenGLTextureName(),
@@ -1150,17 +1425,13 @@ void updateModelMatrix()
                             textures[5]->getOpenGLTextureName()
                         }};
                 }
-                g_final_draw_calls[i][dc].second.emplace_back
+                g_final_draw_calls[i].back().second.emplace_back
                     (texture_names,
                     std::vector<std::pair<SPMeshBuffer*, int> >());
-                for (SPMeshBuffer* spmb : q.second)
-                {
-                    g_final_draw_calls[i][dc].second[texture].second.push_back
-                        (std::make_pair(spmb, material_id == -1 ?
-                        -1 : spmb->getMaterialID(q.first)));
-                }
-                texture++;
             }
+            g_final_draw_calls[i].back().second.back().second.push_back
+                (std::make_pair(spmb, material_id == -1 ?
+                -1 : spmb->getMaterialID(texture)));
         }
     }
 }
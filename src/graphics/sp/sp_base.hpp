@@ -126,6 +126,18 @@ void prepareScene();
 // ----------------------------------------------------------------------------
 void handleDynamicDrawCall();
 // ----------------------------------------------------------------------------
+void cullObjects();
+// ----------------------------------------------------------------------------
+#ifdef SERVER_ONLY
+inline void beginPoseBatch() {}
+inline bool addPoseRequest(SPMeshNode*)                     { return false; }
+inline void endPoseBatch() {}
+#else
+void beginPoseBatch();
+bool addPoseRequest(SPMeshNode*);
+void endPoseBatch();
+#endif
+// ----------------------------------------------------------------------------
 void addDynamicDrawCall(std::shared_ptr<SPDynamicDrawCall>);
 // ----------------------------------------------------------------------------
 void updateModelMatrix();
@@ -0,0 +1,453 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "graphics/sp/sp_culling.hpp"
+
+#include "utils/log.hpp"
+
+#include <SViewFrustum.h>
+#include <matrix4.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define SP_CULLING_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define SP_CULLING_NEON
+#endif
+
+namespace SP
+{
+
+// ----------------------------------------------------------------------------
+SPCulling::SPCulling()
+{
+    m_num_frustums = 0;
+    m_num_boxes    = 0;
+}   // SPCulling
+
+// ----------------------------------------------------------------------------
+/** Removes all boxes, but keeps the memory of the arrays.
+ *  \param num_frustums Number of frustums the boxes of the next frame
+ *         are tested against.
+ */
+void SPCulling::clear(unsigned int num_frustums)
+{
+    assert(num_frustums <= MAX_FRUSTUMS);
+    m_num_frustums = num_frustums;
+    m_num_boxes    = 0;
+    m_min_x.clear();
+    m_min_y.clear();
+    m_min_z.clear();
+    m_max_x.clear();
+    m_max_y.clear();
+    m_max_z.clear();
+    m_frustum_mask.clear();
+}   // clear
+
+// ----------------------------------------------------------------------------
+/** Sets the 6 planes of frustum n. A point is inside a plane (a, b, c, d)
+ *  if a*x + b*y + c*z + d >= 0.
+ */
+void SPCulling::setFrustum(unsigned int n, const float *planes)
+{
+    assert(n < MAX_FRUSTUMS);
+    std::copy(planes, planes + 24, m_frustums[n]);
+}   // setFrustum
+
+// ----------------------------------------------------------------------------
+/** Adds a box to be culled.
+ *  \param box The box in world space.
+ *  \param frustum_mask Bit n is set if the box should be tested against
+ *         frustum n.
+ *  \return The index of the box, used in getVisibleFrustums().
+ */
+unsigned int SPCulling::addBox(const core::aabbox3df &box,
+                               uint8_t frustum_mask)
+{
+    const unsigned int n = m_num_boxes;
+    // Resize by a full batch of boxes at a time, which makes sure that the
+    // arrays can always be accessed in full batches.
+    if (n % BATCH_SIZE == 0)
+        resize(n + 1);
+    else
+        m_num_boxes++;
+    setBox(n, box, frustum_mask);
+    return n;
+}   // addBox
+
+// ----------------------------------------------------------------------------
+/** Sets the number of boxes, which can then be set with setBox(), e.g. from
+ *  several threads. New boxes are not tested against any frustum.
+ */
+void SPCulling::resize(unsigned int num_boxes)
+{
+    const size_t size = (num_boxes + BATCH_SIZE - 1) / BATCH_SIZE
+                      * BATCH_SIZE;
+    m_min_x.resize(size, 0.0f);
+    m_min_y.resize(size, 0.0f);
+    m_min_z.resize(size, 0.0f);
+    m_max_x.resize(size, 0.0f);
+    m_max_y.resize(size, 0.0f);
+    m_max_z.resize(size, 0.0f);
+    m_frustum_mask.resize(size, 0);
+    m_num_boxes = num_boxes;
+}   // resize
+
+// ----------------------------------------------------------------------------
+/** Sets box n, see addBox(). */
+void SPCulling::setBox(unsigned int n, const core::aabbox3df &box,
+                       uint8_t frustum_mask)
+{
+    assert(n < m_num_boxes);
+    m_min_x[n] = box.MinEdge.X;
+    m_min_y[n] = box.MinEdge.Y;
+    m_min_z[n] = box.MinEdge.Z;
+    m_max_x[n] = box.MaxEdge.X;
+    m_max_y[n] = box.MaxEdge.Y;
+    m_max_z[n] = box.MaxEdge.Z;
+    m_frustum_mask[n] = frustum_mask & ((1 << m_num_frustums) - 1);
+}   // setBox
+
+// ----------------------------------------------------------------------------
+/** Returns box n. */
+core::aabbox3df SPCulling::getBox(unsigned int n) const
+{
+    return core::aabbox3df(m_min_x[n], m_min_y[n], m_min_z[n],
+                           m_max_x[n], m_max_y[n], m_max_z[n]);
+}   // getBox
+
+// ----------------------------------------------------------------------------
+/** Tests a range of boxes against their frustums. Afterwards
+ *  getVisibleFrustums() returns the frustums in which a box is (at least
+ *  partially) visible. Different ranges can be culled in parallel.
+ *  A box is outside of a plane if all its corners are outside. The
+ *  corner with the largest distance is the one that takes the maximum
+ *  coordinate if the plane normal is positive and the minimum otherwise,
+ *  and since this choice is the same for all boxes, only one corner is
+ *  tested for a batch of boxes. Its distance is computed in the same way
+ *  as for each corner in cullBox(), so the results are identical.
+ *  \param first The first box, which must be a multiple of BATCH_SIZE.
+ *  \param count Number of boxes, a multiple of BATCH_SIZE unless the range
+ *         ends with the last box.
+ */
+void SPCulling::cull(unsigned int first, unsigned int count)
+{
+    // Ranges must not share a batch
+    assert(first % BATCH_SIZE == 0);
+    assert(first + count == m_num_boxes || count % BATCH_SIZE == 0);
+    const unsigned int end = std::min(first + count, m_num_boxes);
+    for (; first < end; first += BATCH_SIZE)
+    {
+        uint8_t used_frustums = 0;
+        for (unsigned int i = 0; i < BATCH_SIZE; i++)
+            used_frustums |= m_frustum_mask[first + i];
+
+        for (unsigned int f = 0; f < m_num_frustums; f++)
+        {
+            if ((used_frustums & (1 << f)) == 0)
+                continue;
+
+            // Bit i is set if box first+i is outside of a plane
+            unsigned int outside = 0;
+#if defined(SP_CULLING_SSE)
+            __m128 outside_4 = _mm_setzero_ps();
+            const __m128 zero = _mm_setzero_ps();
+#elif defined(SP_CULLING_NEON)
+            uint32x4_t outside_4 = vdupq_n_u32(0);
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+#endif
+            for (unsigned int p = 0; p < 24; p += 4)
+            {
+                const float *plane = &m_frustums[f][p];
+                const float *x = plane[0] >= 0.0f ? &m_max_x[first]
+                                                  : &m_min_x[first];
+                const float *y = plane[1] >= 0.0f ? &m_max_y[first]
+                                                  : &m_min_y[first];
+                const float *z = plane[2] >= 0.0f ? &m_max_z[first]
+                                                  : &m_min_z[first];
+#if defined(SP_CULLING_SSE)
+                const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(plane[0])),
+                    _mm_mul_ps(_mm_loadu_ps(y), _mm_set1_ps(plane[1]))),
+                    _mm_mul_ps(_mm_loadu_ps(z), _mm_set1_ps(plane[2]))),
+                    _mm_set1_ps(plane[3]));
+                outside_4 = _mm_or_ps(outside_4, _mm_cmplt_ps(dist, zero));
+#elif defined(SP_CULLING_NEON)
+                const float32x4_t dist = vaddq_f32(vaddq_f32(vaddq_f32(
+                    vmulq_f32(vld1q_f32(x), vdupq_n_f32(plane[0])),
+                    vmulq_f32(vld1q_f32(y), vdupq_n_f32(plane[1]))),
+                    vmulq_f32(vld1q_f32(z), vdupq_n_f32(plane[2]))),
+                    vdupq_n_f32(plane[3]));
+                outside_4 = vorrq_u32(outside_4, vcltq_f32(dist, zero));
+#else
+                for (unsigned int i = 0; i < BATCH_SIZE; i++)
+                {
+                    const float dist = x[i] * plane[0] + y[i] * plane[1] +
+                                       z[i] * plane[2] + plane[3];
+                    if (dist < 0.0f)
+                        outside |= 1 << i;
+                }
+#endif
+            }   // for p < 24
+#if defined(SP_CULLING_SSE)
+            outside = _mm_movemask_ps(outside_4);
+#elif defined(SP_CULLING_NEON)
+            outside = (vgetq_lane_u32(outside_4, 0) & 1)
+                    | (vgetq_lane_u32(outside_4, 1) & 2)
+                    | (vgetq_lane_u32(outside_4, 2) & 4)
+                    | (vgetq_lane_u32(outside_4, 3) & 8);
+#endif
+            for (unsigned int i = 0; i < BATCH_SIZE; i++)
+            {
+                if (outside & (1 << i))
+                    m_frustum_mask[first + i] &= ~(1 << f);
+            }
+        }   // for f < m_num_frustums
+    }   // for first < end
+}   // cull
+
+// ----------------------------------------------------------------------------
+/** Culls a single box by testing all 8 corners against each plane, which
+ *  is how culling was done before. Used to test and benchmark cull().
+ */
+uint8_t SPCulling::cullBox(const core::aabbox3df &box,
+                           const float frustums[][24],
+                           unsigned int num_frustums, uint8_t frustum_mask)
+{
+    uint8_t visible = 0;
+    for (unsigned int f = 0; f < num_frustums; f++)
+    {
+        if ((frustum_mask & (1 << f)) == 0)
+            continue;
+        bool discard = false;
+        for (int i = 0; i < 24 && !discard; i += 4)
+        {
+            bool outside = true;
+            for (int j = 0; j < 8 && outside; j++)
+            {
+                const core::vector3df corner(
+                    j & 1 ? box.MaxEdge.X : box.MinEdge.X,
+                    j & 2 ? box.MaxEdge.Y : box.MinEdge.Y,
+                    j & 4 ? box.MaxEdge.Z : box.MinEdge.Z);
+                const float dist = corner.X * frustums[f][i] +
+                                   corner.Y * frustums[f][i + 1] +
+                                   corner.Z * frustums[f][i + 2] +
+                                   frustums[f][i + 3];
+                outside = dist < 0.0f;
+            }
+            discard = outside;
+        }
+        if (!discard)
+            visible |= 1 << f;
+    }
+    return visible;
+}   // cullBox
+
+// ----------------------------------------------------------------------------
+namespace
+{
+    /** Creates a scene similar to a large track: boxes of different size
+     *  along a closed loop, and the frustums of a camera behind a kart and
+     *  of 4 shadow cascades. */
+    void createScene(std::mt19937 *random, unsigned int num_boxes,
+                     std::vector<core::aabbox3df> *boxes,
+                     float frustums[SPCulling::MAX_FRUSTUMS][24])
+    {
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        std::uniform_real_distribution<float> offset(-60.0f, 60.0f);
+        std::uniform_real_distribution<float> size(0.2f, 15.0f);
+        boxes->clear();
+        for (unsigned int i = 0; i < num_boxes; i++)
+        {
+            const float a = angle(*random);
+            const core::vector3df center(cosf(a) * 400.0f + offset(*random),
+                                         offset(*random) * 0.2f,
+                                         sinf(a) * 400.0f + offset(*random));
+            const core::vector3df extend(size(*random), size(*random),
+                                         size(*random));
+            boxes->push_back(core::aabbox3df(center - extend,
+                                             center + extend));
+        }
+
+        const core::vector3df camera(400.0f, 3.0f, -5.0f);
+        const core::vector3df target(395.0f, 1.0f, 30.0f);
+        core::matrix4 view, projection[SPCulling::MAX_FRUSTUMS];
+        view.buildCameraLookAtMatrixLH(camera, target,
+                                       core::vector3df(0, 1, 0));
+        projection[0].buildProjectionMatrixPerspectiveFovLH(1.0f, 1.6f,
+                                                            0.1f, 300.0f);
+        for (unsigned int n = 1; n < SPCulling::MAX_FRUSTUMS; n++)
+        {
+            const float extend = 10.0f * (float)(1 << (2 * n - 2));
+            projection[n].buildProjectionMatrixOrthoLH(extend, extend,
+                                                       -200.0f, 200.0f);
+        }
+        for (unsigned int n = 0; n < SPCulling::MAX_FRUSTUMS; n++)
+        {
+            // The planes of irrlicht point outside of the frustum
+            const scene::SViewFrustum frustum(projection[n] * view);
+            for (unsigned int p = 0; p < 6; p++)
+            {
+                const core::plane3df &plane = frustum.planes[p];
+                frustums[n][p * 4    ] = -plane.Normal.X;
+                frustums[n][p * 4 + 1] = -plane.Normal.Y;
+                frustums[n][p * 4 + 2] = -plane.Normal.Z;
+                frustums[n][p * 4 + 3] = -plane.D;
+            }
+        }
+    }   // createScene
+}   // anonymous namespace
+
+// ----------------------------------------------------------------------------
+/** Tests that cull() gives the same results as testing all corners of each
+ *  box, including boxes that touch a plane and boxes of size 0.
+ */
+void SPCulling::unitTesting()
+{
+    std::mt19937 random(1);
+    std::vector<core::aabbox3df> boxes;
+    float frustums[MAX_FRUSTUMS][24];
+    createScene(&random, 5003, &boxes, frustums);
+
+    // Boxes with corners exactly on a plane of the camera frustum
+    for (unsigned int p = 0; p < 24; p += 4)
+    {
+        const float *plane = frustums[0] + p;
+        if (plane[1] == 0.0f)
+            continue;
+        const float y = -plane[3] / plane[1];
+        boxes.push_back(core::aabbox3df(0.0f, y, 0.0f, 0.0f, y, 0.0f));
+        boxes.push_back(core::aabbox3df(-1.0f, y - 1.0f, -1.0f,
+                                        1.0f, y, 1.0f));
+    }
+
+    SPCulling culling;
+    for (unsigned int num_frustums = 1; num_frustums <= MAX_FRUSTUMS;
+         num_frustums += MAX_FRUSTUMS - 1)
+    {
+        culling.clear(num_frustums);
+        for (unsigned int n = 0; n < num_frustums; n++)
+            culling.setFrustum(n, frustums[n]);
+        if (num_frustums == 1)
+        {
+            for (unsigned int i = 0; i < boxes.size(); i++)
+                culling.addBox(boxes[i], i % 3 == 0 ? 1 : 0xff);
+            culling.cull();
+        }
+        else
+        {
+            // Set the boxes and cull them in ranges, as done with threads
+            culling.resize((unsigned int)boxes.size());
+            for (unsigned int i = 0; i < boxes.size(); i++)
+                culling.setBox(i, boxes[i], i % 3 == 0 ? 1 : 0xff);
+            for (unsigned int i = 0; i < boxes.size(); i += 64)
+                culling.cull(i, 64);
+        }
+
+        unsigned int visible = 0;
+        for (unsigned int i = 0; i < boxes.size(); i++)
+        {
+            const uint8_t expected = cullBox(boxes[i], frustums,
+                                             num_frustums,
+                                             i % 3 == 0 ? 1 : 0xff);
+            if (culling.getVisibleFrustums(i) != expected)
+            {
+                Log::fatal("SPCulling", "Box %u: visible in %x, expected "
+                           "%x.", i, culling.getVisibleFrustums(i),
+                           expected);
+            }
+            if (culling.getBox(i).MinEdge != boxes[i].MinEdge ||
+                culling.getBox(i).MaxEdge != boxes[i].MaxEdge)
+                Log::fatal("SPCulling", "Box %u was changed.", i);
+            visible += expected != 0;
+        }
+        // Make sure the test does not pass trivially
+        if (visible == 0 || visible == boxes.size())
+            Log::fatal("SPCulling", "%u of %u boxes are visible.", visible,
+                       (unsigned int)boxes.size());
+    }
+}   // unitTesting
+
+// ----------------------------------------------------------------------------
+/** Compares the time to cull the boxes of a large scene with cull() and
+ *  by testing the corners of each box.
+ */
+void SPCulling::benchmark()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    const unsigned int num_boxes  = 10000;
+    const unsigned int num_frames = 500;
+    std::mt19937 random(1);
+    std::vector<core::aabbox3df> boxes;
+    float frustums[MAX_FRUSTUMS][24];
+    createScene(&random, num_boxes, &boxes, frustums);
+
+    SPCulling culling;
+    unsigned int visible[2] = { 0, 0 };
+    Clock::duration time[2];
+    for (int use_batch = 0; use_batch < 2; use_batch++)
+    {
+        Clock::time_point begin = Clock::now();
+        for (unsigned int frame = 0; frame < num_frames; frame++)
+        {
+            if (use_batch)
+            {
+                culling.clear(MAX_FRUSTUMS);
+                for (unsigned int n = 0; n < MAX_FRUSTUMS; n++)
+                    culling.setFrustum(n, frustums[n]);
+                for (const core::aabbox3df &box : boxes)
+                    culling.addBox(box, 0xff);
+                culling.cull();
+                for (unsigned int i = 0; i < num_boxes; i++)
+                    visible[1] += culling.getVisibleFrustums(i) != 0;
+            }
+            else
+            {
+                for (const core::aabbox3df &box : boxes)
+                {
+                    visible[0] += cullBox(box, frustums, MAX_FRUSTUMS,
+                                          0xff) != 0;
+                }
+            }
+        }
+        time[use_batch] = Clock::now() - begin;
+    }
+    Log::info("SPCulling", "%u boxes, %u frustums, %u frames: %u visible, "
+              "all corners %f ms, batched %f ms, speedup %.1fx.",
+              num_boxes, MAX_FRUSTUMS, num_frames, visible[1] / num_frames,
+              std::chrono::duration<double, std::milli>(time[0]).count(),
+              std::chrono::duration<double, std::milli>(time[1]).count(),
+              (double)time[0].count() / std::max<double>(1.0,
+                                                 (double)time[1].count()));
+    if (visible[0] != visible[1])
+    {
+        Log::error("SPCulling", "Different number of visible boxes: %u and "
+                   "%u.", visible[0], visible[1]);
+    }
+}   // benchmark
+
+}
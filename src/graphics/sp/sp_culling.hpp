@@ -0,0 +1,103 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_SP_CULLING_HPP
+#define HEADER_SP_CULLING_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <aabbox3d.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace irr;
+
+namespace SP
+{
+
+/** Culls a batch of axis aligned bounding boxes against up to MAX_FRUSTUMS
+ *  frustums (the camera and the shadow cascades). The boxes are stored as
+ *  structure of arrays, so that several boxes are tested against a plane
+ *  with one SSE or NEON instruction. The arrays are only cleared (not
+ *  freed) between frames, so no allocations happen once they reached
+ *  their maximum size. The class does not depend on OpenGL, which allows
+ *  it to be unit tested.
+ */
+class SPCulling : public NoCopy
+{
+public:
+    /** Maximum number of frustums, the camera and 4 shadow cascades. */
+    static const unsigned int MAX_FRUSTUMS = 5;
+
+    /** Number of boxes tested at the same time. The arrays are padded to
+     *  a multiple of this. */
+    static const unsigned int BATCH_SIZE = 4;
+
+private:
+
+    /** The 6 planes (a, b, c, d) of each frustum, in the same layout as
+     *  the frustums in sp_base.cpp. */
+    float m_frustums[MAX_FRUSTUMS][24];
+
+    /** Number of frustums used. */
+    unsigned int m_num_frustums;
+
+    /** Number of boxes added. */
+    unsigned int m_num_boxes;
+
+    /** The minimum and maximum coordinates of all boxes. */
+    std::vector<float> m_min_x, m_min_y, m_min_z;
+    std::vector<float> m_max_x, m_max_y, m_max_z;
+
+    /** For each box a bit mask of the frustums it is tested against,
+     *  after cull() the frustums in which it is visible. */
+    std::vector<uint8_t> m_frustum_mask;
+
+    static uint8_t cullBox(const core::aabbox3df &box,
+                           const float frustums[][24],
+                           unsigned int num_frustums, uint8_t frustum_mask);
+
+public:
+         SPCulling();
+    void clear(unsigned int num_frustums);
+    void setFrustum(unsigned int n, const float *planes);
+    unsigned int addBox(const core::aabbox3df &box, uint8_t frustum_mask);
+    void resize(unsigned int num_boxes);
+    void setBox(unsigned int n, const core::aabbox3df &box,
+                uint8_t frustum_mask);
+    void cull(unsigned int first, unsigned int count);
+    core::aabbox3df getBox(unsigned int n) const;
+    static void unitTesting();
+    static void benchmark();
+    // ------------------------------------------------------------------------
+    /** Returns the number of boxes added since the last clear(). */
+    unsigned int getNumBoxes() const                  { return m_num_boxes; }
+    // ------------------------------------------------------------------------
+    /** Culls all boxes. */
+    void cull()                                      { cull(0, m_num_boxes); }
+    // ------------------------------------------------------------------------
+    /** Returns a bit mask of the frustums in which box n is visible. Only
+     *  valid after cull(). */
+    uint8_t getVisibleFrustums(unsigned int n) const
+                                               { return m_frustum_mask[n]; }
+};   // SPCulling
+
+}
+
+#endif
@@ -46,7 +46,8 @@ SPDynamicDrawCall::SPDynamicDrawCall(scene::E_PRIMITIVE_TYPE pt,
             m_shaders[0] && m_shaders[0]->isSrgbForTextureLayer(j),
             std::get<2>(m_stk_material[0])->getContainerId());
     }
-    m_tex_cmp[m_textures[0][0]->getPath() + m_textures[0][1]->getPath()] = 0;
+    addTextureCompare(m_textures[0][0]->getPath() +
+        m_textures[0][1]->getPath(), 0);
     m_pitch = 48;
 
     // Rerserve 4 vertices, and use m_ibo buffer for instance array
@@ -40,6 +40,7 @@ class SPMesh : public ISkinnedMesh
 {
 friend class ::B3DMeshLoader;
 friend class ::SPMeshLoader;
+friend class SPMeshCache;
 private:
     std::vector<SPMeshBuffer*> m_buffer;
 
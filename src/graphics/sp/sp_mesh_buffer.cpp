@@ -27,6 +27,8 @@
 #include "utils/mini_glm.hpp"
 #include "utils/string_utils.hpp"
 
+#include <unordered_map>
+
 namespace SP
 {
 // ----------------------------------------------------------------------------
@@ -133,8 +135,8 @@ void SPMeshBuffer::uploadGLMesh()
                 std::get<2>(m_stk_material[i])->getContainerId());
         }
         // Use the original spm uv texture 1 and 2 for compare in scene manager
-        m_tex_cmp[std::get<2>(m_stk_material[i])->getSamplerPath(0) +
-            std::get<2>(m_stk_material[i])->getSamplerPath(1)] = i;
+        addTextureCompare(std::get<2>(m_stk_material[i])->getSamplerPath(0) +
+            std::get<2>(m_stk_material[i])->getSamplerPath(1), i);
     }
 
     bool use_2_uv = std::get<2>(m_stk_material[0])->use2UV();
@@ -461,10 +463,40 @@ void SPMeshBuffer::reloadTextureCompare()
     {
         const std::string name =
             m_textures[i][0]->getPath() + m_textures[i][1]->getPath();
-        m_tex_cmp[name] = i;
+        addTextureCompare(name, i);
     }
 }   // reloadTextureCompare
 
+// ----------------------------------------------------------------------------
+/** Sets the material used for a combination of texture names, replacing
+ *  the previous material with the same names.
+ */
+void SPMeshBuffer::addTextureCompare(const std::string& name,
+                                     unsigned material_id)
+{
+    const uint32_t id = getTextureCompareID(name);
+    for (auto& p : m_tex_cmp)
+    {
+        if (p.first == id)
+        {
+            p.second = material_id;
+            return;
+        }
+    }
+    m_tex_cmp.emplace_back(id, material_id);
+}   // addTextureCompare
+
+// ----------------------------------------------------------------------------
+/** Returns a unique id for a combination of texture names, so that draw
+ *  calls can be grouped by textures without comparing strings each frame.
+ *  The empty name has id 0.
+ */
+uint32_t SPMeshBuffer::getTextureCompareID(const std::string& name)
+{
+    static std::unordered_map<std::string, uint32_t> ids = {{ "", 0 }};
+    return ids.emplace(name, (uint32_t)ids.size()).first->second;
+}   // getTextureCompareID
+
 // ----------------------------------------------------------------------------
 void SPMeshBuffer::setSTKMaterial(Material* m)
 {
@@ -32,6 +32,7 @@
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 using namespace irr;
@@ -54,7 +55,9 @@ protected:
 
     std::vector<std::array<std::shared_ptr<SPTexture>, 6> > m_textures;
 
-    std::unordered_map<std::string, unsigned> m_tex_cmp;
+    /** The texture compare id (see getTextureCompareID()) and material id
+     *  of each material, used to group draw calls with the same textures. */
+    std::vector<std::pair<uint32_t, unsigned> > m_tex_cmp;
 
     std::vector<video::S3DVertexSkinnedMesh> m_vertices;
 
@@ -83,9 +86,19 @@ private:
 
     bool m_skinned;
 
+    /** The frame in which m_draw_call_index was set. */
+    unsigned m_draw_call_frame;
+
+    /** Index of this mesh buffer in the draw call keys of a frame. */
+    unsigned m_draw_call_index;
+
     // ------------------------------------------------------------------------
     bool initTexture();
 
+protected:
+    // ------------------------------------------------------------------------
+    void addTextureCompare(const std::string& name, unsigned material_id);
+
 public:
     SPMeshBuffer()
     {
@@ -108,6 +121,8 @@ public:
         m_uploaded_gl = false;
         m_uploaded_instance = false;
         m_skinned = false;
+        m_draw_call_frame = 0;
+        m_draw_call_index = 0;
     }
     // ------------------------------------------------------------------------
     ~SPMeshBuffer();
@@ -220,19 +235,36 @@ public:
         return ret;
     }
     // ------------------------------------------------------------------------
-    const std::unordered_map<std::string, unsigned>& getTextureCompare() const
-                                                          { return m_tex_cmp; }
+    const std::vector<std::pair<uint32_t, unsigned> >& getTextureCompare()
+                                                    const { return m_tex_cmp; }
     // ------------------------------------------------------------------------
-    int getMaterialID(const std::string& tex_cmp) const
+    int getMaterialID(uint32_t tex_cmp) const
     {
-        auto itr = m_tex_cmp.find(tex_cmp);
-        if (itr != m_tex_cmp.end())
+        for (auto& p : m_tex_cmp)
         {
-            return (int)itr->second;
+            if (p.first == tex_cmp)
+            {
+                return (int)p.second;
+            }
         }
         return -1;
     }
     // ------------------------------------------------------------------------
+    static uint32_t getTextureCompareID(const std::string& name);
+    // ------------------------------------------------------------------------
+    /** Returns the index of this mesh buffer in the draw call keys of the
+     *  given frame, or -1 if it was not set in that frame. */
+    int getDrawCallIndex(unsigned frame) const
+    {
+        return m_draw_call_frame == frame ? (int)m_draw_call_index : -1;
+    }
+    // ------------------------------------------------------------------------
+    void setDrawCallIndex(unsigned frame, unsigned index)
+    {
+        m_draw_call_frame = frame;
+        m_draw_call_index = index;
+    }
+    // ------------------------------------------------------------------------
     void addInstanceData(const SPInstancedData& id, DrawCallType dct)
     {
         if (m_uploaded_instance)
@@ -275,6 +307,18 @@ public:
     // ------------------------------------------------------------------------
     void setSTKMaterial(Material* m);
     // ------------------------------------------------------------------------
+    /** Sets the materials of a mesh buffer which was combined from several
+     *  mesh buffers, each as first index, indices count and material. */
+    void setSTKMaterials(const std::vector<std::tuple<size_t, unsigned,
+                         Material*> >& materials)
+    {
+        setSTKMaterial(std::get<2>(materials[0]));
+        m_stk_material = materials;
+    }
+    // ------------------------------------------------------------------------
+    const std::vector<std::tuple<size_t, unsigned, Material*> >&
+                              getSTKMaterials() const { return m_stk_material; }
+    // ------------------------------------------------------------------------
     void reloadTextureCompare();
     // ------------------------------------------------------------------------
     void shrinkToFit()
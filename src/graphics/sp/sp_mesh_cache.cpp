@@ -0,0 +1,553 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef SERVER_ONLY
+
+#include "graphics/sp/sp_mesh_cache.hpp"
+
+#include "graphics/material.hpp"
+#include "graphics/material_manager.hpp"
+#include "graphics/sp/sp_animation.hpp"
+#include "graphics/sp/sp_mesh.hpp"
+#include "graphics/sp/sp_mesh_buffer.hpp"
+#include "io/file_manager.hpp"
+#include "race/race_manager.hpp"
+#include "utils/log.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/string_utils.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace SP
+{
+
+namespace
+{
+    const char     MESH_CACHE_MAGIC[4] = { 'S', 'P', 'M', 'C' };
+    const uint32_t MESH_CACHE_BYTE_ORDER = 0x01020304;
+    const uint32_t MESH_CACHE_VERSION = 2;
+    const uint32_t MESH_CACHE_VERTEX_SIZE =
+        (uint32_t)sizeof(video::S3DVertexSkinnedMesh);
+
+    // ------------------------------------------------------------------------
+    /** Adds data to a FNV-1a hash. */
+    uint64_t addToHash(uint64_t hash, const void *data, size_t size)
+    {
+        const uint8_t *bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }   // addToHash
+
+    // ------------------------------------------------------------------------
+    template<typename T> void write(std::ostream &out, const T &value)
+    {
+        out.write((const char*)&value, sizeof(T));
+    }   // write
+
+    // ------------------------------------------------------------------------
+    void writeString(std::ostream &out, const std::string &s)
+    {
+        const uint32_t size = (uint32_t)s.size();
+        write(out, size);
+        out.write(s.data(), size);
+    }   // writeString
+
+    // ------------------------------------------------------------------------
+    /** A material in the cache file. */
+    struct CachedMaterial
+    {
+        /** The texture names the loader looked up the material with. */
+        std::string m_layer_one, m_layer_two;
+        /** Properties of the material found, to detect changed materials. */
+        std::string m_tex_name, m_full_path, m_uv_two, m_shader;
+        // --------------------------------------------------------------------
+        bool isMatching(const Material* m) const
+        {
+            return m->getTexFname() == m_tex_name &&
+                   m->getTexFullPath() == m_full_path &&
+                   m->getUVTwoTexture() == m_uv_two &&
+                   m->getShaderName() == m_shader;
+        }   // isMatching
+    };   // CachedMaterial
+
+    // ------------------------------------------------------------------------
+    /** Reads from the mapped cache file. After the first read beyond the end
+     *  of the data all reads fail.
+     */
+    class CacheReader
+    {
+    private:
+        const char *m_data;
+        size_t      m_size;
+        bool        m_ok;
+    public:
+        CacheReader(const void *data, size_t size)
+            : m_data((const char*)data), m_size(size), m_ok(true) {}
+        // --------------------------------------------------------------------
+        bool read(void *dest, size_t size)
+        {
+            if (!m_ok || size > m_size)
+            {
+                m_ok = false;
+                return false;
+            }
+            memcpy(dest, m_data, size);
+            m_data += size;
+            m_size -= size;
+            return true;
+        }   // read
+        // --------------------------------------------------------------------
+        template<typename T> bool read(T *value)
+        {
+            return read(value, sizeof(T));
+        }   // read
+        // --------------------------------------------------------------------
+        bool readString(std::string *s)
+        {
+            uint32_t size = 0;
+            if (!read(&size) || size > m_size)
+            {
+                m_ok = false;
+                return false;
+            }
+            s->assign(m_data, size);
+            m_data += size;
+            m_size -= size;
+            return true;
+        }   // readString
+        // --------------------------------------------------------------------
+        /** Marks the data as invalid. */
+        void fail()                                         { m_ok = false; }
+        // --------------------------------------------------------------------
+        bool ok() const                                      { return m_ok; }
+    };   // CacheReader
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Computes the key of a model file and the name of its cache file.
+ *  \param file The model file, its position is not changed.
+ *  \param loader_setting A setting of the loader which changes the
+ *         converted mesh.
+ */
+SPMeshCache::SPMeshCache(io::IReadFile* file, int loader_setting)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hash = addToHash(hash, &loader_setting, sizeof(loader_setting));
+    const long pos = file->getPos();
+    file->seek(0);
+    std::vector<char> buffer(65536);
+    while (true)
+    {
+        const s32 size = file->read(buffer.data(), (u32)buffer.size());
+        if (size <= 0)
+            break;
+        hash = addToHash(hash, buffer.data(), size);
+    }
+    file->seek(pos);
+    m_key = hash;
+
+    // Models in different directories can have the same name
+    const std::string name = file->getFileName().c_str();
+    const uint64_t path_hash =
+        addToHash(14695981039346656037ULL, name.data(), name.size());
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)path_hash);
+    m_cache_file = file_manager->getCachedMeshesDir() +
+        StringUtils::getBasename(name) + "-" + hex + ".spmc";
+}   // SPMeshCache
+
+// ----------------------------------------------------------------------------
+/** Creates the mesh from the cache file.
+ *  \return The mesh, or NULL if the cache file is missing, outdated or
+ *          invalid.
+ */
+SPMesh* SPMeshCache::load() const
+{
+    // SPMeshBuffer::initDrawMaterial() mirrors the uvs of some materials
+    // in reversed tracks, which can't be done for combined mesh buffers
+    if (race_manager->getReverseTrack())
+        return NULL;
+
+    MappedFile file;
+    if (!file.open(m_cache_file))
+        return NULL;
+    CacheReader in(file.getData(), file.getSize());
+
+    char magic[4];
+    uint32_t byte_order = 0, version = 0, vertex_size = 0;
+    uint64_t key = 0;
+    in.read(magic, sizeof(magic));
+    in.read(&byte_order);
+    in.read(&version);
+    in.read(&vertex_size);
+    in.read(&key);
+    if (!in.ok() || memcmp(magic, MESH_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        byte_order != MESH_CACHE_BYTE_ORDER ||
+        version != MESH_CACHE_VERSION ||
+        vertex_size != MESH_CACHE_VERTEX_SIZE || key != m_key)
+    {
+        Log::info("SPMeshCache", "Cache '%s' is outdated.",
+                  m_cache_file.c_str());
+        return NULL;
+    }
+
+    // The materials are looked up with the texture names the loader used,
+    // make sure that the same materials are found again, and that they use
+    // the same shaders (which decide the order and combination of the mesh
+    // buffers)
+    uint32_t num_materials = 0;
+    in.read(&num_materials);
+    std::vector<CachedMaterial> cached_materials;
+    for (uint32_t i = 0; i < num_materials && in.ok(); i++)
+    {
+        CachedMaterial cm;
+        if (!in.readString(&cm.m_layer_one) ||
+            !in.readString(&cm.m_layer_two) ||
+            !in.readString(&cm.m_tex_name) ||
+            !in.readString(&cm.m_full_path) ||
+            !in.readString(&cm.m_uv_two) || !in.readString(&cm.m_shader))
+            break;
+        cached_materials.push_back(cm);
+    }
+    if (!in.ok())
+    {
+        Log::warn("SPMeshCache", "Invalid cache '%s'.", m_cache_file.c_str());
+        return NULL;
+    }
+
+    // First only search existing materials, so that no default material is
+    // created if the cache can't be used
+    std::vector<Material*> materials;
+    for (const CachedMaterial& cm : cached_materials)
+    {
+        // The loaders only use the full path of a texture that exists
+        bool is_changed =
+            cm.m_layer_one.find_first_of("/\\") != std::string::npos &&
+            !file_manager->fileExists(cm.m_layer_one);
+        Material* m = NULL;
+        if (!is_changed)
+        {
+            m = material_manager->getMaterialSPM(cm.m_layer_one,
+                cm.m_layer_two, "solid", /*create_default*/false);
+            // A material which is not found must have been a default one
+            is_changed = m ? !cm.isMatching(m) : cm.m_shader != "solid";
+        }
+        if (is_changed)
+        {
+            Log::info("SPMeshCache", "Material '%s' of cache '%s' changed.",
+                      cm.m_layer_one.c_str(), m_cache_file.c_str());
+            return NULL;
+        }
+        materials.push_back(m);
+    }
+    // Then create the default materials the loader would create
+    for (unsigned i = 0; i < materials.size(); i++)
+    {
+        if (materials[i])
+            continue;
+        const CachedMaterial& cm = cached_materials[i];
+        materials[i] = material_manager->getMaterialSPM(cm.m_layer_one,
+                                                        cm.m_layer_two);
+        if (!cm.isMatching(materials[i]))
+        {
+            Log::info("SPMeshCache", "Material '%s' of cache '%s' changed.",
+                      cm.m_layer_one.c_str(), m_cache_file.c_str());
+            return NULL;
+        }
+    }
+
+    SPMesh* spm = new SPMesh();
+    in.read(&spm->m_fps);
+    in.read(&spm->m_bind_frame);
+    in.read(&spm->m_total_joints);
+    in.read(&spm->m_joint_using);
+    in.read(&spm->m_frame_count);
+
+    uint32_t num_buffers = 0;
+    in.read(&num_buffers);
+    for (uint32_t b = 0; b < num_buffers && in.ok(); b++)
+    {
+        uint32_t num_vertices = 0, num_indices = 0, num_buffer_materials = 0;
+        in.read(&num_vertices);
+        in.read(&num_indices);
+        in.read(&num_buffer_materials);
+        // Mesh buffers use 16bit indices
+        if (!in.ok() || num_vertices == 0 || num_vertices > 65536 ||
+            num_buffer_materials == 0)
+            break;
+        std::vector<std::tuple<size_t, unsigned, Material*> > buffer_materials;
+        for (uint32_t i = 0; i < num_buffer_materials; i++)
+        {
+            uint32_t first = 0, count = 0, index = 0;
+            in.read(&first);
+            in.read(&count);
+            if (!in.read(&index) || index >= materials.size())
+                break;
+            buffer_materials.emplace_back(first, count, materials[index]);
+        }
+        std::vector<video::S3DVertexSkinnedMesh> vertices(num_vertices);
+        std::vector<uint16_t> indices(num_indices);
+        in.read(vertices.data(), num_vertices * MESH_CACHE_VERTEX_SIZE);
+        in.read(indices.data(), num_indices * sizeof(uint16_t));
+        if (!in.ok() || buffer_materials.size() != num_buffer_materials)
+            break;
+        for (uint16_t index : indices)
+        {
+            if (index >= num_vertices)
+                in.fail();
+        }
+        if (!in.ok())
+            break;
+
+        SPMeshBuffer* spmb = new SPMeshBuffer();
+        spmb->setSPMVertices(vertices);
+        spmb->setIndices(indices);
+        spmb->setSTKMaterials(buffer_materials);
+        spm->m_buffer.push_back(spmb);
+    }
+
+    uint32_t num_armatures = 0;
+    in.read(&num_armatures);
+    if (in.ok() && spm->m_buffer.size() == num_buffers)
+        spm->m_all_armatures.resize(num_armatures);
+    for (Armature& arm : spm->m_all_armatures)
+    {
+        uint32_t num_joints = 0;
+        in.read(&arm.m_joint_used);
+        in.read(&num_joints);
+        if (!in.ok() || num_joints == 0 || num_joints > 65536 ||
+            arm.m_joint_used > num_joints)
+        {
+            in.fail();
+            break;
+        }
+        arm.m_joint_names.resize(num_joints);
+        for (std::string& name : arm.m_joint_names)
+            in.readString(&name);
+        arm.m_joint_matrices.resize(num_joints);
+        for (core::matrix4& m : arm.m_joint_matrices)
+            in.read(m.pointer(), 64);
+        arm.m_interpolated_matrices.resize(num_joints);
+        arm.m_world_matrices.resize(num_joints,
+            std::make_pair(core::matrix4(), false));
+        arm.m_parent_infos.resize(num_joints);
+        for (int& parent : arm.m_parent_infos)
+        {
+            int32_t p = 0;
+            in.read(&p);
+            if (p < -1 || p >= (int32_t)num_joints)
+                in.fail();
+            parent = p;
+        }
+        uint32_t num_frames = 0;
+        in.read(&num_frames);
+        if (!in.ok() || num_frames == 0 || num_frames > 65536)
+        {
+            in.fail();
+            break;
+        }
+        arm.m_frame_pose_matrices.resize(num_frames);
+        for (auto& frame : arm.m_frame_pose_matrices)
+        {
+            int32_t frame_index = 0;
+            in.read(&frame_index);
+            frame.first = frame_index;
+            frame.second.resize(num_joints);
+            for (LocRotScale& lrs : frame.second)
+            {
+                in.read(&lrs.m_loc, 12);
+                in.read(&lrs.m_rot.X, 4);
+                in.read(&lrs.m_rot.Y, 4);
+                in.read(&lrs.m_rot.Z, 4);
+                in.read(&lrs.m_rot.W, 4);
+                in.read(&lrs.m_scale, 12);
+            }
+        }
+    }
+
+    if (!in.ok() || spm->m_buffer.size() != num_buffers ||
+        spm->m_all_armatures.size() != num_armatures)
+    {
+        Log::warn("SPMeshCache", "Invalid cache '%s'.", m_cache_file.c_str());
+        spm->drop();
+        return NULL;
+    }
+
+    // The remaining steps of SPMesh::finalize()
+    spm->m_bounding_box.reset(0.0f, 0.0f, 0.0f);
+    for (unsigned i = 0; i < spm->m_buffer.size(); i++)
+    {
+        SPMeshBuffer* spmb = spm->m_buffer[i];
+        spmb->recalculateBoundingBox();
+        spm->m_bounding_box.addInternalBox(spmb->getBoundingBox());
+        spmb->initDrawMaterial();
+        if (!spm->isStatic())
+            spmb->enableSkinningData();
+    }
+    return spm;
+}   // load
+
+// ----------------------------------------------------------------------------
+/** Looks up the material of a mesh buffer for the loader, and remembers the
+ *  texture names so that load() can look it up the same way.
+ *  \param layer_one Name of the first texture.
+ *  \param layer_two Name of the second texture.
+ */
+Material* SPMeshCache::getMaterial(const std::string& layer_one,
+                                   const std::string& layer_two)
+{
+    Material* m = material_manager->getMaterialSPM(layer_one, layer_two);
+    if (m_material_names.find(m) == m_material_names.end())
+        m_material_names[m] = std::make_pair(layer_one, layer_two);
+    return m;
+}   // getMaterial
+
+// ----------------------------------------------------------------------------
+/** Writes a mesh to the cache file, so that load() can use it the next time
+ *  the model is loaded.
+ *  \param mesh The finalized mesh.
+ */
+void SPMeshCache::save(const SPMesh* mesh) const
+{
+    // SPMeshBuffer::initDrawMaterial() mirrors the uvs of some materials
+    // in reversed tracks
+    if (race_manager->getReverseTrack())
+        return;
+
+    std::map<const Material*, uint32_t> material_index;
+    std::vector<const Material*> materials;
+    for (const SPMeshBuffer* spmb : mesh->m_buffer)
+    {
+        for (auto& p : spmb->getSTKMaterials())
+        {
+            const Material* m = std::get<2>(p);
+            // A material not looked up with getMaterial() can't be found
+            // again by load()
+            if (m_material_names.find(m) == m_material_names.end())
+                return;
+            if (material_index.find(m) == material_index.end())
+            {
+                material_index[m] = (uint32_t)materials.size();
+                materials.push_back(m);
+            }
+        }
+    }
+
+    // Write to a temporary file first, so that other processes never map
+    // a partially written cache
+    const std::string tmp_file = m_cache_file + ".tmp";
+    std::ofstream out(tmp_file.c_str(), std::ios::out | std::ios::binary);
+    out.write(MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    write(out, MESH_CACHE_BYTE_ORDER);
+    write(out, MESH_CACHE_VERSION);
+    write(out, MESH_CACHE_VERTEX_SIZE);
+    write(out, m_key);
+    write(out, (uint32_t)materials.size());
+    for (const Material *m : materials)
+    {
+        const auto& names = m_material_names.at(m);
+        writeString(out, names.first);
+        writeString(out, names.second);
+        writeString(out, m->getTexFname());
+        writeString(out, m->getTexFullPath());
+        writeString(out, m->getUVTwoTexture());
+        writeString(out, m->getShaderName());
+    }
+
+    write(out, mesh->m_fps);
+    write(out, mesh->m_bind_frame);
+    write(out, mesh->m_total_joints);
+    write(out, mesh->m_joint_using);
+    write(out, mesh->m_frame_count);
+
+    write(out, (uint32_t)mesh->m_buffer.size());
+    for (const SPMeshBuffer* spmb : mesh->m_buffer)
+    {
+        const auto& buffer_materials = spmb->getSTKMaterials();
+        write(out, (uint32_t)spmb->getVertexCount());
+        write(out, (uint32_t)spmb->getIndexCount());
+        write(out, (uint32_t)buffer_materials.size());
+        for (auto& p : buffer_materials)
+        {
+            write(out, (uint32_t)std::get<0>(p));
+            write(out, (uint32_t)std::get<1>(p));
+            write(out, material_index.at(std::get<2>(p)));
+        }
+        out.write((const char*)spmb->getVertices(),
+                  spmb->getVertexCount() * MESH_CACHE_VERTEX_SIZE);
+        out.write((const char*)spmb->getIndices(),
+                  spmb->getIndexCount() * sizeof(uint16_t));
+    }
+
+    write(out, (uint32_t)mesh->m_all_armatures.size());
+    for (const Armature& arm : mesh->m_all_armatures)
+    {
+        write(out, arm.m_joint_used);
+        write(out, (uint32_t)arm.m_joint_names.size());
+        for (const std::string& name : arm.m_joint_names)
+            writeString(out, name);
+        for (const core::matrix4& m : arm.m_joint_matrices)
+            out.write((const char*)m.pointer(), 64);
+        for (int parent : arm.m_parent_infos)
+            write(out, (int32_t)parent);
+        write(out, (uint32_t)arm.m_frame_pose_matrices.size());
+        for (auto& frame : arm.m_frame_pose_matrices)
+        {
+            write(out, (int32_t)frame.first);
+            for (const LocRotScale& lrs : frame.second)
+            {
+                out.write((const char*)&lrs.m_loc, 12);
+                write(out, lrs.m_rot.X);
+                write(out, lrs.m_rot.Y);
+                write(out, lrs.m_rot.Z);
+                write(out, lrs.m_rot.W);
+                out.write((const char*)&lrs.m_scale, 12);
+            }
+        }
+    }
+    out.close();
+
+    bool success = !out.fail();
+    if (success && std::rename(tmp_file.c_str(), m_cache_file.c_str()) != 0)
+    {
+        // Renaming to an existing file fails on windows
+        file_manager->removeFile(m_cache_file);
+        success =
+            std::rename(tmp_file.c_str(), m_cache_file.c_str()) == 0;
+    }
+    if (!success)
+    {
+        Log::warn("SPMeshCache", "Can't write cache '%s'.",
+                  m_cache_file.c_str());
+        file_manager->removeFile(tmp_file);
+    }
+}   // save
+
+}
+
+#endif   // !SERVER_ONLY
@@ -0,0 +1,73 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_SP_MESH_CACHE_HPP
+#define HEADER_SP_MESH_CACHE_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <IReadFile.h>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+using namespace irr;
+
+class Material;
+
+namespace SP
+{
+class SPMesh;
+
+/** A cache of converted meshes in the user cache directory, so that models
+ *  which were loaded before are not parsed and converted again. It stores
+ *  the vertices and indices of the final mesh buffers (after they were
+ *  sorted and combined in SPMesh::finalize()), the texture names the loader
+ *  looked up their materials with, and the armatures including the inverse
+ *  bind matrices. The cache file is mapped into memory when it is loaded,
+ *  and it is only used if it was written for a model file with the same
+ *  content and the same lookups still find the same materials. Meshes of
+ *  reversed tracks are not cached, since their uvs can be mirrored.
+ */
+class SPMeshCache : public NoCopy
+{
+private:
+    /** Full path of the cache file. */
+    std::string m_cache_file;
+
+    /** Hash of the model file and the loader setting. */
+    uint64_t m_key;
+
+    /** The texture names each material was looked up with by the loader. */
+    std::map<const Material*, std::pair<std::string, std::string> >
+        m_material_names;
+
+public:
+              SPMeshCache(io::IReadFile* file, int loader_setting);
+    SPMesh*   load() const;
+    Material* getMaterial(const std::string& layer_one,
+                          const std::string& layer_two);
+    void      save(const SPMesh* mesh) const;
+};   // SPMeshCache
+
+}
+
+#endif
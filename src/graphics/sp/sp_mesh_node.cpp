@@ -20,6 +20,7 @@
 #include "graphics/sp/sp_base.hpp"
 #include "graphics/sp/sp_mesh.hpp"
 #include "graphics/sp/sp_mesh_buffer.hpp"
+#include "graphics/sp/sp_pose_cache.hpp"
 #include "graphics/sp/sp_shader.hpp"
 #include "graphics/sp/sp_shader_manager.hpp"
 #include "graphics/graphics_restrictions.hpp"
@@ -167,7 +168,13 @@ IMesh* SPMeshNode::getMeshForCurrentFrame()
     {
         return m_mesh;
     }
-    m_mesh->getSkinningMatrices(getFrameNr(), m_skinning_matrices.data());
+    if (addPoseRequest(this))
+    {
+        // The pose is set later in setPose()
+        return m_mesh;
+    }
+    m_mesh->getSkinningMatrices(SPPoseCache::quantizeFrame(getFrameNr()),
+        m_skinning_matrices.data());
     updateAbsolutePosition();
 
     for (Armature& arm : m_mesh->getArmatures())
@@ -181,6 +188,37 @@ IMesh* SPMeshNode::getMeshForCurrentFrame()
     return m_mesh;
 }   // getMeshForCurrentFrame
 
+// ----------------------------------------------------------------------------
+/** Sets the pose evaluated by SPPoseCache for the current frame.
+ *  \param skinning_matrices The skinning matrices of all used joints.
+ *  \param world_matrices The world matrices of all joints.
+ */
+void SPMeshNode::setPose(const std::array<float, 16>* skinning_matrices,
+                         const core::matrix4* world_matrices)
+{
+    std::copy(skinning_matrices,
+        skinning_matrices + m_skinning_matrices.size(),
+        m_skinning_matrices.begin());
+    updateAbsolutePosition();
+
+    unsigned joint = 0;
+    for (Armature& arm : m_mesh->getArmatures())
+    {
+        for (unsigned i = 0; i < arm.m_joint_names.size(); i++)
+        {
+            IBoneSceneNode* node = m_joint_nodes.at(arm.m_joint_names[i]);
+            node->setAbsoluteTransformation
+                (AbsoluteTransformation * world_matrices[joint++]);
+            // The children of the joint were animated before its pose was
+            // known
+            for (ISceneNode* child : node->getChildren())
+            {
+                child->recursiveUpdateAbsolutePosition();
+            }
+        }
+    }
+}   // setPose
+
 // ----------------------------------------------------------------------------
 int SPMeshNode::getTotalJoints() const
 {
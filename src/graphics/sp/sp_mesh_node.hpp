@@ -92,6 +92,9 @@ public:
     // ------------------------------------------------------------------------
     virtual irr::scene::IMesh* getMeshForCurrentFrame();
     // ------------------------------------------------------------------------
+    void setPose(const std::array<float, 16>* skinning_matrices,
+                 const core::matrix4* world_matrices);
+    // ------------------------------------------------------------------------
     virtual IBoneSceneNode* getJointNode(const c8* joint_name);
     // ------------------------------------------------------------------------
     virtual IBoneSceneNode* getJointNode(u32 joint_id)
@@ -0,0 +1,489 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "graphics/sp/sp_pose_cache.hpp"
+
+#include "graphics/sp/sp_animation.hpp"
+#include "graphics/sp/sp_mesh.hpp"
+#include "utils/log.hpp"
+#include "utils/worker_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define SP_POSE_CACHE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define SP_POSE_CACHE_NEON
+#endif
+
+namespace SP
+{
+
+// ----------------------------------------------------------------------------
+/** Computes out = a * b. Each column of the result is the sum of the columns
+ *  of a multiplied with the elements of the column of b, added in the same
+ *  order as in matrix4::operator*, so the result is identical.
+ */
+static inline void multiply(const core::matrix4& a, const core::matrix4& b,
+                            core::matrix4* out)
+{
+    const float* m1 = a.pointer();
+    const float* m2 = b.pointer();
+    float* m3 = out->pointer();
+#if defined(SP_POSE_CACHE_SSE)
+    const __m128 c0 = _mm_loadu_ps(m1);
+    const __m128 c1 = _mm_loadu_ps(m1 + 4);
+    const __m128 c2 = _mm_loadu_ps(m1 + 8);
+    const __m128 c3 = _mm_loadu_ps(m1 + 12);
+    for (unsigned int j = 0; j < 16; j += 4)
+    {
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(m2[j]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(m2[j + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(m2[j + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(m2[j + 3])));
+        _mm_storeu_ps(m3 + j, r);
+    }
+#elif defined(SP_POSE_CACHE_NEON)
+    const float32x4_t c0 = vld1q_f32(m1);
+    const float32x4_t c1 = vld1q_f32(m1 + 4);
+    const float32x4_t c2 = vld1q_f32(m1 + 8);
+    const float32x4_t c3 = vld1q_f32(m1 + 12);
+    for (unsigned int j = 0; j < 16; j += 4)
+    {
+        float32x4_t r = vmulq_n_f32(c0, m2[j]);
+        r = vaddq_f32(r, vmulq_n_f32(c1, m2[j + 1]));
+        r = vaddq_f32(r, vmulq_n_f32(c2, m2[j + 2]));
+        r = vaddq_f32(r, vmulq_n_f32(c3, m2[j + 3]));
+        vst1q_f32(m3 + j, r);
+    }
+#else
+    (void)m1;
+    (void)m2;
+    (void)m3;
+    *out = a * b;
+#endif
+}   // multiply
+
+// ----------------------------------------------------------------------------
+/** Same as LocRotScale::toMatrix(). */
+static inline void toMatrix(const LocRotScale& lrs, core::matrix4* out)
+{
+    core::matrix4 lm, sm, rm, lrm;
+    lm.setTranslation(lrs.m_loc);
+    sm.setScale(lrs.m_scale);
+    lrs.m_rot.getMatrix(rm);
+    multiply(lm, rm, &lrm);
+    multiply(lrm, sm, out);
+}   // toMatrix
+
+// ----------------------------------------------------------------------------
+SPPoseCache::SPPoseCache()
+{
+    m_num_poses = 0;
+}   // SPPoseCache
+
+// ----------------------------------------------------------------------------
+/** Removes all requests, the memory of the poses is kept. */
+void SPPoseCache::clear()
+{
+    m_requests.clear();
+    m_num_poses = 0;
+}   // clear
+
+// ----------------------------------------------------------------------------
+/** Requests the pose of a mesh at a frame, and returns the index of the
+ *  request which is used to get the matrices after evaluate().
+ */
+unsigned int SPPoseCache::addPose(SPMesh* mesh, float frame)
+{
+    Request r;
+    r.m_mesh = mesh;
+    r.m_frame = (int)std::floor(frame * FRAME_STEPS + 0.5f);
+    r.m_pose = 0;
+    m_requests.push_back(r);
+    return (unsigned int)m_requests.size() - 1;
+}   // addPose
+
+// ----------------------------------------------------------------------------
+/** Finds the unique poses of all requests and evaluates them, in parallel
+ *  jobs if a worker pool is given.
+ */
+void SPPoseCache::evaluate(WorkerPool* pool)
+{
+    m_sorted.resize(m_requests.size());
+    for (unsigned int i = 0; i < m_sorted.size(); i++)
+        m_sorted[i] = i;
+    std::sort(m_sorted.begin(), m_sorted.end(),
+        [this](unsigned int a, unsigned int b)->bool
+        {
+            const Request& ra = m_requests[a];
+            const Request& rb = m_requests[b];
+            if (ra.m_mesh != rb.m_mesh)
+                return std::less<SPMesh*>()(ra.m_mesh, rb.m_mesh);
+            return ra.m_frame < rb.m_frame;
+        });
+
+    m_num_poses = 0;
+    for (unsigned int i = 0; i < m_sorted.size(); i++)
+    {
+        Request& r = m_requests[m_sorted[i]];
+        const Request* prev = i == 0 ? NULL : &m_requests[m_sorted[i - 1]];
+        if (!prev || prev->m_mesh != r.m_mesh || prev->m_frame != r.m_frame)
+        {
+            if (m_poses.size() <= m_num_poses)
+                m_poses.emplace_back();
+            m_poses[m_num_poses].m_mesh = r.m_mesh;
+            m_poses[m_num_poses].m_frame = r.m_frame;
+            m_num_poses++;
+        }
+        r.m_pose = m_num_poses - 1;
+    }
+
+    if (pool && m_num_poses > 1)
+    {
+        pool->run(m_num_poses, [this](unsigned int index, unsigned int)
+            {
+                evaluatePose(&m_poses[index]);
+            });
+    }
+    else
+    {
+        for (unsigned int i = 0; i < m_num_poses; i++)
+            evaluatePose(&m_poses[i]);
+    }
+}   // evaluate
+
+// ----------------------------------------------------------------------------
+/** Evaluates all armatures of a pose. Only data of the pose is written, so
+ *  different poses can be evaluated at the same time.
+ */
+void SPPoseCache::evaluatePose(Pose* pose)
+{
+    const std::vector<Armature>& armatures = pose->m_mesh->getArmatures();
+    unsigned int all_joints = 0;
+    unsigned int used_joints = 0;
+    for (const Armature& arm : armatures)
+    {
+        all_joints += (unsigned int)arm.m_joint_matrices.size();
+        used_joints += arm.m_joint_used;
+    }
+    pose->m_skinning_matrices.resize(used_joints);
+    pose->m_world_matrices.resize(all_joints);
+    pose->m_local_matrices.resize(all_joints);
+    pose->m_world_done.resize(all_joints);
+
+    const float frame = (float)pose->m_frame / FRAME_STEPS;
+    unsigned int all_offset = 0;
+    unsigned int used_offset = 0;
+    for (const Armature& arm : armatures)
+    {
+        const unsigned int num_joints =
+            (unsigned int)arm.m_joint_matrices.size();
+        core::matrix4* local = &pose->m_local_matrices[all_offset];
+        core::matrix4* world = &pose->m_world_matrices[all_offset];
+        uint8_t* world_done = &pose->m_world_done[all_offset];
+        getInterpolatedMatrices(arm, frame, local);
+        memset(world_done, 0, num_joints);
+        for (unsigned int i = 0; i < num_joints; i++)
+        {
+            const core::matrix4& m =
+                getWorldMatrix(arm, i, local, world, world_done);
+            if (i < arm.m_joint_used)
+            {
+                core::matrix4 skinning;
+                multiply(m, arm.m_joint_matrices[i], &skinning);
+                memcpy(&pose->m_skinning_matrices[used_offset + i],
+                       skinning.pointer(), 64);
+            }
+        }
+        all_offset += num_joints;
+        used_offset += arm.m_joint_used;
+    }
+}   // evaluatePose
+
+// ----------------------------------------------------------------------------
+/** Same as Armature::getInterpolatedMatrices(), but writes to dest and
+ *  finds the key frames with a binary search.
+ */
+void SPPoseCache::getInterpolatedMatrices(const Armature& arm, float frame,
+                                          core::matrix4* dest)
+{
+    const auto& frames = arm.m_frame_pose_matrices;
+    const unsigned int num_joints = (unsigned int)arm.m_joint_matrices.size();
+    if (frame < float(frames.front().first) ||
+        frame >= float(frames.back().first))
+    {
+        const std::vector<LocRotScale>& lrs =
+            frame >= float(frames.back().first) ?
+            frames.back().second : frames.front().second;
+        for (unsigned int i = 0; i < num_joints; i++)
+            toMatrix(lrs[i], &dest[i]);
+        return;
+    }
+    // The last key frame which is not after frame
+    auto next = std::upper_bound(frames.begin(), frames.end(), frame,
+        [](float f, const std::pair<int, std::vector<LocRotScale> >& p)
+        {
+            return f < float(p.first);
+        });
+    assert(next != frames.begin() && next != frames.end());
+    const std::vector<LocRotScale>& lrs_1 = (next - 1)->second;
+    const std::vector<LocRotScale>& lrs_2 = next->second;
+    const float interpolation = (frame - float((next - 1)->first)) /
+        float(next->first - (next - 1)->first);
+    for (unsigned int i = 0; i < num_joints; i++)
+    {
+        LocRotScale interpolated;
+        interpolated.m_loc =
+            lrs_2[i].m_loc.getInterpolated(lrs_1[i].m_loc, interpolation);
+        interpolated.m_rot.slerp(lrs_1[i].m_rot, lrs_2[i].m_rot,
+                                 interpolation);
+        interpolated.m_scale =
+            lrs_2[i].m_scale.getInterpolated(lrs_1[i].m_scale,
+                                             interpolation);
+        toMatrix(interpolated, &dest[i]);
+    }
+}   // getInterpolatedMatrices
+
+// ----------------------------------------------------------------------------
+/** Same as Armature::getWorldMatrix(), with the world matrices and the
+ *  flags which of them are computed stored in the given arrays.
+ */
+const core::matrix4& SPPoseCache::getWorldMatrix(const Armature& arm,
+                                                 unsigned int id,
+                                                 const core::matrix4* local,
+                                                 core::matrix4* world,
+                                                 uint8_t* world_done)
+{
+    if (world_done[id])
+        return world[id];
+    const int parent_id = arm.m_parent_infos[id];
+    if (parent_id == -1)
+        world[id] = local[id];
+    else
+    {
+        multiply(getWorldMatrix(arm, parent_id, local, world, world_done),
+                 local[id], &world[id]);
+    }
+    world_done[id] = 1;
+    return world[id];
+}   // getWorldMatrix
+
+// ----------------------------------------------------------------------------
+/** Creates a mesh with random animated armatures for testing. */
+static void createMesh(std::mt19937* random, unsigned int num_armatures,
+                       unsigned int num_joints, SPMesh* mesh)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    auto random_lrs = [&]()
+        {
+            LocRotScale lrs;
+            lrs.m_loc = core::vector3df(dist(*random), dist(*random),
+                                        dist(*random));
+            lrs.m_rot = core::quaternion(dist(*random), dist(*random),
+                                         dist(*random), dist(*random));
+            lrs.m_rot.normalize();
+            lrs.m_scale = core::vector3df(1.0f + 0.1f * dist(*random),
+                                          1.0f, 1.0f - 0.1f * dist(*random));
+            return lrs;
+        };
+    const int key_frames[] = { 0, 10, 11, 25, 40 };
+    std::vector<Armature>& armatures = mesh->getArmatures();
+    armatures.resize(num_armatures);
+    for (Armature& arm : armatures)
+    {
+        // Some joints are not used for skinning
+        arm.m_joint_used = num_joints - num_joints / 4;
+        arm.m_joint_names.resize(num_joints);
+        arm.m_joint_matrices.resize(num_joints);
+        arm.m_interpolated_matrices.resize(num_joints);
+        arm.m_world_matrices.resize(num_joints,
+            std::make_pair(core::matrix4(), false));
+        arm.m_parent_infos.resize(num_joints);
+        for (unsigned int i = 0; i < num_joints; i++)
+        {
+            arm.m_joint_matrices[i] = random_lrs().toMatrix();
+            // Joint 0 is the root, and joint 1 has a parent after it
+            arm.m_parent_infos[i] = i == 0 ? -1 :
+                i == 1 ? (int)num_joints - 1 :
+                i == num_joints - 1 ? 0 : (int)((i - 1) / 2);
+        }
+        arm.m_frame_pose_matrices.clear();
+        for (int f : key_frames)
+        {
+            arm.m_frame_pose_matrices.emplace_back(f,
+                std::vector<LocRotScale>());
+            for (unsigned int i = 0; i < num_joints; i++)
+                arm.m_frame_pose_matrices.back().second.push_back(
+                    random_lrs());
+        }
+    }
+}   // createMesh
+
+// ----------------------------------------------------------------------------
+/** Tests that the poses are the same as the ones from Armature::getPose(),
+ *  and that requests with the same mesh and rounded frame share a pose.
+ */
+void SPPoseCache::unitTesting()
+{
+    std::mt19937 random(1);
+    SPMesh meshes[2];
+    createMesh(&random, 1, 30, &meshes[0]);
+    createMesh(&random, 2, 12, &meshes[1]);
+    // All frames are different after rounding
+    const float frames[] = { -1.0f, 0.0f, 0.3f, 10.0f, 10.4f, 10.6f,
+                             24.97f, 39.9f, 40.0f, 100.0f };
+    const unsigned int num_frames = sizeof(frames) / sizeof(frames[0]);
+
+    WorkerPool pool(4);
+    for (int use_pool = 0; use_pool < 2; use_pool++)
+    {
+        SPPoseCache cache;
+        for (int repeat = 0; repeat < 2; repeat++)
+        {
+            cache.clear();
+            for (SPMesh& mesh : meshes)
+            {
+                for (float f : frames)
+                    cache.addPose(&mesh, f);
+                // The same as the first two frames after rounding
+                cache.addPose(&mesh, frames[0] + 0.01f);
+                cache.addPose(&mesh, frames[1] - 0.01f);
+            }
+            cache.evaluate(use_pool ? &pool : NULL);
+            if (cache.getNumPoses() != 2 * num_frames)
+            {
+                Log::fatal("SPPoseCache", "%u poses, expected %u.",
+                           cache.getNumPoses(), 2 * num_frames);
+            }
+
+            unsigned int request = 0;
+            for (SPMesh& mesh : meshes)
+            {
+                std::vector<Armature>& armatures = mesh.getArmatures();
+                for (unsigned int f = 0; f < num_frames + 2; f++)
+                {
+                    const float frame = quantizeFrame(f < num_frames ?
+                        frames[f] : frames[f - num_frames]);
+                    const std::array<float, 16>* skinning =
+                        cache.getSkinningMatrices(request);
+                    const core::matrix4* world =
+                        cache.getWorldMatrices(request);
+                    request++;
+                    for (Armature& arm : armatures)
+                    {
+                        std::vector<std::array<float, 16> >
+                            expected(arm.m_joint_used);
+                        arm.getPose(frame, expected.data());
+                        if (memcmp(expected.data(), skinning,
+                                   64 * arm.m_joint_used) != 0)
+                        {
+                            Log::fatal("SPPoseCache", "Wrong skinning "
+                                       "matrices at frame %f.", frame);
+                        }
+                        for (unsigned int i = 0;
+                             i < arm.m_world_matrices.size(); i++)
+                        {
+                            if (arm.m_world_matrices[i].second &&
+                                memcmp(arm.m_world_matrices[i].first
+                                       .pointer(), world[i].pointer(),
+                                       64) != 0)
+                            {
+                                Log::fatal("SPPoseCache", "Wrong world "
+                                           "matrix at frame %f.", frame);
+                            }
+                        }
+                        skinning += arm.m_joint_used;
+                        world += arm.m_world_matrices.size();
+                    }
+                }
+            }
+        }
+    }
+}   // unitTesting
+
+// ----------------------------------------------------------------------------
+/** Compares the time to evaluate the poses of 20 karts using 5 models and 10
+ *  track characters, once per node as before and with the cache.
+ */
+void SPPoseCache::benchmark()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    const unsigned int num_models = 6;
+    const unsigned int num_nodes = 30;
+    const unsigned int num_frames = 500;
+    std::mt19937 random(1);
+    SPMesh meshes[num_models];
+    for (unsigned int i = 0; i < num_models; i++)
+        createMesh(&random, 1, 40, &meshes[i]);
+    std::uniform_real_distribution<float> dist(0.0f, 40.0f);
+
+    // Many karts drive straight and use the same frame
+    std::vector<std::pair<SPMesh*, float> > nodes;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        SPMesh* mesh = i < 20 ? &meshes[i % 5] : &meshes[5];
+        nodes.emplace_back(mesh, i % 3 == 0 ? dist(random) : 20.0f);
+    }
+
+    std::vector<std::array<float, 16> > dest(40);
+    SPPoseCache cache;
+    WorkerPool pool(WorkerPool::getDefaultNumThreads());
+    Clock::duration time[3];
+    for (int method = 0; method < 3; method++)
+    {
+        Clock::time_point begin = Clock::now();
+        for (unsigned int frame = 0; frame < num_frames; frame++)
+        {
+            const float offset = frame * 0.05f;
+            if (method == 0)
+            {
+                for (auto& node : nodes)
+                {
+                    node.first->getSkinningMatrices(node.second + offset,
+                                                    dest.data());
+                }
+            }
+            else
+            {
+                cache.clear();
+                for (auto& node : nodes)
+                    cache.addPose(node.first, node.second + offset);
+                cache.evaluate(method == 2 ? &pool : NULL);
+            }
+        }
+        time[method] = Clock::now() - begin;
+    }
+    Log::info("SPPoseCache", "%u nodes, %u meshes, %u frames: %u poses, "
+              "per node %f ms, cached %f ms, cached with %u threads %f ms.",
+              num_nodes, num_models, num_frames, cache.getNumPoses(),
+              std::chrono::duration<double, std::milli>(time[0]).count(),
+              std::chrono::duration<double, std::milli>(time[1]).count(),
+              pool.getNumThreads(),
+              std::chrono::duration<double, std::milli>(time[2]).count());
+}   // benchmark
+
+}
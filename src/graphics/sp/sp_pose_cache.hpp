@@ -0,0 +1,135 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_SP_POSE_CACHE_HPP
+#define HEADER_SP_POSE_CACHE_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <matrix4.h>
+
+#include <array>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+class WorkerPool;
+
+using namespace irr;
+
+namespace SP
+{
+class SPMesh;
+struct Armature;
+
+/** Evaluates the poses (skinning matrices and world matrices of all joints)
+ *  of animated meshes for one frame. Poses are requested for a mesh and a
+ *  frame, which is rounded to a multiple of 1 / FRAME_STEPS, and requests
+ *  for the same mesh and rounded frame share one pose, e.g. karts using the
+ *  same model while driving straight. The unique poses are evaluated in
+ *  parallel in evaluate(). The matrix products are done with SSE or NEON,
+ *  with exactly the same results as the scalar code in Armature::getPose().
+ *  The class does not depend on OpenGL, which allows it to be unit tested.
+ */
+class SPPoseCache : public NoCopy
+{
+public:
+    /** Frames are rounded to a multiple of 1 / FRAME_STEPS. */
+    static const int FRAME_STEPS = 16;
+
+private:
+    struct Pose
+    {
+        SPMesh* m_mesh;
+        int m_frame;
+        /** The skinning matrices of the used joints of all armatures. */
+        std::vector<std::array<float, 16> > m_skinning_matrices;
+        /** The world matrices of all joints of all armatures. */
+        std::vector<core::matrix4> m_world_matrices;
+        /** Scratch data used while the pose is evaluated. */
+        std::vector<core::matrix4> m_local_matrices;
+        std::vector<uint8_t> m_world_done;
+    };
+
+    struct Request
+    {
+        SPMesh* m_mesh;
+        /** The rounded frame multiplied with FRAME_STEPS. */
+        int m_frame;
+        /** Index of the pose in m_poses, set in evaluate(). */
+        unsigned int m_pose;
+    };
+
+    /** The requests since the last clear(). */
+    std::vector<Request> m_requests;
+
+    /** Indices of the requests, sorted by mesh and frame. */
+    std::vector<unsigned int> m_sorted;
+
+    /** The unique poses, only the first m_num_poses are used. The poses
+     *  are only cleared (not freed) between frames. */
+    std::vector<Pose> m_poses;
+
+    /** Number of unique poses. */
+    unsigned int m_num_poses;
+
+    static void evaluatePose(Pose* pose);
+    static void getInterpolatedMatrices(const Armature& arm, float frame,
+                                        core::matrix4* dest);
+    static const core::matrix4& getWorldMatrix(const Armature& arm,
+                                               unsigned int id,
+                                               const core::matrix4* local,
+                                               core::matrix4* world,
+                                               uint8_t* world_done);
+
+public:
+         SPPoseCache();
+    void clear();
+    unsigned int addPose(SPMesh* mesh, float frame);
+    void evaluate(WorkerPool* pool);
+    static void unitTesting();
+    static void benchmark();
+    // ------------------------------------------------------------------------
+    /** Rounds a frame to a multiple of 1 / FRAME_STEPS. */
+    static float quantizeFrame(float frame)
+    {
+        return std::floor(frame * FRAME_STEPS + 0.5f) / FRAME_STEPS;
+    }
+    // ------------------------------------------------------------------------
+    /** Returns the number of unique poses, only valid after evaluate(). */
+    unsigned int getNumPoses() const                 { return m_num_poses; }
+    // ------------------------------------------------------------------------
+    /** Returns the skinning matrices of request n, only valid after
+     *  evaluate(). */
+    const std::array<float, 16>* getSkinningMatrices(unsigned int n) const
+    {
+        return m_poses[m_requests[n].m_pose].m_skinning_matrices.data();
+    }
+    // ------------------------------------------------------------------------
+    /** Returns the world matrices of all joints of all armatures of
+     *  request n, only valid after evaluate(). */
+    const core::matrix4* getWorldMatrices(unsigned int n) const
+    {
+        return m_poses[m_requests[n].m_pose].m_world_matrices.data();
+    }
+};   // SPPoseCache
+
+}
+
+#endif
@@ -43,6 +43,8 @@ SPShader::SPShader(const std::string& name,
                    m_use_alpha_channel(use_alpha_channel),
                    m_use_tangents(use_tangents), m_srgb(srgb)
 {
+    m_draw_call_frame = 0;
+    m_draw_call_index = 0;
 #ifndef SERVER_ONLY
     if (CVS->isARBTextureBufferObjectUsable())
     {
@@ -110,6 +110,12 @@ private:
 
     const std::array<bool, 6> m_srgb;
 
+    /** The frame in which m_draw_call_index was set. */
+    unsigned m_draw_call_frame;
+
+    /** Index of this shader in the draw call keys of a frame. */
+    unsigned m_draw_call_index;
+
 public:
     // ------------------------------------------------------------------------
     static bool m_sp_shader_debug;
@@ -209,6 +215,19 @@ public:
     // ------------------------------------------------------------------------
     int getDrawingPriority() const               { return m_drawing_priority; }
     // ------------------------------------------------------------------------
+    /** Returns the index of this shader in the draw call keys of the given
+     *  frame, or -1 if it was not set in that frame. */
+    int getDrawCallIndex(unsigned frame) const
+    {
+        return m_draw_call_frame == frame ? (int)m_draw_call_index : -1;
+    }
+    // ------------------------------------------------------------------------
+    void setDrawCallIndex(unsigned frame, unsigned index)
+    {
+        m_draw_call_frame = frame;
+        m_draw_call_index = index;
+    }
+    // ------------------------------------------------------------------------
     bool samplerLess(RenderPass rp = RP_1ST) const
                                              { return m_samplers[rp].empty(); }
     // ------------------------------------------------------------------------
@@ -19,6 +19,7 @@
 
 #include "graphics/sp/sp_mesh.hpp"
 #include "graphics/sp/sp_mesh_buffer.hpp"
+#include "graphics/sp/sp_mesh_cache.hpp"
 #include "graphics/central_settings.hpp"
 #include "graphics/material_manager.hpp"
 #include "graphics/stk_tex_manager.hpp"
@@ -30,6 +31,7 @@ const uint8_t VERSION_NOW = 1;
 
 #include <algorithm>
 #include <cmath>
+#include <memory>
 #include <IVideoDriver.h>
 #include <IFileSystem.h>
 
@@ -56,6 +58,19 @@ scene::IAnimatedMesh* SPMeshLoader::createMesh(io::IReadFile* f)
     {
         return NULL;
     }
+#ifndef SERVER_ONLY
+    // Converted meshes are only cached for the SP renderer
+    std::unique_ptr<SP::SPMeshCache> cache;
+    if (real_spm)
+    {
+        cache.reset(new SP::SPMeshCache(f, 0));
+        SP::SPMesh* spm = cache->load();
+        if (spm)
+        {
+            return spm;
+        }
+    }
+#endif
     m_bind_frame = 0;
     m_joint_count = 0;
     m_frame_count = 0;
@@ -131,10 +146,16 @@ scene::IAnimatedMesh* SPMeshLoader::createMesh(io::IReadFile* f)
                     tex_name_1 = full_path;
                 }
             }
-            sp_mat_map[id] =
-                std::make_tuple(
-                material_manager->getMaterialSPM(tex_name_1, tex_name_2),
-                !tex_name_1.empty(), !tex_name_2.empty());
+            Material* m = NULL;
+#ifndef SERVER_ONLY
+            // The cache remembers the names used to look up the material
+            if (cache)
+                m = cache->getMaterial(tex_name_1, tex_name_2);
+            else
+#endif
+                m = material_manager->getMaterialSPM(tex_name_1, tex_name_2);
+            sp_mat_map[id] = std::make_tuple(m, !tex_name_1.empty(),
+                !tex_name_2.empty());
         }
         else
         {
@@ -256,6 +277,12 @@ scene::IAnimatedMesh* SPMeshLoader::createMesh(io::IReadFile* f)
         spm->m_all_armatures = std::move(m_all_armatures);
     }
     m_mesh->finalize();
+#ifndef SERVER_ONLY
+    if (cache)
+    {
+        cache->save(static_cast<SP::SPMesh*>(m_mesh));
+    }
+#endif
     if (!real_spm && has_armature)
     {
         // Because the last frame in spm is usable
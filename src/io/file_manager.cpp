@@ -247,6 +247,8 @@ FileManager::FileManager()
     checkAndCreateScreenshotDir();
     checkAndCreateReplayDir();
     checkAndCreateCachedTexturesDir();
+    checkAndCreateCachedPhysicsDir();
+    checkAndCreateCachedMeshesDir();
     checkAndCreateGPDir();
 
     redirectOutput();
@@ -724,6 +726,22 @@ std::string FileManager::getCachedTexturesDir() const
     return m_cached_textures_dir;
 }   // getCachedTexturesDir
 
+//-----------------------------------------------------------------------------
+/** Returns the directory in which the physics data of tracks is cached.
+*/
+std::string FileManager::getCachedPhysicsDir() const
+{
+    return m_cached_physics_dir;
+}   // getCachedPhysicsDir
+
+//-----------------------------------------------------------------------------
+/** Returns the directory in which converted meshes are cached.
+*/
+std::string FileManager::getCachedMeshesDir() const
+{
+    return m_cached_meshes_dir;
+}   // getCachedMeshesDir
+
 //-----------------------------------------------------------------------------
 /** Returns the directory in which user-defined grand prix should be stored.
  */
@@ -1062,6 +1080,56 @@ void FileManager::checkAndCreateCachedTexturesDir()
 
 }   // checkAndCreateCachedTexturesDir
 
+// ----------------------------------------------------------------------------
+/** Creates the directory for cached track physics data. This will set
+*  m_cached_physics_dir with the appropriate path.
+*/
+void FileManager::checkAndCreateCachedPhysicsDir()
+{
+#if defined(WIN32) || defined(__CYGWIN__)
+    m_cached_physics_dir = m_user_config_dir + "cached-physics/";
+#elif defined(__APPLE__)
+    m_cached_physics_dir = getenv("HOME");
+    m_cached_physics_dir += "/Library/Application Support/SuperTuxKart/CachedPhysics/";
+#else
+    m_cached_physics_dir = checkAndCreateLinuxDir("XDG_CACHE_HOME", "supertuxkart", ".cache/", ".");
+    m_cached_physics_dir += "cached-physics/";
+#endif
+
+    if (!checkAndCreateDirectory(m_cached_physics_dir))
+    {
+        Log::error("FileManager", "Can not create cached physics directory '%s', "
+            "falling back to '.'.", m_cached_physics_dir.c_str());
+        m_cached_physics_dir = ".";
+    }
+
+}   // checkAndCreateCachedPhysicsDir
+
+// ----------------------------------------------------------------------------
+/** Creates the directory for cached meshes. This will set
+*  m_cached_meshes_dir with the appropriate path.
+*/
+void FileManager::checkAndCreateCachedMeshesDir()
+{
+#if defined(WIN32) || defined(__CYGWIN__)
+    m_cached_meshes_dir = m_user_config_dir + "cached-meshes/";
+#elif defined(__APPLE__)
+    m_cached_meshes_dir = getenv("HOME");
+    m_cached_meshes_dir += "/Library/Application Support/SuperTuxKart/CachedMeshes/";
+#else
+    m_cached_meshes_dir = checkAndCreateLinuxDir("XDG_CACHE_HOME", "supertuxkart", ".cache/", ".");
+    m_cached_meshes_dir += "cached-meshes/";
+#endif
+
+    if (!checkAndCreateDirectory(m_cached_meshes_dir))
+    {
+        Log::error("FileManager", "Can not create cached meshes directory '%s', "
+            "falling back to '.'.", m_cached_meshes_dir.c_str());
+        m_cached_meshes_dir = ".";
+    }
+
+}   // checkAndCreateCachedMeshesDir
+
 // ----------------------------------------------------------------------------
 /** Creates the directories for user-defined grand prix. This will set m_gp_dir
  *  with the appropriate path.
@@ -99,6 +99,12 @@ private:
     /** Directory where resized textures are cached. */
     std::string       m_cached_textures_dir;
 
+    /** Directory where the physics data of tracks is cached. */
+    std::string       m_cached_physics_dir;
+
+    /** Directory where converted meshes are cached. */
+    std::string       m_cached_meshes_dir;
+
     /** Directory where user-defined grand prix are stored. */
     std::string       m_gp_dir;
 
@@ -126,6 +132,8 @@ private:
     void              checkAndCreateScreenshotDir();
     void              checkAndCreateReplayDir();
     void              checkAndCreateCachedTexturesDir();
+    void              checkAndCreateCachedPhysicsDir();
+    void              checkAndCreateCachedMeshesDir();
     void              checkAndCreateGPDir();
     void              discoverPaths();
 #if !defined(WIN32) && !defined(__CYGWIN__) && !defined(__APPLE__)
@@ -149,6 +157,8 @@ public:
     std::string       getScreenshotDir() const;
     std::string       getReplayDir() const;
     std::string       getCachedTexturesDir() const;
+    std::string       getCachedPhysicsDir() const;
+    std::string       getCachedMeshesDir() const;
     std::string       getGPDir() const;
     bool              checkAndCreateDirectory(const std::string &path);
     bool              checkAndCreateDirectoryP(const std::string &path);
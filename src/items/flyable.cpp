@@ -27,6 +27,7 @@
 #include <IMeshSceneNode.h>
 
 #include "achievements/achievements_status.hpp"
+#include "config/stk_config.hpp"
 #include "config/player_manager.hpp"
 #include "graphics/explosion.hpp"
 #include "graphics/irr_driver.hpp"
@@ -652,14 +653,11 @@ void Flyable::moveToInfinity(bool set_moveable_trans)
 }   // moveToInfinity
 
 // ----------------------------------------------------------------------------
-BareNetworkString* Flyable::saveState(std::vector<std::string>* ru)
+bool Flyable::saveState(BareNetworkString* buffer)
 {
     if (m_has_hit_something)
-        return NULL;
-
-    ru->push_back(getUniqueIdentity());
+        return false;
 
-    BareNetworkString* buffer = new BareNetworkString();
     uint16_t ticks_since_thrown_animation = (m_ticks_since_thrown & 32767) |
         (hasAnimation() ? 32768 : 0);
     buffer->addUInt16(ticks_since_thrown_animation);
@@ -673,9 +671,34 @@ BareNetworkString* Flyable::saveState(std::vector<std::string>* ru)
         CompressNetworkBody::compress(
             m_body.get(), m_motion_state.get(), buffer);
     }
-    return buffer;
+    return true;
 }   // saveState
 
+// ----------------------------------------------------------------------------
+/** Compares a predicted state with the state from the server. Only the
+ *  physical body can differ slightly, all other data (including the one
+ *  saved by subclasses) must be identical.
+ */
+bool Flyable::isStateMatching(BareNetworkString* predicted,
+                              BareNetworkString* confirmed, int count)
+{
+    const int header_size = m_do_terrain_info ? 6 : 2;
+    const int body_size = CompressNetworkBody::COMPRESSED_SIZE;
+    if (count < header_size)
+        return false;
+    const bool has_animation =
+        (((const uint8_t*)predicted->getCurrentData())[0] >> 7 & 1) == 1;
+    if (has_animation)
+        return Rewinder::isStateMatching(predicted, confirmed, count);
+
+    return count >= header_size + body_size &&
+        Rewinder::isStateMatching(predicted, confirmed, header_size) &&
+        CompressNetworkBody::isMatching(predicted, confirmed,
+            stk_config->m_network_max_prediction_error) &&
+        Rewinder::isStateMatching(predicted, confirmed,
+            count - header_size - body_size);
+}   // isStateMatching
+
 // ----------------------------------------------------------------------------
 void Flyable::restoreState(BareNetworkString *buffer, int count)
 {
@@ -257,8 +257,11 @@ public:
     // ------------------------------------------------------------------------
     virtual void computeError() OVERRIDE;
     // ------------------------------------------------------------------------
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru)
-        OVERRIDE;
+    virtual bool saveState(BareNetworkString* buffer) OVERRIDE;
+    // ------------------------------------------------------------------------
+    virtual bool isStateMatching(BareNetworkString* predicted,
+                                 BareNetworkString* confirmed,
+                                 int count) OVERRIDE;
     // ------------------------------------------------------------------------
     virtual void restoreState(BareNetworkString *buffer, int count) OVERRIDE;
     // ------------------------------------------------------------------------
@@ -400,6 +400,10 @@ public:
         return lc.length2() < m_distance_2;
     }   // hitKart
     // ------------------------------------------------------------------------
+    /** Returns the largest distance at which a kart can hit this item (since
+     *  hitKart halves the vertical distance). */
+    float getMaxHitDistance() const  { return 2.0f * sqrtf(m_distance_2); }
+    // ------------------------------------------------------------------------
     bool rotating() const               { return getType() != ITEM_BUBBLEGUM; }
 
 public:
@@ -0,0 +1,301 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "items/item_grid.hpp"
+
+#include "items/item.hpp"
+#include "utils/log.hpp"
+#include "utils/vec3.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+// ----------------------------------------------------------------------------
+/** Creates an empty grid.
+ *  \param cell_size Size of a grid cell, which should be larger than the
+ *         distance at which items can be hit.
+ */
+ItemGrid::ItemGrid(float cell_size)
+{
+    m_cell_size    = cell_size;
+    m_max_distance = 0.0f;
+}   // ItemGrid
+
+// ----------------------------------------------------------------------------
+/** Returns the cell coordinate of a x or z coordinate.
+ */
+int ItemGrid::getCellCoordinate(float f) const
+{
+    return (int)floorf(f / m_cell_size);
+}   // getCellCoordinate
+
+// ----------------------------------------------------------------------------
+/** Adds an item to the cell of its position.
+ *  \param item The item to add.
+ *  \param max_distance The largest (3d) distance at which the item can be
+ *         hit by a kart.
+ */
+void ItemGrid::insert(ItemState *item, float max_distance)
+{
+    const Vec3 &xyz = item->getXYZ();
+    m_cells[getKey(getCellCoordinate(xyz.getX()),
+                   getCellCoordinate(xyz.getZ()))].push_back(item);
+    m_max_distance = std::max(m_max_distance, max_distance);
+}   // insert
+
+// ----------------------------------------------------------------------------
+/** Removes an item from the grid. The item must be at the same position as
+ *  when it was inserted.
+ *  \param item The item to remove.
+ */
+void ItemGrid::remove(ItemState *item)
+{
+    const Vec3 &xyz = item->getXYZ();
+    auto cell = m_cells.find(getKey(getCellCoordinate(xyz.getX()),
+                                    getCellCoordinate(xyz.getZ())));
+    assert(cell != m_cells.end());
+    if (cell == m_cells.end())
+        return;
+    std::vector<ItemState*> &items = cell->second;
+    auto it = std::find(items.begin(), items.end(), item);
+    assert(it != items.end());
+    if (it == items.end())
+        return;
+    // The order in a cell does not matter, findItems() sorts the items
+    *it = items.back();
+    items.pop_back();
+    if (items.empty())
+        m_cells.erase(cell);
+}   // remove
+
+// ----------------------------------------------------------------------------
+/** Removes all items.
+ */
+void ItemGrid::clear()
+{
+    m_cells.clear();
+    m_max_distance = 0.0f;
+}   // clear
+
+// ----------------------------------------------------------------------------
+/** Returns all items in the cells that are closer to the given position
+ *  than the largest hit distance, sorted by item id. This is the order in
+ *  which a test of all items would find them.
+ *  \param xyz The position to find items for.
+ *  \param items On return the (candidate) items close to xyz.
+ */
+void ItemGrid::findItems(const Vec3 &xyz,
+                         std::vector<ItemState*> *items) const
+{
+    items->clear();
+    if (m_cells.empty())
+        return;
+    const int min_x = getCellCoordinate(xyz.getX() - m_max_distance);
+    const int max_x = getCellCoordinate(xyz.getX() + m_max_distance);
+    const int min_z = getCellCoordinate(xyz.getZ() - m_max_distance);
+    const int max_z = getCellCoordinate(xyz.getZ() + m_max_distance);
+    for (int x = min_x; x <= max_x; x++)
+    {
+        for (int z = min_z; z <= max_z; z++)
+        {
+            auto cell = m_cells.find(getKey(x, z));
+            if (cell != m_cells.end())
+            {
+                items->insert(items->end(), cell->second.begin(),
+                              cell->second.end());
+            }
+        }
+    }
+    std::sort(items->begin(), items->end(),
+              [](const ItemState *a, const ItemState *b)
+              {
+                  return a->getItemId() < b->getItemId();
+              });
+}   // findItems
+
+// ----------------------------------------------------------------------------
+namespace
+{
+    /** The same test as Item::hitKart() for an item that can be hit at a
+     *  squared distance of 1.2. */
+    bool isHit(const ItemState *item, const Vec3 &xyz)
+    {
+        Vec3 lc = quatRotate(item->getOriginalRotation(),
+                             xyz - item->getXYZ());
+        lc.setY(lc.getY() / 2.0f);
+        return lc.length2() < 1.2f;
+    }   // isHit
+
+    /** Creates num items with random positions and normals. */
+    void createItems(std::mt19937 *random, int num, float size,
+                     std::vector<ItemState*> *items)
+    {
+        std::uniform_real_distribution<float> pos(-size, size);
+        std::uniform_real_distribution<float> tilt(-0.5f, 0.5f);
+        for (int i = 0; i < num; i++)
+        {
+            ItemState *item = new ItemState(ItemState::ITEM_BONUS_BOX,
+                                            NULL, i);
+            Vec3 normal(tilt(*random), 1.0f, tilt(*random));
+            item->initItem(ItemState::ITEM_BONUS_BOX,
+                           Vec3(pos(*random), pos(*random) * 0.05f,
+                                pos(*random)),
+                           normal.normalized());
+            items->push_back(item);
+        }
+    }   // createItems
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Tests that the grid finds all items a kart can hit, in the order of their
+ *  ids, after items were added and removed.
+ */
+void ItemGrid::unitTesting()
+{
+    std::mt19937 random(42);
+    std::vector<ItemState*> items;
+    createItems(&random, 400, 40.0f, &items);
+    const float max_distance = 2.0f * sqrtf(1.2f);
+
+    ItemGrid grid(2.5f);
+    for (ItemState *item : items)
+        grid.insert(item, max_distance);
+    // Remove every third item
+    std::vector<bool> in_grid(items.size(), true);
+    for (unsigned int i = 0; i < items.size(); i += 3)
+    {
+        grid.remove(items[i]);
+        in_grid[i] = false;
+    }
+
+    std::uniform_real_distribution<float> pos(-42.0f, 42.0f);
+    std::vector<ItemState*> found;
+    unsigned int num_hits = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        Vec3 xyz(pos(random), pos(random) * 0.05f, pos(random));
+        grid.findItems(xyz, &found);
+        for (unsigned int j = 1; j < found.size(); j++)
+        {
+            if (found[j - 1]->getItemId() >= found[j]->getItemId())
+                Log::fatal("ItemGrid", "Items are not sorted.");
+        }
+        std::vector<ItemState*> hits;
+        for (ItemState *item : found)
+        {
+            if (!in_grid[item->getItemId()])
+                Log::fatal("ItemGrid", "Found a removed item.");
+            if (isHit(item, xyz))
+                hits.push_back(item);
+        }
+        std::vector<ItemState*> expected;
+        for (unsigned int j = 0; j < items.size(); j++)
+        {
+            if (in_grid[j] && isHit(items[j], xyz))
+                expected.push_back(items[j]);
+        }
+        if (hits != expected)
+        {
+            Log::fatal("ItemGrid", "Hits differ at %f %f %f.",
+                       xyz.getX(), xyz.getY(), xyz.getZ());
+        }
+        num_hits += (unsigned int)hits.size();
+    }
+    if (num_hits == 0)
+        Log::fatal("ItemGrid", "No item was hit.");
+
+    grid.clear();
+    grid.findItems(Vec3(0, 0, 0), &found);
+    if (!found.empty())
+        Log::fatal("ItemGrid", "Items found after clear.");
+
+    for (ItemState *item : items)
+        delete item;
+}   // unitTesting
+
+// ----------------------------------------------------------------------------
+/** Compares testing all items against only testing the items found by the
+ *  grid for 16 karts and 500 items.
+ */
+void ItemGrid::benchmark()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    const int num_karts = 16;
+    const int num_ticks = 20000;
+    std::mt19937 random(1);
+    std::vector<ItemState*> items;
+    createItems(&random, 500, 150.0f, &items);
+    ItemGrid grid;
+    for (ItemState *item : items)
+        grid.insert(item, 2.0f * sqrtf(1.2f));
+
+    // Karts drive in straight lines through the area
+    std::uniform_real_distribution<float> pos(-150.0f, 150.0f);
+    std::uniform_real_distribution<float> dir(-0.5f, 0.5f);
+    std::vector<Vec3> start, velocity;
+    for (int i = 0; i < num_karts; i++)
+    {
+        start.push_back(Vec3(pos(random), 0, pos(random)));
+        velocity.push_back(Vec3(dir(random), 0, dir(random)));
+    }
+
+    unsigned int hits[2] = { 0, 0 };
+    Clock::duration time[2];
+    std::vector<ItemState*> found;
+    for (int use_grid = 0; use_grid < 2; use_grid++)
+    {
+        Clock::time_point begin = Clock::now();
+        for (int t = 0; t < num_ticks; t++)
+        {
+            for (int k = 0; k < num_karts; k++)
+            {
+                Vec3 xyz = start[k] + velocity[k] * (float)(t % 600);
+                if (use_grid)
+                {
+                    grid.findItems(xyz, &found);
+                    for (ItemState *item : found)
+                        hits[1] += isHit(item, xyz);
+                }
+                else
+                {
+                    for (ItemState *item : items)
+                        hits[0] += isHit(item, xyz);
+                }
+            }
+        }
+        time[use_grid] = Clock::now() - begin;
+    }
+    Log::info("ItemGrid", "%d karts, %u items, %d ticks: all items %f ms, "
+              "grid %f ms, speedup %.1fx.", num_karts,
+              (unsigned int)items.size(), num_ticks,
+              std::chrono::duration<double, std::milli>(time[0]).count(),
+              std::chrono::duration<double, std::milli>(time[1]).count(),
+              (double)time[0].count() / std::max<double>(1.0,
+                                                 (double)time[1].count()));
+    if (hits[0] != hits[1])
+    {
+        Log::error("ItemGrid", "Different number of hits: %u and %u.",
+                   hits[0], hits[1]);
+    }
+    for (ItemState *item : items)
+        delete item;
+}   // benchmark
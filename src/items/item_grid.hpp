@@ -0,0 +1,71 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_ITEM_GRID_HPP
+#define HEADER_ITEM_GRID_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+class ItemState;
+class Vec3;
+
+/**
+  * \ingroup items
+  * A uniform grid in the x/z plane over the positions of all items, so that
+  * only items close to a kart need to be tested for a hit. The cells are
+  * hashed, since items can be dropped anywhere (not only on the track).
+  * Items are added and removed when they are inserted into or deleted from
+  * the item manager, and must be removed before their position changes.
+  */
+class ItemGrid : public NoCopy
+{
+private:
+    /** Size of a (square) grid cell. */
+    float m_cell_size;
+
+    /** The largest distance at which any item in the grid can be hit. */
+    float m_max_distance;
+
+    /** The items in each non-empty cell, indexed by getKey(). */
+    std::unordered_map<uint64_t, std::vector<ItemState*> > m_cells;
+
+    // ------------------------------------------------------------------------
+    /** Returns the key of the cell with the given coordinates. */
+    static uint64_t getKey(int x, int z)
+    {
+        return ((uint64_t)(uint32_t)x << 32) | (uint64_t)(uint32_t)z;
+    }   // getKey
+    // ------------------------------------------------------------------------
+    int getCellCoordinate(float f) const;
+
+public:
+         ItemGrid(float cell_size = 4.0f);
+    void insert(ItemState *item, float max_distance);
+    void remove(ItemState *item);
+    void clear();
+    void findItems(const Vec3 &xyz, std::vector<ItemState*> *items) const;
+    static void unitTesting();
+    static void benchmark();
+};   // ItemGrid
+
+#endif
@@ -242,10 +242,11 @@ unsigned int ItemManager::insertItem(Item *item)
 
 //-----------------------------------------------------------------------------
 /** Insert into the appropriate quad list, if there is a quad list
- *  (i.e. race mode has a quad graph).
+ *  (i.e. race mode has a quad graph), and into the item grid.
  */
 void ItemManager::insertItemInQuad(Item *item)
 {
+    m_item_grid.insert(item, item->getMaxHitDistance());
     if(m_items_in_quads)
     {
         int graph_node = item->getGraphNode();
@@ -375,14 +376,9 @@ void ItemManager::collectedItem(ItemState *item, AbstractKart *kart)
  */
 void  ItemManager::checkItemHit(AbstractKart* kart)
 {
-    // We could use m_items_in_quads to to check for item hits: take the quad
-    // of the graph node of the kart, and only check items in that quad. But
-    // then we also need to check for any adjacent quads (since an item just
-    // on the order of one quad might get hit from an adjacent quad). Then
-    // it is possible that a quad is that short that we need to test adjacent
-    // of adjacent quads. And check for items outside of the track.
-    // Since at this stace item detection is by far not a bottle neck,
-    // the original, simple and stable algorithm is left in place.
+    // Only the items close to the kart are tested. They are tested in the
+    // order of their index in m_all_items, so the result is the same as
+    // when testing all items.
 
     /** Disable item collection detection for debug purposes. */
     if(m_disable_item_collection) return;
@@ -390,11 +386,12 @@ void  ItemManager::checkItemHit(AbstractKart* kart)
     // Spare tire karts don't collect items
     if ( dynamic_cast<SpareTireAI*>(kart->getController()) ) return;
 
-    for(AllItemTypes::iterator i =m_all_items.begin();
-                               i!=m_all_items.end();  i++)
+    m_item_grid.findItems(kart->getXYZ(), &m_items_near_kart);
+    for(AllItemTypes::iterator i =m_items_near_kart.begin();
+                               i!=m_items_near_kart.end();  i++)
     {
         // Ignore items that have been collected or are not available atm
-        if ((!*i) || !(*i)->isAvailable() || (*i)->isUsedUp()) continue;
+        if (!(*i)->isAvailable() || (*i)->isUsedUp()) continue;
 
         // Shielded karts can simply drive over bubble gums without any effect
         if ( kart->isShielded() &&
@@ -411,7 +408,7 @@ void  ItemManager::checkItemHit(AbstractKart* kart)
         {
             collectedItem(*i, kart);
         }   // if hit
-    }   // for m_all_items
+    }   // for m_items_near_kart
 }   // checkItemHit
 
 //-----------------------------------------------------------------------------
@@ -522,11 +519,12 @@ void ItemManager::deleteItem(ItemState *item)
 }   // delete item
 
 //-----------------------------------------------------------------------------
-/** Removes an items from the items-in-quad list only
+/** Removes an items from the items-in-quad list and the item grid only
  *  \param The item to delete.
  */
 void ItemManager::deleteItemInQuad(ItemState* item)
 {
+    m_item_grid.remove(item);
     if(m_items_in_quads)
     {
         int sector = item->getGraphNode();
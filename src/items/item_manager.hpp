@@ -22,6 +22,7 @@
 #include "LinearMath/btTransform.h"
 
 #include "items/item.hpp"
+#include "items/item_grid.hpp"
 #include "utils/aligned_array.hpp"
 #include "utils/no_copy.hpp"
 #include "utils/vec3.hpp"
@@ -110,6 +111,9 @@ private:
      *  field is undefined if no Graph exist, e.g. arena without navmesh. */
     std::vector< AllItemTypes > *m_items_in_quads;
 
+    /** The items close to a kart, used in checkItemHit. */
+    AllItemTypes m_items_near_kart;
+
     /** Stores all item models. */
     static std::vector<scene::IMesh *> m_item_mesh;
 
@@ -121,6 +125,10 @@ protected:
      *  value is <0, it indicates that the items are not switched atm. */
     int m_switch_ticks;
 
+    /** A grid over the positions of all items, so that only items close to
+     *  a kart are tested for a hit. */
+    ItemGrid m_item_grid;
+
     void deleteItem(ItemState *item);
     virtual unsigned int insertItem(Item *item);
     void switchItemsInternal(std::vector < ItemState*> &all_items);
@@ -223,29 +223,17 @@ void NetworkItemManager::setItemConfirmationTime(std::weak_ptr<STKPeer> peer,
  *  to save the initial state, which is the first confirmed state by all
  *  clients.
  */
-BareNetworkString* NetworkItemManager::saveState(std::vector<std::string>* ru)
+bool NetworkItemManager::saveState(BareNetworkString* buffer)
 {
-    ru->push_back(getUniqueIdentity());
     // On the server:
     // ==============
     m_item_events.lock();
-    uint16_t n = (uint16_t)m_item_events.getData().size();
-    if(n==0)
+    for (auto& p : m_item_events.getData())
     {
-        BareNetworkString *s = new BareNetworkString();
-        m_item_events.unlock();
-        return s;
-    }
-
-    BareNetworkString *s =
-        new BareNetworkString(n * (  sizeof(int) + sizeof(uint16_t)
-                                   + sizeof(uint8_t)              ) );
-    for (auto p : m_item_events.getData())
-    {
-        p.saveState(s);
+        p.saveState(buffer);
     }
     m_item_events.unlock();
-    return s;
+    return true;
 }   // saveState
 
 //-----------------------------------------------------------------------------
@@ -488,7 +476,17 @@ void NetworkItemManager::restoreState(BareNetworkString *buffer, int count)
         // ... will be copied from item state to item
         if (is && item)
         {
+            // The item grid uses the position of the item
+            const bool moved = item->getXYZ().getX() != is->getXYZ().getX()
+                            || item->getXYZ().getZ() != is->getXYZ().getZ();
+            if (moved)
+                m_item_grid.remove(item);
             *(ItemState*)item = *is;
+            if (moved)
+            {
+                m_item_grid.insert(item,
+                    static_cast<Item*>(item)->getMaxHitDistance());
+            }
         }
         else if (is && !item)
         {
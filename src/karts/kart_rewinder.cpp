@@ -19,6 +19,7 @@
 #include "karts/kart_rewinder.hpp"
 
 #include "audio/sfx_manager.hpp"
+#include "config/stk_config.hpp"
 #include "items/attachment.hpp"
 #include "items/powerup.hpp"
 #include "guiengine/message_queue.hpp"
@@ -28,6 +29,7 @@
 #include "karts/rescue_animation.hpp"
 #include "karts/controller/player_controller.hpp"
 #include "karts/kart_properties.hpp"
+#include "karts/kart_state_block.hpp"
 #include "karts/max_speed.hpp"
 #include "karts/skidding.hpp"
 #include "modes/world.hpp"
@@ -147,21 +149,14 @@ void KartRewinder::computeError()
 }   // computeError
 
 // ----------------------------------------------------------------------------
-/** Saves all state information for a kart in a memory buffer. The memory
- *  is allocated here and the address returned. It will then be managed
- *  by the RewindManager.
- *  \param[out] ru The unique identity of rewinder writing to.
- *  \return The address of the memory buffer with the state.
+/** Saves all state information for a kart in the state buffer.
+ *  \param buffer The buffer to which the state is appended.
+ *  \return False if the kart is eliminated and has no state.
  */
-BareNetworkString* KartRewinder::saveState(std::vector<std::string>* ru)
+bool KartRewinder::saveState(BareNetworkString* buffer)
 {
     if (m_eliminated)
-        return nullptr;
-
-    ru->push_back(getUniqueIdentity());
-    const int MEMSIZE = 17*sizeof(float) + 9+3;
-
-    BareNetworkString *buffer = new BareNetworkString(MEMSIZE);
+        return false;
 
     // 1) Steering and other player controls
     // -------------------------------------
@@ -254,9 +249,47 @@ BareNetworkString* KartRewinder::saveState(std::vector<std::string>* ru)
     // -----------
     m_skidding->saveState(buffer);
 
-    return buffer;
+    return true;
 }   // saveState
 
+// ----------------------------------------------------------------------------
+/** Compares a predicted state with the state from the server. The physical
+ *  body can differ slightly, everything else must be identical.
+ */
+bool KartRewinder::isStateMatching(BareNetworkString* predicted,
+                                   BareNetworkString* confirmed, int count)
+{
+    // Controls (5 bytes) and controller (5 bytes) are followed by two
+    // bytes with flags for the optional values, see saveState()
+    const int flags_offset = 5 + 5;
+    if (count < flags_offset + 2)
+        return false;
+    const uint8_t flags =
+        ((const uint8_t*)predicted->getCurrentData())[flags_offset];
+    if ((flags & (1 << 5)) != 0)   // Kart animation instead of body
+        return Rewinder::isStateMatching(predicted, confirmed, count);
+
+    // If everything before the body is identical, the body is at the same
+    // offset in both states
+    int body_offset = flags_offset + 2;
+    if (flags & (1 << 1))
+        body_offset += 2;
+    if (flags & (1 << 2))
+        body_offset += 2;
+    if (flags & (1 << 3))
+        body_offset += 2;
+    if (flags & (1 << 4))
+        body_offset += 4;
+    const int body_size = CompressNetworkBody::COMPRESSED_SIZE;
+
+    return count >= body_offset + body_size &&
+        Rewinder::isStateMatching(predicted, confirmed, body_offset) &&
+        CompressNetworkBody::isMatching(predicted, confirmed,
+            stk_config->m_network_max_prediction_error) &&
+        Rewinder::isStateMatching(predicted, confirmed,
+            count - body_offset - body_size);
+}   // isStateMatching
+
 // ----------------------------------------------------------------------------
 /** Actually rewind to the specified state. 
  *  \param buffer The buffer with the state info.
@@ -441,51 +474,55 @@ void KartRewinder::update(int ticks)
 }   // update
 
 // ----------------------------------------------------------------------------
-std::function<void()> KartRewinder::getLocalStateRestoreFunction()
+/** Saves the values that are not part of the state sent by the server, but
+ *  can be restored locally since their adjustment only depends on the kart
+ *  itself.
+ *  \param block The block to save the local state of all karts in.
+ *  \param index Index of this kart in the block.
+ */
+void KartRewinder::saveLocalState(KartStateBlock *block, unsigned int index)
 {
+    block->m_saved[index] = m_eliminated ? 0 : 1;
     if (m_eliminated)
-        return nullptr;
+        return;
 
-    // Variable can be saved locally if its adjustment only depends on the kart
-    // itself
-    int brake_ticks = m_brake_ticks;
-    int8_t min_nitro_ticks = m_min_nitro_ticks;
+    block->m_brake_ticks[index] = m_brake_ticks;
+    block->m_min_nitro_ticks[index] = m_min_nitro_ticks;
 
     // Controller local state
-    int steer_val_l = 0;
-    int steer_val_r = 0;
     PlayerController* pc = dynamic_cast<PlayerController*>(m_controller);
-    if (pc)
-    {
-        steer_val_l = pc->m_steer_val_l;
-        steer_val_r = pc->m_steer_val_r;
-    }
+    block->m_steer_val_l[index] = pc ? pc->m_steer_val_l : 0;
+    block->m_steer_val_r[index] = pc ? pc->m_steer_val_r : 0;
 
     // Max speed local state (terrain)
-    float current_fraction = m_max_speed->m_speed_decrease
-        [MaxSpeed::MS_DECREASE_TERRAIN].m_current_fraction;
-    uint16_t max_speed_fraction = m_max_speed->m_speed_decrease
-        [MaxSpeed::MS_DECREASE_TERRAIN].m_max_speed_fraction;
+    const MaxSpeed::SpeedDecrease &terrain =
+        m_max_speed->m_speed_decrease[MaxSpeed::MS_DECREASE_TERRAIN];
+    block->m_terrain_fraction[index] = terrain.m_current_fraction;
+    block->m_terrain_max_speed_fraction[index] = terrain.m_max_speed_fraction;
 
     // Skidding local state
-    float remaining_jump_time = m_skidding->m_remaining_jump_time;
+    block->m_remaining_jump_time[index] = m_skidding->m_remaining_jump_time;
+}   // saveLocalState
 
-    return [brake_ticks, min_nitro_ticks,
-        steer_val_l, steer_val_r, current_fraction,
-        max_speed_fraction, remaining_jump_time, this]()
+// ----------------------------------------------------------------------------
+/** Restores the values saved by saveLocalState.
+ *  \param block The block with the local state of all karts.
+ *  \param index Index of this kart in the block.
+ */
+void KartRewinder::restoreLocalState(const KartStateBlock &block,
+                                     unsigned int index)
+{
+    m_brake_ticks = block.m_brake_ticks[index];
+    m_min_nitro_ticks = block.m_min_nitro_ticks[index];
+    PlayerController* pc = dynamic_cast<PlayerController*>(m_controller);
+    if (pc)
     {
-        m_brake_ticks = brake_ticks;
-        m_min_nitro_ticks = min_nitro_ticks;
-        PlayerController* pc = dynamic_cast<PlayerController*>(m_controller);
-        if (pc)
-        {
-            pc->m_steer_val_l = steer_val_l;
-            pc->m_steer_val_r = steer_val_r;
-        }
-        m_max_speed->m_speed_decrease[MaxSpeed::MS_DECREASE_TERRAIN]
-            .m_current_fraction = current_fraction;
-        m_max_speed->m_speed_decrease[MaxSpeed::MS_DECREASE_TERRAIN]
-            .m_max_speed_fraction = max_speed_fraction;
-        m_skidding->m_remaining_jump_time = remaining_jump_time;
-    };
-}   // getLocalStateRestoreFunction
+        pc->m_steer_val_l = block.m_steer_val_l[index];
+        pc->m_steer_val_r = block.m_steer_val_r[index];
+    }
+    MaxSpeed::SpeedDecrease &terrain =
+        m_max_speed->m_speed_decrease[MaxSpeed::MS_DECREASE_TERRAIN];
+    terrain.m_current_fraction = block.m_terrain_fraction[index];
+    terrain.m_max_speed_fraction = block.m_terrain_max_speed_fraction[index];
+    m_skidding->m_remaining_jump_time = block.m_remaining_jump_time[index];
+}   // restoreLocalState
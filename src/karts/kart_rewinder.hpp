@@ -23,6 +23,8 @@
 #include "network/rewinder.hpp"
 #include "utils/cpp2011.hpp"
 
+class KartStateBlock;
+
 class AbstractKart;
 class BareNetworkString;
 
@@ -40,10 +42,16 @@ public:
     ~KartRewinder() {}
     virtual void saveTransform() OVERRIDE;
     virtual void computeError() OVERRIDE;
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru)
-        OVERRIDE;
+    virtual bool saveState(BareNetworkString* buffer) OVERRIDE;
+    virtual bool isStateMatching(BareNetworkString* predicted,
+                                 BareNetworkString* confirmed,
+                                 int count) OVERRIDE;
     void reset() OVERRIDE;
     virtual void restoreState(BareNetworkString *p, int count) OVERRIDE;
+    // -------------------------------------------------------------------------
+    /** The server only skips the state of a kart far away from the karts of
+     *  this client, so the kart has not left the game. */
+    virtual void keepLocalState() OVERRIDE       { m_has_server_state = true; }
     virtual void rewindToEvent(BareNetworkString *p) OVERRIDE {}
     virtual void update(int ticks) OVERRIDE;
     // -------------------------------------------------------------------------
@@ -72,7 +80,9 @@ public:
     // -------------------------------------------------------------------------
     virtual void undoEvent(BareNetworkString *p) OVERRIDE {}
     // ------------------------------------------------------------------------
-    virtual std::function<void()> getLocalStateRestoreFunction() OVERRIDE;
+    void saveLocalState(KartStateBlock *block, unsigned int index);
+    // ------------------------------------------------------------------------
+    void restoreLocalState(const KartStateBlock &block, unsigned int index);
 
 
 };   // Rewinder
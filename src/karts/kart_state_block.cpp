@@ -0,0 +1,68 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "karts/kart_state_block.hpp"
+
+#include "karts/kart_rewinder.hpp"
+#include "modes/world.hpp"
+
+// ----------------------------------------------------------------------------
+/** Saves the local state of all karts of the world.
+ */
+void KartStateBlock::save()
+{
+    World *world = World::getWorld();
+    const unsigned int num_karts = world->getNumKarts();
+    m_saved.resize(num_karts);
+    m_brake_ticks.resize(num_karts);
+    m_min_nitro_ticks.resize(num_karts);
+    m_steer_val_l.resize(num_karts);
+    m_steer_val_r.resize(num_karts);
+    m_terrain_fraction.resize(num_karts);
+    m_terrain_max_speed_fraction.resize(num_karts);
+    m_remaining_jump_time.resize(num_karts);
+    for (unsigned int i = 0; i < num_karts; i++)
+    {
+        KartRewinder *kart =
+            dynamic_cast<KartRewinder*>(world->getKart(i));
+        if (kart)
+            kart->saveLocalState(this, i);
+        else
+            m_saved[i] = 0;
+    }
+}   // save
+
+// ----------------------------------------------------------------------------
+/** Restores the local state of all karts saved in this block.
+ */
+void KartStateBlock::restore() const
+{
+    World *world = World::getWorld();
+    const unsigned int num_karts =
+        std::min(world->getNumKarts(), (unsigned int)m_saved.size());
+    for (unsigned int i = 0; i < num_karts; i++)
+    {
+        if (!m_saved[i])
+            continue;
+        KartRewinder *kart =
+            dynamic_cast<KartRewinder*>(world->getKart(i));
+        if (kart)
+            kart->restoreLocalState(*this, i);
+    }
+}   // restore
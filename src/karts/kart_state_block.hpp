@@ -0,0 +1,63 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_KART_STATE_BLOCK_HPP
+#define HEADER_KART_STATE_BLOCK_HPP
+
+#include <stdint.h>
+#include <vector>
+
+/**
+  * \ingroup karts
+  * The local state of all karts at one time, i.e. the values which are not
+  * part of the state sent by the server, and which a client needs to restore
+  * when rewinding to a confirmed state. The values are stored as structure
+  * of arrays indexed by world kart id, so saving and restoring all karts
+  * only touches a few contiguous arrays, and the memory of a block can be
+  * reused for later times without any allocation. The rest of the kart
+  * state is still saved with KartRewinder::saveState().
+  */
+class KartStateBlock
+{
+private:
+    friend class KartRewinder;
+
+    /** 1 for each kart whose local state was saved (eliminated karts have
+     *  no local state). */
+    std::vector<uint8_t> m_saved;
+
+    std::vector<int> m_brake_ticks;
+
+    std::vector<int8_t> m_min_nitro_ticks;
+
+    /** Local steering values of player controllers. */
+    std::vector<int> m_steer_val_l, m_steer_val_r;
+
+    /** Current and maximum fraction of the terrain speed decrease. */
+    std::vector<float> m_terrain_fraction;
+    std::vector<uint16_t> m_terrain_max_speed_fraction;
+
+    std::vector<float> m_remaining_jump_time;
+
+public:
+    void save();
+    void restore() const;
+};   // KartStateBlock
+
+#endif
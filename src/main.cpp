@@ -192,6 +192,8 @@
 #include "graphics/particle_kind_manager.hpp"
 #include "graphics/referee.hpp"
 #include "graphics/sp/sp_base.hpp"
+#include "graphics/sp/sp_culling.hpp"
+#include "graphics/sp/sp_pose_cache.hpp"
 #include "graphics/sp/sp_shader.hpp"
 #include "guiengine/engine.hpp"
 #include "guiengine/event_handler.hpp"
@@ -202,6 +204,7 @@
 #include "input/wiimote_manager.hpp"
 #include "io/file_manager.hpp"
 #include "items/attachment_manager.hpp"
+#include "items/item_grid.hpp"
 #include "items/item_manager.hpp"
 #include "items/network_item_manager.hpp"
 #include "items/powerup_manager.hpp"
@@ -224,10 +227,15 @@
 #include "network/server.hpp"
 #include "network/server_config.hpp"
 #include "network/servers_manager.hpp"
+#include "network/state_checksums.hpp"
+#include "network/state_delta.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
 #include "online/profile_manager.hpp"
 #include "online/request_manager.hpp"
+#include "physics/ray_packet.hpp"
+#include "physics/stk_dynamics_world.hpp"
+#include "physics/triangle_mesh.hpp"
 #include "race/grand_prix_manager.hpp"
 #include "race/highscore_manager.hpp"
 #include "race/history.hpp"
@@ -242,6 +250,7 @@
 #include "states_screens/dialogs/init_android_dialog.hpp"
 #include "states_screens/dialogs/message_dialog.hpp"
 #include "tracks/arena_graph.hpp"
+#include "tracks/drive_graph.hpp"
 #include "tracks/track.hpp"
 #include "tracks/track_manager.hpp"
 #include "utils/command_line.hpp"
@@ -257,6 +266,7 @@
 static void cleanSuperTuxKart();
 static void cleanUserConfig();
 void runUnitTests();
+void runMicroBenchmarks();
 
 // ============================================================================
 //                        gamepad visualisation screen
@@ -585,6 +595,22 @@ void cmdLineHelp()
                               "laps.\n"
     "       --profile-time=n   Enable automatic driven profile mode for n "
                               "seconds.\n"
+    "       --profile-ticks=n  Benchmark mode: simulate n physics ticks as fast "
+                              "as possible\n"
+    "                          (best with --no-graphics), and report tick "
+                              "times as JSON.\n"
+    "       --profile-output=file Write the results of --profile-ticks to "
+                              "this file.\n"
+    "       --physics-threads=n Use n threads to solve independent physics "
+                              "islands\n"
+    "                          and cast wheel rays (results are identical to "
+                              "using one thread).\n"
+    "       --micro-benchmarks Run micro benchmarks and print the results.\n"
+    "       --generate-arena-paths Write the precomputed shortest paths of all\n"
+    "                          arenas next to their navmesh.\n"
+    "       --generate-drive-paths Write the precomputed path tables of the "
+                              "drive graph\n"
+    "                          of all tracks next to their quads.\n"
     "       --unlock-all       Permanently unlock all karts and tracks for testing.\n"
     "       --no-unlock-all    Disable unlock-all (i.e. base unlocking on player achievement).\n"
     "       --no-graphics      Do not display the actual race.\n"
@@ -605,6 +631,10 @@ void cmdLineHelp()
     "       --server-config=file Specify the server_config.xml for server hosting, it will create\n"
     "                            one if not found.\n"
     "       --network-console  Enable network console.\n"
+    "       --state-checksums=file Write checksums of all network states to "
+                               "file,\n"
+    "                          compare them with "
+                               "tools/compare_state_checksums.py.\n"
     "       --wan-server=name  Start a Wan server (not a playing client).\n"
     "       --public-server    Allow direct connection to the server (without stk server)\n"
     "       --lan-server=name  Start a LAN server (not a playing client).\n"
@@ -681,6 +711,8 @@ void cmdLineHelp()
     "                           Takes precedence over trilinear or bilinear\n"
     "                           texture filtering.\n"
     "       --shadows=n         Set resolution of shadows (0 to disable).\n"
+    "       --render-threads=n  Use n threads to cull and prepare the scene\n"
+    "                           (0 or 1 uses no extra threads).\n"
     "       --apitrace          This will disable buffer storage and\n"
     "                           writing gpu query strings to opengl, which\n"
     "                           can be seen later in apitrace.\n"
@@ -923,6 +955,8 @@ int handleCmdLinePreliminary()
         UserConfigParams::m_shadows_resolution = n;
     if (CommandLine::has("--anisotropic", &n))
         UserConfigParams::m_anisotropic = n;
+    if (CommandLine::has("--render-threads", &n) && n >= 0)
+        UserConfigParams::m_render_threads = n;
 
     // Useful for debugging: the temple navmesh needs 12 minutes in debug
     // mode to compute the distance matrix!!
@@ -955,6 +989,12 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
 
     if (CommandLine::has("--unit-testing"))
         UserConfigParams::m_unit_testing = true;
+    if (CommandLine::has("--micro-benchmarks"))
+        UserConfigParams::m_micro_benchmarks = true;
+    if (CommandLine::has("--generate-arena-paths"))
+        UserConfigParams::m_generate_arena_paths = true;
+    if (CommandLine::has("--generate-drive-paths"))
+        UserConfigParams::m_generate_drive_paths = true;
     if (CommandLine::has("--gamepad-debug"))
         UserConfigParams::m_gamepad_debug=true;
     if (CommandLine::has("--keyboard-debug"))
@@ -1207,6 +1247,9 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
 
     if (CommandLine::has("--network-item-debugging"))
         NetworkItemManager::m_network_item_debugging = true;
+
+    if (CommandLine::has("--state-checksums", &s))
+        StateChecksums::setFileName(s);
     
     std::string server_password;
     if (CommandLine::has("--server-password", &s))
@@ -1578,6 +1621,37 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
         race_manager->setNumLaps(999999); // profile end depends on time
     }   // --profile-time
 
+    if(CommandLine::has("--profile-ticks",  &n))
+    {
+        if (n <= 0)
+        {
+            Log::error("main", "Invalid number of profile-ticks: %i.", n);
+            return 0;
+        }
+        Log::verbose("main", "Profiling: %d ticks.", n);
+        UserConfigParams::m_no_start_screen = true;
+        ProfileWorld::setProfileModeTicks(n);
+        race_manager->setNumLaps(999999); // profile end depends on ticks
+        // The profiler markers are used for the per subsystem breakdown,
+        // and the profiler is not initialised without graphics.
+        if (ProfileWorld::isNoGraphics())
+            profiler.init();
+        UserConfigParams::m_profiler_enabled = true;
+    }   // --profile-ticks
+
+    if(CommandLine::has("--profile-output", &s))
+        ProfileWorld::setOutputFile(s);
+
+    if(CommandLine::has("--physics-threads", &n))
+    {
+        if (n < 0)
+        {
+            Log::error("main", "Invalid number of physics threads: %i.", n);
+            return 0;
+        }
+        UserConfigParams::m_physics_threads = n;
+    }   // --physics-threads
+
     if(CommandLine::has("--history"))
     {
         history->setReplayHistory(true);
@@ -2070,6 +2144,21 @@ int main(int argc, char *argv[] )
             runUnitTests();
             exit(0);
         }
+        if (UserConfigParams::m_micro_benchmarks)
+        {
+            runMicroBenchmarks();
+            exit(0);
+        }
+        if (UserConfigParams::m_generate_arena_paths)
+        {
+            ArenaGraph::generatePathsFiles();
+            exit(0);
+        }
+        if (UserConfigParams::m_generate_drive_paths)
+        {
+            DriveGraph::generatePathsFiles();
+            exit(0);
+        }
 
 #ifndef SERVER_ONLY
         if (!ProfileWorld::isNoGraphics())
@@ -2491,7 +2580,53 @@ void runUnitTests()
     Log::info("UnitTest", "RewindQueue");
     RewindQueue::unitTesting();
 
+    Log::info("UnitTest", "StateDelta");
+    StateDelta::unitTesting();
+
+    Log::info("UnitTest", "TriangleMesh");
+    TriangleMesh::unitTesting();
+
+    Log::info("UnitTest", "STKDynamicsWorld");
+    STKDynamicsWorld::unitTesting();
+
+    Log::info("UnitTest", "RayPacket");
+    RayPacket::unitTesting();
+
+    Log::info("UnitTest", "ItemGrid");
+    ItemGrid::unitTesting();
+
+    Log::info("UnitTest", "SPCulling");
+    SP::SPCulling::unitTesting();
+
+    Log::info("UnitTest", "SPPoseCache");
+    SP::SPPoseCache::unitTesting();
+
     Log::info("UnitTest", "=====================");
     Log::info("UnitTest", "Testing successful   ");
     Log::info("UnitTest", "=====================");
 }   // runUnitTests
+
+//=============================================================================
+/** Runs micro benchmarks of performance critical code, the results are
+ *  printed to the log.
+ */
+void runMicroBenchmarks()
+{
+    Log::info("Benchmark", "Starting micro benchmarks");
+    Log::info("Benchmark", "=====================");
+    Log::info("Benchmark", "RewindQueue");
+    RewindQueue::benchmark();
+    Log::info("Benchmark", "=====================");
+    Log::info("Benchmark", "Graph");
+    Graph::benchmark();
+    Log::info("Benchmark", "=====================");
+    Log::info("Benchmark", "ItemGrid");
+    ItemGrid::benchmark();
+    Log::info("Benchmark", "=====================");
+    Log::info("Benchmark", "SPCulling");
+    SP::SPCulling::benchmark();
+    Log::info("Benchmark", "=====================");
+    Log::info("Benchmark", "SPPoseCache");
+    SP::SPPoseCache::benchmark();
+    Log::info("Benchmark", "=====================");
+}   // runMicroBenchmarks
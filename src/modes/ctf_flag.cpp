@@ -30,10 +30,8 @@
 // Position offset to attach in kart model
 const Vec3 g_kart_flag_offset(0.0, 0.2f, -0.5f);
 // ============================================================================
-BareNetworkString* CTFFlag::saveState(std::vector<std::string>* ru)
+bool CTFFlag::saveState(BareNetworkString* buffer)
 {
-    ru->push_back(getUniqueIdentity());
-    BareNetworkString* buffer = new BareNetworkString();
     int flag_status_unsigned = m_flag_status + 2;
     flag_status_unsigned &= 31;
     // Max 2047 for m_deactivated_ticks set by resetToBase
@@ -47,7 +45,7 @@ BareNetworkString* CTFFlag::saveState(std::vector<std::string>* ru)
             .addUInt32(m_off_base_compressed[3]);
         buffer->addUInt16(m_ticks_since_off_base);
     }
-    return buffer;
+    return true;
 }   // saveState
 
 // ----------------------------------------------------------------------------
@@ -89,7 +89,7 @@ public:
     // ------------------------------------------------------------------------
     virtual void computeError() {}
     // ------------------------------------------------------------------------
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru);
+    virtual bool saveState(BareNetworkString* buffer);
     // ------------------------------------------------------------------------
     virtual void undoEvent(BareNetworkString* buffer) {}
     // ------------------------------------------------------------------------
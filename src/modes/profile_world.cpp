@@ -24,17 +24,54 @@
 #include "karts/kart_with_stats.hpp"
 #include "karts/controller/controller.hpp"
 #include "tracks/track.hpp"
+#include "utils/profiler.hpp"
 
 #include <ISceneManager.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 ProfileWorld::ProfileType ProfileWorld::m_profile_mode=PROFILE_NONE;
 int   ProfileWorld::m_num_laps    = 0;
 float ProfileWorld::m_time        = 0.0f;
+int   ProfileWorld::m_num_ticks   = 0;
+std::string ProfileWorld::m_output_file;
 bool  ProfileWorld::m_no_graphics = false;
 
+namespace
+{
+    /** Returns a string which can be written as a JSON string, with quotes,
+     *  backslashes and control characters escaped. */
+    std::string escapeJSON(const std::string &s)
+    {
+        std::string result;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result += '\\';
+                result += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char hex[7];
+                snprintf(hex, sizeof(hex), "\\u%04x", (unsigned char)c);
+                result += hex;
+            }
+            else
+                result += c;
+        }
+        return result;
+    }   // escapeJSON
+}   // namespace
+
 //-----------------------------------------------------------------------------
 /** The constructor sets the number of (local) players to 0, since only AI
  *  karts are used.
@@ -92,6 +129,20 @@ void ProfileWorld::setProfileModeLaps(int laps)
     m_num_laps     = laps;
 }   // setProfileModeLaps
 
+//-----------------------------------------------------------------------------
+/** Enables profiling for a certain number of physics ticks. The time each
+ *  tick takes is measured, and at the end the tick rate, percentiles of the
+ *  tick time and the time spent in each profiler event are reported. Like
+ *  time based profiling the number of laps is set to a high number.
+ *  \param ticks The number of ticks to simulate.
+ */
+void ProfileWorld::setProfileModeTicks(int ticks)
+{
+    m_profile_mode = PROFILE_TICKS;
+    m_num_laps     = 99999;
+    m_num_ticks    = ticks;
+}   // setProfileModeTicks
+
 //-----------------------------------------------------------------------------
 /** Creates a kart, having a certain position, starting location, and local
  *  and global player id (if applicable).
@@ -136,6 +187,9 @@ bool ProfileWorld::isRaceOver()
     if(m_profile_mode==PROFILE_TIME)
         return getTime()>m_time;
 
+    if(m_profile_mode==PROFILE_TICKS)
+        return (int)m_tick_times.size() >= m_num_ticks;
+
     if(m_profile_mode == PROFILE_LAPS )
     {
         // Now it must be laps based profiling:
@@ -152,7 +206,19 @@ bool ProfileWorld::isRaceOver()
  */
 void ProfileWorld::update(int ticks)
 {
-    StandardRace::update(ticks);
+    if (m_profile_mode == PROFILE_TICKS)
+    {
+        // Only count the time of the ticks that are actually measured
+        if (m_tick_times.empty())
+            profiler.resetTotals();
+        auto start = std::chrono::steady_clock::now();
+        StandardRace::update(ticks);
+        std::chrono::duration<double, std::milli> duration =
+            std::chrono::steady_clock::now() - start;
+        m_tick_times.push_back(duration.count());
+    }
+    else
+        StandardRace::update(ticks);
 
     m_frame_count++;
     video::IVideoDriver *driver = irr_driver->getVideoDriver();
@@ -178,7 +244,7 @@ void ProfileWorld::enterRaceOverState()
     // aborting too early). So in this case determine the maximum number
     // of laps and set this +1 as the number of laps to get more meaningful
     // time estimations.
-    if(m_profile_mode==PROFILE_TIME)
+    if(m_profile_mode!=PROFILE_LAPS)
     {
         int max_laps = -2;
         for(unsigned int i=0; i<race_manager->getNumberOfKarts(); i++)
@@ -199,6 +265,9 @@ void ProfileWorld::enterRaceOverState()
         m_karts[i]->finishedRace(estimateFinishTimeForKart(m_karts[i].get()));
     }
 
+    if (m_profile_mode == PROFILE_TICKS)
+        writeBenchmarkResults();
+
     // Print framerate statistics
     float runtime = (irr_driver->getRealTime()-m_start_time)*0.001f;
     Log::verbose("profile", "Number of frames: %d time %f, Average FPS: %f",
@@ -348,3 +417,74 @@ void ProfileWorld::enterRaceOverState()
     delete this;
     main_loop->abort();
 }   // enterRaceOverState
+
+//-----------------------------------------------------------------------------
+/** Writes the results of tick based profiling as JSON: the number of ticks
+ *  simulated per second, mean, median, 99th percentile and maximum of the
+ *  time per tick (in ms), and the time spent in each profiler event.
+ */
+void ProfileWorld::writeBenchmarkResults()
+{
+    if (m_tick_times.empty())
+        return;
+
+    std::vector<double> sorted = m_tick_times;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double t : sorted)
+        total += t;
+    const size_t n = sorted.size();
+    // Nearest-rank percentile
+    auto percentile = [&sorted, n](double p)
+    {
+        size_t rank = (size_t)std::ceil(p * n);
+        return sorted[rank > 0 ? rank - 1 : 0];
+    };
+
+    std::map<std::string, double> events;
+    profiler.getTotals(&events);
+
+    std::ostringstream json;
+    json.setf(std::ios::fixed, std::ios::floatfield);
+    json.precision(4);
+    json << "{\n"
+         << "  \"track\": \"" << escapeJSON(race_manager->getTrackName())
+         << "\",\n"
+         << "  \"karts\": " << getNumKarts() << ",\n"
+         << "  \"ticks\": " << n << ",\n"
+         << "  \"total_time_ms\": " << total << ",\n"
+         << "  \"ticks_per_second\": " << (total > 0 ? n * 1000.0 / total : 0)
+         << ",\n"
+         << "  \"tick_time_ms\": {\n"
+         << "    \"mean\": " << total / n << ",\n"
+         << "    \"p50\": "  << percentile(0.5) << ",\n"
+         << "    \"p99\": "  << percentile(0.99) << ",\n"
+         << "    \"max\": "  << sorted.back() << "\n"
+         << "  },\n"
+         << "  \"subsystems\": {";
+    for (auto it = events.begin(); it != events.end(); it++)
+    {
+        json << (it == events.begin() ? "\n" : ",\n")
+             << "    \"" << escapeJSON(it->first) << "\": { \"total_ms\": "
+             << it->second << ", \"per_tick_ms\": " << it->second / n << " }";
+    }
+    json << "\n  }\n}\n";
+
+    if (m_output_file.empty())
+    {
+        Log::info("profile", "Benchmark results:\n%s", json.str().c_str());
+        return;
+    }
+    std::ofstream f(m_output_file.c_str());
+    f << json.str();
+    if (!f.good())
+    {
+        Log::error("profile", "Can't write benchmark results to '%s'.",
+                   m_output_file.c_str());
+    }
+    else
+    {
+        Log::info("profile", "Benchmark results written to '%s'.",
+                  m_output_file.c_str());
+    }
+}   // writeBenchmarkResults
@@ -21,6 +21,9 @@
 
 #include "modes/standard_race.hpp"
 
+#include <string>
+#include <vector>
+
 class Kart;
 
 /**
@@ -31,7 +34,8 @@ class ProfileWorld : public StandardRace
 {
 private:
     /** Profiling modes. */
-    enum        ProfileType {PROFILE_NONE, PROFILE_TIME, PROFILE_LAPS};
+    enum        ProfileType {PROFILE_NONE, PROFILE_TIME, PROFILE_LAPS,
+                             PROFILE_TICKS};
 
     /** If profiling is done, and if so, which mode. */
     static ProfileType m_profile_mode;
@@ -43,6 +47,16 @@ private:
     /** In time based profiling only: time to run. */
     static float m_time;
 
+    /** In tick based profiling only: number of ticks to simulate. */
+    static int   m_num_ticks;
+
+    /** In tick based profiling only: name of the file to which the results
+     *  are written as JSON. If empty, the results are printed. */
+    static std::string m_output_file;
+
+    /** In tick based profiling only: real time (in ms) each tick took. */
+    std::vector<double> m_tick_times;
+
     /** Return value of real time at start of race. */
     unsigned int m_start_time;
 
@@ -76,6 +90,7 @@ protected:
         (const std::string &kart_ident, int index, int local_player_id,
         int global_player_id, RaceManager::KartType type,
         PerPlayerDifficulty difficulty);
+    void writeBenchmarkResults();
 
 public:
                           ProfileWorld();
@@ -88,6 +103,11 @@ public:
 
     static   void setProfileModeTime(float time);
     static   void setProfileModeLaps(int laps);
+    static   void setProfileModeTicks(int ticks);
+    // ------------------------------------------------------------------------
+    /** Sets the file to which the results of tick based profiling are
+     *  written. */
+    static   void setOutputFile(const std::string &f) { m_output_file = f; }
     // ------------------------------------------------------------------------
     /** Returns true if profile mode was selected. */
     static   bool isProfileMode() {return m_profile_mode!=PROFILE_NONE; }
@@ -765,7 +765,9 @@ void World::resetAllKarts()
     m_schedule_unpause = false;
 
     //Project karts onto track from above. This will lower each kart so
-    //that at least one of its wheel will be on the surface of the track
+    //that at least one of its wheel will be on the surface of the track.
+    //The rays of all karts are cast as one batch.
+    std::vector<AbstractKart*> karts;
     for ( KartList::iterator i=m_karts.begin(); i!=m_karts.end(); i++)
     {
         if ((*i)->isGhostKart()) continue;
@@ -773,19 +775,23 @@ void World::resetAllKarts()
         //start projection from top of kart
         Vec3 up_offset = (*i)->getNormal() * (0.5f * ((*i)->getKartHeight()));
         (*i)->setXYZ(xyz+up_offset);
+        karts.push_back(i->get());
+    }
 
-        bool kart_over_ground = Track::getCurrentTrack()->findGround(i->get());
-
-        if (!kart_over_ground)
+    std::vector<bool> over_ground =
+        Track::getCurrentTrack()->findGround(karts);
+    for (unsigned int i = 0; i < karts.size(); i++)
+    {
+        if (!over_ground[i])
         {
             Log::error("World",
                        "No valid starting position for kart %d on track %s.",
-                       (int)(i - m_karts.begin()),
+                       (int)karts[i]->getWorldKartId(),
                        Track::getCurrentTrack()->getIdent().c_str());
             if (UserConfigParams::m_artist_debug_mode)
             {
                 Log::warn("World", "Activating fly mode.");
-                (*i)->flyUp();
+                karts[i]->flyUp();
                 continue;
             }
             else
@@ -25,9 +25,13 @@
 #include "LinearMath/btMotionState.h"
 #include "btBulletDynamicsCommon.h"
 
+#include <algorithm>
+
 namespace CompressNetworkBody
 {
     using namespace MiniGLM;
+    /** Number of bytes written by compress(). */
+    const int COMPRESSED_SIZE = 3 * 4 + 4 + 6 * 2;
     // ------------------------------------------------------------------------
     /** Set body and motion state of bullet object with compressed values. */
     inline void setCompressedValues(float x, float y, float z,
@@ -101,6 +105,44 @@ namespace CompressNetworkBody
         setCompressedValues(x, y, z, compressed_q, lvx, lvy, lvz, avx, avy,
             avz, body, ms);
     }   // decompress
+    // ------------------------------------------------------------------------
+    /** Reads a compressed body from two buffers, and tests if they differ
+     *  by at most max_error in position, rotation and velocities. Used by a
+     *  client to compare its predicted state with the state from the server.
+     *  \param a, b The buffers with the compressed bodies.
+     *  \param max_error Maximum difference in m, radians and m/s.
+     */
+    inline bool isMatching(const BareNetworkString* a,
+                           const BareNetworkString* b, float max_error)
+    {
+        btVector3 xyz_a, xyz_b;
+        for (unsigned j = 0; j < 3; j++)
+        {
+            xyz_a[j] = a->getFloat();
+            xyz_b[j] = b->getFloat();
+        }
+        uint32_t q_a = a->getUInt32();
+        uint32_t q_b = b->getUInt32();
+        bool is_matching = (xyz_a - xyz_b).length() <= max_error;
+        if (q_a != q_b)
+        {
+            float d = fabsf(decompressbtQuaternion(q_a)
+                .dot(decompressbtQuaternion(q_b)));
+            is_matching &= 2.0f * acosf(std::min(d, 1.0f)) <= max_error;
+        }
+        // Linear and angular velocity
+        for (unsigned i = 0; i < 2; i++)
+        {
+            btVector3 v_a, v_b;
+            for (unsigned j = 0; j < 3; j++)
+            {
+                v_a[j] = toFloat32(a->getUInt16());
+                v_b[j] = toFloat32(b->getUInt16());
+            }
+            is_matching &= (v_a - v_b).length() <= max_error;
+        }
+        return is_matching;
+    }   // isMatching
 };
 
 #endif // HEADER_COMPRESS_NETWORK_BODY_HPP
@@ -60,6 +60,7 @@ NetworkConfig::NetworkConfig()
     m_joined_server_version = 0;
     m_network_ai_tester = false;
     m_state_frequency = 10;
+    m_min_state_frequency = 10;
 }   // NetworkConfig
 
 // ----------------------------------------------------------------------------
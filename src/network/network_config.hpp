@@ -94,6 +94,9 @@ private:
     /** Set by client or server which is required to be the same. */
     int m_state_frequency;
 
+    /** Minimum number of states per second the server sends to a client. */
+    int m_min_state_frequency;
+
     /** List of server capabilities set when joining it, to determine features
      *  available in same version. */
     std::set<std::string> m_server_capabilities;
@@ -235,6 +238,10 @@ public:
     // ------------------------------------------------------------------------
     int getStateFrequency() const                 { return m_state_frequency; }
     // ------------------------------------------------------------------------
+    void setMinStateFrequency(int f)         { m_min_state_frequency = f; }
+    // ------------------------------------------------------------------------
+    int getMinStateFrequency() const          { return m_min_state_frequency; }
+    // ------------------------------------------------------------------------
     bool roundValuesNow() const;
     // ------------------------------------------------------------------------
     void setServerCapabilities(std::set<std::string>& caps)
@@ -16,12 +16,15 @@
 //  along with this program; if not, write to the Free Software
 //  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
+#include "io/file_manager.hpp"
 #include "network/network_config.hpp"
 #include "network/network_player_profile.hpp"
 #include "network/server_config.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
 #include "network/protocols/server_lobby.hpp"
+#include "utils/profiler.hpp"
+#include "utils/string_utils.hpp"
 #include "utils/time.hpp"
 #include "utils/vs.hpp"
 #include "main_loop.hpp"
@@ -43,6 +46,11 @@ void showHelp()
     std::cout << "listpeers, List all peers with host ID and IP." << std::endl;
     std::cout << "listban, List IP ban list of server." << std::endl;
     std::cout << "speedstats, Show upload and download speed." << std::endl;
+    std::cout << "tracestart #, Record the last # (default 100000) profiler "
+        "events of all threads." << std::endl;
+    std::cout << "tracestop, Stop recording profiler events." << std::endl;
+    std::cout << "tracedump, Write the recorded profiler events as Chrome "
+        "trace." << std::endl;
 }   // showHelp
 
 // ----------------------------------------------------------------------------
@@ -122,6 +130,26 @@ void mainLoop(STKHost* host)
                 "   Download speed (KBps): " <<
                 (float)host->getDownloadSpeed() / 1024.0f  << std::endl;
         }
+        else if (str == "tracestart")
+        {
+            profiler.startTraceCapture(number > 0 ? number : 100000);
+            std::cout << "Recording profiler events." << std::endl;
+        }
+        else if (str == "tracestop")
+        {
+            profiler.stopTraceCapture();
+            std::cout << "Stopped recording profiler events." << std::endl;
+        }
+        else if (str == "tracedump")
+        {
+            std::string file = file_manager->getUserConfigFile("trace-" +
+                StringUtils::toString(StkTime::getTimeSinceEpoch()) +
+                ".json");
+            if (profiler.writeTrace(file))
+                std::cout << "Trace written to " << file << std::endl;
+            else
+                std::cout << "Can't write trace to " << file << std::endl;
+        }
         else
         {
             std::cout << "Unknown command: " << str << std::endl;
@@ -21,6 +21,7 @@
 #include "items/network_item_manager.hpp"
 #include "karts/abstract_kart.hpp"
 #include "karts/controller/player_controller.hpp"
+#include "modes/linear_world.hpp"
 #include "modes/world.hpp"
 #include "network/event.hpp"
 #include "network/network_config.hpp"
@@ -30,12 +31,19 @@
 #include "network/protocol_manager.hpp"
 #include "network/rewind_info.hpp"
 #include "network/rewind_manager.hpp"
+#include "network/rewinder.hpp"
+#include "network/server_config.hpp"
+#include "network/state_delta.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
+#include "tracks/arena_graph.hpp"
+#include "tracks/track.hpp"
 #include "utils/log.hpp"
 #include "utils/time.hpp"
 #include "main_loop.hpp"
 
+#include <cstring>
+
 // ============================================================================
 std::weak_ptr<GameProtocol> GameProtocol::m_game_protocol;
 // ============================================================================
@@ -57,13 +65,28 @@ GameProtocol::GameProtocol()
             : Protocol( PROTOCOL_CONTROLLER_EVENTS)
 {
     m_data_to_send = getNetworkString();
-
+    m_current_state = NULL;
+    m_next_state_history = 0;
+    m_num_delta_states = 0;
+    m_num_states_sent = 0;
+    m_next_state_interval_update = 0;
+    m_full_state_bytes = 0;
+    m_sent_state_bytes = 0;
 }   // GameProtocol
 
 //-----------------------------------------------------------------------------
 GameProtocol::~GameProtocol()
 {
     delete m_data_to_send;
+    for (DeltaState& ds : m_delta_states)
+        delete ds.m_message;
+    if (m_full_state_bytes > 0)
+    {
+        Log::info("GameProtocol", "State bytes sent: %lu (%lu with full "
+            "states only, %.1f%%).", (unsigned long)m_sent_state_bytes,
+            (unsigned long)m_full_state_bytes,
+            100.0 * (double)m_sent_state_bytes / (double)m_full_state_bytes);
+    }
 }   // ~GameProtocol
 
 //-----------------------------------------------------------------------------
@@ -126,7 +149,10 @@ bool GameProtocol::notifyEventAsynchronous(Event* event)
     {
     case GP_CONTROLLER_ACTION: handleControllerAction(event); break;
     case GP_STATE:             handleState(event);            break;
+    case GP_STATE_DELTA:       handleDeltaState(event);       break;
     case GP_ITEM_CONFIRMATION: handleItemEventConfirmation(event); break;
+    case GP_STATE_CONFIRMATION: handleStateConfirmation(event); break;
+    case GP_REWINDER_NAMES:    handleRewinderNames(event);    break;
     case GP_ADJUST_TIME:
     case GP_ITEM_UPDATE:
         break;
@@ -274,6 +300,76 @@ void GameProtocol::handleItemEventConfirmation(Event *event)
         ticks);
 }   // handleItemEventConfirmation
 
+// ----------------------------------------------------------------------------
+/** Sends a confirmation to the server that the state at 'ticks' has been
+ *  received, so the server can use it as baseline for delta states.
+ *  \param ticks Time of the state received.
+ */
+void GameProtocol::sendStateConfirmation(int ticks)
+{
+    assert(NetworkConfig::get()->isClient());
+    NetworkString *ns = getNetworkString(5);
+    ns->addUInt8(GP_STATE_CONFIRMATION).addUInt32(ticks);
+    // Unreliable, a later confirmation will replace a lost one
+    sendToServer(ns, /*reliable*/false);
+    delete ns;
+}   // sendStateConfirmation
+
+// ----------------------------------------------------------------------------
+/** Handles a state confirmation from a client, the latest confirmed state
+ *  is used as baseline for delta states sent to this client.
+ *  \param event The data from the client.
+ */
+void GameProtocol::handleStateConfirmation(Event *event)
+{
+    assert(NetworkConfig::get()->isServer());
+    int ticks = event->data().getTime();
+    std::lock_guard<std::mutex> lock(m_state_confirmation_mutex);
+    auto it = m_last_confirmed_state_ticks.find(event->getPeerSP());
+    if (it == m_last_confirmed_state_ticks.end())
+        m_last_confirmed_state_ticks[event->getPeerSP()] = ticks;
+    else if (ticks > it->second)
+        it->second = ticks;
+}   // handleStateConfirmation
+
+// ----------------------------------------------------------------------------
+/** Returns the state snapshot at the given time, or NULL if it is not
+ *  available (anymore).
+ */
+const GameProtocol::StateSnapshot* GameProtocol::getStateSnapshot(int ticks)
+                                                                       const
+{
+    if (ticks < 0)
+        return NULL;
+    for (unsigned i = 0; i < MAX_STATE_HISTORY; i++)
+    {
+        if (m_state_history[i].m_ticks == ticks)
+            return &m_state_history[i];
+    }
+    return NULL;
+}   // getStateSnapshot
+
+// ----------------------------------------------------------------------------
+/** Returns the oldest state snapshot cleared for a new state, reusing its
+ *  memory.
+ *  \param ticks Time of the new state.
+ *  \param keep A snapshot which must not be overwritten (the baseline used
+ *         while decoding the new state).
+ */
+GameProtocol::StateSnapshot* GameProtocol::getNewStateSnapshot(int ticks,
+                                                    const StateSnapshot* keep)
+{
+    StateSnapshot* snapshot = &m_state_history[m_next_state_history];
+    m_next_state_history = (m_next_state_history + 1) % MAX_STATE_HISTORY;
+    if (snapshot == keep)
+    {
+        snapshot = &m_state_history[m_next_state_history];
+        m_next_state_history = (m_next_state_history + 1) % MAX_STATE_HISTORY;
+    }
+    snapshot->clear(ticks);
+    return snapshot;
+}   // getNewStateSnapshot
+
 // ----------------------------------------------------------------------------
 /** Called by the server before assembling a new message containing the full
  *  state of the race to be sent to a client.
@@ -281,21 +377,50 @@ void GameProtocol::handleItemEventConfirmation(Event *event)
 void GameProtocol::startNewState()
 {
     assert(NetworkConfig::get()->isServer());
+    m_current_state =
+        getNewStateSnapshot(World::getWorld()->getTicksSinceStart());
     m_data_to_send->clear();
-    m_data_to_send->addUInt8(GP_STATE)
-        .addUInt32(World::getWorld()->getTicksSinceStart());
+    m_data_to_send->addUInt8(GP_STATE).addUInt32(m_current_state->m_ticks);
 }   // startNewState
 
 // ----------------------------------------------------------------------------
-/** Called by a server to add data to the current state. The data in buffer
- *  is copied, so the data can be freed after this call/.
- *  \param buffer Adds the data in the buffer to the current state.
+/** Called by a server to add the state of a rewinder to the current state.
+ *  The rewinder writes its state directly into the message to be sent, the
+ *  size in front of it is filled in afterwards.
+ *  \param rewinder The rewinder to save the state of.
+ *  \return The size of the state, or -1 if the rewinder did not save a
+ *          state.
  */
-void GameProtocol::addState(BareNetworkString *buffer)
+int GameProtocol::addState(Rewinder *rewinder)
 {
     assert(NetworkConfig::get()->isServer());
-    m_data_to_send->addUInt16(buffer->size());
-    (*m_data_to_send) += *buffer;
+    std::vector<uint8_t>& buffer = m_data_to_send->getBuffer();
+    const size_t size_pos = buffer.size();
+    m_data_to_send->addUInt16(0);
+    if (!rewinder->saveState(m_data_to_send))
+    {
+        buffer.resize(size_pos);
+        return -1;
+    }
+    const size_t size = buffer.size() - size_pos - 2;
+    buffer[size_pos] = (uint8_t)((size >> 8) & 0xff);
+    buffer[size_pos + 1] = (uint8_t)(size & 0xff);
+
+    // Keep the state for the id based state, and as possible baseline for
+    // delta states
+    StateSnapshot* snapshot = m_current_state;
+    snapshot->m_rewinder_ids.push_back(rewinder->getRewinderId());
+    snapshot->m_data.insert(snapshot->m_data.end(),
+        buffer.begin() + size_pos + 2, buffer.end());
+    snapshot->m_offsets.push_back((unsigned)snapshot->m_data.size());
+    // Flyables and flags are short-lived or rarely sent, only encode karts,
+    // items and physical objects against the baseline
+    const char type = rewinder->getUniqueIdentity()[0];
+    snapshot->m_use_baseline.push_back(type == RN_KART ||
+        type == RN_ITEM_MANAGER || type == RN_PHYSICAL_OBJ);
+    snapshot->m_world_kart_ids.push_back(type == RN_KART ?
+        (uint8_t)rewinder->getUniqueIdentity()[1] : -1);
+    return (int)size;
 }   // addState
 
 // ----------------------------------------------------------------------------
@@ -306,30 +431,366 @@ void GameProtocol::addState(BareNetworkString *buffer)
 void GameProtocol::finalizeState(std::vector<std::string>& cur_rewinder)
 {
     assert(NetworkConfig::get()->isServer());
+    assert(cur_rewinder.size() == m_current_state->m_rewinder_ids.size());
     auto& buffer = m_data_to_send->getBuffer();
-    auto pos = buffer.begin() + 1/*protocol type*/ + 1 /*gp event type*/+
+    const unsigned pos = 1/*protocol type*/ + 1 /*gp event type*/+
         4/*time*/;
 
     m_data_to_send->reset();
-    std::vector<uint8_t> names;
-    names.push_back((uint8_t)cur_rewinder.size());
-    for (std::string& name : cur_rewinder)
+    unsigned names_size = 1;
+    for (const std::string& name : cur_rewinder)
+        names_size += 1 + (unsigned)name.size();
+    buffer.insert(buffer.begin() + pos, names_size, 0);
+    uint8_t* names = buffer.data() + pos;
+    *names++ = (uint8_t)cur_rewinder.size();
+    for (const std::string& name : cur_rewinder)
     {
-        names.push_back((uint8_t)name.size());
-        std::vector<uint8_t> rewinder(name.begin(), name.end());
-        names.insert(names.end(), rewinder.begin(), rewinder.end());
+        *names++ = (uint8_t)name.size();
+        memcpy(names, name.data(), name.size());
+        names += name.size();
     }
-    buffer.insert(pos, names.begin(), names.end());
+    m_current_state->buildIndex();
 }   // finalizeState
 
+// ----------------------------------------------------------------------------
+/** Returns a state message for the current state which uses rewinder ids,
+ *  in which the states of karts, items and physical objects (e.g. the
+ *  soccer ball) are encoded as difference to the state sent at
+ *  baseline_ticks. Peers with the same baseline and the same rewinders not
+ *  sent share the same message, and the messages are reused for the next
+ *  state.
+ *  \param baseline_ticks Time of the baseline state, or -1 if the peer has
+ *         not confirmed any state yet (then all rewinder states are sent
+ *         in full).
+ *  \param not_sent Rewinder ids whose state is not sent to the peer.
+ *  \param baseline_not_sent Rewinder ids whose state was not sent to the
+ *         peer in the baseline state.
+ */
+NetworkString* GameProtocol::getDeltaState(int baseline_ticks,
+                                 const std::vector<uint16_t>& not_sent,
+                                 const std::vector<uint16_t>& baseline_not_sent)
+{
+    for (unsigned i = 0; i < m_num_delta_states; i++)
+    {
+        const DeltaState& ds = m_delta_states[i];
+        if (ds.m_baseline_ticks == baseline_ticks &&
+            ds.m_not_sent == not_sent &&
+            ds.m_baseline_not_sent == baseline_not_sent)
+            return ds.m_message;
+    }
+    if (m_num_delta_states == m_delta_states.size())
+    {
+        m_delta_states.push_back(DeltaState());
+        m_delta_states.back().m_message =
+            getNetworkString(m_data_to_send->size());
+    }
+    DeltaState& ds = m_delta_states[m_num_delta_states++];
+    ds.m_baseline_ticks = baseline_ticks;
+    ds.m_not_sent = not_sent;
+    ds.m_baseline_not_sent = baseline_not_sent;
+    NetworkString* ns = ds.m_message;
+    ns->clear();
+
+    const StateSnapshot* current = m_current_state;
+    const StateSnapshot* baseline = getStateSnapshot(baseline_ticks);
+    if (baseline && baseline_ticks >= current->m_ticks)
+        baseline = NULL;
+
+    ns->addUInt8(GP_STATE_DELTA).addUInt32(current->m_ticks);
+    if (baseline)
+        ns->addUInt8(1).addUInt32(baseline_ticks);
+    else
+        ns->addUInt8(0);
+
+    ns->addUInt8((uint8_t)current->m_rewinder_ids.size());
+    for (uint16_t id : current->m_rewinder_ids)
+    {
+        if (std::find(not_sent.begin(), not_sent.end(), id) != not_sent.end())
+            id |= REWINDER_ID_NOT_SENT;
+        ns->addUInt16(id);
+    }
+
+    for (unsigned i = 0; i < current->m_rewinder_ids.size(); i++)
+    {
+        const uint16_t id = current->m_rewinder_ids[i];
+        if (std::find(not_sent.begin(), not_sent.end(), id) != not_sent.end())
+            continue;
+        const uint8_t* state = NULL;
+        const int size = current->getStateAt(i, &state);
+        const uint8_t* baseline_state = NULL;
+        int baseline_size = -1;
+        if (baseline && current->m_use_baseline[i] &&
+            std::find(baseline_not_sent.begin(), baseline_not_sent.end(),
+            id) == baseline_not_sent.end())
+        {
+            baseline_size = baseline->getState(id, &baseline_state);
+        }
+        StateDelta::encode(baseline_state, baseline_size, state,
+            (unsigned)size, ns);
+    }
+    return ns;
+}   // getDeltaState
+
+// ----------------------------------------------------------------------------
+/** Returns the distance between two karts along the drive graph (in linear
+ *  races) or the arena graph (in battle and soccer), or the straight
+ *  distance if the track has no graph.
+ */
+float GameProtocol::getKartDistance(const AbstractKart* a,
+                                    const AbstractKart* b) const
+{
+    World* world = World::getWorld();
+    LinearWorld* lw = dynamic_cast<LinearWorld*>(world);
+    if (lw)
+    {
+        float distance = fabsf(
+            lw->getDistanceDownTrackForKart(a->getWorldKartId(), false) -
+            lw->getDistanceDownTrackForKart(b->getWorldKartId(), false));
+        const float length = Track::getCurrentTrack()->getTrackLength();
+        return std::min(distance, length - distance);
+    }
+    WorldWithRank* wwr = dynamic_cast<WorldWithRank*>(world);
+    ArenaGraph* ag = ArenaGraph::get();
+    if (wwr && ag)
+    {
+        return ag->getDistance(wwr->getSectorForKart(a),
+            wwr->getSectorForKart(b));
+    }
+    return (a->getXYZ() - b->getXYZ()).length();
+}   // getKartDistance
+
+// ----------------------------------------------------------------------------
+/** Determines the karts whose state is not sent to a peer in the current
+ *  state, because they are further away than state-interest-distance from
+ *  all karts of this peer. Those karts are only sent in every n-th state
+ *  (state-interest-rate), while all other rewinders (including the soccer
+ *  ball, flags and items) are always sent. Spectators receive all states.
+ *  \param peer The peer the state is sent to.
+ *  \param peer_state_count Number of states sent to this peer.
+ *  \param not_sent On return the rewinder ids not sent.
+ */
+void GameProtocol::getNotSentRewinders(STKPeer* peer,
+                                       unsigned peer_state_count,
+                                       std::vector<uint16_t>* not_sent)
+{
+    not_sent->clear();
+    const float max_distance = ServerConfig::m_state_interest_distance;
+    const std::set<unsigned>& kart_ids = peer->getAvailableKartIDs();
+    if (max_distance <= 0.0f || kart_ids.empty())
+        return;
+
+    World* world = World::getWorld();
+    const unsigned rate =
+        (unsigned)std::max((int)ServerConfig::m_state_interest_rate, 1);
+    const StateSnapshot* current = m_current_state;
+    for (unsigned i = 0; i < current->m_rewinder_ids.size(); i++)
+    {
+        const int kart_id = current->m_world_kart_ids[i];
+        const uint16_t id = current->m_rewinder_ids[i];
+        // Spread the far karts sent over the states
+        if (kart_id < 0 || kart_ids.find(kart_id) != kart_ids.end() ||
+            (peer_state_count + id) % rate == 0)
+            continue;
+        const AbstractKart* kart = world->getKart(kart_id);
+        bool is_near = false;
+        for (unsigned own_id : kart_ids)
+        {
+            if (own_id < world->getNumKarts() &&
+                getKartDistance(world->getKart(own_id), kart) <= max_distance)
+            {
+                is_near = true;
+                break;
+            }
+        }
+        if (!is_near)
+            not_sent->push_back(id);
+    }
+}   // getNotSentRewinders
+
+// ----------------------------------------------------------------------------
+/** Adjusts once per second how often states are sent to each peer, between
+ *  state-frequency and min-state-frequency. The interval between states
+ *  sent to a peer is doubled if the upload speed of the server exceeds
+ *  state-upload-budget or if the peer has packet loss, increased if the
+ *  peer has a high ping, and decreased otherwise.
+ */
+void GameProtocol::updateStateIntervals()
+{
+    const uint64_t now = StkTime::getMonoTimeMs();
+    if (now < m_next_state_interval_update)
+        return;
+    m_next_state_interval_update = now + 1000;
+
+    const unsigned max_interval =
+        (unsigned)std::max(NetworkConfig::get()->getStateFrequency() /
+        std::max(NetworkConfig::get()->getMinStateFrequency(), 1), 1);
+    if (max_interval == 1)
+    {
+        m_state_intervals.clear();
+        return;
+    }
+
+    const unsigned budget = (unsigned)ServerConfig::m_state_upload_budget
+        * 1024;
+    const unsigned upload = STKHost::get()->getUploadSpeed();
+    const bool over_budget = budget > 0 && upload > budget;
+    const bool below_budget = budget == 0 || upload < budget / 10 * 8;
+    for (auto& peer : STKHost::get()->getPeers())
+    {
+        unsigned& interval = m_state_intervals[peer];
+        const unsigned old_interval = interval;
+        if (interval == 0)
+            interval = 1;
+        if (over_budget || peer->getPacketLoss() > 0.05f)
+            interval = std::min(interval * 2, max_interval);
+        else if (peer->getAveragePing() > 200)
+            interval = std::min(interval + 1, max_interval);
+        else if (below_budget && interval > 1)
+            interval--;
+        if (interval != old_interval && old_interval != 0)
+        {
+            Log::debug("GameProtocol", "State frequency of %s is now %d.",
+                peer->getAddress().toString().c_str(),
+                NetworkConfig::get()->getStateFrequency() / interval);
+        }
+    }
+
+    for (auto it = m_state_intervals.begin(); it != m_state_intervals.end();)
+    {
+        if (it->first.expired())
+            it = m_state_intervals.erase(it);
+        else
+            it++;
+    }
+}   // updateStateIntervals
+
+// ----------------------------------------------------------------------------
+/** Creates a message with the rewinder ids and unique identities of the
+ *  given rewinders.
+ *  \return The message, which must be freed by the caller.
+ */
+NetworkString* GameProtocol::encodeRewinderNames(
+                  const std::vector<std::pair<uint16_t, std::string> >& names)
+{
+    NetworkString* ns = getNetworkString(3 + (int)names.size() * 10);
+    ns->addUInt8(GP_REWINDER_NAMES).addUInt16((uint16_t)names.size());
+    for (auto& p : names)
+        ns->addUInt16(p.first).encodeString(p.second);
+    return ns;
+}   // encodeRewinderNames
+
 // ----------------------------------------------------------------------------
 /** Called when the last state information has been added and the message
- *  can be sent to the clients.
+ *  can be sent to the clients. Clients which support it will receive a
+ *  state using rewinder ids, which is a delta state against the last state
+ *  they confirmed. The names of the rewinder ids are sent reliably, all of
+ *  them the first time a client gets a state (at the start of the game or
+ *  after live join), later only the ones of new rewinders.
  */
 void GameProtocol::sendState()
 {
     assert(NetworkConfig::get()->isServer());
-    sendMessageToPeers(m_data_to_send, /*reliable*/false);
+    RewindManager* rm = RewindManager::get();
+    std::vector<std::pair<uint16_t, std::string> > new_names =
+        rm->getNewRewinderNames();
+    NetworkString* new_names_message = NULL;
+    NetworkString* all_names_message = NULL;
+
+    m_num_delta_states = 0;
+    updateStateIntervals();
+    for (auto& peer : STKHost::get()->getPeers())
+    {
+        if (!peer->isValidated() || peer->isWaitingForGame())
+            continue;
+
+        const bool use_delta_state =
+            peer->getClientCapabilities().find("state_delta") !=
+            peer->getClientCapabilities().end();
+
+        // The names are sent to all peers, also if they don't receive this
+        // state, since the new names are only available once
+        if (use_delta_state && m_peers_with_rewinder_names.find(peer) ==
+            m_peers_with_rewinder_names.end())
+        {
+            if (!all_names_message)
+            {
+                all_names_message =
+                    encodeRewinderNames(rm->getAllRewinderNames());
+            }
+            peer->sendPacket(all_names_message, /*reliable*/true);
+            m_peers_with_rewinder_names.insert(peer);
+        }
+        else if (use_delta_state && !new_names.empty())
+        {
+            if (!new_names_message)
+                new_names_message = encodeRewinderNames(new_names);
+            peer->sendPacket(new_names_message, /*reliable*/true);
+        }
+
+        // Spread the peers which don't receive every state over the states
+        unsigned interval = 1;
+        auto interval_it = m_state_intervals.find(peer);
+        if (interval_it != m_state_intervals.end() && interval_it->second > 1)
+            interval = interval_it->second;
+        const unsigned peer_state_count =
+            m_num_states_sent + peer->getHostId();
+        if (peer_state_count % interval != 0)
+            continue;
+        m_full_state_bytes += m_data_to_send->getTotalSize();
+        if (!use_delta_state)
+        {
+            peer->sendPacket(m_data_to_send, /*reliable*/false);
+            m_sent_state_bytes += m_data_to_send->getTotalSize();
+            continue;
+        }
+
+        int baseline_ticks = -1;
+        if (ServerConfig::m_state_delta_compression)
+        {
+            std::lock_guard<std::mutex> lock(m_state_confirmation_mutex);
+            auto it = m_last_confirmed_state_ticks.find(peer);
+            if (it != m_last_confirmed_state_ticks.end())
+                baseline_ticks = it->second;
+        }
+
+        // Remember the rewinders not sent, a peer can't use them in its
+        // baseline state
+        static const std::vector<uint16_t> all_sent;
+        const std::vector<uint16_t>* baseline_not_sent = &all_sent;
+        getNotSentRewinders(peer.get(), peer_state_count / interval,
+            &m_not_sent);
+        if (ServerConfig::m_state_interest_distance > 0.0f)
+        {
+            NotSentRewinders& nsr = m_not_sent_rewinders[peer];
+            if (baseline_ticks != -1)
+            {
+                baseline_not_sent = nsr.get(baseline_ticks);
+                if (!baseline_not_sent)
+                {
+                    baseline_ticks = -1;
+                    baseline_not_sent = &all_sent;
+                }
+            }
+            nsr.add(m_current_state->m_ticks, m_not_sent);
+        }
+
+        NetworkString* ns = getDeltaState(baseline_ticks, m_not_sent,
+            *baseline_not_sent);
+        peer->sendPacket(ns, /*reliable*/false);
+        m_sent_state_bytes += ns->getTotalSize();
+    }
+    delete new_names_message;
+    delete all_names_message;
+    m_num_states_sent++;
+
+    for (auto it = m_not_sent_rewinders.begin();
+         it != m_not_sent_rewinders.end();)
+    {
+        if (it->first.expired())
+            it = m_not_sent_rewinders.erase(it);
+        else
+            it++;
+    }
 }   // sendState
 
 // ----------------------------------------------------------------------------
@@ -358,6 +819,104 @@ void GameProtocol::handleState(Event *event)
     RewindManager::get()->addNetworkRewindInfo(ris);
 }   // handleState
 
+// ----------------------------------------------------------------------------
+/** Called when a delta state is received form the server. It reconstructs
+ *  the full state using the baseline state, and confirms the state to the
+ *  server so that it can be used as baseline for later states. The state
+ *  is reconstructed into a reused snapshot and state buffer, so usually no
+ *  memory needs to be allocated for it.
+ */
+void GameProtocol::handleDeltaState(Event *event)
+{
+    if (!NetworkConfig::get()->isClient())
+        return;
+    NetworkString &data = event->data();
+    int ticks = data.getUInt32();
+    if (getStateSnapshot(ticks))
+        return;
+
+    const StateSnapshot* baseline = NULL;
+    if (data.getUInt8() == 1)
+    {
+        int baseline_ticks = data.getUInt32();
+        baseline = getStateSnapshot(baseline_ticks);
+        if (!baseline)
+        {
+            // Wait for a later state, the server will use an older
+            // confirmed baseline or a full state then
+            Log::warn("GameProtocol", "Missing baseline state %d for "
+                "state %d.", baseline_ticks, ticks);
+            return;
+        }
+    }
+
+    StateSnapshot* snapshot = getNewStateSnapshot(ticks, baseline);
+    // The memory for state will be handled in the RewindInfoState object
+    BareNetworkString* state = RewindInfoState::getFreeBuffer();
+    try
+    {
+        unsigned rewinder_size = data.getUInt8();
+        for (unsigned i = 0; i < rewinder_size; i++)
+            snapshot->m_rewinder_ids.push_back(data.getUInt16());
+
+        for (unsigned i = 0; i < rewinder_size; i++)
+        {
+            const uint16_t id = snapshot->m_rewinder_ids[i];
+            if ((id & REWINDER_ID_NOT_SENT) != 0)
+            {
+                // Keep the id in the state, so the client knows that the
+                // rewinder still exists
+                snapshot->m_offsets.push_back(
+                    (unsigned)snapshot->m_data.size());
+                state->addUInt16(id).addUInt16(0);
+                continue;
+            }
+            const uint8_t* baseline_state = NULL;
+            const int baseline_size = baseline ?
+                baseline->getState(id, &baseline_state) : -1;
+            StateDelta::decode(&data, baseline_state, baseline_size,
+                &snapshot->m_data);
+            snapshot->m_offsets.push_back((unsigned)snapshot->m_data.size());
+            const uint8_t* s = NULL;
+            const int size = snapshot->getStateAt(i, &s);
+            state->addUInt16(id).addUInt16((uint16_t)size);
+            state->getBuffer().insert(state->getBuffer().end(), s, s + size);
+        }
+    }
+    catch (std::exception& e)
+    {
+        Log::error("GameProtocol", "Delta state %d error: %s", ticks,
+            e.what());
+        snapshot->clear(-1);
+        RewindInfoState::freeBuffer(state);
+        return;
+    }
+    snapshot->buildIndex();
+    sendStateConfirmation(ticks);
+
+    RewindInfoState* ris = new RewindInfoState(ticks, state);
+    RewindManager::get()->addNetworkRewindInfo(ris);
+}   // handleDeltaState
+
+// ----------------------------------------------------------------------------
+/** Called when the server sends the unique identities of rewinder ids used
+ *  in states.
+ */
+void GameProtocol::handleRewinderNames(Event *event)
+{
+    if (!NetworkConfig::get()->isClient())
+        return;
+    NetworkString &data = event->data();
+    unsigned count = data.getUInt16();
+    for (unsigned i = 0; i < count; i++)
+    {
+        uint16_t id = data.getUInt16();
+        std::string name;
+        data.decodeString(&name);
+        RewindManager::get()->addNetworkRewinderName(id, name);
+    }
+}   // handleRewinderNames
+
 // ----------------------------------------------------------------------------
 /** Called from the RewindManager when rolling back.
  *  \param buffer Pointer to the saved state information.
@@ -21,16 +21,23 @@
 
 #include "network/event_rewinder.hpp"
 #include "network/protocol.hpp"
+#include "network/rewinder.hpp"
 
 #include "input/input.hpp"                // for PlayerAction
 #include "utils/cpp2011.hpp"
 #include "utils/singleton.hpp"
 
+#include <algorithm>
 #include <cstdlib>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string>
 #include <vector>
 #include <tuple>
 
+class AbstractKart;
 class BareNetworkString;
 class NetworkString;
 class STKPeer;
@@ -48,9 +55,92 @@ private:
            GP_STATE,
            GP_ITEM_UPDATE,
            GP_ITEM_CONFIRMATION,
-           GP_ADJUST_TIME
+           GP_ADJUST_TIME,
+           GP_STATE_DELTA,
+           GP_STATE_CONFIRMATION,
+           GP_REWINDER_NAMES
     };
 
+    /** Number of states kept as possible baseline for delta states, on the
+     *  server the last states sent, on the client the last states received.
+     */
+    static const unsigned MAX_STATE_HISTORY = 32;
+
+    /** The state of each rewinder at a given time, used as baseline for
+     *  delta states. The snapshots are kept in a ring buffer and reused, so
+     *  no memory needs to be allocated once all of them were used. */
+    struct StateSnapshot
+    {
+        /** Time of this state, -1 if not used. */
+        int m_ticks;
+
+        /** Server rewinder ids in the order of the states. */
+        std::vector<uint16_t> m_rewinder_ids;
+
+        /** The states of all rewinders one after another. */
+        std::vector<uint8_t> m_data;
+
+        /** Start of each state in m_data, with an additional entry for the
+         *  end of the last state. */
+        std::vector<unsigned> m_offsets;
+
+        /** On the server true for each rewinder which can be encoded
+         *  against a baseline. */
+        std::vector<bool> m_use_baseline;
+
+        /** On the server the world kart id of each rewinder which is a
+         *  kart, -1 otherwise. */
+        std::vector<int> m_world_kart_ids;
+
+        /** Index in m_rewinder_ids for each rewinder id, -1 if not used. */
+        std::vector<int> m_state_index;
+        // --------------------------------------------------------------------
+        StateSnapshot()                                         { clear(-1); }
+        // --------------------------------------------------------------------
+        /** Removes all states, but keeps the allocated memory. */
+        void clear(int ticks)
+        {
+            m_ticks = ticks;
+            m_rewinder_ids.clear();
+            m_data.clear();
+            m_offsets.clear();
+            m_offsets.push_back(0);
+            m_use_baseline.clear();
+            m_world_kart_ids.clear();
+            std::fill(m_state_index.begin(), m_state_index.end(), -1);
+        }   // clear
+        // --------------------------------------------------------------------
+        void buildIndex()
+        {
+            for (unsigned i = 0; i < m_rewinder_ids.size(); i++)
+            {
+                // Rewinders not sent have no state
+                if ((m_rewinder_ids[i] & REWINDER_ID_NOT_SENT) != 0)
+                    continue;
+                if (m_rewinder_ids[i] >= m_state_index.size())
+                    m_state_index.resize(m_rewinder_ids[i] + 1, -1);
+                m_state_index[m_rewinder_ids[i]] = i;
+            }
+        }   // buildIndex
+        // --------------------------------------------------------------------
+        /** Returns the state of a rewinder id.
+         *  \param[out] data Set to the start of the state.
+         *  \return The size of the state, -1 if not included. */
+        int getState(uint16_t id, const uint8_t** data) const
+        {
+            if (id >= m_state_index.size() || m_state_index[id] == -1)
+                return -1;
+            return getStateAt(m_state_index[id], data);
+        }   // getState
+        // --------------------------------------------------------------------
+        /** Returns the i-th state in this snapshot. */
+        int getStateAt(unsigned i, const uint8_t** data) const
+        {
+            *data = m_data.data() + m_offsets[i];
+            return (int)(m_offsets[i + 1] - m_offsets[i]);
+        }   // getStateAt
+    };   // struct StateSnapshot
+
     /** A network string that collects all information from the server to be sent
      *  next. */
     NetworkString *m_data_to_send;
@@ -59,6 +149,108 @@ private:
      *  to reduce number of rollbacks. */
     std::vector<int8_t> m_adjust_time;
 
+    /** The snapshot of the state currently being assembled on the server. */
+    StateSnapshot* m_current_state;
+
+    /** On the server the last states sent, on the client the last states
+     *  received, used as baseline for delta states. */
+    StateSnapshot m_state_history[MAX_STATE_HISTORY];
+
+    /** Index of the oldest entry in m_state_history, which is used next. */
+    unsigned m_next_state_history;
+
+    /** A delta state created for the current state on the server. */
+    struct DeltaState
+    {
+        /** Time of the baseline used. */
+        int m_baseline_ticks;
+
+        /** Rewinder ids not sent in this state. */
+        std::vector<uint16_t> m_not_sent;
+
+        /** Rewinder ids not sent in the baseline state, which are not
+         *  encoded against the baseline. */
+        std::vector<uint16_t> m_baseline_not_sent;
+
+        NetworkString* m_message;
+    };
+
+    /** The delta states created for the current state on the server. Peers
+     *  with the same baseline and the same rewinders not sent share a
+     *  message. The messages are reused for later states,
+     *  m_num_delta_states of them are used. */
+    std::vector<DeltaState> m_delta_states;
+
+    /** Number of entries of m_delta_states used for the current state. */
+    unsigned m_num_delta_states;
+
+    /** Protects m_last_confirmed_state_ticks, which is written by the
+     *  network thread. */
+    std::mutex m_state_confirmation_mutex;
+
+    /** Stores on the server the latest state received by each client. */
+    std::map<std::weak_ptr<STKPeer>, int,
+        std::owner_less<std::weak_ptr<STKPeer> > >
+        m_last_confirmed_state_ticks;
+
+    /** On the server the rewinders not sent to a peer in each of the last
+     *  states (because they were far away from all karts of the peer). */
+    struct NotSentRewinders
+    {
+        int m_ticks[MAX_STATE_HISTORY];
+        std::vector<uint16_t> m_ids[MAX_STATE_HISTORY];
+        unsigned m_next;
+        // --------------------------------------------------------------------
+        NotSentRewinders() : m_next(0)
+        {
+            std::fill(m_ticks, m_ticks + MAX_STATE_HISTORY, -1);
+        }
+        // --------------------------------------------------------------------
+        /** Returns the rewinder ids not sent in the state at the given time,
+         *  or NULL if that state is not known. */
+        const std::vector<uint16_t>* get(int ticks) const
+        {
+            for (unsigned i = 0; i < MAX_STATE_HISTORY; i++)
+            {
+                if (m_ticks[i] == ticks)
+                    return &m_ids[i];
+            }
+            return NULL;
+        }   // get
+        // --------------------------------------------------------------------
+        void add(int ticks, const std::vector<uint16_t>& ids)
+        {
+            m_ticks[m_next] = ticks;
+            m_ids[m_next] = ids;
+            m_next = (m_next + 1) % MAX_STATE_HISTORY;
+        }   // add
+    };   // struct NotSentRewinders
+
+    std::map<std::weak_ptr<STKPeer>, NotSentRewinders,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_not_sent_rewinders;
+
+    /** Rewinder ids not sent to the current peer, reused for each peer. */
+    std::vector<uint16_t> m_not_sent;
+
+    /** Number of states created by the server. */
+    unsigned m_num_states_sent;
+
+    /** On the server the number of states between two states sent to each
+     *  peer, 1 if every state is sent. */
+    std::map<std::weak_ptr<STKPeer>, unsigned,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_state_intervals;
+
+    /** Time when m_state_intervals is adjusted next. */
+    uint64_t m_next_state_interval_update;
+
+    /** Peers which have received the names of all rewinder ids. */
+    std::set<std::weak_ptr<STKPeer>,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_peers_with_rewinder_names;
+
+    /** Number of bytes the server would have sent with full states only,
+     *  and the number of bytes actually sent. */
+    uint64_t m_full_state_bytes, m_sent_state_bytes;
+
     // Dummy data structure to save all kart actions.
     struct Action
     {
@@ -75,6 +267,22 @@ private:
 
     void handleControllerAction(Event *event);
     void handleState(Event *event);
+    void handleDeltaState(Event *event);
+    void handleStateConfirmation(Event *event);
+    void handleRewinderNames(Event *event);
+    const StateSnapshot* getStateSnapshot(int ticks) const;
+    StateSnapshot* getNewStateSnapshot(int ticks,
+                                       const StateSnapshot* keep = NULL);
+    NetworkString* getDeltaState(int baseline_ticks,
+                                 const std::vector<uint16_t>& not_sent,
+                                 const std::vector<uint16_t>& baseline_not_sent);
+    void getNotSentRewinders(STKPeer* peer, unsigned peer_state_count,
+                             std::vector<uint16_t>* not_sent);
+    void updateStateIntervals();
+    float getKartDistance(const AbstractKart* a,
+                          const AbstractKart* b) const;
+    NetworkString* encodeRewinderNames(
+                  const std::vector<std::pair<uint16_t, std::string> >& names);
     void handleAdjustTime(Event *event);
     void handleItemEventConfirmation(Event *event);
     static std::weak_ptr<GameProtocol> m_game_protocol;
@@ -110,10 +318,11 @@ public:
     void controllerAction(int kart_id, PlayerAction action,
                           int value, int val_l, int val_r);
     void startNewState();
-    void addState(BareNetworkString *buffer);
+    int  addState(Rewinder *rewinder);
     void sendState();
     void finalizeState(std::vector<std::string>& cur_rewinder);
     void sendItemEventConfirmation(int ticks);
+    void sendStateConfirmation(int ticks);
 
     virtual void undo(BareNetworkString *buffer) OVERRIDE;
     virtual void rewind(BareNetworkString *buffer) OVERRIDE;
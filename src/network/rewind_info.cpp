@@ -24,6 +24,8 @@
 #include "items/projectile_manager.hpp"
 #include "utils/log.hpp"
 
+#include <stdexcept>
+
 /** Constructor for a state: it only takes the size, and allocates a buffer
  *  for all state info.
  *  \param size Necessary buffer size for a state.
@@ -47,12 +49,16 @@ void RewindInfo::setTicks(int ticks)
 }   // setTicks
 
 // ============================================================================
+Synchronised<std::vector<BareNetworkString*> >
+    RewindInfoState::m_free_buffers;
+// ----------------------------------------------------------------------------
 RewindInfoState::RewindInfoState(int ticks, int start_offset,
                                  std::vector<std::string>& rewinder_using,
                                  std::vector<uint8_t>& buffer)
                : RewindInfo(ticks, true/*is_confirmed*/)
 {
     std::swap(m_rewinder_using, rewinder_using);
+    m_has_rewinder_ids = false;
     m_start_offset = start_offset;
     m_buffer = new BareNetworkString();
     std::swap(m_buffer->getBuffer(), buffer);
@@ -65,61 +71,329 @@ RewindInfoState::RewindInfoState(int ticks, BareNetworkString* buffer,
                                  bool is_confirmed)
                : RewindInfo(ticks, is_confirmed)
 {
+    m_has_rewinder_ids = false;
     m_start_offset = 0;
     m_buffer = buffer;
 }   // RewindInfoState
 
+// ------------------------------------------------------------------------
+/** Constructor for a state received from a server which uses rewinder ids.
+ *  \param buffer The buffer with the rewinder id, size and state of each
+ *         rewinder. It should be allocated with getFreeBuffer(), and is
+ *         given back to the free buffers when this state is deleted.
+ */
+RewindInfoState::RewindInfoState(int ticks, BareNetworkString *buffer)
+               : RewindInfo(ticks, true/*is_confirmed*/)
+{
+    m_has_rewinder_ids = true;
+    m_start_offset = 0;
+    m_buffer = buffer;
+}   // RewindInfoState
+
+// ------------------------------------------------------------------------
+RewindInfoState::~RewindInfoState()
+{
+    if (m_has_rewinder_ids)
+        freeBuffer(m_buffer);
+    else
+        delete m_buffer;
+}   // ~RewindInfoState
+
+// ------------------------------------------------------------------------
+/** Returns an empty buffer for a state with rewinder ids, which reuses the
+ *  memory of a deleted state if possible. This is called from the network
+ *  thread for each state received.
+ */
+BareNetworkString* RewindInfoState::getFreeBuffer()
+{
+    BareNetworkString* buffer = NULL;
+    m_free_buffers.lock();
+    if (!m_free_buffers.getData().empty())
+    {
+        buffer = m_free_buffers.getData().back();
+        m_free_buffers.getData().pop_back();
+    }
+    m_free_buffers.unlock();
+    if (!buffer)
+        return new BareNetworkString(1024);
+    buffer->getBuffer().clear();
+    buffer->reset();
+    return buffer;
+}   // getFreeBuffer
+
+// ------------------------------------------------------------------------
+/** Gives a buffer from getFreeBuffer() back to the free buffers, or deletes
+ *  it if enough buffers are kept already. This is used for states which are
+ *  deleted, and for buffers not used for a state (e.g. after an error).
+ *  \param buffer The buffer, can be NULL.
+ */
+void RewindInfoState::freeBuffer(BareNetworkString* buffer)
+{
+    if (!buffer)
+        return;
+    m_free_buffers.lock();
+    if (m_free_buffers.getData().size() < MAX_FREE_BUFFERS)
+    {
+        m_free_buffers.getData().push_back(buffer);
+        buffer = NULL;
+    }
+    m_free_buffers.unlock();
+    delete buffer;
+}   // freeBuffer
+
+// ------------------------------------------------------------------------
+/** Frees all buffers kept for later states, called when the race ends. */
+void RewindInfoState::clearFreeBuffers()
+{
+    m_free_buffers.lock();
+    for (BareNetworkString* buffer : m_free_buffers.getData())
+        delete buffer;
+    m_free_buffers.getData().clear();
+    m_free_buffers.unlock();
+}   // clearFreeBuffers
+
 // ------------------------------------------------------------------------
 /** Rewinds to this state. This is called while going forwards in time
  *  again to reach current time. It will call rewindToState().
  *  if the state is a confirmed state.
+ *  \param prediction The state saved by the client at the time of this
+ *         state, or NULL. Rewinders not sent by the server are restored to
+ *         it, since they are simulated again from this time.
+ *  \param match_prediction If true, rewinders whose state matches the
+ *         prediction are restored to the predicted state, which avoids
+ *         small corrections.
+ *  \return Number of rewinders restored to the predicted state.
  */
-void RewindInfoState::restore()
+unsigned RewindInfoState::restore(PredictedState* prediction,
+                                  bool match_prediction)
 {
     m_buffer->reset();
     m_buffer->skip(m_start_offset);
-    for (const std::string& name : m_rewinder_using)
+    RewindManager* rm = RewindManager::get();
+    unsigned num_predicted = 0;
+    while (m_has_rewinder_ids && m_buffer->size() > 0)
     {
-        const uint16_t data_size = m_buffer->getUInt16();
-        const unsigned current_offset_now = m_buffer->getCurrentOffset();
-        std::shared_ptr<Rewinder> r =
-            RewindManager::get()->getRewinder(name);
-
+        const uint16_t id = m_buffer->getUInt16();
+        if ((id & REWINDER_ID_NOT_SENT) != 0)
+        {
+            m_buffer->skip(m_buffer->getUInt16());
+            std::shared_ptr<Rewinder> r =
+                rm->getNetworkRewinder(id & ~REWINDER_ID_NOT_SENT);
+            if (r)
+                restoreSavedState(r, prediction);
+            continue;
+        }
+        std::shared_ptr<Rewinder> r = rm->getNetworkRewinder(id);
         if (!r)
         {
             // For now we only need to get missing rewinder from
             // projectile_manager
-            r = projectile_manager->addRewinderFromNetworkState(name);
+            const std::string& name = rm->getNetworkRewinderName(id);
+            if (!name.empty())
+            {
+                r = projectile_manager->addRewinderFromNetworkState(name);
+                rm->setNetworkRewinder(id, r);
+            }
         }
+        if (restoreRewinder(r, rm->getNetworkRewinderName(id),
+                            match_prediction ? prediction : NULL))
+            num_predicted++;
+    }   // for all rewinder ids
+
+    for (const std::string& name : m_rewinder_using)
+    {
+        std::shared_ptr<Rewinder> r = rm->getRewinder(name);
         if (!r)
         {
-            Log::error("RewindInfoState", "Missing rewinder %s",
-                name.c_str());
-            m_buffer->skip(data_size);
-            continue;
+            // For now we only need to get missing rewinder from
+            // projectile_manager
+            r = projectile_manager->addRewinderFromNetworkState(name);
         }
+        if (restoreRewinder(r, name, match_prediction ? prediction : NULL))
+            num_predicted++;
+    }   // for all rewinder
+    return num_predicted;
+}   // restore
+
+// ------------------------------------------------------------------------
+/** Restores a rewinder which the server did not send in this state to the
+ *  state the client saved at the same time. Otherwise it would keep its
+ *  current state and be simulated again from this time, moving it ahead
+ *  on every rewind.
+ *  \param r The rewinder.
+ *  \param saved The state saved by the client at this time, or NULL.
+ */
+void RewindInfoState::restoreSavedState(std::shared_ptr<Rewinder> r,
+                                        PredictedState* saved)
+{
+    const PredictedState::PredictedRewinder* pr =
+        saved ? saved->find(r) : NULL;
+    if (pr)
+    {
+        BareNetworkString* buffer = &saved->m_buffer;
+        buffer->reset();
+        buffer->skip(pr->m_offset);
         try
         {
-            r->restoreState(m_buffer, data_size);
+            r->restoreState(buffer, pr->m_size);
         }
         catch (std::exception& e)
         {
-            Log::error("RewindInfoState", "Restore state error: %s",
+            Log::error("RewindInfoState", "Restore saved state error: %s",
                 e.what());
-            m_buffer->reset();
-            m_buffer->skip(current_offset_now + data_size);
-            continue;
         }
+    }
+    else
+    {
+        Log::warn("RewindInfoState", "Missing saved state at ticks %d",
+            getTicks());
+    }
+    r->keepLocalState();
+}   // restoreSavedState
 
-        if (m_buffer->getCurrentOffset() - current_offset_now != data_size)
+// ------------------------------------------------------------------------
+/** Compares this state with the state predicted by the client at the same
+ *  time. If all rewinders match, the client does not need to rewind.
+ *  \param prediction The state predicted by the client.
+ *  \return The number of rewinders in this state (which all match the
+ *          prediction), or -1 if any rewinder does not match.
+ */
+int RewindInfoState::comparePrediction(PredictedState* prediction)
+{
+    m_buffer->reset();
+    m_buffer->skip(m_start_offset);
+    RewindManager* rm = RewindManager::get();
+    int num_matching = 0;
+    try
+    {
+        for (unsigned i = 0; m_buffer->size() > 0; i++)
         {
-            Log::error("RewindInfoState", "Wrong size read when restore "
-                "state, incompatible binary?");
-            m_buffer->reset();
-            m_buffer->skip(current_offset_now + data_size);
+            std::shared_ptr<Rewinder> r;
+            if (m_has_rewinder_ids)
+            {
+                const uint16_t id = m_buffer->getUInt16();
+                if ((id & REWINDER_ID_NOT_SENT) != 0)
+                {
+                    // Nothing to compare, the prediction is kept
+                    m_buffer->skip(m_buffer->getUInt16());
+                    if (rm->getNetworkRewinder(id & ~REWINDER_ID_NOT_SENT))
+                        num_matching++;
+                    continue;
+                }
+                r = rm->getNetworkRewinder(id);
+            }
+            else if (i < m_rewinder_using.size())
+                r = rm->getRewinder(m_rewinder_using[i]);
+            else
+                break;
+            const uint16_t data_size = m_buffer->getUInt16();
+            if (!isMatching(r, prediction, data_size))
+                return -1;
+            num_matching++;
         }
-    }   // for all rewinder
-}   // restore
+    }
+    catch (std::exception& e)
+    {
+        return -1;
+    }
+    return num_matching;
+}   // comparePrediction
+
+// ------------------------------------------------------------------------
+/** Tests if the state of a rewinder at the current position of the buffer
+ *  matches its predicted state. Afterwards the buffer is at the start of
+ *  the next state.
+ *  \param r The rewinder, can be NULL.
+ *  \param prediction The state predicted by the client.
+ *  \param data_size Size of the state in the buffer.
+ */
+bool RewindInfoState::isMatching(std::shared_ptr<Rewinder> r,
+                                 PredictedState* prediction, int data_size)
+{
+    const int offset = m_buffer->getCurrentOffset();
+    if ((int)m_buffer->size() < data_size)
+        throw std::out_of_range("State out of range.");
+    const PredictedState::PredictedRewinder* pr =
+        r ? prediction->find(r) : NULL;
+    bool is_matching = false;
+    if (pr && (int)pr->m_size == data_size)
+    {
+        BareNetworkString* predicted = &prediction->m_buffer;
+        predicted->reset();
+        predicted->skip(pr->m_offset);
+        try
+        {
+            is_matching = r->isStateMatching(predicted, m_buffer, data_size);
+        }
+        catch (std::exception& e)
+        {
+            is_matching = false;
+        }
+    }
+    m_buffer->reset();
+    m_buffer->skip(offset + data_size);
+    return is_matching;
+}   // isMatching
+
+// ------------------------------------------------------------------------
+/** Restores the state of one rewinder from the current position of the
+ *  buffer, or skips it if the rewinder does not exist.
+ *  \param r The rewinder, can be NULL.
+ *  \param name Unique identity of the rewinder for error messages.
+ *  \param prediction The state predicted by the client, or NULL.
+ *  \return True if the rewinder was restored to its predicted state.
+ */
+bool RewindInfoState::restoreRewinder(std::shared_ptr<Rewinder> r,
+                                      const std::string& name,
+                                      PredictedState* prediction)
+{
+    const uint16_t data_size = m_buffer->getUInt16();
+    const unsigned current_offset_now = m_buffer->getCurrentOffset();
+    if (!r)
+    {
+        Log::error("RewindInfoState", "Missing rewinder %s",
+            name.c_str());
+        m_buffer->skip(data_size);
+        return false;
+    }
+
+    if (prediction && m_buffer->size() >= data_size &&
+        isMatching(r, prediction, data_size))
+    {
+        // Restore the predicted state instead, so that the client does
+        // not correct the small prediction error. isMatching has already
+        // moved m_buffer to the next state.
+        BareNetworkString* predicted = &prediction->m_buffer;
+        predicted->reset();
+        predicted->skip(prediction->find(r)->m_offset);
+        r->restoreState(predicted, data_size);
+        return true;
+    }
+    m_buffer->reset();
+    m_buffer->skip(current_offset_now);
+
+    try
+    {
+        r->restoreState(m_buffer, data_size);
+    }
+    catch (std::exception& e)
+    {
+        Log::error("RewindInfoState", "Restore state error: %s",
+            e.what());
+        m_buffer->reset();
+        m_buffer->skip(current_offset_now + data_size);
+        return false;
+    }
+
+    if (m_buffer->getCurrentOffset() - current_offset_now != data_size)
+    {
+        Log::error("RewindInfoState", "Wrong size read when restore "
+            "state, incompatible binary?");
+        m_buffer->reset();
+        m_buffer->skip(current_offset_now + data_size);
+    }
+    return false;
+}   // restoreRewinder
 
 // ============================================================================
 RewindInfoEvent::RewindInfoEvent(int ticks, EventRewinder *event_rewinder,
@@ -24,12 +24,17 @@
 #include "utils/cpp2011.hpp"
 #include "utils/leak_check.hpp"
 #include "utils/ptr_vector.hpp"
+#include "utils/synchronised.hpp"
+#include "utils/types.hpp"
 
 #include <assert.h>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+class Rewinder;
+
 /** Used to store rewind information for a given time for all rewind
  *  instances.
  *  Rewind information can either be a state (for example a kart would
@@ -86,30 +91,94 @@ public:
     // ------------------------------------------------------------------------
 };   // RewindInfo
 
+// ============================================================================
+/** The states of all rewinders saved by a client at a time for which a state
+ *  from the server will be received. It is compared with the server state
+ *  to avoid rewinds if the prediction of the client was correct.
+ */
+struct PredictedState
+{
+    struct PredictedRewinder
+    {
+        std::weak_ptr<Rewinder> m_rewinder;
+        unsigned m_offset;
+        unsigned m_size;
+    };
+
+    /** The states of all rewinders one after another. */
+    BareNetworkString m_buffer;
+
+    /** The rewinders which saved a state, and where it is in m_buffer. */
+    std::vector<PredictedRewinder> m_rewinders;
+    // ------------------------------------------------------------------------
+    const PredictedRewinder* find(const std::shared_ptr<Rewinder>& r) const
+    {
+        for (const PredictedRewinder& pr : m_rewinders)
+        {
+            if (pr.m_rewinder.lock() == r)
+                return &pr;
+        }
+        return NULL;
+    }   // find
+};   // struct PredictedState
+
 // ============================================================================
 /** A class that stores a game state and can rewind it.
  */
 class RewindInfoState: public RewindInfo
 {
 private:
+    /** Unique identity of the rewinders in this state (used by servers not
+     *  supporting rewinder ids). */
     std::vector<std::string> m_rewinder_using;
 
+    /** True if the buffer contains the server rewinder id before the state
+     *  of each rewinder. */
+    bool m_has_rewinder_ids;
+
     int m_start_offset;
 
     /** Pointer to the buffer which stores all states. */
     BareNetworkString *m_buffer;
 
+    /** Maximum number of buffers kept in m_free_buffers. */
+    static const unsigned MAX_FREE_BUFFERS = 16;
+
+    /** Buffers of deleted states with rewinder ids, reused for states
+     *  received later so that no memory needs to be allocated for them. */
+    static Synchronised<std::vector<BareNetworkString*> > m_free_buffers;
+
+    bool isMatching(std::shared_ptr<Rewinder> r, PredictedState* prediction,
+                    int data_size);
+    void restoreSavedState(std::shared_ptr<Rewinder> r,
+                           PredictedState* saved);
+
 public:
     // ------------------------------------------------------------------------
     RewindInfoState(int ticks, int start_offset,
                     std::vector<std::string>& rewinder_using,
                     std::vector<uint8_t>& buffer);
     // ------------------------------------------------------------------------
+    RewindInfoState(int ticks, BareNetworkString *buffer);
+    // ------------------------------------------------------------------------
     RewindInfoState(int ticks, BareNetworkString *buffer, bool is_confirmed);
     // ------------------------------------------------------------------------
-    virtual ~RewindInfoState()                             { delete m_buffer; }
+    virtual ~RewindInfoState();
+    // ------------------------------------------------------------------------
+    static BareNetworkString* getFreeBuffer();
+    // ------------------------------------------------------------------------
+    static void freeBuffer(BareNetworkString* buffer);
+    // ------------------------------------------------------------------------
+    static void clearFreeBuffers();
+    // ------------------------------------------------------------------------
+    virtual void restore()                            { restore(NULL, false); }
+    // ------------------------------------------------------------------------
+    unsigned restore(PredictedState* prediction, bool match_prediction);
+    // ------------------------------------------------------------------------
+    int  comparePrediction(PredictedState* prediction);
     // ------------------------------------------------------------------------
-    virtual void restore();
+    bool restoreRewinder(std::shared_ptr<Rewinder> r, const std::string& name,
+                         PredictedState* prediction);
     // ------------------------------------------------------------------------
     /** Returns a pointer to the state buffer. */
     BareNetworkString *getBuffer() const { return m_buffer; }
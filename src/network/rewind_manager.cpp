@@ -18,6 +18,7 @@
 
 #include "network/rewind_manager.hpp"
 
+#include "config/stk_config.hpp"
 #include "graphics/irr_driver.hpp"
 #include "modes/world.hpp"
 #include "network/network_config.hpp"
@@ -26,6 +27,7 @@
 #include "network/rewinder.hpp"
 #include "network/rewind_info.hpp"
 #include "network/smooth_network_body.hpp"
+#include "network/state_checksums.hpp"
 #include "physics/physics.hpp"
 #include "race/history.hpp"
 #include "tracks/check_manager.hpp"
@@ -73,6 +75,15 @@ RewindManager::~RewindManager()
     for (RewindInfoEventFunction* rief : m_pending_rief)
         delete rief;
     m_pending_rief.clear();
+    if (m_rewinds_avoided > 0 || m_resimulated_ticks > 0)
+    {
+        Log::info("RewindManager", "Rewinds avoided %u, rewinds with "
+            "predicted states %u, resimulated ticks %lu.", m_rewinds_avoided,
+            m_partial_restores, (unsigned long)m_resimulated_ticks);
+    }
+    // Free all states before the buffers kept for them
+    m_rewind_queue.reset();
+    RewindInfoState::clearFreeBuffers();
 }   // ~RewindManager
 
 // ----------------------------------------------------------------------------
@@ -83,6 +94,9 @@ void RewindManager::reset()
     m_is_rewinding = false;
     m_not_rewound_ticks.store(0);
     m_overall_state_size = 0;
+    m_rewinds_avoided = 0;
+    m_partial_restores = 0;
+    m_resimulated_ticks = 0;
     m_state_frequency = stk_config->getPhysicsFPS() /
         NetworkConfig::get()->getStateFrequency();
 
@@ -90,6 +104,15 @@ void RewindManager::reset()
 
     clearExpiredRewinder();
     m_rewind_queue.reset();
+    m_local_state.clear();
+    m_predicted_state.clear();
+    // Each race is written as a new race to the checksum file
+    m_state_checksums.reset();
+    if (StateChecksums::isEnabled() && NetworkConfig::get()->isNetworking())
+    {
+        m_state_checksums.reset(
+            new StateChecksums(Track::getCurrentTrack()->getIdent()));
+    }
 }   // reset
 
 // ----------------------------------------------------------------------------    
@@ -145,7 +168,8 @@ void RewindManager::addNetworkState(BareNetworkString *buffer, int ticks)
 
 // ----------------------------------------------------------------------------
 /** Saves a state using the GameProtocol function to combine several
- *  independent rewinders to write one state.
+ *  independent rewinders to write one state. Each rewinder writes its state
+ *  directly into the message sent to the clients.
  */
 void RewindManager::saveState()
 {
@@ -156,23 +180,37 @@ void RewindManager::saveState()
     gp->startNewState();
 
     m_overall_state_size = 0;
-    std::vector<std::string> rewinder_using;
+    // Reuse the memory of the last state
+    m_rewinder_using.clear();
 
     for (auto& p : m_all_rewinder)
     {
-        // TODO: check if it's worth passing in a sufficiently large buffer from
-        // GameProtocol - this would save the copy operation.
-        BareNetworkString* buffer = NULL;
-        if (auto r = p.second.lock())
-            buffer = r->saveState(&rewinder_using);
-        if (buffer != NULL)
+        auto r = p.second.lock();
+        if (!r)
+            continue;
+        const int size = gp->addState(r.get());
+        if (size >= 0)
         {
-            m_overall_state_size += buffer->size();
-            gp->addState(buffer);
+            m_rewinder_using.push_back(p.first);
+            m_overall_state_size += size;
+            if (m_state_checksums)
+            {
+                if (m_rewinder_using.size() == 1)
+                {
+                    m_state_checksums->startState(
+                        World::getWorld()->getTicksSinceStart());
+                }
+                const std::vector<uint8_t>& buffer =
+                    gp->getState()->getBuffer();
+                m_state_checksums->addRewinder(p.first,
+                    buffer.data() + buffer.size() - size, size);
+            }
         }
-        delete buffer;    // buffer can be freed
     }
-    gp->finalizeState(rewinder_using);
+    gp->finalizeState(m_rewinder_using);
+    // A server never simulates a time step again
+    if (m_state_checksums)
+        m_state_checksums->writeUntil(World::getWorld()->getTicksSinceStart());
     PROFILER_POP_CPU_MARKER();
 }   // saveState
 
@@ -185,10 +223,17 @@ void RewindManager::update(int ticks_not_used)
 {
     // FIXME: rename ticks_not_used
     if (!m_enable_rewind_manager ||
-        m_all_rewinder.size() == 0 ||
-        m_is_rewinding)  return;
+        m_all_rewinder.size() == 0) return;
 
     int ticks = World::getWorld()->getTicksSinceStart();
+    if (m_is_rewinding)
+    {
+        // The checksums of a time step simulated again replace the
+        // previous ones
+        if (m_state_checksums && shouldSaveState(ticks))
+            saveStateChecksums(ticks);
+        return;
+    }
 
     m_not_rewound_ticks.store(ticks, std::memory_order_relaxed);
 
@@ -199,12 +244,30 @@ void RewindManager::update(int ticks_not_used)
     clearExpiredRewinder();
     if (NetworkConfig::get()->isClient())
     {
-        auto& ret = m_local_state[ticks];
+        // Reuse the memory of a local state no longer needed
+        if (m_free_local_state.empty())
+            m_local_state.emplace_back();
+        else
+        {
+            m_local_state.push_back(std::move(m_free_local_state.back()));
+            m_free_local_state.pop_back();
+        }
+        LocalState& ls = m_local_state.back();
+        ls.m_ticks = ticks;
+        ls.m_restore_functions.clear();
         for (auto& p : m_all_rewinder)
         {
-            if (auto r = p.second.lock())
-                ret.push_back(r->getLocalStateRestoreFunction());
+            auto r = p.second.lock();
+            if (!r)
+                continue;
+            std::function<void()> f = r->getLocalStateRestoreFunction();
+            if (f)
+                ls.m_restore_functions.push_back(std::move(f));
         }
+        ls.m_karts.save();
+        // The full state is always saved, since rewinders which the server
+        // does not send in a state are restored to it on a rewind
+        savePredictedState(ticks);
     }
     else
     {
@@ -231,13 +294,27 @@ void RewindManager::playEventsTill(int world_ticks, bool fast_forward)
     bool needs_rewind;
     int rewind_ticks;
 
+    // Rewinder names must be known before states using them are merged
+    mergeNetworkRewinderNames();
+
     // Merge in all network events that have happened at the current
     // time step.
     // merge and that have happened before the current time (which will
     // be getTime()+dt - world time has not been updated yet).
     m_rewind_queue.mergeNetworkData(world_ticks, &needs_rewind, &rewind_ticks);
 
-    if (needs_rewind)
+    if (needs_rewind && isPredictionMatching(rewind_ticks))
+    {
+        // The local simulation is still correct, so only the states of
+        // the time steps already simulated need to be skipped
+        m_rewinds_avoided++;
+        m_rewind_queue.skipUntil(world_ticks);
+        if (m_state_checksums)
+            m_state_checksums->writeUntil(rewind_ticks - 1);
+        eraseLocalState(rewind_ticks - 1);
+        erasePredictedState(rewind_ticks - 1);
+    }
+    else if (needs_rewind)
     {
         Log::setPrefix("Rewind");
         PROFILER_PUSH_CPU_MARKER("Rewind", 128, 128, 128);
@@ -262,7 +339,136 @@ void RewindManager::playEventsTill(int world_ticks, bool fast_forward)
 }   // playEventsTill
 
 // ----------------------------------------------------------------------------
-/** Adds a Rewinder to the list of all rewinders.
+/** Saves the state of all rewinders on a client at a state time, which is
+ *  the state the server is expected to send for this time.
+ *  \param ticks Current world time.
+ */
+void RewindManager::savePredictedState(int ticks)
+{
+    PredictedState& ps = m_predicted_state[ticks];
+    ps.m_buffer.getBuffer().clear();
+    ps.m_rewinders.clear();
+    if (m_state_checksums)
+        m_state_checksums->startState(ticks);
+    for (auto& p : m_all_rewinder)
+    {
+        auto r = p.second.lock();
+        if (!r)
+            continue;
+        std::vector<uint8_t>& buffer = ps.m_buffer.getBuffer();
+        const unsigned offset = (unsigned)buffer.size();
+        if (r->saveState(&ps.m_buffer))
+        {
+            PredictedState::PredictedRewinder pr;
+            pr.m_rewinder = r;
+            pr.m_offset = offset;
+            pr.m_size = (unsigned)buffer.size() - offset;
+            ps.m_rewinders.push_back(pr);
+            if (m_state_checksums)
+            {
+                m_state_checksums->addRewinder(p.first,
+                    buffer.data() + offset, pr.m_size);
+            }
+        }
+        else
+            buffer.resize(offset);
+    }
+}   // savePredictedState
+
+// ----------------------------------------------------------------------------
+/** Saves the state of all rewinders on a client only to compute their
+ *  checksums, which is done if no predicted state is saved, and when a
+ *  state time is simulated again during a rewind.
+ *  \param ticks Current world time.
+ */
+void RewindManager::saveStateChecksums(int ticks)
+{
+    m_state_checksums->startState(ticks);
+    for (auto& p : m_all_rewinder)
+    {
+        auto r = p.second.lock();
+        if (!r)
+            continue;
+        m_checksum_buffer.getBuffer().clear();
+        if (r->saveState(&m_checksum_buffer))
+        {
+            const std::vector<uint8_t>& buffer =
+                m_checksum_buffer.getBuffer();
+            m_state_checksums->addRewinder(p.first, buffer.data(),
+                                           (unsigned)buffer.size());
+        }
+    }
+}   // saveStateChecksums
+
+// ----------------------------------------------------------------------------
+/** Tests if the confirmed states received for a time step that was already
+ *  simulated match the predicted state saved at that time, in which case
+ *  no rewind is necessary. This is only the case if the server state
+ *  contains all rewinders that the client predicted, and if no event was
+ *  received late (which would need to be replayed).
+ *  \param rewind_ticks Time of the latest state received.
+ */
+bool RewindManager::isPredictionMatching(int rewind_ticks)
+{
+    if (stk_config->m_network_max_prediction_error < 0.0f)
+        return false;
+
+    const int latest_past_event = m_rewind_queue.getLatestPastEvent();
+    if (latest_past_event >= rewind_ticks)
+        return false;
+
+    auto it = m_predicted_state.find(rewind_ticks);
+    if (it == m_predicted_state.end())
+        return false;
+
+    m_rewind_queue.getConfirmedStates(rewind_ticks, &m_rewind_states);
+    if (m_rewind_states.empty())
+        return false;
+
+    unsigned num_matching = 0;
+    for (RewindInfoState* ris : m_rewind_states)
+    {
+        const int count = ris->comparePrediction(&it->second);
+        if (count < 0)
+            return false;
+        num_matching += count;
+    }
+    return num_matching == it->second.m_rewinders.size();
+}   // isPredictionMatching
+
+// ----------------------------------------------------------------------------
+/** Removes all predicted states up to and including the given time.
+ *  \param ticks Time in ticks.
+ */
+void RewindManager::erasePredictedState(int ticks)
+{
+    for (auto it = m_predicted_state.begin(); it != m_predicted_state.end();)
+    {
+        if (it->first <= ticks)
+            it = m_predicted_state.erase(it);
+        else
+            break;
+    }
+}   // erasePredictedState
+
+// ----------------------------------------------------------------------------
+/** Removes all local states up to and including the given time. Their
+ *  memory is kept for later states.
+ *  \param ticks Time in ticks.
+ */
+void RewindManager::eraseLocalState(int ticks)
+{
+    auto it = m_local_state.begin();
+    while (it != m_local_state.end() && it->m_ticks <= ticks)
+    {
+        m_free_local_state.push_back(std::move(*it));
+        it++;
+    }
+    m_local_state.erase(m_local_state.begin(), it);
+}   // eraseLocalState
+
+// ----------------------------------------------------------------------------
+/** Adds a Rewinder to the list of all rewinders, and gives it a rewinder id.
  *  \return true If successfully added, false otherwise.
  */
 bool RewindManager::addRewinder(std::shared_ptr<Rewinder> rewinder)
@@ -271,10 +477,147 @@ bool RewindManager::addRewinder(std::shared_ptr<Rewinder> rewinder)
     // Maximum 1 bit to store no of rewinder used
     if (m_all_rewinder.size() == 255)
         return false;
+
+    // Reuse the oldest freed id if it has been freed long enough ago
+    int ticks = World::getWorld() ? World::getWorld()->getTicksSinceStart() : 0;
+    uint16_t id;
+    if (!m_free_rewinder_ids.empty() &&
+        ticks - m_free_rewinder_ids.front().second >
+        stk_config->time2Ticks(10.0f))
+    {
+        id = m_free_rewinder_ids.front().first;
+        m_free_rewinder_ids.pop_front();
+        m_rewinder_by_id[id] = rewinder;
+        m_rewinder_id_free[id] = false;
+    }
+    else
+    {
+        if (m_rewinder_by_id.size() == REWINDER_ID_NOT_SENT)
+        {
+            Log::error("RewindManager", "No rewinder id left for %s.",
+                rewinder->getUniqueIdentity().c_str());
+            return false;
+        }
+        id = (uint16_t)m_rewinder_by_id.size();
+        m_rewinder_by_id.push_back(rewinder);
+        m_rewinder_id_free.push_back(false);
+    }
+    rewinder->m_rewinder_id = id;
+    m_new_rewinder_ids.push_back(id);
     m_all_rewinder[rewinder->getUniqueIdentity()] = rewinder;
     return true;
 }   // addRewinder
 
+// ----------------------------------------------------------------------------
+/** Removes all expired rewinders, and marks their rewinder ids as free.
+ */
+void RewindManager::clearExpiredRewinder()
+{
+    for (auto it = m_all_rewinder.begin(); it != m_all_rewinder.end();)
+    {
+        if (it->second.expired())
+        {
+            it = m_all_rewinder.erase(it);
+            continue;
+        }
+        it++;
+    }
+
+    int ticks = World::getWorld() ? World::getWorld()->getTicksSinceStart() : 0;
+    for (unsigned i = 0; i < m_rewinder_by_id.size(); i++)
+    {
+        if (!m_rewinder_id_free[i] && m_rewinder_by_id[i].expired())
+        {
+            m_rewinder_id_free[i] = true;
+            m_free_rewinder_ids.emplace_back((uint16_t)i, ticks);
+        }
+    }
+}   // clearExpiredRewinder
+
+// ----------------------------------------------------------------------------
+/** Returns the rewinder ids and unique identities of all current rewinders,
+ *  which is sent by the server to clients starting or live joining a game.
+ */
+std::vector<std::pair<uint16_t, std::string> >
+    RewindManager::getAllRewinderNames()
+{
+    std::vector<std::pair<uint16_t, std::string> > names;
+    for (auto& p : m_all_rewinder)
+    {
+        if (auto r = p.second.lock())
+            names.emplace_back(r->getRewinderId(), p.first);
+    }
+    return names;
+}   // getAllRewinderNames
+
+// ----------------------------------------------------------------------------
+/** Returns the rewinder ids and unique identities of all rewinders added
+ *  since the last call of this function, which is sent by the server to all
+ *  clients which already know the previous rewinders.
+ */
+std::vector<std::pair<uint16_t, std::string> >
+    RewindManager::getNewRewinderNames()
+{
+    std::vector<std::pair<uint16_t, std::string> > names;
+    for (uint16_t id : m_new_rewinder_ids)
+    {
+        if (auto r = getRewinder(id))
+            names.emplace_back(id, r->getUniqueIdentity());
+    }
+    m_new_rewinder_ids.clear();
+    return names;
+}   // getNewRewinderNames
+
+// ----------------------------------------------------------------------------
+/** Called by the network thread on a client when the server sends the
+ *  unique identity of a rewinder id. It is used by the main thread after
+ *  mergeNetworkRewinderNames().
+ */
+void RewindManager::addNetworkRewinderName(uint16_t id,
+                                           const std::string& name)
+{
+    m_pending_network_rewinder.lock();
+    m_pending_network_rewinder.getData().emplace_back(id, name);
+    m_pending_network_rewinder.unlock();
+}   // addNetworkRewinderName
+
+// ----------------------------------------------------------------------------
+void RewindManager::mergeNetworkRewinderNames()
+{
+    m_pending_network_rewinder.lock();
+    for (auto& p : m_pending_network_rewinder.getData())
+    {
+        if (p.first >= m_network_rewinder.size())
+            m_network_rewinder.resize(p.first + 1);
+        NetworkRewinder& nr = m_network_rewinder[p.first];
+        if (nr.m_name != p.second)
+        {
+            nr.m_name = p.second;
+            nr.m_rewinder.reset();
+        }
+    }
+    m_pending_network_rewinder.getData().clear();
+    m_pending_network_rewinder.unlock();
+}   // mergeNetworkRewinderNames
+
+// ----------------------------------------------------------------------------
+/** Returns the local rewinder for a rewinder id used by the server. The
+ *  rewinder is looked up by its unique identity only the first time.
+ */
+std::shared_ptr<Rewinder> RewindManager::getNetworkRewinder(uint16_t id)
+{
+    if (id >= m_network_rewinder.size())
+        return nullptr;
+    NetworkRewinder& nr = m_network_rewinder[id];
+    if (auto r = nr.m_rewinder.lock())
+        return r;
+    if (nr.m_name.empty())
+        return nullptr;
+    std::shared_ptr<Rewinder> r = getRewinder(nr.m_name);
+    nr.m_rewinder = r;
+    return r;
+}   // getNetworkRewinder
+
 // ----------------------------------------------------------------------------
 /** Rewinds to the specified time, then goes forward till the current
  *  World::getTime() is reached again: it will replay everything before
@@ -310,6 +653,10 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks,
     // the specified rewind ticks.
     int exact_rewind_ticks = m_rewind_queue.undoUntil(rewind_ticks);
 
+    // Time steps before the confirmed state are never simulated again
+    if (m_state_checksums)
+        m_state_checksums->writeUntil(exact_rewind_ticks - 1);
+
     // Rewind the required state(s)
     // ----------------------------
     World* world = World::getWorld();
@@ -326,21 +673,15 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks,
 
     // Restore states from the exact rewind time
     // -----------------------------------------
-    auto it = m_local_state.find(exact_rewind_ticks);
+    auto it = std::find_if(m_local_state.begin(), m_local_state.end(),
+        [exact_rewind_ticks](const LocalState& ls)
+        { return ls.m_ticks == exact_rewind_ticks; });
     if (it != m_local_state.end())
     {
-        for (auto& restore_local_state : it->second)
-        {
-            if (restore_local_state)
-                restore_local_state();
-        }
-        for (auto it = m_local_state.begin(); it != m_local_state.end();)
-        {
-            if (it->first <= exact_rewind_ticks)
-                it = m_local_state.erase(it);
-            else
-                break;
-        }
+        for (auto& restore_local_state : it->m_restore_functions)
+            restore_local_state();
+        it->m_karts.restore();
+        eraseLocalState(exact_rewind_ticks);
     }
     else if (!fast_forward)
     {
@@ -348,14 +689,31 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks,
             exact_rewind_ticks);
     }
 
+    // Rewinders whose state matches the prediction are restored to the
+    // predicted state, rewinders not sent by the server to the saved one
+    PredictedState* prediction = NULL;
+    auto predicted = m_predicted_state.find(exact_rewind_ticks);
+    if (predicted != m_predicted_state.end())
+        prediction = &predicted->second;
+    const bool match_prediction =
+        stk_config->m_network_max_prediction_error >= 0.0f;
+
     // A loop in case that we should split states into several smaller ones:
+    unsigned num_predicted = 0;
     while (current && current->getTicks() == exact_rewind_ticks && 
            current->isState()                                        )
     {
-        current->restore();
+        num_predicted +=
+            static_cast<RewindInfoState*>(current)->restore(prediction,
+                                                            match_prediction);
         m_rewind_queue.next();
         current = m_rewind_queue.getCurrent();
     }
+    if (num_predicted > 0)
+        m_partial_restores++;
+    erasePredictedState(exact_rewind_ticks);
+    m_rewind_queue.clearLatestPastEvent();
+    m_resimulated_ticks += now_ticks - exact_rewind_ticks;
 
     // Update check line, so the cannon animation can be replayed correctly
     CheckManager::get()->resetAfterRewind();
@@ -19,12 +19,15 @@
 #ifndef HEADER_REWIND_MANAGER_HPP
 #define HEADER_REWIND_MANAGER_HPP
 
+#include "network/rewind_info.hpp"
+#include "karts/kart_state_block.hpp"
 #include "network/rewind_queue.hpp"
 #include "utils/ptr_vector.hpp"
 #include "utils/synchronised.hpp"
 
 #include <assert.h>
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <map>
@@ -36,6 +39,7 @@ class Rewinder;
 class RewindInfo;
 class RewindInfoEventFunction;
 class EventRewinder;
+class StateChecksums;
 
 /** \ingroup network
  *  This class manages rewinding. It keeps track of:
@@ -92,17 +96,87 @@ private:
      *  rewind data in case of local races only. */
     static bool           m_enable_rewind_manager;
 
-    std::map<int, std::vector<std::function<void()> > > m_local_state;
+    /** The state at one time which is not part of the server state, and
+     *  which a client restores when rewinding to that time. */
+    struct LocalState
+    {
+        int m_ticks;
+        /** Restore functions of rewinders other than karts. */
+        std::vector<std::function<void()> > m_restore_functions;
+        /** The local state of all karts. */
+        KartStateBlock m_karts;
+    };
+
+    /** On a client the local state at each state time, in increasing order
+     *  of time. */
+    std::vector<LocalState> m_local_state;
+
+    /** Local states no longer needed, kept to reuse their memory. */
+    std::vector<LocalState> m_free_local_state;
+
+    /** On a client the state of all rewinders saved at each state time, it
+     *  is compared with the state received from the server to avoid
+     *  unnecessary rewinds, and restores rewinders the server did not
+     *  send in its state. */
+    std::map<int, PredictedState> m_predicted_state;
+
+    /** Confirmed states at the time a rewind is requested, kept to reuse
+     *  the memory. */
+    std::vector<RewindInfoState*> m_rewind_states;
+
+    /** Number of rewinds not done since the prediction of the client
+     *  matched the server state. */
+    unsigned m_rewinds_avoided;
+
+    /** Number of rewinds in which at least one rewinder was restored to its
+     *  predicted state. */
+    unsigned m_partial_restores;
+
+    /** Number of time steps simulated again in all rewinds. */
+    uint64_t m_resimulated_ticks;
 
     /** A list of all objects that can be rewound. */
     std::map<std::string, std::weak_ptr<Rewinder> > m_all_rewinder;
 
+    /** All rewinders indexed by their rewinder id, which is used instead of
+     *  the unique identity in network states. */
+    std::vector<std::weak_ptr<Rewinder> > m_rewinder_by_id;
+
+    /** True for each rewinder id which is in m_free_rewinder_ids. */
+    std::vector<bool> m_rewinder_id_free;
+
+    /** Ids of expired rewinders and the time they were freed, an id is only
+     *  reused after some time, so that no state still in flight to a client
+     *  refers to the previous rewinder with this id. */
+    std::deque<std::pair<uint16_t, int> > m_free_rewinder_ids;
+
+    /** Ids of rewinders added since the last call to getNewRewinderNames(). */
+    std::vector<uint16_t> m_new_rewinder_ids;
+
+    /** On the client, the unique identity (and the rewinder once it was
+     *  found) of each rewinder id used by the server. */
+    struct NetworkRewinder
+    {
+        std::string m_name;
+        std::weak_ptr<Rewinder> m_rewinder;
+    };
+    std::vector<NetworkRewinder> m_network_rewinder;
+
+    /** Rewinder names received from the server by the network thread, which
+     *  are merged into m_network_rewinder by the main thread. */
+    Synchronised<std::vector<std::pair<uint16_t, std::string> > >
+        m_pending_network_rewinder;
+
     /** The queue that stores all rewind infos. */
     RewindQueue m_rewind_queue;
 
     /** Overall amount of memory allocated by states. */
     unsigned int m_overall_state_size;
 
+    /** Unique identity of the rewinders in the last state saved on the
+     *  server, kept to reuse the memory for the next state. */
+    std::vector<std::string> m_rewinder_using;
+
     /** Indicates if currently a rewind is happening. */
     bool m_is_rewinding;
 
@@ -116,23 +190,30 @@ private:
 
     std::vector<RewindInfoEventFunction*> m_pending_rief;
 
+    /** If not NULL, the checksums of all states are written with this. */
+    std::unique_ptr<StateChecksums> m_state_checksums;
+
+    /** Used on a client to save the states for the checksums. */
+    BareNetworkString m_checksum_buffer;
+
     RewindManager();
    ~RewindManager();
     // ------------------------------------------------------------------------
-    void clearExpiredRewinder()
-    {
-        for (auto it = m_all_rewinder.begin(); it != m_all_rewinder.end();)
-        {
-            if (it->second.expired())
-            {
-                it = m_all_rewinder.erase(it);
-                continue;
-            }
-            it++;
-        }
-    }
+    void clearExpiredRewinder();
     // ------------------------------------------------------------------------
     void mergeRewindInfoEventFunction();
+    // ------------------------------------------------------------------------
+    void mergeNetworkRewinderNames();
+    // ------------------------------------------------------------------------
+    void savePredictedState(int ticks);
+    // ------------------------------------------------------------------------
+    bool isPredictionMatching(int rewind_ticks);
+    // ------------------------------------------------------------------------
+    void erasePredictedState(int ticks);
+    // ------------------------------------------------------------------------
+    void eraseLocalState(int ticks);
+    // ------------------------------------------------------------------------
+    void saveStateChecksums(int ticks);
 
 public:
     // First static functions to manage rewinding.
@@ -178,6 +259,39 @@ public:
         return nullptr;
     }
     // ------------------------------------------------------------------------
+    /** Returns the rewinder with the given rewinder id (server), or NULL if
+     *  it does not exist anymore. */
+    std::shared_ptr<Rewinder> getRewinder(uint16_t id) const
+    {
+        if (id < m_rewinder_by_id.size())
+            return m_rewinder_by_id[id].lock();
+        return nullptr;
+    }
+    // ------------------------------------------------------------------------
+    std::shared_ptr<Rewinder> getNetworkRewinder(uint16_t id);
+    // ------------------------------------------------------------------------
+    /** Returns the unique identity of the server rewinder id, or an empty
+     *  string if it is not known (yet). */
+    const std::string& getNetworkRewinderName(uint16_t id) const
+    {
+        static const std::string empty;
+        if (id < m_network_rewinder.size())
+            return m_network_rewinder[id].m_name;
+        return empty;
+    }
+    // ------------------------------------------------------------------------
+    void setNetworkRewinder(uint16_t id, std::shared_ptr<Rewinder> r)
+    {
+        if (id < m_network_rewinder.size())
+            m_network_rewinder[id].m_rewinder = r;
+    }
+    // ------------------------------------------------------------------------
+    void addNetworkRewinderName(uint16_t id, const std::string& name);
+    // ------------------------------------------------------------------------
+    std::vector<std::pair<uint16_t, std::string> > getAllRewinderNames();
+    // ------------------------------------------------------------------------
+    std::vector<std::pair<uint16_t, std::string> > getNewRewinderNames();
+    // ------------------------------------------------------------------------
     bool addRewinder(std::shared_ptr<Rewinder> rewinder);
     // ------------------------------------------------------------------------
     /** Returns true if currently a rewind is happening. */
@@ -210,6 +324,17 @@ public:
     }
     // ------------------------------------------------------------------------
     void resetSmoothNetworkBody();
+    // ------------------------------------------------------------------------
+    /** Returns the number of rewinds avoided because the client prediction
+     *  matched the server state. */
+    unsigned getRewindsAvoided() const            { return m_rewinds_avoided; }
+    // ------------------------------------------------------------------------
+    /** Returns the number of rewinds which restored at least one rewinder
+     *  to its predicted state. */
+    unsigned getPartialRestores() const          { return m_partial_restores; }
+    // ------------------------------------------------------------------------
+    /** Returns the number of time steps simulated again in rewinds. */
+    uint64_t getResimulatedTicks() const        { return m_resimulated_ticks; }
 };   // RewindManager
 
 
@@ -28,6 +28,7 @@
 #include "network/rewind_manager.hpp"
 
 #include <algorithm>
+#include <chrono>
 
 /** The RewindQueue stores one TimeStepInfo for each time step done.
  *  The TimeStepInfo stores all states and events to be used at the
@@ -81,6 +82,7 @@ void RewindQueue::reset()
     m_all_rewind_info.clear();
     m_current = m_all_rewind_info.end();
     m_latest_confirmed_state_time = -1;
+    m_latest_past_event_time = -1;
 }   // reset
 
 // ----------------------------------------------------------------------------
@@ -110,7 +112,13 @@ void RewindQueue::insertRewindInfo(RewindInfo *ri)
     if(m_current == m_all_rewind_info.end())
         m_current = m_all_rewind_info.insert(i, ri);
     else
-        m_all_rewind_info.insert(i, ri);  
+    {
+        // Keep m_current at the same rewind info, which is moved to the
+        // next position if ri is inserted before it.
+        if (!(m_current < i))
+            m_current++;
+        m_all_rewind_info.insert(i, ri);
+    }
 }   // insertRewindInfo
 
 // ----------------------------------------------------------------------------
@@ -283,6 +291,15 @@ void RewindQueue::mergeNetworkData(int world_ticks, bool *needs_rewind,
                 *rewind_ticks = (*i)->getTicks();
         }   // if client and ticks < world_ticks
 
+        // An event for a time step which was already simulated can only be
+        // replayed by a rewind
+        if (NetworkConfig::get()->isClient() &&
+            (*i)->getTicks() < world_ticks && (*i)->isEvent() &&
+            (*i)->getTicks() > m_latest_past_event_time)
+        {
+            m_latest_past_event_time = (*i)->getTicks();
+        }
+
         if ((*i)->isState() && (*i)->getTicks() > latest_confirmed_state &&
             (*i)->isConfirmed())
         {
@@ -327,14 +344,12 @@ void RewindQueue::mergeNetworkData(int world_ticks, bool *needs_rewind,
  */
 void RewindQueue::cleanupOldRewindInfo(int ticks)
 {
-    auto i = m_all_rewind_info.begin();
-
     while (!m_all_rewind_info.empty() &&
-        (*i)->getTicks() < ticks)
+        m_all_rewind_info.front()->getTicks() < ticks)
     {
-        if (m_current == i) next();
-        delete *i;
-        i = m_all_rewind_info.erase(i);
+        if (m_current == m_all_rewind_info.begin()) next();
+        delete m_all_rewind_info.front();
+        m_all_rewind_info.pop_front();
     }
 
     if (m_all_rewind_info.empty())
@@ -390,6 +405,40 @@ int RewindQueue::undoUntil(int undo_ticks)
     return (*m_current)->getTicks();
 }   // undoUntil
 
+// ----------------------------------------------------------------------------
+/** Returns all confirmed states at the specified time.
+ *  \param ticks Time in ticks.
+ *  \param states On return contains all confirmed states at this time.
+ */
+void RewindQueue::getConfirmedStates(int ticks,
+                                     std::vector<RewindInfoState*>* states)
+{
+    states->clear();
+    AllRewindInfo::iterator i = m_all_rewind_info.end();
+    while (i != m_all_rewind_info.begin())
+    {
+        i--;
+        if ((*i)->getTicks() < ticks)
+            break;
+        if ((*i)->getTicks() == ticks && (*i)->isState() &&
+            (*i)->isConfirmed())
+            states->push_back(static_cast<RewindInfoState*>(*i));
+    }
+}   // getConfirmedStates
+
+// ----------------------------------------------------------------------------
+/** Moves the current pointer to the first RewindInfo at or after the
+ *  specified time without restoring or replaying anything. This is used
+ *  on a client if a rewind is not necessary, since the states received for
+ *  a past time step match the local simulation.
+ *  \param ticks Time in ticks.
+ */
+void RewindQueue::skipUntil(int ticks)
+{
+    while (hasMoreRewindInfo() && (*m_current)->getTicks() < ticks)
+        m_current++;
+}   // skipUntil
+
 // ----------------------------------------------------------------------------
 /** Replays all events (not states) that happened at the specified time.
  *  \param ticks Time in ticks.
@@ -520,5 +569,103 @@ void RewindQueue::unitTesting()
     b2.mergeNetworkData(4, &needs_rewind, &rewind_ticks);
     assert((*b2.m_current)->getTicks() == 3);
 
+    // 4) Inserting before the current rewind info must keep m_current at
+    //    the same rewind info, also after the ring buffer had to grow and
+    //    old rewind infos were removed at the front.
+    RewindQueue b3;
+    for (int i = 0; i < 200; i++)
+        b3.addLocalEvent(NULL, NULL, true, i);
+    for (int i = 0; i < 150; i++)
+        b3.next();
+    assert((*b3.m_current)->getTicks() == 150);
+    b3.cleanupOldRewindInfo(100);
+    assert(b3.m_all_rewind_info.size() == 100);
+    b3.addLocalEvent(NULL, NULL, true, 120);
+    assert((*b3.m_current)->getTicks() == 150);
+    b3.m_current--;
+    assert((*b3.m_current)->getTicks() == 149);
+    b3.addNetworkState(NULL, 300);
+    b3.mergeNetworkData(300, &needs_rewind, &rewind_ticks);
+    assert(b3.m_all_rewind_info.size() == 1);
+    assert((*b3.m_current)->getTicks() == 300);
 
 }   // unitTesting
+
+// ----------------------------------------------------------------------------
+/** Measures the time needed to merge network data and to undo and replay
+ *  the rewind queue on a client (without simulating the world). Each kart
+ *  creates a control event per time step, the events of the remote karts
+ *  and the states arrive with some latency.
+ */
+void RewindQueue::benchmark()
+{
+    auto dummy_rewinder = std::make_shared<DummyRewinder>();
+    // Two minutes at 120 physics updates per second
+    const int num_ticks = 120 * 120;
+    const int latency = 12;
+    const int state_frequency = 12;
+    const int all_num_karts[] = { 2, 8, 16 };
+
+    typedef std::chrono::high_resolution_clock Clock;
+    for (int num_karts : all_num_karts)
+    {
+        RewindQueue q;
+        Clock::duration merge_time(0), rewind_time(0);
+        unsigned num_rewinds = 0;
+        unsigned replayed_ticks = 0;
+        for (int ticks = 0; ticks < num_ticks; ticks++)
+        {
+            // The local kart
+            BareNetworkString* event = new BareNetworkString(8);
+            event->addUInt8(0).addUInt16(0).addUInt32(0);
+            q.addLocalEvent(dummy_rewinder.get(), event, true, ticks);
+            if (ticks >= latency)
+            {
+                // The remote karts
+                for (int i = 1; i < num_karts; i++)
+                {
+                    event = new BareNetworkString(8);
+                    event->addUInt8(i).addUInt16(0).addUInt32(0);
+                    q.addNetworkEvent(dummy_rewinder.get(), event,
+                                      ticks - latency);
+                }
+                if ((ticks - latency) % state_frequency == 0)
+                {
+                    q.addNetworkState(new BareNetworkString(100),
+                                      ticks - latency);
+                }
+            }
+
+            bool needs_rewind;
+            int rewind_ticks;
+            Clock::time_point start = Clock::now();
+            q.mergeNetworkData(ticks, &needs_rewind, &rewind_ticks);
+            Clock::time_point end = Clock::now();
+            merge_time += end - start;
+
+            if (needs_rewind)
+            {
+                int exact_rewind_ticks = q.undoUntil(rewind_ticks);
+                while (q.hasMoreRewindInfo() &&
+                       q.getCurrent()->getTicks() == exact_rewind_ticks &&
+                       q.getCurrent()->isState())
+                    q.next();
+                for (int t = exact_rewind_ticks; t < ticks; t++)
+                    q.replayAllEvents(t);
+                rewind_time += Clock::now() - end;
+                num_rewinds++;
+                replayed_ticks += ticks - exact_rewind_ticks;
+            }
+            q.replayAllEvents(ticks);
+        }
+        const double merge_us =
+            std::chrono::duration<double, std::micro>(merge_time).count();
+        const double rewind_us =
+            std::chrono::duration<double, std::micro>(rewind_time).count();
+        Log::info("RewindQueue", "%2d karts: merge %.3f us per tick, "
+            "rewind %.3f us per rewind (%u rewinds, %u replayed ticks).",
+            num_karts, merge_us / num_ticks,
+            num_rewinds > 0 ? rewind_us / num_rewinds : 0.0, num_rewinds,
+            replayed_ticks);
+    }
+}   // benchmark
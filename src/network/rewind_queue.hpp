@@ -19,15 +19,16 @@
 #ifndef HEADER_REWIND_QUEUE_HPP
 #define HEADER_REWIND_QUEUE_HPP
 
+#include "utils/ring_buffer.hpp"
 #include "utils/synchronised.hpp"
 
 #include <assert.h>
-#include <list>
 #include <vector>
 
 class BareNetworkString;
 class EventRewinder;
 class RewindInfo;
+class RewindInfoState;
 class TimeStepInfo;
 
 /** \ingroup network
@@ -37,7 +38,10 @@ class RewindQueue
 {
 private:
 
-    typedef std::list<RewindInfo*> AllRewindInfo;
+    /** All rewind infos sorted by time. Almost all rewind infos are added
+     *  at the end and removed at the front, so a ring buffer avoids
+     *  allocating a list node for each of them. */
+    typedef RingBuffer<RewindInfo*> AllRewindInfo;
 
     AllRewindInfo m_all_rewind_info;
 
@@ -55,11 +59,17 @@ private:
     /** Time at which the latest confirmed state is at. */
     int m_latest_confirmed_state_time;
 
+    /** On a client the time of the latest event received from the network
+     *  for a time step which was already simulated, -1 if there is none
+     *  since the last rewind. */
+    int m_latest_past_event_time;
+
 
     void cleanupOldRewindInfo(int ticks);
 
 public:
         static void unitTesting();
+        static void benchmark();
 
          RewindQueue();
         ~RewindQueue();
@@ -83,6 +93,8 @@ public:
     bool hasMoreRewindInfo() const;
     int  undoUntil(int undo_ticks);
     void insertRewindInfo(RewindInfo *ri);
+    void getConfirmedStates(int ticks, std::vector<RewindInfoState*>* states);
+    void skipUntil(int ticks);
 
     // ------------------------------------------------------------------------
     /** Returns the time of the latest confirmed state. */
@@ -91,6 +103,13 @@ public:
         return m_latest_confirmed_state_time;
     }
     // ------------------------------------------------------------------------
+    /** Returns the time of the latest event received for a time step that
+     *  was already simulated, or -1 if there is none. */
+    int getLatestPastEvent() const             { return m_latest_past_event_time; }
+    // ------------------------------------------------------------------------
+    /** Called after a rewind, which replays all events received late. */
+    void clearLatestPastEvent()                  { m_latest_past_event_time = -1; }
+    // ------------------------------------------------------------------------
     /** Sets the current element to be the next one and returns the next
      *  RewindInfo element. */
     void next()
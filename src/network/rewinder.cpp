@@ -18,8 +18,11 @@
 
 #include "network/rewinder.hpp"
 
+#include "network/network_string.hpp"
 #include "network/rewind_manager.hpp"
 
+#include <string.h>
+
 // ----------------------------------------------------------------------------
 /** Add this object to the list of all rewindable
  *  objects in the rewind manager.
@@ -28,3 +31,23 @@ bool Rewinder::rewinderAdd()
 {
     return RewindManager::get()->addRewinder(shared_from_this());
 }   // rewinderAdd
+
+// ----------------------------------------------------------------------------
+/** Called on a client to test if a state received from the server matches
+ *  the state this client predicted for the same time (both saved with
+ *  saveState()), in which case the client does not need to rewind for this
+ *  object. The default implementation requires both states to be
+ *  identical, rewinders with a physical body can accept small differences.
+ *  \param predicted The state saved by the client.
+ *  \param confirmed The state received from the server.
+ *  \param count Size of both states.
+ */
+bool Rewinder::isStateMatching(BareNetworkString* predicted,
+                               BareNetworkString* confirmed, int count)
+{
+    const bool is_matching = memcmp(predicted->getCurrentData(),
+        confirmed->getCurrentData(), count) == 0;
+    predicted->skip(count);
+    confirmed->skip(count);
+    return is_matching;
+}   // isStateMatching
@@ -19,6 +19,8 @@
 #ifndef HEADER_REWINDER_HPP
 #define HEADER_REWINDER_HPP
 
+#include "utils/types.hpp"
+
 #include <cassert>
 #include <functional>
 #include <string>
@@ -40,8 +42,14 @@ enum RewinderName : char
     RN_PHYSICAL_OBJ = 0x09
 };
 
+/** Set in the rewinder id of a state sent by the server if the state of this
+ *  rewinder is not included (since it is far away from all karts of the
+ *  client). Rewinder ids are always smaller than this value. */
+const uint16_t REWINDER_ID_NOT_SENT = 0x8000;
+
 class Rewinder : public std::enable_shared_from_this<Rewinder>
 {
+friend class RewindManager;
 protected:
     void setUniqueIdentity(const std::string& uid)  { m_unique_identity = uid; }
 private:
@@ -56,8 +64,16 @@ private:
     */
     std::string m_unique_identity;
 
+    /** A compact id set by the RewindManager when this rewinder is added,
+     *  which is used instead of the unique identity in network states. */
+    uint16_t m_rewinder_id;
+
 public:
-    Rewinder(const std::string& ui = "")             { m_unique_identity = ui; }
+    Rewinder(const std::string& ui = "")
+    {
+        m_unique_identity = ui;
+        m_rewinder_id = 0;
+    }
 
     virtual ~Rewinder() {}
 
@@ -70,12 +86,16 @@ public:
      *  caused by the rewind (which is then visually smoothed over time). */
     virtual void computeError() = 0;
 
-    /** Provides a copy of the state of the object in one memory buffer.
-     *  The memory is managed by the RewindManager.
-     *  \param[out] ru The unique identity of rewinder writing to.
-     *  \return The address of the memory buffer with the state.
+    /** Appends the state of the object to the given buffer, which is the
+     *  message sent to the clients, so no copy of the state is necessary.
+     *  \param buffer The buffer to which the state is appended.
+     *  \return True if a state was saved. If false is returned, anything
+     *          written to buffer is discarded.
      */
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru) = 0;
+    virtual bool saveState(BareNetworkString* buffer) = 0;
+
+    virtual bool isStateMatching(BareNetworkString* predicted,
+                                 BareNetworkString* confirmed, int count);
 
     /** Called when an event needs to be undone. This is called while going
      *  backwards for rewinding - all stored events will get an 'undo' call.
@@ -93,6 +113,10 @@ public:
      */
     virtual void restoreState(BareNetworkString *buffer, int count) = 0;
 
+    /** Called instead of restoreState if the server did not send the state
+     *  of this rewinder, the state predicted by the client is kept. */
+    virtual void keepLocalState() {}
+
     /** Undo the effects of the given state, but do not rewind to that
      *  state (which is done by rewindTo). This is called while going
      *  backwards for rewinding - all stored events will get an 'undo' call.
@@ -112,6 +136,9 @@ public:
         return m_unique_identity;
     }
     // -------------------------------------------------------------------------
+    /** Returns the id of this rewinder, only valid after rewinderAdd(). */
+    uint16_t getRewinderId() const                   { return m_rewinder_id; }
+    // -------------------------------------------------------------------------
     bool rewinderAdd();
     // -------------------------------------------------------------------------
     template<typename T> std::shared_ptr<T> getShared()
@@ -312,6 +312,18 @@ void loadServerLobbyFromConfig()
         m_state_frequency.revertToDefaults();
     }
     NetworkConfig::get()->setStateFrequency(m_state_frequency);
+    int min_frequency_in_config = m_min_state_frequency;
+    if (min_frequency_in_config <= 0 ||
+        min_frequency_in_config > m_state_frequency)
+    {
+        Log::warn("ServerConfig", "Invalid %d minimum state frequency, use "
+            "state frequency %d.", min_frequency_in_config,
+            (int)m_state_frequency);
+        min_frequency_in_config = m_state_frequency;
+    }
+    NetworkConfig::get()->setMinStateFrequency(min_frequency_in_config);
+    if (m_state_upload_budget < 0)
+        m_state_upload_budget.revertToDefaults();
 
     if (m_player_reports_expired_days < 0.0f)
         m_player_reports_expired_days.revertToDefaults();
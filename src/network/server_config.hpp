@@ -319,6 +319,44 @@ namespace ServerConfig
         "more rewind, which clients with slow device may have problem playing "
         "this server, use the default value is recommended."));
 
+    SERVER_CFG_PREFIX IntServerConfigParam m_min_state_frequency
+        SERVER_CFG_DEFAULT(IntServerConfigParam(10,
+        "min-state-frequency",
+        "Minimum number of states per second sent to each client. If lower "
+        "than state-frequency, the server sends fewer states to clients with "
+        "high ping or packet loss, and to all clients if the upload speed is "
+        "above state-upload-budget."));
+
+    SERVER_CFG_PREFIX IntServerConfigParam m_state_upload_budget
+        SERVER_CFG_DEFAULT(IntServerConfigParam(0,
+        "state-upload-budget",
+        "Upload speed in kilobytes per second which the server should not "
+        "exceed by sending fewer states (down to min-state-frequency), 0 for "
+        "no limit."));
+
+    SERVER_CFG_PREFIX BoolServerConfigParam m_state_delta_compression
+        SERVER_CFG_DEFAULT(BoolServerConfigParam(true,
+        "state-delta-compression",
+        "If true, the server will only send the difference of kart, item "
+        "and ball states to the last state received by each client, which "
+        "saves upload bandwidth. Clients not supporting it will still "
+        "receive full states."));
+
+    SERVER_CFG_PREFIX FloatServerConfigParam m_state_interest_distance
+        SERVER_CFG_DEFAULT(FloatServerConfigParam(0.0f,
+        "state-interest-distance",
+        "Karts further away than this distance (in meters along the track or "
+        "arena) from all karts of a player are sent less often to this "
+        "player, which saves upload bandwidth in large arenas, but makes far "
+        "away karts less accurate. 0 to send all karts in every state. "
+        "Only used for clients supporting state-delta-compression."));
+
+    SERVER_CFG_PREFIX IntServerConfigParam m_state_interest_rate
+        SERVER_CFG_DEFAULT(IntServerConfigParam(3,
+        "state-interest-rate",
+        "If state-interest-distance is used, karts far away from a player are "
+        "sent only in every n-th state to this player."));
+
     SERVER_CFG_PREFIX BoolServerConfigParam m_sql_management
         SERVER_CFG_DEFAULT(BoolServerConfigParam(false,
         "sql-management",
@@ -0,0 +1,126 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "network/state_checksums.hpp"
+
+#include "utils/log.hpp"
+
+#include <assert.h>
+#include <limits>
+
+std::string StateChecksums::m_file_name;
+unsigned    StateChecksums::m_num_races = 0;
+
+// ----------------------------------------------------------------------------
+/** Opens the checksum file. The content of a previous process is
+ *  overwritten, the checksums of previous races of this process are kept.
+ *  \param track Identity of the track of this race.
+ */
+StateChecksums::StateChecksums(const std::string& track)
+{
+    m_current      = NULL;
+    m_track        = track;
+    m_race_started = false;
+    m_file.open(m_file_name.c_str(), m_num_races == 0 ?
+                std::ios::out : std::ios::out | std::ios::app);
+    if (!m_file.good())
+    {
+        Log::error("StateChecksums", "Can't open '%s' for writing.",
+                   m_file_name.c_str());
+    }
+}   // StateChecksums
+
+// ----------------------------------------------------------------------------
+/** Writes all checksums not yet written.
+ */
+StateChecksums::~StateChecksums()
+{
+    writeUntil(std::numeric_limits<int>::max());
+}   // ~StateChecksums
+
+// ----------------------------------------------------------------------------
+/** Starts the checksums of the state at the given time, replacing the
+ *  checksums of a previous simulation of this time step.
+ *  \param ticks Time of the state.
+ */
+void StateChecksums::startState(int ticks)
+{
+    m_current = &m_pending[ticks];
+    *m_current = std::to_string(ticks);
+}   // startState
+
+// ----------------------------------------------------------------------------
+/** Adds the checksum of the state of one rewinder to the current state.
+ *  \param uid Unique identity of the rewinder.
+ *  \param data, size The state saved by the rewinder.
+ */
+void StateChecksums::addRewinder(const std::string& uid, const uint8_t* data,
+                                 unsigned size)
+{
+    assert(m_current);
+    static const char hex[] = "0123456789abcdef";
+    std::string& line = *m_current;
+    line.push_back(' ');
+    for (char c : uid)
+    {
+        line.push_back(hex[((uint8_t)c) >> 4]);
+        line.push_back(hex[((uint8_t)c) & 15]);
+    }
+    line.push_back(':');
+    const uint64_t h = hash(data, size);
+    for (int shift = 60; shift >= 0; shift -= 4)
+        line.push_back(hex[(h >> shift) & 15]);
+}   // addRewinder
+
+// ----------------------------------------------------------------------------
+/** Writes the checksums of all states up to and including the given time,
+ *  which will not be simulated again.
+ *  \param ticks Time in ticks.
+ */
+void StateChecksums::writeUntil(int ticks)
+{
+    m_current = NULL;
+    for (auto it = m_pending.begin(); it != m_pending.end();)
+    {
+        if (it->first > ticks)
+            break;
+        if (!m_race_started)
+        {
+            m_race_started = true;
+            m_num_races++;
+            m_file << "race " << m_num_races << " " << m_track << '\n';
+        }
+        m_file << it->second << '\n';
+        it = m_pending.erase(it);
+    }
+}   // writeUntil
+
+// ----------------------------------------------------------------------------
+/** 64-bit FNV-1a hash of the given data.
+ */
+uint64_t StateChecksums::hash(const uint8_t* data, unsigned size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}   // hash
@@ -0,0 +1,87 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_STATE_CHECKSUMS_HPP
+#define HEADER_STATE_CHECKSUMS_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+/** \ingroup network */
+
+/** Writes a checksum of the state of each rewinder at each state time to a
+ *  file, so that the files written by a server and a client can be compared
+ *  offline (see tools/compare_state_checksums.py) to find the first time
+ *  and rewinder at which their simulations diverged. The checksums are
+ *  computed from the same compressed data that is sent in (or predicted for)
+ *  a state. Each line of the file contains the time in ticks, followed by
+ *  a 'unique identity:checksum' pair for each rewinder, both in hex.
+ *  A client can simulate a time step several times (after a rewind), so the
+ *  checksums are only written once no rewind can change them anymore.
+ *  One object is used per race. All races of a process are written to the
+ *  same file, each one starts with a line 'race <number> <track>', so that
+ *  the checksums of a race are kept when the next race or a restart begins.
+ */
+class StateChecksums : public NoCopy
+{
+private:
+    /** Name of the file to write to, empty if checksums are not written. */
+    static std::string m_file_name;
+
+    /** Number of races written to the file, the file is overwritten by the
+     *  first race of a process. */
+    static unsigned m_num_races;
+
+    std::ofstream m_file;
+
+    /** The lines not yet written, indexed by time in ticks. */
+    std::map<int, std::string> m_pending;
+
+    /** The line for the state currently being added. */
+    std::string* m_current;
+
+    /** Identity of the track, written in the race line. */
+    std::string m_track;
+
+    /** If the race line was written, which is only done once the first
+     *  checksums are written, so that no empty races are written. */
+    bool m_race_started;
+
+public:
+    StateChecksums(const std::string& track);
+   ~StateChecksums();
+    void startState(int ticks);
+    void addRewinder(const std::string& uid, const uint8_t* data,
+                     unsigned size);
+    void writeUntil(int ticks);
+    // ------------------------------------------------------------------------
+    static uint64_t hash(const uint8_t* data, unsigned size);
+    // ------------------------------------------------------------------------
+    /** Enables writing the checksums of all states to the given file. */
+    static void setFileName(const std::string& name) { m_file_name = name; }
+    // ------------------------------------------------------------------------
+    /** Returns if checksums of states should be written. */
+    static bool isEnabled()                   { return !m_file_name.empty(); }
+};   // StateChecksums
+
+#endif
@@ -0,0 +1,234 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include "network/state_delta.hpp"
+
+#include "network/network_string.hpp"
+#include "utils/log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+// ----------------------------------------------------------------------------
+/** Writes the state of one rewinder to a buffer, using the baseline (if
+ *  available) to only write the difference. The delta is written directly
+ *  into the buffer, and replaced by the full state if it is not smaller.
+ *  \param baseline The state of this rewinder in the baseline snapshot.
+ *  \param baseline_size Size of the baseline state, or -1 if the receiver
+ *         has no baseline for this rewinder.
+ *  \param data Pointer to the current state of the rewinder.
+ *  \param size Size of the current state.
+ *  \param out The buffer to which the encoded state is appended.
+ */
+void StateDelta::encode(const uint8_t* baseline, int baseline_size,
+                        const uint8_t* data, unsigned size,
+                        BareNetworkString* out)
+{
+    std::vector<uint8_t>& buffer = out->getBuffer();
+    const size_t start = buffer.size();
+    if (baseline_size == (int)size)
+    {
+        if (size == 0 || memcmp(baseline, data, size) == 0)
+        {
+            out->addUInt8(DT_UNCHANGED);
+            return;
+        }
+
+        out->addUInt8(DT_XOR_RLE).addUInt16(0);
+        const size_t rle_start = buffer.size();
+        unsigned i = 0;
+        // Stop as soon as the delta is not smaller than the full state
+        while (i < size && buffer.size() - rle_start < size)
+        {
+            uint8_t zeros = 0;
+            while (i < size && zeros < 255 && (data[i] ^ baseline[i]) == 0)
+            {
+                zeros++;
+                i++;
+            }
+            const size_t literal_pos = buffer.size() + 1;
+            buffer.push_back(zeros);
+            buffer.push_back(0);
+            uint8_t literals = 0;
+            while (i < size && literals < 255 &&
+                   (data[i] ^ baseline[i]) != 0)
+            {
+                buffer.push_back(data[i] ^ baseline[i]);
+                literals++;
+                i++;
+            }
+            buffer[literal_pos] = literals;
+        }
+        const size_t rle_size = buffer.size() - rle_start;
+        if (i == size && rle_size < size)
+        {
+            buffer[rle_start - 2] = (uint8_t)(rle_size >> 8);
+            buffer[rle_start - 1] = (uint8_t)(rle_size & 0xff);
+            return;
+        }
+        buffer.resize(start);
+    }
+
+    out->addUInt8(DT_FULL).addUInt16((uint16_t)size);
+    buffer.insert(buffer.end(), data, data + size);
+}   // encode
+
+// ----------------------------------------------------------------------------
+/** Reads the state of one rewinder written by encode(), and appends the
+ *  reconstructed full state of it to out.
+ *  \param in The buffer to read from.
+ *  \param baseline The state of this rewinder in the baseline snapshot.
+ *  \param baseline_size Size of the baseline state, or -1 if the receiver
+ *         has no baseline for this rewinder.
+ *  \param out The buffer to which the full state of the rewinder is
+ *         appended. It must not contain the baseline.
+ */
+void StateDelta::decode(BareNetworkString* in,
+                        const uint8_t* baseline, int baseline_size,
+                        std::vector<uint8_t>* out)
+{
+    uint8_t type = in->getUInt8();
+    switch (type)
+    {
+    case DT_FULL:
+    {
+        uint16_t size = in->getUInt16();
+        if (in->size() < size)
+            throw std::out_of_range("Full state out of range.");
+        const uint8_t* data = (const uint8_t*)in->getCurrentData();
+        out->insert(out->end(), data, data + size);
+        in->skip(size);
+        break;
+    }
+    case DT_UNCHANGED:
+    {
+        if (baseline_size < 0)
+            throw std::runtime_error("Missing baseline for state.");
+        out->insert(out->end(), baseline, baseline + baseline_size);
+        break;
+    }
+    case DT_XOR_RLE:
+    {
+        if (baseline_size < 0)
+            throw std::runtime_error("Missing baseline for delta state.");
+        uint16_t rle_size = in->getUInt16();
+        if (in->size() < rle_size)
+            throw std::out_of_range("Delta state out of range.");
+        const size_t start = out->size();
+        out->insert(out->end(), baseline, baseline + baseline_size);
+        uint8_t* state = out->data() + start;
+        unsigned i = 0;
+        for (unsigned n = 0; n < rle_size;)
+        {
+            if (n + 2 > rle_size)
+                throw std::out_of_range("Invalid delta run.");
+            i += in->getUInt8();
+            uint8_t literals = in->getUInt8();
+            n += 2;
+            if (n + literals > rle_size ||
+                i + literals > (unsigned)baseline_size)
+                throw std::out_of_range("Invalid delta literals.");
+            for (unsigned j = 0; j < literals; j++)
+                state[i++] ^= in->getUInt8();
+            n += literals;
+        }
+        break;
+    }
+    default:
+        throw std::runtime_error("Unknown delta type.");
+    }
+}   // decode
+
+// ----------------------------------------------------------------------------
+/** Unit tests for StateDelta: encodes different kinds of changes against
+ *  a baseline, and makes sure that the decoded data is identical to the
+ *  original one.
+ */
+void StateDelta::unitTesting()
+{
+    std::vector<uint8_t> baseline;
+    for (unsigned i = 0; i < 600; i++)
+        baseline.push_back((uint8_t)(i * 7));
+    const int baseline_size = (int)baseline.size();
+
+    // 1) Unchanged data must be encoded in one byte
+    BareNetworkString s1;
+    encode(baseline.data(), baseline_size, baseline.data(),
+        (unsigned)baseline.size(), &s1);
+    assert(s1.size() == 1);
+    std::vector<uint8_t> out;
+    decode(&s1, baseline.data(), baseline_size, &out);
+    assert(out == baseline);
+
+    // 2) A few changed bytes (including a run of more than 255 unchanged
+    //    bytes) must be smaller than the full state and decode correctly
+    std::vector<uint8_t> changed = baseline;
+    changed[0] ^= 0x12;
+    changed[3] ^= 0x01;
+    changed[4] ^= 0xff;
+    changed[400] ^= 0x80;
+    changed[599] ^= 0x01;
+    BareNetworkString s2;
+    encode(baseline.data(), baseline_size, changed.data(),
+        (unsigned)changed.size(), &s2);
+    assert(s2.size() < 20);
+    out.clear();
+    decode(&s2, baseline.data(), baseline_size, &out);
+    assert(out == changed);
+    assert(s2.size() == 0);
+
+    // 3) Completely different data falls back to a full state
+    std::vector<uint8_t> different;
+    for (unsigned i = 0; i < 600; i++)
+        different.push_back(~baseline[i]);
+    BareNetworkString s3;
+    encode(baseline.data(), baseline_size, different.data(),
+        (unsigned)different.size(), &s3);
+    assert(s3.getBuffer()[0] == DT_FULL);
+    assert(s3.size() == 3 + different.size());
+    out.clear();
+    decode(&s3, baseline.data(), baseline_size, &out);
+    assert(out == different);
+
+    // 4) No baseline or a different size also uses a full state, several
+    //    decoded states are appended to the same buffer
+    BareNetworkString s4;
+    encode(NULL, -1, changed.data(), 10, &s4);
+    encode(baseline.data(), baseline_size, changed.data(), 20, &s4);
+    out.clear();
+    decode(&s4, NULL, -1, &out);
+    decode(&s4, baseline.data(), baseline_size, &out);
+    assert(out.size() == 30 &&
+        std::equal(out.begin(), out.begin() + 10, changed.begin()) &&
+        std::equal(out.begin() + 10, out.end(), changed.begin()));
+
+    // 5) A delta without baseline must be rejected
+    bool thrown = false;
+    try
+    {
+        s2.reset();
+        decode(&s2, NULL, -1, &out);
+    }
+    catch (std::exception&)
+    {
+        thrown = true;
+    }
+    if (!thrown)
+        Log::fatal("StateDelta", "Delta decoded without baseline.");
+}   // unitTesting
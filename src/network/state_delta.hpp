@@ -0,0 +1,59 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_STATE_DELTA_HPP
+#define HEADER_STATE_DELTA_HPP
+
+#include "utils/types.hpp"
+
+#include <vector>
+
+class BareNetworkString;
+
+/** \ingroup network
+ *  Encodes the state of a single rewinder against the state of the same
+ *  rewinder in an older snapshot (the baseline) which the receiver is known
+ *  to have. The state is xor'ed with the baseline, and the result is run
+ *  length encoded as (number of zero bytes, number of literal bytes,
+ *  literal bytes). Since most values of a kart change little (or not at
+ *  all) between two states, the xor'ed data contains mostly zero bytes.
+ *  If there is no usable baseline, or the delta would not be smaller, the
+ *  full state is written instead.
+ */
+class StateDelta
+{
+public:
+    /** How a rewinder state is encoded in a delta state. */
+    enum DeltaType : uint8_t
+    {
+        DT_FULL      = 0,
+        DT_UNCHANGED = 1,
+        DT_XOR_RLE   = 2
+    };
+
+    static void unitTesting();
+
+    static void encode(const uint8_t* baseline, int baseline_size,
+                       const uint8_t* data, unsigned size,
+                       BareNetworkString* out);
+    static void decode(BareNetworkString* in,
+                       const uint8_t* baseline, int baseline_size,
+                       std::vector<uint8_t>* out);
+};   // StateDelta
+
+#endif
@@ -36,6 +36,7 @@
 #include "tracks/track.hpp"
 #include "tracks/track_manager.hpp"
 #include "utils/log.hpp"
+#include "utils/profiler.hpp"
 #include "utils/separate_process.hpp"
 #include "utils/time.hpp"
 #include "utils/vs.hpp"
@@ -723,6 +724,7 @@ void STKHost::mainLoop()
     std::map<std::string, uint64_t> ctp;
     while (m_exit_timeout.load() > StkTime::getMonoTimeMs())
     {
+        PROFILER_PUSH_CPU_MARKER("STKHost - update", 0x80, 0x40, 0x00);
         // Clear outdated connect to peer list every 15 seconds
         for (auto it = ctp.begin(); it != ctp.end();)
         {
@@ -927,6 +929,8 @@ void STKHost::mainLoop()
             }
         }
 
+        PROFILER_POP_CPU_MARKER();
+
         bool need_ping_update = false;
         while (enet_host_service(host, &event, 10) != 0)
         {
@@ -952,6 +956,8 @@ void STKHost::mainLoop()
             if (event.type == ENET_EVENT_TYPE_NONE)
                 continue;
 
+            PROFILER_PUSH_CPU_MARKER("STKHost - handle event", 0x80, 0x40,
+                0x40);
             Event* stk_event = NULL;
             if (event.type == ENET_EVENT_TYPE_CONNECT)
             {
@@ -978,6 +984,7 @@ void STKHost::mainLoop()
                     std::numeric_limits<uint64_t>::max())
                 {
                     m_exit_timeout.store(0);
+                    PROFILER_POP_CPU_MARKER();
                     break;
                 }
                 // Use the previous stk peer so protocol can see the network
@@ -1054,6 +1061,7 @@ void STKHost::mainLoop()
                         }
                     }
                     enet_packet_destroy(event.packet);
+                    PROFILER_POP_CPU_MARKER();
                     continue;
                 }
                 try
@@ -1064,12 +1072,14 @@ void STKHost::mainLoop()
                 {
                     Log::warn("STKHost", "%s", e.what());
                     enet_packet_destroy(event.packet);
+                    PROFILER_POP_CPU_MARKER();
                     continue;
                 }
             }
             else if (!stk_event)
             {
                 enet_packet_destroy(event.packet);
+                PROFILER_POP_CPU_MARKER();
                 continue;
             }
             if (stk_event->getType() == EVENT_TYPE_MESSAGE)
@@ -1092,6 +1102,7 @@ void STKHost::mainLoop()
                 pm->propagateEvent(stk_event);
             else
                 delete stk_event;
+            PROFILER_POP_CPU_MARKER();
         }   // while enet_host_service
     }   // while m_exit_timeout.load() > StkTime::getMonoTimeMs()
     delete direct_socket;
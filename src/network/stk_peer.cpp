@@ -40,6 +40,7 @@ STKPeer::STKPeer(ENetPeer *enet_peer, STKHost* host, uint32_t host_id)
     m_connected_time      = StkTime::getMonoTimeMs();
     m_validated.store(false);
     m_average_ping.store(0);
+    m_packet_loss.store(0);
     m_waiting_for_game.store(true);
     m_spectator.store(false);
     m_disconnected.store(false);
@@ -171,6 +172,7 @@ bool STKPeer::isSamePeer(const ENetPeer* peer) const
  */
 uint32_t STKPeer::getPing()
 {
+    m_packet_loss.store(m_enet_peer->packetLoss);
     if (getConnectedTime() < 3.0f)
     {
         m_average_ping.store(m_enet_peer->roundTripTime);
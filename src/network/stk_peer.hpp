@@ -96,6 +96,10 @@ protected:
 
     std::atomic<uint32_t> m_average_ping;
 
+    /** Packet loss of reliable packets measured by enet, relative to
+     *  ENET_PEER_PACKET_LOSS_SCALE. */
+    std::atomic<uint32_t> m_packet_loss;
+
     std::set<unsigned> m_available_kart_ids;
 
     std::string m_user_version;
@@ -192,6 +196,13 @@ public:
     // ------------------------------------------------------------------------
     uint32_t getAveragePing() const           { return m_average_ping.load(); }
     // ------------------------------------------------------------------------
+    /** Returns the packet loss (between 0 and 1) measured by enet. */
+    float getPacketLoss() const
+    {
+        return (float)m_packet_loss.load() /
+            (float)ENET_PEER_PACKET_LOSS_SCALE;
+    }   // getPacketLoss
+    // ------------------------------------------------------------------------
     ENetPeer* getENetPeer() const                       { return m_enet_peer; }
     // ------------------------------------------------------------------------
     void setWaitingForGame(bool val)         { m_waiting_for_game.store(val); }
@@ -35,14 +35,15 @@
 
 btRigidBody& btKart::getFixedBody()
 {
+    // A body created with zero mass already has zero mass properties, and
+    // nothing modifies them. Not setting them on each call avoids writing
+    // to the shared object when the wheel rays are cast in parallel.
     static btRigidBody s_fixed(0, 0,0);
-    s_fixed.setMassProps(btScalar(0.),btVector3(btScalar(0.),
-                         btScalar(0.),btScalar(0.)));
     return s_fixed;
 }
 
 // ============================================================================
-btKart::btKart(btRigidBody* chassis, btVehicleRaycaster* raycaster,
+btKart::btKart(btRigidBody* chassis, btKartRaycaster* raycaster,
                Kart *kart)
       : m_vehicleRaycaster(raycaster)
 {
@@ -117,6 +118,7 @@ void btKart::reset()
         updateWheelTransform(i, true);
     }
     m_visual_wheels_touch_ground = false;
+    m_wheel_rays_cast            = false;
     m_allow_sliding              = false;
     m_num_wheels_on_ground       = 0;
     m_additional_impulse         = btVector3(0,0,0);
@@ -230,42 +232,83 @@ void btKart::updateAllWheelTransformsWS()
 
     m_num_wheels_on_ground       = 0;
     m_visual_wheels_touch_ground = true;
-    for (int i=0;i<m_wheelInfo.size();i++)
+
+    // Cast the rays of (up to) four wheels as one batch, which gives the
+    // same results as casting them one by one with rayCast()
+    const int batch_size = 4;
+    for (int first = 0; first < m_wheelInfo.size(); first += batch_size)
     {
-        rayCast( i);
-        if(m_wheelInfo[i].m_raycastInfo.m_isInContact)
-            m_num_wheels_on_ground++;
-        else
+        const int count = btMin(m_wheelInfo.size() - first, batch_size);
+        btVector3 from[batch_size], to[batch_size];
+        btVehicleRaycaster::btVehicleRaycasterResult results[batch_size];
+        void *objects[batch_size];
+        btScalar raylen[batch_size];
+        for (int i = 0; i < count; i++)
+        {
+            raylen[i] = prepareWheelRay(first + i, 1.0f);
+            from[i]   = m_wheelInfo[first + i].m_raycastInfo.m_hardPointWS;
+            to[i]     = m_wheelInfo[first + i].m_raycastInfo.m_contactPointWS;
+        }
+        btAssert(m_vehicleRaycaster);
+        m_vehicleRaycaster->castRays(count, from, to, results, objects,
+                                     m_chassisBody);
+
+        for (int i = first; i < first + count; i++)
         {
-            // If the original raycast did not hit the ground,
-            // try a little bit (5%) closer to the centre of the chassis.
-            // Some tracks have very minor gaps that would otherwise
-            // trigger odd physical behaviour.
-            rayCast(i, 0.95f);
-            if (m_wheelInfo[i].m_raycastInfo.m_isInContact)
+            updateWheelContact(i, raylen[i - first], objects[i - first],
+                               results[i - first]);
+            if(m_wheelInfo[i].m_raycastInfo.m_isInContact)
                 m_num_wheels_on_ground++;
+            else
+            {
+                // If the original raycast did not hit the ground,
+                // try a little bit (5%) closer to the centre of the chassis.
+                // Some tracks have very minor gaps that would otherwise
+                // trigger odd physical behaviour.
+                rayCast(i, 0.95f);
+                if (m_wheelInfo[i].m_raycastInfo.m_isInContact)
+                    m_num_wheels_on_ground++;
+            }
         }
     }
 }   // updateAllWheelTransformsWS
 
 // ----------------------------------------------------------------------------
-/**
+/** Casts the ray of one wheel and updates its contact information.
+ *  \param index Index of the wheel.
+ *  \param fraction Moves the start of the ray closer to the centre of the
+ *         chassis (see updateWheelTransformsWS).
+ *  \return The suspension length, or -1 if the wheel is not in contact.
  */
 btScalar btKart::rayCast(unsigned int index, float fraction)
 {
-    btWheelInfo &wheel = m_wheelInfo[index];
+    btScalar raylen = prepareWheelRay(index, fraction);
+    const btWheelInfo &wheel = m_wheelInfo[index];
+
+    btVehicleRaycaster::btVehicleRaycasterResult rayResults;
+
+    btAssert(m_vehicleRaycaster);
 
     // Work around a bullet problem: when using a convex hull the raycast
     // would sometimes hit the chassis (which does not happen when using a
-    // box shape). Therefore set the collision mask in the chassis body so
-    // that it is not hit anymore.
-    short int old_group=0;
-    if(m_chassisBody->getBroadphaseHandle())
-    {
-        old_group = m_chassisBody->getBroadphaseHandle()
-                                 ->m_collisionFilterGroup;
-        m_chassisBody->getBroadphaseHandle()->m_collisionFilterGroup = 0;
-    }
+    // box shape). Therefore exclude the chassis body from the raycast.
+    void* object = m_vehicleRaycaster->castRay(
+                                     wheel.m_raycastInfo.m_hardPointWS,
+                                     wheel.m_raycastInfo.m_contactPointWS,
+                                     rayResults, m_chassisBody);
+    return updateWheelContact(index, raylen, object, rayResults);
+}   // rayCast
+
+// ----------------------------------------------------------------------------
+/** Updates the world transform of a wheel and prepares its ray: on return
+ *  the ray goes from m_hardPointWS to m_contactPointWS of the wheel.
+ *  \param index Index of the wheel.
+ *  \param fraction See rayCast.
+ *  \return The length of the ray.
+ */
+btScalar btKart::prepareWheelRay(unsigned int index, float fraction)
+{
+    btWheelInfo &wheel = m_wheelInfo[index];
 
     updateWheelTransformsWS(wheel, getChassisWorldTransform(), false, fraction);
 
@@ -278,15 +321,26 @@ btScalar btKart::rayCast(unsigned int index, float fraction)
     btScalar raylen = max_susp_len + 0.5f;
 
     btVector3 rayvector = wheel.m_raycastInfo.m_wheelDirectionWS * (raylen);
-    const btVector3& source = wheel.m_raycastInfo.m_hardPointWS;
-    wheel.m_raycastInfo.m_contactPointWS = source + rayvector;
-    const btVector3& target = wheel.m_raycastInfo.m_contactPointWS;
-
-    btVehicleRaycaster::btVehicleRaycasterResult rayResults;
-
-    btAssert(m_vehicleRaycaster);
+    wheel.m_raycastInfo.m_contactPointWS = wheel.m_raycastInfo.m_hardPointWS
+                                         + rayvector;
+    return raylen;
+}   // prepareWheelRay
 
-    void* object = m_vehicleRaycaster->castRay(source,target,rayResults);
+// ----------------------------------------------------------------------------
+/** Updates the contact information of a wheel from the result of its ray.
+ *  \param index Index of the wheel.
+ *  \param raylen Length of the ray as returned by prepareWheelRay.
+ *  \param object The object hit by the ray, or NULL.
+ *  \param rayResults The result of the raycast.
+ *  \return The suspension length, or -1 if the wheel is not in contact.
+ */
+btScalar btKart::updateWheelContact(unsigned int index, btScalar raylen,
+              void *object,
+              const btVehicleRaycaster::btVehicleRaycasterResult &rayResults)
+{
+    btWheelInfo &wheel = m_wheelInfo[index];
+    btScalar max_susp_len = wheel.getSuspensionRestLength()
+                          + wheel.m_maxSuspensionTravel;
 
     wheel.m_raycastInfo.m_groundObject = 0;
 
@@ -354,15 +408,9 @@ btScalar btKart::rayCast(unsigned int index, float fraction)
         wheel.m_clippedInvContactDotSuspension = btScalar(1.0);
     }
 
-    if(m_chassisBody->getBroadphaseHandle())
-    {
-        m_chassisBody->getBroadphaseHandle()->m_collisionFilterGroup
-            = old_group;
-    }
-
     return depth;
 
-}   // rayCast
+}   // updateWheelContact
 
 // ----------------------------------------------------------------------------
 /** Returns the contact point of a visual wheel.
@@ -433,7 +481,10 @@ void btKart::updateAllWheelPositions()
 // ----------------------------------------------------------------------------
 void btKart::updateVehicle( btScalar step )
 {
-    updateAllWheelTransformsWS();
+    if (m_wheel_rays_cast)
+        m_wheel_rays_cast = false;
+    else
+        updateAllWheelTransformsWS();
 
     for(int i=0; i<m_wheelInfo.size(); i++)
         m_wheelInfo[i].m_was_on_ground = m_wheelInfo[i].m_raycastInfo.m_isInContact;
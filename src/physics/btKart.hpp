@@ -69,7 +69,7 @@ private:
     btScalar calcRollingFriction(btWheelContactPoint& contactPoint);
 
     btScalar            m_damping;
-    btVehicleRaycaster *m_vehicleRaycaster;
+    btKartRaycaster    *m_vehicleRaycaster;
 
     /** Sliding (skidding) will only be permited when this is true. Also check
      *  the friction parameter in the wheels since friction directly affects
@@ -119,10 +119,18 @@ private:
     /** True if the visual wheels touch the ground. */
     bool m_visual_wheels_touch_ground;
 
+    /** True if the wheel raycasts for the next call to updateVehicle() were
+     *  already done by castWheelRays(). */
+    bool m_wheel_rays_cast;
+
     btAlignedObjectArray<btWheelInfo> m_wheelInfo;
 
     void     defaultInit();
     btScalar rayCast(btWheelInfo& wheel, const btVector3& ray);
+    btScalar prepareWheelRay(unsigned int index, float fraction);
+    btScalar updateWheelContact(unsigned int index, btScalar raylen,
+                  void *object,
+                  const btVehicleRaycaster::btVehicleRaycasterResult &result);
     void     updateWheelTransformsWS(btWheelInfo& wheel,
                                      btTransform chassis_trans,
                                      bool interpolatedTransform=true,
@@ -137,7 +145,7 @@ public:
      *         (this is used to get access to the kart properties).
      */
                        btKart(btRigidBody* chassis,
-                              btVehicleRaycaster* raycaster,
+                              btKartRaycaster* raycaster,
                               Kart *kart);
      virtual          ~btKart();
     void               reset();
@@ -178,6 +186,16 @@ public:
         return m_visual_wheels_touch_ground;
     }   // visualWheelsTouchGround
     // ------------------------------------------------------------------------
+    /** Casts the wheel rays for the next call to updateVehicle(), which will
+     *  then not cast them again. The rays of different karts can be cast
+     *  at the same time by different threads, as long as no body is moved
+     *  in the meantime. */
+    void castWheelRays()
+    {
+        updateAllWheelTransformsWS();
+        m_wheel_rays_cast = true;
+    }   // castWheelRays
+    // ------------------------------------------------------------------------
     /** btActionInterface interface. */
     virtual void updateAction(btCollisionWorld* collisionWorld,
                               btScalar step)
@@ -16,26 +16,43 @@
 #include "BulletDynamics/Dynamics/btDynamicsWorld.h"
 
 #include "modes/world.hpp"
+#include "physics/ray_packet.hpp"
 #include "physics/triangle_mesh.hpp"
 #include "tracks/track.hpp"
 
-void* btKartRaycaster::castRay(const btVector3& from, const btVector3& to,
-                               btVehicleRaycasterResult& result)
+#include <algorithm>
+
+namespace
 {
     // ========================================================================
     class ClosestWithNormal : public btCollisionWorld::ClosestRayResultCallback
     {
     private:
         int m_triangle_index;
+
+        /** An object that is ignored by this ray, can be NULL. */
+        const btCollisionObject *m_excluded;
     public:
         /** Constructor, initialises the triangle index. */
         ClosestWithNormal(const btVector3 &from,
-                          const btVector3 &to)
+                          const btVector3 &to,
+                          const btCollisionObject *excluded)
                           : btCollisionWorld::ClosestRayResultCallback(from,to)
         {
             m_triangle_index = -1;
+            m_excluded       = excluded;
         }   // CloestWithNormal
         // --------------------------------------------------------------------
+        /** Ignores the excluded object, otherwise uses the collision
+         *  filter as usual. */
+        virtual bool needsCollision(btBroadphaseProxy* proxy0) const
+        {
+            if (proxy0->m_clientObject == m_excluded)
+                return false;
+            return btCollisionWorld::ClosestRayResultCallback
+                                   ::needsCollision(proxy0);
+        }   // needsCollision
+        // --------------------------------------------------------------------
         /** Stores the index of the triangle hit. */
         virtual    btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult,
                                          bool normalInWorldSpace)
@@ -55,15 +72,230 @@ void* btKartRaycaster::castRay(const btVector3& from, const btVector3& to,
         int getTriangleIndex() const { return m_triangle_index; }
 
     };   // CloestWithNormal
+
     // ========================================================================
+    /** The packet results of the triangle meshes hit by the rays of one
+     *  packet. The packet for a mesh is only cast when the first ray of
+     *  the packet reaches the mesh in the broadphase. */
+    class PacketCache
+    {
+    private:
+        /** Maximum number of meshes stored. Rays hitting more meshes use
+         *  the normal raycast for the additional meshes. */
+        static const unsigned int MAX_OBJECTS = 4;
+
+        struct Entry
+        {
+            const btCollisionObject *m_object;
+            RayPacket::Hit           m_hits[RayPacket::MAX_RAYS];
+        };   // Entry
+        Entry m_entries[MAX_OBJECTS];
+
+        unsigned int     m_num_entries;
+        unsigned int     m_num_rays;
+        const btVector3 *m_from;
+        const btVector3 *m_to;
+
+    public:
+        PacketCache(unsigned int num_rays, const btVector3 *from,
+                    const btVector3 *to)
+        {
+            m_num_entries = 0;
+            m_num_rays    = num_rays;
+            m_from        = from;
+            m_to          = to;
+        }   // PacketCache
+        // --------------------------------------------------------------------
+        /** Returns the hits of all rays with the given object, or NULL if
+         *  the object can not be tested with a packet.
+         *  \param flags The flags of the ray callbacks, which are the same
+         *         for all rays of a packet. */
+        const RayPacket::Hit* getHits(const btCollisionObject *object,
+                                      unsigned int flags)
+        {
+            for (unsigned int i = 0; i < m_num_entries; i++)
+            {
+                if (m_entries[i].m_object == object)
+                    return m_entries[i].m_hits;
+            }
+            if (m_num_entries == MAX_OBJECTS ||
+                !RayPacket::canCastRays(object->getCollisionShape()))
+                return NULL;
+
+            // Transform the rays into the local space of the object, in
+            // the same way as btCollisionWorld::rayTestSingle
+            const btTransform world_to_object =
+                object->getWorldTransform().inverse();
+            btVector3 from[RayPacket::MAX_RAYS], to[RayPacket::MAX_RAYS];
+            for (unsigned int i = 0; i < m_num_rays; i++)
+            {
+                from[i] = world_to_object * m_from[i];
+                to[i]   = world_to_object * m_to[i];
+            }
+            Entry &entry = m_entries[m_num_entries++];
+            entry.m_object = object;
+            RayPacket::castRays(object->getCollisionShape(), m_num_rays,
+                                from, to, flags, entry.m_hits);
+            return entry.m_hits;
+        }   // getHits
+    };   // PacketCache
+
+    // ========================================================================
+    /** Replaces bullet's btSingleRayCallback for one ray of a packet: the
+     *  broadphase is used to find all objects in the same order, but the
+     *  packet result is used for triangle meshes. */
+    class PacketRayCallback : public btBroadphaseRayCallback
+    {
+    private:
+        btTransform                          m_from;
+        btTransform                          m_to;
+        PacketCache                         *m_cache;
+        unsigned int                         m_ray;
+        btCollisionWorld::RayResultCallback *m_result;
+    public:
+        PacketRayCallback(const btVector3 &from, const btVector3 &to,
+                          PacketCache *cache, unsigned int ray,
+                          btCollisionWorld::RayResultCallback *result)
+        {
+            m_from.setIdentity();
+            m_from.setOrigin(from);
+            m_to.setIdentity();
+            m_to.setOrigin(to);
+            m_cache  = cache;
+            m_ray    = ray;
+            m_result = result;
+
+            // Same as the constructor of btSingleRayCallback
+            btVector3 dir = to - from;
+            dir.normalize();
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                m_rayDirectionInverse[i] = dir[i] == btScalar(0.0)
+                                         ? btScalar(BT_LARGE_FLOAT)
+                                         : btScalar(1.0) / dir[i];
+                m_signs[i] = m_rayDirectionInverse[i] < 0.0;
+            }
+            m_lambda_max = dir.dot(to - from);
+        }   // PacketRayCallback
+        // --------------------------------------------------------------------
+        virtual bool process(const btBroadphaseProxy* proxy)
+        {
+            // Terminate further ray tests once the closest hit fraction
+            // reached zero, as bullet does
+            if (m_result->m_closestHitFraction == btScalar(0.f))
+                return false;
+
+            btCollisionObject *object =
+                (btCollisionObject*)proxy->m_clientObject;
+            if (!m_result->needsCollision(object->getBroadphaseHandle()))
+                return true;
+
+            const RayPacket::Hit *hits = m_cache->getHits(object,
+                                                          m_result->m_flags);
+            if (!hits)
+            {
+                btCollisionWorld::rayTestSingle(m_from, m_to, object,
+                                                object->getCollisionShape(),
+                                                object->getWorldTransform(),
+                                                *m_result);
+                return true;
+            }
+            // Bullet would report the closest hit of this mesh (and
+            // possibly other hits before it) only if it is closer than
+            // the current closest hit, so the final result is the same.
+            const RayPacket::Hit &hit = hits[m_ray];
+            if (hit.m_hit && hit.m_fraction < m_result->m_closestHitFraction)
+            {
+                btCollisionWorld::LocalShapeInfo shape_info;
+                shape_info.m_shapePart     = hit.m_part;
+                shape_info.m_triangleIndex = hit.m_triangle;
+                btCollisionWorld::LocalRayResult ray_result(object,
+                    &shape_info,
+                    object->getWorldTransform().getBasis() * hit.m_normal,
+                    hit.m_fraction);
+                m_result->addSingleResult(ray_result,
+                                          /*normalInWorldSpace*/true);
+            }
+            return true;
+        }   // process
+    };   // PacketRayCallback
 
-    ClosestWithNormal rayCallback(from,to);
+}   // anonymous namespace
+
+// ----------------------------------------------------------------------------
+/** Casts a ray from 'from' to 'to'.
+ *  \param excluded An object that can not be hit (e.g. the chassis of the
+ *         kart casting the ray), or NULL. Excluding the object here instead
+ *         of changing its collision filter group allows rays of different
+ *         karts to be cast at the same time.
+ */
+void* btKartRaycaster::castRay(const btVector3& from, const btVector3& to,
+                               btVehicleRaycasterResult& result,
+                               const btCollisionObject *excluded)
+{
+    ClosestWithNormal rayCallback(from, to, excluded);
 
     m_dynamicsWorld->rayTest(from, to, rayCallback);
 
+    return setResult(rayCallback, rayCallback.getTriangleIndex(), result);
+}   // castRay
+
+// ----------------------------------------------------------------------------
+/** Casts several rays, e.g. the rays of all wheels of a kart, with exactly
+ *  the same results as calling castRay() for each ray. Up to
+ *  RayPacket::MAX_RAYS rays are cast as a packet: each triangle mesh (e.g.
+ *  the track) reached by any of these rays is traversed only once for all
+ *  of them. This matters most when many ticks are resimulated in a rewind.
+ *  \param num_rays Number of rays.
+ *  \param from, to Start and end points of the rays.
+ *  \param results On return the result for each ray.
+ *  \param objects On return the object hit by each ray (as returned by
+ *         castRay()).
+ *  \param excluded An object that can not be hit, or NULL.
+ */
+void btKartRaycaster::castRays(unsigned int num_rays, const btVector3 *from,
+                               const btVector3 *to,
+                               btVehicleRaycasterResult *results,
+                               void **objects,
+                               const btCollisionObject *excluded)
+{
+    for (unsigned int first = 0; first < num_rays;
+         first += RayPacket::MAX_RAYS)
+    {
+        const unsigned int count = std::min(num_rays - first,
+                                            RayPacket::MAX_RAYS);
+        PacketCache cache(count, from + first, to + first);
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            ClosestWithNormal ray_callback(from[i], to[i], excluded);
+            PacketRayCallback packet_callback(from[i], to[i], &cache,
+                                              i - first, &ray_callback);
+            m_dynamicsWorld->getBroadphase()->rayTest(from[i], to[i],
+                                                      packet_callback);
+            objects[i] = setResult(ray_callback,
+                                   ray_callback.getTriangleIndex(),
+                                   results[i]);
+        }
+    }
+}   // castRays
+
+// ----------------------------------------------------------------------------
+/** Sets the result of a raycast.
+ *  \param rayCallback The ray callback after the raycast.
+ *  \param triangle_index Index of the triangle hit, or -1.
+ *  \param result The result to set.
+ *  \return The object hit, or NULL if no object with contact response
+ *          was hit.
+ */
+void* btKartRaycaster::setResult(
+                  const btCollisionWorld::ClosestRayResultCallback &rayCallback,
+                  int triangle_index,
+                  btVehicleRaycasterResult &result) const
+{
     if (rayCallback.hasHit())
     {
-        btRigidBody* body = btRigidBody::upcast(rayCallback.m_collisionObject);
+        const btRigidBody* body =
+            btRigidBody::upcast(rayCallback.m_collisionObject);
         if (body && body->hasContactResponse())
         {
             result.m_hitPointInWorld = rayCallback.m_hitPointWorld;
@@ -79,19 +311,19 @@ void* btKartRaycaster::castRay(const btVector3& from, const btVector3& to,
             // different triangle mesh). TODO: Add a mapping from bullet
             // objects back to triangle meshes, so that it's easy to pick up
             // the right triangle mesh for smoothing
-            TriangleMesh::RigidBodyTriangleMesh *rbtm =
-                dynamic_cast<TriangleMesh::RigidBodyTriangleMesh*>(body);
+            const TriangleMesh::RigidBodyTriangleMesh *rbtm =
+                dynamic_cast<const TriangleMesh::RigidBodyTriangleMesh*>(body);
             if(m_smooth_normals &&
-                rayCallback.getTriangleIndex()>-1 &&
+                triangle_index>-1 &&
                 rbtm != NULL                         )
             {
 #undef DEBUG_NORMALS
 #ifdef DEBUG_NORMALS
                 btVector3 n=result.m_hitNormalInWorld;
 #endif
-                result.m_triangle_index = rayCallback.getTriangleIndex();
+                result.m_triangle_index = triangle_index;
                 result.m_hitNormalInWorld =
-                    rbtm->m_triangle_mesh->getInterpolatedNormal(rayCallback.getTriangleIndex(),
+                    rbtm->m_triangle_mesh->getInterpolatedNormal(triangle_index,
                                              result.m_hitPointInWorld);
 #ifdef DEBUG_NORMALS
                 printf("old %f %f %f new %f %f %f\n",
@@ -101,9 +333,8 @@ void* btKartRaycaster::castRay(const btVector3& from, const btVector3& to,
                     result.m_hitNormalInWorld.getZ());
 #endif
             }
-            return body;
+            return (void*)body;
         }
     }
     return 0;
-}
-
+}   // setResult
@@ -11,6 +11,7 @@
 #ifndef BTKARTRAYCAST_HPP
 #define BTKARTRAYCAST_HPP
 
+#include "BulletCollision/CollisionDispatch/btCollisionWorld.h"
 #include "BulletDynamics/Dynamics/btRigidBody.h"
 #include "BulletDynamics/ConstraintSolver/btTypedConstraint.h"
 #include "BulletDynamics/Vehicle/btVehicleRaycaster.h"
@@ -27,6 +28,10 @@ private:
     /** True if the normals should be smoothed. Not all tracks support this,
     *  so this flag is set depending on track when constructing this object. */
     bool                m_smooth_normals;
+
+    void* setResult(const btCollisionWorld::ClosestRayResultCallback &callback,
+                    int triangle_index,
+                    btVehicleRaycasterResult &result) const;
 public:
     btKartRaycaster(btDynamicsWorld* world, bool smooth_normals=false)
         :m_dynamicsWorld(world), m_smooth_normals(smooth_normals)
@@ -34,7 +39,16 @@ public:
     }
 
     virtual void* castRay(const btVector3& from,const btVector3& to,
-                          btVehicleRaycasterResult& result);
+                          btVehicleRaycasterResult& result)
+    {
+        return castRay(from, to, result, NULL);
+    }   // castRay
+    void* castRay(const btVector3& from, const btVector3& to,
+                  btVehicleRaycasterResult& result,
+                  const btCollisionObject *excluded);
+    void  castRays(unsigned int num_rays, const btVector3 *from,
+                   const btVector3 *to, btVehicleRaycasterResult *results,
+                   void **objects, const btCollisionObject *excluded);
 
 };
 
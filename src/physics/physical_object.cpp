@@ -812,16 +812,16 @@ void PhysicalObject::computeError()
 }   // computeError
 
 // ----------------------------------------------------------------------------
-BareNetworkString* PhysicalObject::saveState(std::vector<std::string>* ru)
+bool PhysicalObject::saveState(BareNetworkString* buffer)
 {
     bool has_live_join = false;
 
     if (auto sl = LobbyProtocol::get<LobbyProtocol>())
         has_live_join = sl->hasLiveJoiningRecently();
 
-    BareNetworkString* buffer = new BareNetworkString();
     // This will compress and round down values of body, use the rounded
-    // down value to test if sending state is needed
+    // down value to test if sending state is needed (the compressed data is
+    // discarded by the caller if not)
     // If any client live-joined always send new state for this object
     CompressNetworkBody::compress(m_body, m_motion_state, buffer);
     btTransform cur_transform = m_body->getWorldTransform();
@@ -833,17 +833,28 @@ BareNetworkString* PhysicalObject::saveState(std::vector<std::string>* ru)
         (current_lv - m_last_lv).length() < 0.01f &&
         (current_av - m_last_av).length() < 0.01f && !has_live_join)
     {
-        delete buffer;
-        return nullptr;
+        return false;
     }
 
-    ru->push_back(getUniqueIdentity());
+    // A client saves its predicted state to compare it with the server
+    // state, the last values are only updated by states from the server
+    if (!NetworkConfig::get()->isServer())
+        return true;
+
     m_last_transform = cur_transform;
     m_last_lv = current_lv;
     m_last_av = current_av;
-    return buffer;
+    return true;
 }   // saveState
 
+// ----------------------------------------------------------------------------
+bool PhysicalObject::isStateMatching(BareNetworkString* predicted,
+                                     BareNetworkString* confirmed, int count)
+{
+    return CompressNetworkBody::isMatching(predicted, confirmed,
+        stk_config->m_network_max_prediction_error);
+}   // isStateMatching
+
 // ----------------------------------------------------------------------------
 void PhysicalObject::restoreState(BareNetworkString *buffer, int count)
 {
@@ -285,7 +285,9 @@ public:
     void addForRewind();
     virtual void saveTransform();
     virtual void computeError();
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru);
+    virtual bool saveState(BareNetworkString* buffer);
+    virtual bool isStateMatching(BareNetworkString* predicted,
+                                 BareNetworkString* confirmed, int count);
     virtual void undoEvent(BareNetworkString *buffer) {}
     virtual void rewindToEvent(BareNetworkString *buffer) {}
     virtual void restoreState(BareNetworkString *buffer, int count);
@@ -24,6 +24,7 @@
 #include "config/user_config.hpp"
 #include "karts/abstract_kart.hpp"
 #include "graphics/irr_driver.hpp"
+#include "graphics/material.hpp"
 #include "graphics/stars.hpp"
 #include "items/flyable.hpp"
 #include "karts/kart_properties.hpp"
@@ -66,7 +67,10 @@ void Physics::init(const Vec3 &world_min, const Vec3 &world_max)
     m_dynamics_world      = new STKDynamicsWorld(m_dispatcher,
                                                  m_axis_sweep,
                                                  this,
-                                                 m_collision_conf);
+                                                 m_collision_conf,
+                                                 this);
+    if(UserConfigParams::m_physics_threads > 1)
+        m_dynamics_world->setNumThreads(UserConfigParams::m_physics_threads);
     m_karts_to_delete.clear();
     m_dynamics_world->setGravity(
         btVector3(0.0f,
@@ -554,6 +558,17 @@ btScalar Physics::solveGroup(btCollisionObject** bodies, int numBodies,
                                                         debugDrawer,
                                                         stackAlloc,
                                                         dispatcher);
+    processContactManifolds();
+    return returnValue;
+}   // solveGroup
+
+// ----------------------------------------------------------------------------
+/** Stores all collisions of the current contact manifolds in the list of
+ *  collisions, and informs karts and physical objects about hitting the
+ *  track. This is called after each group of islands was solved.
+ */
+void Physics::processContactManifolds()
+{
     int currentNumManifolds = m_dispatcher->getNumManifolds();
     // We can't explode a rocket in a loop, since a rocket might collide with
     // more than one object, and/or more than once with each object (if there
@@ -726,8 +741,65 @@ btScalar Physics::solveGroup(btCollisionObject** bodies, int numBodies,
             assert("Unknown user pointer");           // 4) Should never happen
     }   // for i<numManifolds
 
-    return returnValue;
-}   // solveGroup
+}   // processContactManifolds
+
+// ----------------------------------------------------------------------------
+/** Returns true if the islands of the current physics step can be solved
+ *  in parallel. processContactManifolds() is called after each group of
+ *  islands is solved, so if it modifies a body (e.g. a kart pushed back by
+ *  the track, or a soccer ball pushed by a material), the result depends on
+ *  the groups that were solved before. Only if no such contact exists the
+ *  parallel result is identical to the sequential one.
+ */
+bool Physics::canSolveIslandsInParallel() const
+{
+    int num_manifolds = m_dispatcher->getNumManifolds();
+    for(int i=0; i<num_manifolds; i++)
+    {
+        const btPersistentManifold* contact_manifold =
+            m_dispatcher->getManifoldByIndexInternal(i);
+        if(!contact_manifold->getNumContacts()) continue;
+
+        const btCollisionObject* objA =
+            static_cast<const btCollisionObject*>(contact_manifold->getBody0());
+        const btCollisionObject* objB =
+            static_cast<const btCollisionObject*>(contact_manifold->getBody1());
+        const UserPointer *upA = (UserPointer*)(objA->getUserPointer());
+        const UserPointer *upB = (UserPointer*)(objB->getUserPointer());
+        if(!upA || !upB) continue;
+
+        // Bullet always seems to use the track as object B, the other
+        // case is not worth optimising.
+        if(upA->is(UserPointer::UP_TRACK))
+            return false;
+        if(!upB->is(UserPointer::UP_TRACK))
+            continue;
+
+        if(upA->is(UserPointer::UP_KART))
+        {
+            int n = contact_manifold->getContactPoint(0).m_index1;
+            const Material *m
+                = n>=0 ? upB->getPointerTriangleMesh()->getMaterial(n) : NULL;
+            if(m && m->getCollisionReaction()!=Material::NORMAL)
+                return false;
+        }
+        else if(upA->is(UserPointer::UP_PHYSICAL_OBJECT) &&
+                upA->getPointerPhysicalObject()->isSoccerBall())
+        {
+            for(int j=0; j<contact_manifold->getNumContacts(); j++)
+            {
+                int n = contact_manifold->getContactPoint(j).m_index1;
+                const Material *m
+                    = n>=0 ? upB->getPointerTriangleMesh()->getMaterial(n)
+                           : NULL;
+                if(m && m->getCollisionReaction() ==
+                        Material::PUSH_SOCCER_BALL)
+                    return false;
+            }
+        }
+    }   // for i<num_manifolds
+    return true;
+}   // canSolveIslandsInParallel
 
 // ----------------------------------------------------------------------------
 /** A debug draw function to show the track and all karts.
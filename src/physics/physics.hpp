@@ -177,6 +177,8 @@ public:
     /** Returns true if the debug drawer is enabled. */
     bool  isDebug() const     {return m_debug_drawer->debugEnabled(); }
     IrrDebugDrawer* getDebugDrawer() { return m_debug_drawer; }
+    void  processContactManifolds();
+    bool  canSolveIslandsInParallel() const;
     virtual btScalar solveGroup(btCollisionObject** bodies, int numBodies,
                                 btPersistentManifold** manifold,int numManifolds,
                                 btTypedConstraint** constraints,int numConstraints,
@@ -0,0 +1,494 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "physics/ray_packet.hpp"
+
+#include "physics/btKartRaycast.hpp"
+#include "physics/triangle_mesh.hpp"
+#include "utils/log.hpp"
+
+#include "BulletCollision/NarrowPhaseCollision/btRaycastCallback.h"
+
+// The node tests must give exactly the same results as bullet's scalar
+// code, so SSE is only used if the compiler uses SSE for scalar float math,
+// too (and not the x87 FPU with its higher internal precision).
+#if !defined(BT_USE_DOUBLE_PRECISION) && (defined(__SSE2_MATH__) || \
+    defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #include <emmintrin.h>
+  #define RAY_PACKET_SSE
+#endif
+
+namespace
+{
+    /** Stores the closest hit of one ray of the packet. */
+    class HitCallback : public btTriangleRaycastCallback
+    {
+    private:
+        RayPacket::Hit *m_hit;
+    public:
+        HitCallback() : btTriangleRaycastCallback(btVector3(0, 0, 0),
+                                                  btVector3(0, 0, 0)),
+                        m_hit(NULL)
+        {
+        }   // HitCallback
+        // --------------------------------------------------------------------
+        /** Sets the ray, with the same start values as the constructor of
+         *  btTriangleRaycastCallback. */
+        void init(const btVector3 &from, const btVector3 &to,
+                  unsigned int flags, RayPacket::Hit *hit)
+        {
+            m_from            = from;
+            m_to              = to;
+            m_flags           = flags;
+            m_hitFraction     = 1.0f;
+            m_hit             = hit;
+            m_hit->m_hit      = false;
+            m_hit->m_fraction = 1.0f;
+            m_hit->m_normal   = btVector3(0, 0, 0);
+            m_hit->m_part     = -1;
+            m_hit->m_triangle = -1;
+        }   // init
+        // --------------------------------------------------------------------
+        virtual btScalar reportHit(const btVector3 &normal, btScalar fraction,
+                                   int part, int triangle)
+        {
+            m_hit->m_hit      = true;
+            m_hit->m_fraction = fraction;
+            m_hit->m_normal   = normal;
+            m_hit->m_part     = part;
+            m_hit->m_triangle = triangle;
+            return fraction;
+        }   // reportHit
+    };   // HitCallback
+
+    // ------------------------------------------------------------------------
+    /** Reads the vertices of a triangle exactly like the node callback of
+     *  btBvhTriangleMeshShape::performRaycast. */
+    void getTriangle(const btStridingMeshInterface *mesh, int part,
+                     int index, btVector3 *triangle)
+    {
+        const unsigned char *vertex_base;
+        const unsigned char *index_base;
+        int num_vertices, stride, index_stride, num_faces;
+        PHY_ScalarType type, index_type;
+        mesh->getLockedReadOnlyVertexIndexBase(&vertex_base, num_vertices,
+                                               type, stride, &index_base,
+                                               index_stride, num_faces,
+                                               index_type, part);
+        const unsigned int *indices =
+            (const unsigned int*)(index_base + index * index_stride);
+        const btVector3 &scaling = mesh->getScaling();
+        for (int j = 2; j >= 0; j--)
+        {
+            int vertex = index_type == PHY_SHORT
+                       ? ((const unsigned short*)indices)[j] : indices[j];
+            if (type == PHY_FLOAT)
+            {
+                const float *v = (const float*)(vertex_base + vertex*stride);
+                triangle[j] = btVector3(v[0] * scaling.getX(),
+                                        v[1] * scaling.getY(),
+                                        v[2] * scaling.getZ());
+            }
+            else
+            {
+                const double *v = (const double*)(vertex_base+vertex*stride);
+                triangle[j] = btVector3(btScalar(v[0]) * scaling.getX(),
+                                        btScalar(v[1]) * scaling.getY(),
+                                        btScalar(v[2]) * scaling.getZ());
+            }
+        }
+        mesh->unLockReadOnlyVertexBase(part);
+    }   // getTriangle
+
+    // ========================================================================
+    /** The rays of a packet, prepared for the node tests in the same way as
+     *  in btQuantizedBvh::walkStacklessTreeAgainstRay. */
+    class PacketRays
+    {
+    private:
+        unsigned int m_num_rays;
+        btVector3    m_from[RayPacket::MAX_RAYS];
+        btVector3    m_aabb_min[RayPacket::MAX_RAYS];
+        btVector3    m_aabb_max[RayPacket::MAX_RAYS];
+        btVector3    m_inverse_direction[RayPacket::MAX_RAYS];
+        unsigned int m_sign[RayPacket::MAX_RAYS][3];
+        btScalar     m_lambda_max[RayPacket::MAX_RAYS];
+#ifdef RAY_PACKET_SSE
+        /** The same data transposed, one register per coordinate. The
+         *  signs are stored as masks. */
+        __m128 m_sse_from[3], m_sse_min[3], m_sse_max[3];
+        __m128 m_sse_inverse[3], m_sse_sign[3], m_sse_lambda_max;
+
+        // --------------------------------------------------------------------
+        /** Returns a register with coordinate j of the vectors v of all
+         *  rays. Unused lanes repeat the first ray, their results are
+         *  ignored anyway. */
+        __m128 transpose(const btVector3 *v, unsigned int j) const
+        {
+            float lanes[RayPacket::MAX_RAYS];
+            for (unsigned int i = 0; i < RayPacket::MAX_RAYS; i++)
+                lanes[i] = v[i < m_num_rays ? i : 0][j];
+            return _mm_loadu_ps(lanes);
+        }   // transpose
+#endif
+
+    public:
+        PacketRays(unsigned int num_rays, const btVector3 *from,
+                   const btVector3 *to)
+        {
+            m_num_rays = num_rays;
+            for (unsigned int i = 0; i < num_rays; i++)
+            {
+                m_from[i]     = from[i];
+                m_aabb_min[i] = from[i];
+                m_aabb_min[i].setMin(to[i]);
+                m_aabb_max[i] = from[i];
+                m_aabb_max[i].setMax(to[i]);
+                btVector3 dir = to[i] - from[i];
+                dir.normalize();
+                m_lambda_max[i] = dir.dot(to[i] - from[i]);
+                for (unsigned int j = 0; j < 3; j++)
+                {
+                    m_inverse_direction[i][j] =
+                        dir[j] == btScalar(0.0) ? btScalar(BT_LARGE_FLOAT)
+                                                : btScalar(1.0) / dir[j];
+                    m_sign[i][j] = m_inverse_direction[i][j] < 0.0;
+                }
+            }
+#ifdef RAY_PACKET_SSE
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                m_sse_from[j]    = transpose(m_from,              j);
+                m_sse_min[j]     = transpose(m_aabb_min,          j);
+                m_sse_max[j]     = transpose(m_aabb_max,          j);
+                m_sse_inverse[j] = transpose(m_inverse_direction, j);
+                m_sse_sign[j]    = _mm_cmplt_ps(m_sse_inverse[j],
+                                                _mm_setzero_ps());
+            }
+            float lambda[RayPacket::MAX_RAYS];
+            for (unsigned int i = 0; i < RayPacket::MAX_RAYS; i++)
+                lambda[i] = m_lambda_max[i < m_num_rays ? i : 0];
+            m_sse_lambda_max = _mm_loadu_ps(lambda);
+#endif
+        }   // PacketRays
+
+        // --------------------------------------------------------------------
+        /** Returns a bit mask of all rays that overlap the node, using the
+         *  same two tests as bullet: TestAabbAgainstAabb2 with the bounding
+         *  box of the ray, and btRayAabb2. */
+        unsigned int testNode(const btOptimizedBvhNode &node) const
+        {
+#ifdef RAY_PACKET_SSE
+            __m128 miss = _mm_setzero_ps();
+            __m128 tmin = _mm_setzero_ps(), tmax = _mm_setzero_ps();
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                const __m128 node_min = _mm_set1_ps(node.m_aabbMinOrg[j]);
+                const __m128 node_max = _mm_set1_ps(node.m_aabbMaxOrg[j]);
+                miss = _mm_or_ps(miss,
+                                 _mm_or_ps(_mm_cmpgt_ps(m_sse_min[j],
+                                                        node_max),
+                                           _mm_cmplt_ps(m_sse_max[j],
+                                                        node_min)));
+                // The near and far side of the box (bounds[sign] and
+                // bounds[1-sign] in btRayAabb2)
+                const __m128 sign = m_sse_sign[j];
+                const __m128 near_side = _mm_or_ps(_mm_and_ps(sign, node_max),
+                                                _mm_andnot_ps(sign, node_min));
+                const __m128 far_side = _mm_or_ps(_mm_and_ps(sign, node_min),
+                                               _mm_andnot_ps(sign, node_max));
+                const __m128 t0 = _mm_mul_ps(_mm_sub_ps(near_side,
+                                                        m_sse_from[j]),
+                                             m_sse_inverse[j]);
+                const __m128 t1 = _mm_mul_ps(_mm_sub_ps(far_side,
+                                                        m_sse_from[j]),
+                                             m_sse_inverse[j]);
+                if (j == 0)
+                {
+                    tmin = t0;
+                    tmax = t1;
+                    continue;
+                }
+                miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmpgt_ps(tmin, t1),
+                                                 _mm_cmpgt_ps(t0, tmax)));
+                // Same as 'if (t0 > tmin) tmin = t0;' and
+                // 'if (t1 < tmax) tmax = t1;'
+                tmin = _mm_max_ps(t0, tmin);
+                tmax = _mm_min_ps(t1, tmax);
+            }
+            const __m128 hit = _mm_and_ps(
+                                 _mm_cmplt_ps(tmin, m_sse_lambda_max),
+                                 _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+            return _mm_movemask_ps(_mm_andnot_ps(miss, hit))
+                 & ((1 << m_num_rays) - 1);
+#else
+            unsigned int mask = 0;
+            for (unsigned int i = 0; i < m_num_rays; i++)
+            {
+                if (!TestAabbAgainstAabb2(m_aabb_min[i], m_aabb_max[i],
+                                          node.m_aabbMinOrg,
+                                          node.m_aabbMaxOrg))
+                    continue;
+                const btVector3 bounds[2] = { node.m_aabbMinOrg,
+                                              node.m_aabbMaxOrg };
+                btScalar param = 1.0f;
+                if (btRayAabb2(m_from[i], m_inverse_direction[i], m_sign[i],
+                               bounds, param, 0.0f, m_lambda_max[i]))
+                    mask |= 1 << i;
+            }
+            return mask;
+#endif
+        }   // testNode
+    };   // PacketRays
+
+}   // anonymous namespace
+
+// ----------------------------------------------------------------------------
+/** Returns true if castRays() supports the given shape: a triangle mesh
+ *  with a bvh that is not quantized (which is what TriangleMesh creates).
+ */
+bool RayPacket::canCastRays(const btCollisionShape *shape)
+{
+    if (shape->getShapeType() != TRIANGLE_MESH_SHAPE_PROXYTYPE)
+        return false;
+    btOptimizedBvh *bvh = const_cast<btBvhTriangleMeshShape*>(
+        static_cast<const btBvhTriangleMeshShape*>(shape))->getOptimizedBvh();
+    return bvh && !bvh->isQuantized();
+}   // canCastRays
+
+// ----------------------------------------------------------------------------
+/** Casts up to MAX_RAYS rays against a shape, which must be supported
+ *  according to canCastRays(). The bvh is walked once: a node is entered if
+ *  any ray overlaps it, and a triangle is tested for exactly the rays that
+ *  overlap its leaf. Since the box of a node contains the boxes of all its
+ *  children, these are the rays that reach the leaf in bullet's traversal.
+ *  \param shape The shape to cast the rays against.
+ *  \param num_rays Number of rays, at most MAX_RAYS.
+ *  \param from, to Start and end points of the rays in the local space of
+ *         the shape.
+ *  \param flags Flags for btTriangleRaycastCallback (e.g. backface
+ *         filtering).
+ *  \param hits On return the closest hit of each ray.
+ */
+void RayPacket::castRays(const btCollisionShape *shape, unsigned int num_rays,
+                         const btVector3 *from, const btVector3 *to,
+                         unsigned int flags, Hit *hits)
+{
+    assert(canCastRays(shape));
+    assert(num_rays > 0 && num_rays <= MAX_RAYS);
+    btBvhTriangleMeshShape *mesh_shape = const_cast<btBvhTriangleMeshShape*>(
+        static_cast<const btBvhTriangleMeshShape*>(shape));
+    const btStridingMeshInterface *mesh = mesh_shape->getMeshInterface();
+    const btOptimizedBvh *bvh = mesh_shape->getOptimizedBvh();
+    const NodeArray &nodes = bvh->getContiguousNodeArray();
+    const int num_nodes = bvh->getNumNodes();
+
+    HitCallback callbacks[MAX_RAYS];
+    for (unsigned int i = 0; i < num_rays; i++)
+        callbacks[i].init(from[i], to[i], flags, &hits[i]);
+    const PacketRays rays(num_rays, from, to);
+
+    int index = 0;
+    while (index < num_nodes)
+    {
+        const btOptimizedBvhNode &node = nodes[index];
+        const unsigned int mask = rays.testNode(node);
+        const bool is_leaf = node.m_escapeIndex == -1;
+        if (is_leaf && mask)
+        {
+            btVector3 triangle[3];
+            getTriangle(mesh, node.m_subPart, node.m_triangleIndex, triangle);
+            for (unsigned int i = 0; i < num_rays; i++)
+            {
+                if (mask & (1 << i))
+                {
+                    callbacks[i].processTriangle(triangle, node.m_subPart,
+                                                 node.m_triangleIndex);
+                }
+            }
+        }
+        if (mask || is_leaf)
+            index++;
+        else
+            index += node.m_escapeIndex;
+    }
+}   // castRays
+
+// ----------------------------------------------------------------------------
+/** Compares packets of rays with bullet's raycast, and the rays cast with
+ *  btKartRaycaster::castRays with castRay: the results must be identical.
+ */
+void RayPacket::unitTesting()
+{
+    // A bumpy terrain of 32x32 quads with a few walls, so that rays can hit
+    // front and back faces
+    TriangleMesh terrain(/*can_be_transformed*/false);
+    TriangleMesh walls(/*can_be_transformed*/false);
+    const btVector3 up(0, 1, 0);
+    auto height = [](int x, int z)
+    {
+        return sinf(x * 0.5f) * cosf(z * 0.3f);
+    };
+    for (int x = 0; x < 32; x++)
+    {
+        for (int z = 0; z < 32; z++)
+        {
+            const btVector3 p1(x,     height(x,     z    ), z    );
+            const btVector3 p2(x + 1, height(x + 1, z    ), z    );
+            const btVector3 p3(x,     height(x,     z + 1), z + 1);
+            const btVector3 p4(x + 1, height(x + 1, z + 1), z + 1);
+            terrain.addTriangle(p1, p2, p3, up, up, up, NULL);
+            terrain.addTriangle(p2, p4, p3, up, up, up, NULL);
+            // The walls duplicate some terrain triangles, so that the
+            // order of the objects matters for rays hitting them
+            if (x % 8 == 0)
+            {
+                walls.addTriangle(p1, p2, p3, up, up, up, NULL);
+                walls.addTriangle(p1, p2, p1 + up * 2.0f, up, up, up, NULL);
+            }
+        }
+    }
+    terrain.createCollisionShape(/*create_collision_object*/false);
+    walls.createCollisionShape(/*create_collision_object*/false);
+    btCollisionShape *shape = &terrain.getCollisionShape();
+    assert(canCastRays(shape));
+
+    // Returns a ray for a test index, including vertical rays, rays
+    // parallel to the x axis, rays from below and rays missing everything
+    auto getRay = [](unsigned int n, btVector3 *from, btVector3 *to)
+    {
+        *from = btVector3((n * 7) % 340 * 0.1f - 1.0f, 3.0f - (n % 5),
+                          (n * 13) % 340 * 0.1f - 1.0f);
+        switch (n % 4)
+        {
+        case 0: *to = *from + btVector3(0, -6.0f, 0);            break;
+        case 1: *to = *from + btVector3(0.5f, -10.0f, -0.3f);    break;
+        case 2: *to = *from + btVector3(3.0f, 0, 0);             break;
+        case 3: *to = *from + btVector3(-1.0f, 4.0f, 2.0f);      break;
+        }
+    };   // getRay
+
+    // Compares only x, y and z, the w component is not always set
+    auto same = [](const btVector3 &a, const btVector3 &b)
+    {
+        return a.getX() == b.getX() && a.getY() == b.getY() &&
+               a.getZ() == b.getZ();
+    };   // same
+
+    unsigned int ray = 0;
+    for (unsigned int flags = 0;
+         flags <= btTriangleRaycastCallback::kF_FilterBackfaces; flags++)
+    {
+        for (unsigned int packet = 0; packet < 1000; packet++)
+        {
+            const unsigned int num_rays = 1 + packet % MAX_RAYS;
+            btVector3 from[MAX_RAYS], to[MAX_RAYS];
+            Hit hits[MAX_RAYS];
+            for (unsigned int i = 0; i < num_rays; i++)
+                getRay(ray++, &from[i], &to[i]);
+            castRays(shape, num_rays, from, to, flags, hits);
+            for (unsigned int i = 0; i < num_rays; i++)
+            {
+                Hit expected;
+                HitCallback callback;
+                callback.init(from[i], to[i], flags, &expected);
+                static_cast<btBvhTriangleMeshShape*>(shape)
+                    ->performRaycast(&callback, from[i], to[i]);
+                if (hits[i].m_hit != expected.m_hit ||
+                    hits[i].m_fraction != expected.m_fraction ||
+                    !same(hits[i].m_normal, expected.m_normal) ||
+                    hits[i].m_part != expected.m_part ||
+                    hits[i].m_triangle != expected.m_triangle)
+                {
+                    Log::fatal("RayPacket", "Ray %u differs from bullet.",
+                               ray);
+                }
+            }
+        }
+    }
+
+    // Now the same in a world with a transformed terrain, the walls and
+    // two boxes, one of which is excluded from the rays
+    btDefaultCollisionConfiguration conf;
+    btCollisionDispatcher dispatcher(&conf);
+    btAxisSweep3 broadphase(btVector3(-100, -100, -100),
+                            btVector3( 100,  100,  100));
+    btSequentialImpulseConstraintSolver solver;
+    btDiscreteDynamicsWorld world(&dispatcher, &broadphase, &solver, &conf);
+    btBoxShape box_shape(btVector3(4.0f, 0.5f, 4.0f));
+    btRigidBody::btRigidBodyConstructionInfo info(0, NULL, shape);
+    info.m_startWorldTransform.setRotation(btQuaternion(up, 0.1f));
+    info.m_startWorldTransform.setOrigin(btVector3(0.3f, -0.2f, 0.1f));
+    TriangleMesh::RigidBodyTriangleMesh terrain_body(&terrain, info);
+    // The walls use the same transform, so some rays hit both meshes at
+    // exactly the same distance
+    info.m_collisionShape = &walls.getCollisionShape();
+    TriangleMesh::RigidBodyTriangleMesh walls_body(&walls, info);
+    info.m_collisionShape = &box_shape;
+    info.m_startWorldTransform.setIdentity();
+    info.m_startWorldTransform.setOrigin(btVector3(16.0f, 1.0f, 16.0f));
+    btRigidBody box(info);
+    info.m_startWorldTransform.setOrigin(btVector3(8.0f, 1.0f, 24.0f));
+    btRigidBody excluded(info);
+    world.addRigidBody(&terrain_body);
+    world.addRigidBody(&walls_body);
+    world.addRigidBody(&box);
+    world.addRigidBody(&excluded);
+
+    for (unsigned int smooth = 0; smooth < 2; smooth++)
+    {
+        btKartRaycaster raycaster(&world, smooth == 1);
+        for (unsigned int batch = 0; batch < 500; batch++)
+        {
+            // Also test batches larger than one packet
+            const unsigned int num_rays = 1 + batch % (MAX_RAYS + 3);
+            btVector3 from[MAX_RAYS + 3], to[MAX_RAYS + 3];
+            btVehicleRaycaster::btVehicleRaycasterResult results[MAX_RAYS+3];
+            void *objects[MAX_RAYS + 3];
+            for (unsigned int i = 0; i < num_rays; i++)
+                getRay(ray++, &from[i], &to[i]);
+            raycaster.castRays(num_rays, from, to, results, objects,
+                               &excluded);
+            for (unsigned int i = 0; i < num_rays; i++)
+            {
+                btVehicleRaycaster::btVehicleRaycasterResult expected;
+                void *object = raycaster.castRay(from[i], to[i], expected,
+                                                 &excluded);
+                if (objects[i] != object ||
+                    (object &&
+                     (!same(results[i].m_hitPointInWorld,
+                            expected.m_hitPointInWorld) ||
+                      !same(results[i].m_hitNormalInWorld,
+                            expected.m_hitNormalInWorld) ||
+                      results[i].m_distFraction != expected.m_distFraction ||
+                      results[i].m_triangle_index !=
+                                                 expected.m_triangle_index)))
+                {
+                    Log::fatal("RayPacket",
+                               "castRays differs from castRay for ray %u.",
+                               ray);
+                }
+            }
+        }
+    }
+    world.removeRigidBody(&excluded);
+    world.removeRigidBody(&box);
+    world.removeRigidBody(&walls_body);
+    world.removeRigidBody(&terrain_body);
+}   // unitTesting
@@ -0,0 +1,63 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_RAY_PACKET_HPP
+#define HEADER_RAY_PACKET_HPP
+
+#include "btBulletDynamicsCommon.h"
+
+/** Casts a packet of up to four rays at once against the bvh of a triangle
+ *  mesh shape. The tree is only traversed once for all rays, and the node
+ *  tests of all rays are done with one SIMD instruction where available.
+ *  The result for each ray is bit-identical to bullet's
+ *  btBvhTriangleMeshShape::performRaycast with a btTriangleRaycastCallback
+ *  (with a hit fraction of 1): the same triangles are tested in the same
+ *  order with the same code, so replacing a raycast with a packet does not
+ *  affect rewinds.
+ * \ingroup physics
+ */
+class RayPacket
+{
+public:
+    /** Maximum number of rays in one packet. */
+    static const unsigned int MAX_RAYS = 4;
+
+    /** The closest hit of one ray. */
+    struct Hit
+    {
+        /** True if the ray hit a triangle. */
+        bool      m_hit;
+        /** The hit fraction along the ray. */
+        btScalar  m_fraction;
+        /** The normal of the triangle hit in the local space of the shape
+         *  (as passed to btTriangleRaycastCallback::reportHit). */
+        btVector3 m_normal;
+        /** The part and index of the triangle hit. */
+        int       m_part;
+        int       m_triangle;
+    };   // Hit
+
+    static bool canCastRays(const btCollisionShape *shape);
+    static void castRays(const btCollisionShape *shape, unsigned int num_rays,
+                         const btVector3 *from, const btVector3 *to,
+                         unsigned int flags, Hit *hits);
+    static void unitTesting();
+};   // RayPacket
+
+#endif
@@ -0,0 +1,410 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "physics/stk_dynamics_world.hpp"
+
+#include "physics/btKart.hpp"
+#include "physics/physics.hpp"
+#include "utils/log.hpp"
+#include "utils/worker_pool.hpp"
+
+#include "BulletCollision/CollisionDispatch/btSimulationIslandManager.h"
+#include "LinearMath/btQuickprof.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+    /** Stores the bodies and manifolds of all islands that bullet would
+     *  pass to the solver, in the same order. */
+    class IslandCollector : public btSimulationIslandManager::IslandCallback
+    {
+    public:
+        btAlignedObjectArray<btCollisionObject*>    *m_bodies;
+        btAlignedObjectArray<btPersistentManifold*> *m_manifolds;
+
+        /** For each island the index of the first body and manifold,
+         *  followed by the number of bodies and manifolds. */
+        btAlignedObjectArray<int>                    m_islands;
+        // --------------------------------------------------------------------
+        virtual void ProcessIsland(btCollisionObject** bodies, int num_bodies,
+                                   btPersistentManifold** manifolds,
+                                   int num_manifolds, int island_id)
+        {
+            (void)island_id;
+            m_islands.push_back(m_bodies->size());
+            m_islands.push_back(num_bodies);
+            m_islands.push_back(m_manifolds->size());
+            m_islands.push_back(num_manifolds);
+            for (int i = 0; i < num_bodies; i++)
+                m_bodies->push_back(bodies[i]);
+            for (int i = 0; i < num_manifolds; i++)
+                m_manifolds->push_back(manifolds[i]);
+        }   // ProcessIsland
+    };   // IslandCollector
+}   // anonymous namespace
+
+// ----------------------------------------------------------------------------
+STKDynamicsWorld::STKDynamicsWorld(btDispatcher*             dispatcher,
+                                   btBroadphaseInterface*    pairCache,
+                                   btConstraintSolver*       constraintSolver,
+                                   btCollisionConfiguration* collisionConfiguration,
+                                   Physics*                  physics)
+                : btDiscreteDynamicsWorld(dispatcher, pairCache,
+                                          constraintSolver,
+                                          collisionConfiguration)
+{
+    m_physics     = physics;
+    m_worker_pool = NULL;
+}   // STKDynamicsWorld
+
+// ----------------------------------------------------------------------------
+STKDynamicsWorld::~STKDynamicsWorld()
+{
+    setNumThreads(1);
+}   // ~STKDynamicsWorld
+
+// ----------------------------------------------------------------------------
+/** Sets the number of threads used to solve the islands and to cast the
+ *  wheel rays of the karts.
+ *  \param n Number of threads, 0 or 1 uses the sequential code.
+ */
+void STKDynamicsWorld::setNumThreads(unsigned int n)
+{
+    delete m_worker_pool;
+    m_worker_pool = NULL;
+    for (unsigned int i = 0; i < m_thread_solvers.size(); i++)
+        delete m_thread_solvers[i];
+    m_thread_solvers.clear();
+
+    if (n < 2)
+        return;
+
+    m_worker_pool = new WorkerPool(n);
+    for (unsigned int i = 0; i < n; i++)
+        m_thread_solvers.push_back(new btSequentialImpulseConstraintSolver());
+}   // setNumThreads
+
+// ----------------------------------------------------------------------------
+/** Solves the contacts of the current step. If threads are enabled, the
+ *  islands are solved in parallel if the result is guaranteed to be
+ *  identical to the sequential code, otherwise bullet's code is used.
+ */
+void STKDynamicsWorld::solveConstraints(btContactSolverInfo &info)
+{
+    // Non-contact constraints (which STK does not use) and a random solver
+    // order are not supported. The collision handling of STK might modify
+    // bodies, in which case the order in which islands are solved matters.
+    if (!m_worker_pool || getNumConstraints() > 0 ||
+        (info.m_solverMode & SOLVER_RANDMIZE_ORDER) ||
+        !getSimulationIslandManager()->getSplitIslands() ||
+        (m_physics && !m_physics->canSolveIslandsInParallel()))
+    {
+        btDiscreteDynamicsWorld::solveConstraints(info);
+        return;
+    }
+    solveIslandsInParallel(info);
+}   // solveConstraints
+
+// ----------------------------------------------------------------------------
+/** Solves all islands in parallel. The sequential code in bullet collects
+ *  islands into batches (of at least m_minimumSolverBatchSize manifolds) and
+ *  solves each batch with one call to solveGroup. Since islands don't share
+ *  any dynamic body, solving each island separately gives bit-identical
+ *  results, as long as the bodies of islands without contacts are written
+ *  back as part of a batch (which can change -0 to +0). So each batch is
+ *  split into one group per island with contacts, with the bodies of the
+ *  remaining islands added to the first group. Afterwards STK's collision
+ *  handling is called once for each batch, as the sequential code does.
+ */
+void STKDynamicsWorld::solveIslandsInParallel(btContactSolverInfo &info)
+{
+    BT_PROFILE("solveConstraints");
+
+    m_island_bodies.resize(0);
+    m_island_manifolds.resize(0);
+    IslandCollector collector;
+    collector.m_bodies    = &m_island_bodies;
+    collector.m_manifolds = &m_island_manifolds;
+
+    m_constraintSolver->prepareSolve(getNumCollisionObjects(),
+                                     getDispatcher()->getNumManifolds());
+    m_islandManager->buildAndProcessIslands(getDispatcher(), this,
+                                            &collector);
+
+    // Split the batches the sequential code would solve into groups
+    // ---------------------------------------------------------------
+    m_group_bodies.resize(0);
+    m_island_groups.clear();
+    const btAlignedObjectArray<int> &islands = collector.m_islands;
+    const int num_islands = islands.size() / 4;
+    unsigned int num_batches = 0;
+    int first_island   = 0;
+    int num_manifolds  = 0;
+    for (int i = 0; i < num_islands; i++)
+    {
+        num_manifolds += islands[4 * i + 3];
+        // Keep on collecting islands till the batch is big enough, or
+        // the last island was added. Bullet solves each island on its
+        // own if the batch size is 1 or less.
+        if (i < num_islands - 1 && info.m_minimumSolverBatchSize > 1 &&
+            num_manifolds <= info.m_minimumSolverBatchSize)
+            continue;
+        if (num_manifolds > 0)
+        {
+            num_batches++;
+            bool first_group = true;
+            for (int j = first_island; j <= i; j++)
+            {
+                if (islands[4 * j + 3] == 0)
+                    continue;
+                IslandGroup group;
+                group.m_first_body     = m_group_bodies.size();
+                group.m_first_manifold = islands[4 * j + 2];
+                group.m_num_manifolds  = islands[4 * j + 3];
+                for (int k = first_island; k <= i; k++)
+                {
+                    // Add the island itself, and in the first group
+                    // all islands without contacts.
+                    if (k != j &&
+                        (!first_group || islands[4 * k + 3] > 0))
+                        continue;
+                    for (int b = 0; b < islands[4 * k + 1]; b++)
+                    {
+                        m_group_bodies.push_back(
+                                      m_island_bodies[islands[4 * k] + b]);
+                    }
+                }
+                group.m_num_bodies = m_group_bodies.size()
+                                   - group.m_first_body;
+                m_island_groups.push_back(group);
+                first_group = false;
+            }   // for j in batch
+        }   // if num_manifolds > 0
+        first_island  = i + 1;
+        num_manifolds = 0;
+    }   // for i < num_islands
+
+    // Solve the groups
+    // ----------------
+    // Bullet's profiler is not thread safe
+    bool profiling = CProfileManager::Is_Enabled();
+    CProfileManager::Set_Enabled(false);
+    m_worker_pool->run((unsigned int)m_island_groups.size(),
+        [this, &info](unsigned int index, unsigned int thread)
+        {
+            const IslandGroup &group = m_island_groups[index];
+            m_thread_solvers[thread]->solveGroup(
+                &m_group_bodies[group.m_first_body], group.m_num_bodies,
+                &m_island_manifolds[group.m_first_manifold],
+                group.m_num_manifolds, NULL, 0, info, m_debugDrawer,
+                m_stackAlloc, m_dispatcher1);
+        });
+    CProfileManager::Set_Enabled(profiling);
+
+    if (m_physics)
+    {
+        for (unsigned int i = 0; i < num_batches; i++)
+            m_physics->processContactManifolds();
+    }
+    m_constraintSolver->allSolved(info, m_debugDrawer, m_stackAlloc);
+}   // solveIslandsInParallel
+
+// ----------------------------------------------------------------------------
+/** Updates all actions (i.e. karts). If threads are enabled, the wheel rays
+ *  of all karts are cast in parallel first. A kart with a timed rotation
+ *  changes its transform when it is updated, which could change the result
+ *  of the rays of karts updated later (a wheel ray can hit another kart), so
+ *  those karts cast their rays in updateVehicle() as before.
+ */
+void STKDynamicsWorld::updateActions(btScalar time_step)
+{
+    if (!m_worker_pool || m_actions.size() < 2)
+    {
+        btDiscreteDynamicsWorld::updateActions(time_step);
+        return;
+    }
+
+    m_karts.clear();
+    for (int i = 0; i < m_actions.size(); i++)
+    {
+        btKart *kart = dynamic_cast<btKart*>(m_actions[i]);
+        if (!kart)
+        {
+            btDiscreteDynamicsWorld::updateActions(time_step);
+            return;
+        }
+        m_karts.push_back(kart);
+    }
+
+    unsigned int num_karts = (unsigned int)m_karts.size();
+    for (unsigned int i = 0; i < m_karts.size(); i++)
+    {
+        if (m_karts[i]->getTimedRotationTicks() > 0)
+        {
+            num_karts = i + 1;
+            break;
+        }
+    }
+    // Bullet's profiler is not thread safe
+    bool profiling = CProfileManager::Is_Enabled();
+    CProfileManager::Set_Enabled(false);
+    m_worker_pool->run(num_karts,
+        [this](unsigned int index, unsigned int /*thread*/)
+        {
+            m_karts[index]->castWheelRays();
+        });
+    CProfileManager::Set_Enabled(profiling);
+    btDiscreteDynamicsWorld::updateActions(time_step);
+}   // updateActions
+
+// ----------------------------------------------------------------------------
+/** Simulates several independent stacks of boxes with different solver
+ *  settings, and checks that the state after each step is identical with
+ *  and without threads.
+ */
+void STKDynamicsWorld::unitTesting()
+{
+    // Returns a hash of the state of all bodies after each step
+    auto simulate = [](unsigned int threads, int batch_size,
+                       bool split_impulse) -> std::vector<uint64_t>
+    {
+        btDefaultCollisionConfiguration conf;
+        btCollisionDispatcher dispatcher(&conf);
+        btAxisSweep3 broadphase(btVector3(-100, -100, -100),
+                                btVector3( 100,  100,  100));
+        btSequentialImpulseConstraintSolver solver;
+        STKDynamicsWorld world(&dispatcher, &broadphase, &solver, &conf);
+        world.setGravity(btVector3(0, -9.81f, 0));
+        world.setNumThreads(threads);
+        world.getSolverInfo().m_minimumSolverBatchSize = batch_size;
+        world.getSolverInfo().m_splitImpulse           = split_impulse;
+
+        btBoxShape ground_shape(btVector3(80, 1, 80));
+        btBoxShape box_shape(btVector3(0.5f, 0.5f, 0.5f));
+        btSphereShape sphere_shape(0.5f);
+        std::vector<btRigidBody*> bodies;
+
+        btTransform t;
+        t.setIdentity();
+        t.setOrigin(btVector3(0, -1, 0));
+        bodies.push_back(new btRigidBody(
+            btRigidBody::btRigidBodyConstructionInfo(0, NULL, &ground_shape)));
+        bodies.back()->setWorldTransform(t);
+
+        btVector3 inertia;
+        box_shape.calculateLocalInertia(1.0f, inertia);
+        for (int stack = 0; stack < 12; stack++)
+        {
+            // Stacks of different height, some of them slightly rotated
+            // and hit by a sphere, and some single falling boxes which
+            // are islands without contacts for a while.
+            float x = (stack % 4) * 8.0f - 12.0f;
+            float z = (stack / 4) * 8.0f - 8.0f;
+            for (int j = 0; j < 1 + stack % 5; j++)
+            {
+                t.setIdentity();
+                t.setRotation(btQuaternion(btVector3(0, 1, 0), 0.1f*j*stack));
+                t.setOrigin(btVector3(x + 0.05f*j, 0.5f + j*1.01f
+                                      + (stack % 3 == 2 ? 4.0f : 0), z));
+                btRigidBody::btRigidBodyConstructionInfo
+                    info(1.0f, NULL, &box_shape, inertia);
+                info.m_startWorldTransform = t;
+                bodies.push_back(new btRigidBody(info));
+            }
+            if (stack % 2 == 0)
+            {
+                t.setIdentity();
+                t.setOrigin(btVector3(x - 3.0f, 1.5f, z));
+                btRigidBody::btRigidBodyConstructionInfo
+                    info(2.0f, NULL, &sphere_shape, inertia);
+                info.m_startWorldTransform = t;
+                bodies.push_back(new btRigidBody(info));
+                bodies.back()->setLinearVelocity(btVector3(6.0f, 0, 0.1f));
+            }
+        }   // for stack
+
+        for (unsigned int i = 0; i < bodies.size(); i++)
+            world.addRigidBody(bodies[i]);
+
+        std::vector<uint64_t> hashes;
+        for (int step = 0; step < 240; step++)
+        {
+            world.stepSimulation(1.0f / 120.0f, 1, 1.0f / 120.0f);
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            for (unsigned int i = 0; i < bodies.size(); i++)
+            {
+                const btTransform &tr = bodies[i]->getWorldTransform();
+                btScalar state[18];
+                for (int k = 0; k < 3; k++)
+                {
+                    state[k    ] = tr.getOrigin()[k];
+                    state[k + 3] = bodies[i]->getLinearVelocity()[k];
+                    state[k + 6] = bodies[i]->getAngularVelocity()[k];
+                    state[k + 9] = tr.getBasis()[0][k];
+                    state[k +12] = tr.getBasis()[1][k];
+                    state[k +15] = tr.getBasis()[2][k];
+                }
+                const unsigned char *p = (const unsigned char*)state;
+                for (unsigned int k = 0; k < sizeof(state); k++)
+                {
+                    hash ^= p[k];
+                    hash *= 0x100000001b3ULL;
+                }
+            }
+            hashes.push_back(hash);
+        }   // for step
+
+        for (unsigned int i = 0; i < bodies.size(); i++)
+        {
+            world.removeRigidBody(bodies[i]);
+            delete bodies[i];
+        }
+        return hashes;
+    };   // simulate
+
+    const int batch_sizes[] = { 0, 4, 128 };
+    for (int split = 0; split < 2; split++)
+    {
+        for (int b = 0; b < 3; b++)
+        {
+            std::vector<uint64_t> serial =
+                simulate(1, batch_sizes[b], split == 1);
+            for (unsigned int threads = 2; threads <= 4; threads += 2)
+            {
+                std::vector<uint64_t> parallel =
+                    simulate(threads, batch_sizes[b], split == 1);
+                for (unsigned int i = 0; i < serial.size(); i++)
+                {
+                    if (serial[i] != parallel[i])
+                    {
+                        Log::error("STKDynamicsWorld",
+                                   "Step %d differs with %d threads, "
+                                   "batch size %d.", i, threads,
+                                   batch_sizes[b]);
+                        assert(false);
+                        break;
+                    }
+                }
+            }   // for threads
+        }   // for b
+    }   // for split
+}   // unitTesting
@@ -21,24 +21,73 @@
 
 #include "btBulletDynamicsCommon.h"
 
+#include <vector>
+
+class btKart;
+class Physics;
+class WorkerPool;
+
 /** A thin wrapper around bullet's btDiscreteDynamicsWorld. Used to
  *  be able to query and set the 'left over' time from a previous
  *  time step, which is needed for more precise rewind/replays.
+ *  Optionally it solves independent simulation islands and casts the wheel
+ *  rays of all karts on several threads. The results are bit-identical to
+ *  the sequential code, so that rewinds are not affected.
  */
 class STKDynamicsWorld : public btDiscreteDynamicsWorld
 {
+private:
+    /** A group of islands that is solved with one call to solveGroup. It
+     *  contains one island with contacts, plus the bodies of islands
+     *  without contacts that bullet would solve in the same batch. */
+    struct IslandGroup
+    {
+        int m_first_body;
+        int m_num_bodies;
+        int m_first_manifold;
+        int m_num_manifolds;
+    };   // IslandGroup
+
+    /** The physics object to handle collisions after each batch of islands
+     *  was solved, can be NULL (e.g. in unit tests). */
+    Physics *m_physics;
+
+    /** The worker threads, or NULL if the sequential code is used. */
+    WorkerPool *m_worker_pool;
+
+    /** One solver for each thread, since the solvers store temporary
+     *  data while solving. */
+    std::vector<btSequentialImpulseConstraintSolver*> m_thread_solvers;
+
+    /** The bodies and manifolds of all islands of the current step. */
+    btAlignedObjectArray<btCollisionObject*>    m_island_bodies;
+    btAlignedObjectArray<btPersistentManifold*> m_island_manifolds;
+
+    /** The bodies of each island group (see IslandGroup). */
+    btAlignedObjectArray<btCollisionObject*>    m_group_bodies;
+
+    /** The island groups of the current step. */
+    std::vector<IslandGroup> m_island_groups;
+
+    /** All karts of this world, used when casting the wheel rays. */
+    std::vector<btKart*> m_karts;
+
+    void solveIslandsInParallel(btContactSolverInfo &info);
+
+protected:
+    virtual void solveConstraints(btContactSolverInfo &info);
+    virtual void updateActions(btScalar time_step);
+
 public:
     /** The standard constructor which just created a btDiscreteDynamicsWorld. */
     STKDynamicsWorld(btDispatcher*             dispatcher,
                      btBroadphaseInterface*    pairCache,
                      btConstraintSolver*       constraintSolver,
-                     btCollisionConfiguration* collisionConfiguration)
-
-                   : btDiscreteDynamicsWorld(dispatcher, pairCache,
-                                             constraintSolver,
-                                             collisionConfiguration)
-    {
-    }
+                     btCollisionConfiguration* collisionConfiguration,
+                     Physics*                  physics = NULL);
+    virtual ~STKDynamicsWorld();
+    void setNumThreads(unsigned int n);
+    static void unitTesting();
 
     /** Resets m_localTime to 0. This allows more precise replay of
      *  physics, which is important for replaying histories. */
@@ -52,4 +101,3 @@ public:
 };   // STKDynamicsWorld
 #endif
 /* EOF */
-
@@ -21,12 +21,17 @@
 #include "config/stk_config.hpp"
 #include "main_loop.hpp"
 #include "physics/physics.hpp"
+#include "physics/ray_packet.hpp"
 #include "utils/constants.hpp"
 #include "utils/time.hpp"
+#include "utils/worker_pool.hpp"
 
 #include "btBulletDynamicsCommon.h"
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <string.h>
 
 // -----------------------------------------------------------------------------
 /** Constructor: Initialises all data structures with zero.
@@ -44,6 +49,7 @@ TriangleMesh::TriangleMesh(bool can_be_transformed) : m_mesh()
     // (and m_mesh->m_weldingThreshold at m_normals
     m_collision_shape  = NULL;
     m_collision_object = NULL;
+    m_bvh_buffer       = NULL;
     m_user_pointer.set(this);
 }   // TriangleMesh
 
@@ -105,7 +111,29 @@ void TriangleMesh::createCollisionShape(bool create_collision_object, const char
     // Now convert the triangle mesh into a static rigid body
     btBvhTriangleMeshShape* bhv_triangle_mesh;
 
-    if (serialized_bhv != NULL)
+    if (serialized_bhv == NULL && !m_serialized_bvh.empty())
+    {
+        // Deserialize a copy, so that the collision shape can be recreated
+        const unsigned int size = (unsigned int)m_serialized_bvh.size();
+        m_bvh_buffer = btAlignedAlloc(size, 16);
+        memcpy(m_bvh_buffer, m_serialized_bvh.data(), size);
+        btOptimizedBvh* bvh = btOptimizedBvh::deSerializeInPlace(m_bvh_buffer,
+                                                   size, !IS_LITTLE_ENDIAN);
+        if (bvh == NULL)
+        {
+            Log::warn("TriangleMesh", "Failed to load serialized BVH");
+            btAlignedFree(m_bvh_buffer);
+            m_bvh_buffer = NULL;
+            bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, false /* useQuantizedAabbCompression */);
+        }
+        else
+        {
+            bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, false /* useQuantizedAabbCompression */,
+                                                           false /* buildBvh */);
+            bhv_triangle_mesh->setOptimizedBvh(bvh);
+        }
+    }
+    else if (serialized_bhv != NULL)
     {
         FILE *f = fopen(serialized_bhv, "rb");
         fseek(f, 0, SEEK_END);
@@ -232,8 +260,130 @@ void TriangleMesh::removeAll()
     }
     delete m_collision_shape;
     m_collision_shape = NULL;
+    if (m_bvh_buffer)
+    {
+        btAlignedFree(m_bvh_buffer);
+        m_bvh_buffer = NULL;
+    }
 }   // removeAll
 
+// ----------------------------------------------------------------------------
+/** Returns a hash (FNV-1a) of the vertices of all triangles starting with
+ *  the given index. Since the bvh only depends on the vertices, this is used
+ *  to check if a serialized bvh can be used.
+ *  \param first Index of the first triangle to include.
+ */
+uint64_t TriangleMesh::hashVertices(unsigned int first) const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned int i = first; i < getNumTriangles(); i++)
+    {
+        btVector3 p[3];
+        getTriangle(i, &p[0], &p[1], &p[2]);
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            const float xyz[3] = { p[j].getX(), p[j].getY(), p[j].getZ() };
+            const uint8_t *bytes = (const uint8_t*)xyz;
+            for (unsigned int k = 0; k < sizeof(xyz); k++)
+            {
+                hash ^= bytes[k];
+                hash *= 1099511628211ULL;
+            }
+        }
+    }
+    return hash;
+}   // hashVertices
+
+// ----------------------------------------------------------------------------
+/** Writes the first triangles of this mesh (vertices, normals and material)
+ *  so that they can be added again with readTriangles().
+ *  \param out The stream to write to.
+ *  \param count Number of triangles to write.
+ *  \param material_index Index of each used material in the table of
+ *         materials which will be passed to readTriangles().
+ */
+void TriangleMesh::writeTriangles(std::ostream &out, unsigned int count,
+                         const std::map<const Material*, int> &material_index)
+                         const
+{
+    assert(count <= getNumTriangles());
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const int32_t material =
+            material_index.at(m_triangleIndex2Material[i]);
+        btVector3 p[3], n[3];
+        getTriangle(i, &p[0], &p[1], &p[2]);
+        getNormals(i, &n[0], &n[1], &n[2]);
+        float data[18];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            data[j * 3    ] = p[j].getX();
+            data[j * 3 + 1] = p[j].getY();
+            data[j * 3 + 2] = p[j].getZ();
+            data[j * 3 + 9] = n[j].getX();
+            data[j * 3 + 10] = n[j].getY();
+            data[j * 3 + 11] = n[j].getZ();
+        }
+        out.write((const char*)&material, sizeof(material));
+        out.write((const char*)data, sizeof(data));
+    }
+}   // writeTriangles
+
+// ----------------------------------------------------------------------------
+/** Adds triangles written by writeTriangles(). The normals are used as they
+ *  were written, i.e. they are not smoothed again.
+ *  \param in The stream to read from.
+ *  \param count Number of triangles to read.
+ *  \param materials The table of materials used when writing the triangles.
+ *  \return False if the data is invalid.
+ */
+bool TriangleMesh::readTriangles(std::istream &in, unsigned int count,
+                                 const std::vector<const Material*> &materials)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        int32_t material;
+        float data[18];
+        in.read((char*)&material, sizeof(material));
+        in.read((char*)data, sizeof(data));
+        if (!in.good() || material < 0 || material >= (int)materials.size())
+            return false;
+
+        const btVector3 t1(data[0], data[1], data[2]);
+        const btVector3 t2(data[3], data[4], data[5]);
+        const btVector3 t3(data[6], data[7], data[8]);
+        m_triangleIndex2Material.push_back(materials[material]);
+        m_normals.push_back(btVector3(data[ 9], data[10], data[11]));
+        m_normals.push_back(btVector3(data[12], data[13], data[14]));
+        m_normals.push_back(btVector3(data[15], data[16], data[17]));
+        m_mesh.addTriangle(t1, t2, t3);
+        m_p1p2p3.push_back((t2 - t1).cross(t3 - t1).length2());
+    }
+    return true;
+}   // readTriangles
+
+// ----------------------------------------------------------------------------
+/** Serializes the optimized bvh of the collision shape, so that it can be
+ *  used with setSerializedBvh() for a mesh with identical triangles.
+ *  \param out On return the serialized bvh.
+ *  \return False if there is no bvh.
+ */
+bool TriangleMesh::serializeBvh(std::vector<char> *out) const
+{
+    btBvhTriangleMeshShape *shape =
+        dynamic_cast<btBvhTriangleMeshShape*>(m_collision_shape);
+    if (!shape || !shape->getOptimizedBvh())
+        return false;
+    btOptimizedBvh *bvh = shape->getOptimizedBvh();
+    const unsigned int size = bvh->calculateSerializeBufferSize();
+    void *buffer = btAlignedAlloc(size, 16);
+    const bool success = bvh->serialize(buffer, size, !IS_LITTLE_ENDIAN);
+    if (success)
+        out->assign((const char*)buffer, (const char*)buffer + size);
+    btAlignedFree(buffer);
+    return success;
+}   // serializeBvh
+
 // -----------------------------------------------------------------------------
 /** Interpolates the normal at the given position for the triangle with
  *  a given index. The position must be inside of the given triangle.
@@ -407,3 +557,203 @@ bool TriangleMesh::castRay(const btVector3 &from, const btVector3 &to,
     return ray_callback.hasHit();
 
 }   // castRay
+
+// ----------------------------------------------------------------------------
+/** Casts a batch of rays, with the same results as calling castRay() for
+ *  each ray. Groups of rays are tested with one walk of the bvh (see
+ *  RayPacket), and if a worker pool is given large batches are split
+ *  between its threads.
+ *  \param num_rays Number of rays.
+ *  \param from/to Arrays with the from and to positions of each ray.
+ *  \param hit On return true for each ray that hit a triangle.
+ *  \param xyz The position in world where each ray hit.
+ *  \param material The material hit by each ray, NULL if nothing was hit.
+ *  \param normal The normals at the hit positions, can be NULL.
+ *  \param interpolate_normal If the normals should be interpolated, see
+ *         castRay().
+ *  \param pool An optional worker pool to use.
+ */
+void TriangleMesh::castRays(unsigned int num_rays, const btVector3 *from,
+                            const btVector3 *to, bool *hit, btVector3 *xyz,
+                            const Material **material, btVector3 *normal,
+                            bool interpolate_normal, WorkerPool *pool) const
+{
+    // Number of rays handled by one job of the worker pool
+    const unsigned int rays_per_job = 64;
+    if (pool && pool->getNumThreads() > 1 && num_rays > rays_per_job)
+    {
+        const unsigned int num_jobs = (num_rays + rays_per_job - 1)
+                                    / rays_per_job;
+        pool->run(num_jobs, [&](unsigned int job, unsigned int thread)
+        {
+            const unsigned int first = job * rays_per_job;
+            castRays(std::min(rays_per_job, num_rays - first), from + first,
+                     to + first, hit + first, xyz + first, material + first,
+                     normal ? normal + first : NULL, interpolate_normal);
+        });
+        return;
+    }
+
+    if (!m_collision_shape || !RayPacket::canCastRays(m_collision_shape))
+    {
+        for (unsigned int i = 0; i < num_rays; i++)
+        {
+            hit[i] = castRay(from[i], to[i], xyz + i, material + i,
+                             normal ? normal + i : NULL, interpolate_normal);
+        }
+        return;
+    }
+
+    // Transform the rays into the local space of the mesh in the same way
+    // as btCollisionWorld::rayTestSingle does in castRay()
+    btTransform world_trans;
+    if (m_body)
+        world_trans = m_body->getWorldTransform();
+    else
+        world_trans.setIdentity();
+    const btTransform world_to_mesh = world_trans.inverse();
+
+    for (unsigned int first = 0; first < num_rays; first += RayPacket::MAX_RAYS)
+    {
+        const unsigned int count = std::min((unsigned int)RayPacket::MAX_RAYS,
+                                            num_rays - first);
+        btVector3 local_from[RayPacket::MAX_RAYS];
+        btVector3 local_to[RayPacket::MAX_RAYS];
+        for (unsigned int i = 0; i < count; i++)
+        {
+            local_from[i] = world_to_mesh * from[first + i];
+            local_to[i]   = world_to_mesh * to[first + i];
+        }
+        RayPacket::Hit hits[RayPacket::MAX_RAYS];
+        // The flags are the default flags of bullet's ray result callbacks
+        RayPacket::castRays(m_collision_shape, count, local_from, local_to,
+                            /*flags*/0, hits);
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const unsigned int n = first + i;
+            hit[n] = hits[i].m_hit;
+            if (!hit[n])
+            {
+                material[n] = NULL;
+                if (normal)
+                    normal[n].setValue(0, 1, 0);
+                continue;
+            }
+            xyz[n].setInterpolate3(from[n], to[n], hits[i].m_fraction);
+            xyz[n].setW(0.0f);
+            material[n] = m_triangleIndex2Material[hits[i].m_triangle];
+            if (normal)
+            {
+                if (interpolate_normal)
+                    normal[n] = getInterpolatedNormal(hits[i].m_triangle,
+                                                      xyz[n]);
+                else
+                    normal[n] = world_trans.getBasis() * hits[i].m_normal;
+                normal[n].normalize();
+            }
+        }   // for i < count
+    }   // for first < num_rays
+}   // castRays
+
+// ----------------------------------------------------------------------------
+/** Unit tests for the physics cache support: the triangles and bvh of a mesh
+ *  are written and read into a new mesh, and raycasts against both meshes
+ *  must give identical results.
+ */
+void TriangleMesh::unitTesting()
+{
+    // A bumpy terrain of 32x32 quads
+    TriangleMesh original(/*can_be_transformed*/false);
+    const btVector3 up(0, 1, 0);
+    auto height = [](int x, int z)
+    {
+        return sinf(x * 0.5f) * cosf(z * 0.3f);
+    };
+    for (int x = 0; x < 32; x++)
+    {
+        for (int z = 0; z < 32; z++)
+        {
+            const btVector3 p1(x,     height(x,     z    ), z    );
+            const btVector3 p2(x + 1, height(x + 1, z    ), z    );
+            const btVector3 p3(x,     height(x,     z + 1), z + 1);
+            const btVector3 p4(x + 1, height(x + 1, z + 1), z + 1);
+            original.addTriangle(p1, p2, p3, up, up, up, NULL);
+            original.addTriangle(p2, p4, p3, up, up, up, NULL);
+        }
+    }
+    original.createCollisionShape();
+
+    std::stringstream data;
+    std::map<const Material*, int> material_index;
+    material_index[NULL] = 0;
+    original.writeTriangles(data, original.getNumTriangles(),
+                            material_index);
+    std::vector<char> bvh;
+    bool success = original.serializeBvh(&bvh);
+    assert(success);
+
+    TriangleMesh copy(/*can_be_transformed*/false);
+    success = copy.readTriangles(data, original.getNumTriangles(),
+                                 std::vector<const Material*>(1, NULL));
+    assert(success);
+    assert(copy.getNumTriangles() == original.getNumTriangles());
+    assert(copy.hashVertices(0) == original.hashVertices(0));
+    assert(copy.hashVertices(100) != original.hashVertices(0));
+    copy.setSerializedBvh(bvh);
+    copy.createCollisionShape();
+    assert(copy.m_bvh_buffer != NULL);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        const btVector3 from((i * 7) % 320 * 0.1f, 5.0f,
+                             (i * 13) % 320 * 0.1f);
+        const btVector3 to = from + btVector3(0.5f, -10.0f, -0.3f);
+        btVector3 xyz1, xyz2, normal1, normal2;
+        const Material *m1, *m2;
+        bool hit1 = original.castRay(from, to, &xyz1, &m1, &normal1);
+        bool hit2 = copy.castRay(from, to, &xyz2, &m2, &normal2);
+        if (hit1 != hit2 || (hit1 && (xyz1 != xyz2 || normal1 != normal2)))
+        {
+            Log::fatal("TriangleMesh",
+                       "Different raycast result with serialized bvh.");
+        }
+    }
+
+    // Batched raycasts must give the same results as single raycasts, with
+    // and without worker threads.
+    const unsigned int num_rays = 1003;
+    std::vector<btVector3> from(num_rays), to(num_rays), xyz(num_rays),
+                           normal(num_rays);
+    std::vector<const Material*> material(num_rays);
+    bool hit[num_rays];
+    WorkerPool pool(4);
+    for (unsigned int i = 0; i < num_rays; i++)
+    {
+        from[i] = btVector3((i * 11) % 340 * 0.1f - 1.0f, 3.0f,
+                            (i * 17) % 340 * 0.1f - 1.0f);
+        to[i] = from[i] + btVector3(0.2f * (i % 3), -8.0f, 0.1f * (i % 5));
+    }
+    for (unsigned int n = 0; n < 2; n++)
+    {
+        original.castRays(num_rays, from.data(), to.data(), hit, xyz.data(),
+                          material.data(), normal.data(),
+                          /*interpolate_normal*/n == 1, n == 1 ? &pool : NULL);
+        for (unsigned int i = 0; i < num_rays; i++)
+        {
+            btVector3 xyz1, normal1;
+            const Material *m1;
+            bool hit1 = original.castRay(from[i], to[i], &xyz1, &m1, &normal1,
+                                         /*interpolate_normal*/n == 1);
+            if (hit1 != hit[i] ||
+                (hit1 && (xyz1 != xyz[i] || normal1 != normal[i])))
+            {
+                Log::fatal("TriangleMesh",
+                           "Different result for batched raycasts.");
+            }
+        }
+    }
+
+    // Avoid unused variable warnings in release mode
+    (void)success;
+}   // unitTesting
@@ -19,13 +19,17 @@
 #ifndef HEADER_TRIANGLE_MESH_HPP
 #define HEADER_TRIANGLE_MESH_HPP
 
+#include <iosfwd>
+#include <map>
 #include <vector>
 #include "btBulletDynamicsCommon.h"
 
 #include "physics/user_pointer.hpp"
 #include "utils/aligned_array.hpp"
+#include "utils/types.hpp"
 
 class Material;
+class WorkerPool;
 
 /**
  * \brief A special class to store a triangle mesh with a separate material per triangle.
@@ -57,6 +61,14 @@ private:
      *  to the current transform of the body. */
     bool m_can_be_transformed;
 
+    /** If not empty, a serialized optimized bvh of all triangles of this
+     *  mesh, which is used instead of building the bvh. */
+    std::vector<char>            m_serialized_bvh;
+
+    /** Memory in which the bvh from m_serialized_bvh was deserialized in
+     *  place, which must be freed after the collision shape. */
+    void                        *m_bvh_buffer;
+
 public:
     class RigidBodyTriangleMesh : public btRigidBody
     {
@@ -72,6 +84,7 @@ public:
 
          TriangleMesh(bool can_be_transformed);
         ~TriangleMesh();
+    static void unitTesting();
     void addTriangle(const btVector3 &t1, const btVector3 &t2,
                      const btVector3 &t3, const btVector3 &n1,
                      const btVector3 &n2, const btVector3 &n3,
@@ -83,6 +96,22 @@ public:
                             const char* serializedBhv = NULL);
     void removeAll();
     void removeCollisionObject();
+    uint64_t hashVertices(unsigned int first) const;
+    void writeTriangles(std::ostream &out, unsigned int count,
+                        const std::map<const Material*, int> &material_index)
+                        const;
+    bool readTriangles(std::istream &in, unsigned int count,
+                       const std::vector<const Material*> &materials);
+    bool serializeBvh(std::vector<char> *out) const;
+    // ------------------------------------------------------------------------
+    /** Sets a bvh serialized with serializeBvh() for all triangles of this
+     *  mesh, which will be used by the next createCollisionShape() call.
+     *  An empty vector means that the bvh is built. */
+    void setSerializedBvh(const std::vector<char> &bvh)
+                                                   { m_serialized_bvh = bvh; }
+    // ------------------------------------------------------------------------
+    unsigned int getNumTriangles() const
+                      { return (unsigned int)m_triangleIndex2Material.size(); }
     btVector3 getInterpolatedNormal(unsigned int index,
                                     const btVector3 &position) const;
     // ------------------------------------------------------------------------
@@ -112,6 +141,10 @@ public:
     bool castRay(const btVector3 &from, const btVector3 &to,
                  btVector3 *xyz, const Material **material,
                  btVector3 *normal=NULL, bool interpolate_normal=false) const;
+    void castRays(unsigned int num_rays, const btVector3 *from,
+                  const btVector3 *to, bool *hit, btVector3 *xyz,
+                  const Material **material, btVector3 *normal=NULL,
+                  bool interpolate_normal=false, WorkerPool *pool=NULL) const;
     // ------------------------------------------------------------------------
     /** Returns the points of the 'indx' triangle.
      *  \param indx Index of the triangle to get.
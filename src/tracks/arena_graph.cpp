@@ -26,24 +26,46 @@
 #include "tracks/track.hpp"
 #include "tracks/track_manager.hpp"
 #include "utils/log.hpp"
+#include "utils/string_utils.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
 #include <queue>
+#include <string.h>
+#include <thread>
+
+namespace
+{
+    /** Identification of a paths file, see ArenaGraph::loadPaths(). */
+    const char     PATHS_MAGIC[4] = { 'S', 'T', 'K', 'P' };
+    const uint32_t PATHS_BYTE_ORDER = 0x01020304;
+    const uint32_t PATHS_VERSION = 1;
+    /** Magic, byte order, version, number of nodes, graph hash, unused. */
+    const size_t   PATHS_HEADER_SIZE = 6 * sizeof(uint32_t);
+}
 
 // -----------------------------------------------------------------------------
 ArenaGraph::ArenaGraph(const std::string &navmesh, const XMLNode *node)
           : Graph()
 {
+    m_distances = NULL;
+    m_parents   = NULL;
     loadNavmesh(navmesh);
-    buildGraph();
-    // Compute shortest distance from all nodes
-    for (unsigned int i = 0; i < getNumNodes(); i++)
-        computeDijkstra(i);
+    // Use the precomputed shortest paths if available, otherwise compute
+    // the shortest distance from all nodes
+    if (!loadPaths(getPathsFileName(navmesh)))
+    {
+        buildGraph();
+        computeAllPaths();
+    }
 
     setNearbyNodesOfAllNodes();
     if (node && race_manager->getMinorMode() == RaceManager::MINOR_MODE_SOCCER)
         loadGoalNodes(node);
 
+    createGrid();
     loadBoundingBoxNodes();
 
 }   // ArenaGraph
@@ -179,43 +201,48 @@ void ArenaGraph::buildGraph()
 {
     const unsigned int n_nodes = getNumNodes();
 
-    m_distance_matrix = std::vector<std::vector<float>>
-        (n_nodes, std::vector<float>(n_nodes, 9999.9f));
+    m_distance_matrix.assign(n_nodes * n_nodes, 9999.9f);
+    m_edge_lengths.resize(n_nodes);
     for (unsigned int i = 0; i < n_nodes; i++)
     {
         ArenaNode* cur_node = getNode(i);
+        m_edge_lengths[i].clear();
         for (const int& adjacent : cur_node->getAdjacentNodes())
         {
             Vec3 diff = getNode(adjacent)->getCenter() - cur_node->getCenter();
             float distance = diff.length();
-            m_distance_matrix[i][adjacent] = distance;
+            m_distance_matrix[i * n_nodes + adjacent] = distance;
+            m_edge_lengths[i].push_back(distance);
         }
-        m_distance_matrix[i][i] = 0.0f;
+        m_distance_matrix[i * n_nodes + i] = 0.0f;
     }
 
     // Allocate and initialise the previous node data structure:
-    m_parent_node = std::vector<std::vector<int16_t>>
-        (n_nodes, std::vector<int16_t>(n_nodes, Graph::UNKNOWN_SECTOR));
+    m_parent_node.assign(n_nodes * n_nodes, Graph::UNKNOWN_SECTOR);
     for (unsigned int i = 0; i < n_nodes; i++)
     {
         for (unsigned int j = 0; j < n_nodes; j++)
         {
-            if (i == j || m_distance_matrix[i][j] >= 9899.9f)
-                m_parent_node[i][j] = -1;
+            if (i == j || m_distance_matrix[i * n_nodes + j] >= 9899.9f)
+                m_parent_node[i * n_nodes + j] = -1;
             else
-                m_parent_node[i][j] = i;
+                m_parent_node[i * n_nodes + j] = i;
         }   // for j
     }   // for i
 
+    m_distances = m_distance_matrix.data();
+    m_parents   = m_parent_node.data();
 }   // buildGraph
 
 // ----------------------------------------------------------------------------
 /** Dijkstra shortest path computation. It computes the shortest distance from
  *  the specified node 'source' to all other nodes. At the end of the
- *  computation, m_distance_matrix[i][j] stores the shortest path distance from
- *  source to j and m_parent_node[source][j] stores the last vertex visited on
- *  the shortest path from i to j before visiting j. Suppose the shortest path
- *  from i to j is i->......->k->j  then m_parent_node[i][j] = k
+ *  computation, m_distance_matrix[source*n+j] stores the shortest path
+ *  distance from source to j and m_parent_node[source*n+j] stores the last
+ *  vertex visited on the shortest path from source to j before visiting j.
+ *  Suppose the shortest path from i to j is i->......->k->j  then
+ *  m_parent_node[i*n+j] = k. Only the data of source is modified, so this
+ *  can be called for different sources in parallel.
  */
 void ArenaGraph::computeDijkstra(int source)
 {
@@ -246,17 +273,19 @@ void ArenaGraph::computeDijkstra(int source)
         if (visited[cur_index]) continue;
         visited[cur_index] = true;
 
-        for (const int& adjacent : getNode(cur_index)->getAdjacentNodes())
+        const std::vector<int>& adjacents =
+            getNode(cur_index)->getAdjacentNodes();
+        for (unsigned int i = 0; i < adjacents.size(); i++)
         {
+            const int adjacent = adjacents[i];
             // Distance already computed, can be ignored
             if (visited[adjacent]) continue;
 
-            float new_dist =
-                current.second + m_distance_matrix[cur_index][adjacent];
-            if (new_dist < m_distance_matrix[source][adjacent])
+            float new_dist = current.second + m_edge_lengths[cur_index][i];
+            if (new_dist < m_distance_matrix[source * n + adjacent])
             {
-                m_distance_matrix[source][adjacent] = new_dist;
-                m_parent_node[source][adjacent] = cur_index;
+                m_distance_matrix[source * n + adjacent] = new_dist;
+                m_parent_node[source * n + adjacent] = cur_index;
             }
             IndDistPair pair(adjacent, new_dist);
             queue.push(pair);
@@ -264,6 +293,33 @@ void ArenaGraph::computeDijkstra(int source)
     }
 }   // computeDijkstra
 
+// ----------------------------------------------------------------------------
+/** Computes the shortest paths between all nodes with Dijkstra, using all
+ *  available cores (each thread computes the paths from different source
+ *  nodes). buildGraph() must have been called before.
+ */
+void ArenaGraph::computeAllPaths()
+{
+    const unsigned int n = getNumNodes();
+    std::atomic<unsigned int> next_source(0);
+    auto compute = [this, n, &next_source]()
+    {
+        unsigned int source;
+        while ((source = next_source.fetch_add(1)) < n)
+            computeDijkstra(source);
+    };
+
+    // Small graphs are not worth starting threads
+    unsigned int num_threads = std::thread::hardware_concurrency();
+    num_threads = std::max(1u, std::min(num_threads, n / 64));
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; i++)
+        threads.emplace_back(compute);
+    compute();
+    for (std::thread &t : threads)
+        t.join();
+}   // computeAllPaths
+
 // ----------------------------------------------------------------------------
 /** THIS FUNCTION IS ONLY USED FOR UNIT-TESTING, to verify that the new
  *  Dijkstra algorithm gives the same results.
@@ -284,12 +340,14 @@ void ArenaGraph::computeFloydWarshall()
         {
             for (unsigned int j = 0; j < n; j++)
             {
-                if ((m_distance_matrix[i][k] + m_distance_matrix[k][j]) <
-                    m_distance_matrix[i][j])
+                if ((m_distance_matrix[i * n + k] +
+                     m_distance_matrix[k * n + j]) <
+                    m_distance_matrix[i * n + j])
                 {
-                    m_distance_matrix[i][j] =
-                        m_distance_matrix[i][k] + m_distance_matrix[k][j];
-                    m_parent_node[i][j] = m_parent_node[k][j];
+                    m_distance_matrix[i * n + j] =
+                        m_distance_matrix[i * n + k] +
+                        m_distance_matrix[k * n + j];
+                    m_parent_node[i * n + j] = m_parent_node[k * n + j];
                 }
             }
         }
@@ -341,7 +399,8 @@ void ArenaGraph::setNearbyNodesOfAllNodes()
         // Get the distance to all nodes at i
         ArenaNode* cur_node = getNode(i);
         std::vector<int> nearby_nodes;
-        std::vector<float> dist = m_distance_matrix[i];
+        std::vector<float> dist(m_distances + i * getNumNodes(),
+                                m_distances + (i + 1) * getNumNodes());
 
         // Skip the same node
         dist[i] = 999999.0f;
@@ -363,18 +422,147 @@ void ArenaGraph::setNearbyNodesOfAllNodes()
  *  std::vector (in reverse order). Used only for unit testing.
  */
 std::vector<int16_t> ArenaGraph::getPathFromTo(int from, int to,
-                      const std::vector< std::vector< int16_t > >& parent_node)
+                                      const std::vector<int16_t>& parent_node)
 {
+    const int n = (int)sqrt((double)parent_node.size());
     std::vector<int16_t> path;
     path.push_back(to);
     while(from!=to)
     {
-        to = parent_node[from][to];
+        to = parent_node[from * n + to];
         path.push_back(to);
     }
     return path;
 }   // getPathFromTo
 
+// ----------------------------------------------------------------------------
+/** Returns the name of the file with the precomputed paths for a navmesh,
+ *  which is stored next to the navmesh file.
+ */
+std::string ArenaGraph::getPathsFileName(const std::string &navmesh)
+{
+    return StringUtils::removeExtension(navmesh) + ".paths";
+}   // getPathsFileName
+
+// ----------------------------------------------------------------------------
+/** Returns a hash (FNV-1a) of all data that the shortest paths depend on,
+ *  used to detect outdated paths files.
+ */
+uint32_t ArenaGraph::getGraphHash() const
+{
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const void *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= ((const uint8_t*)data)[i];
+            hash *= 16777619u;
+        }
+    };
+    const unsigned int n = getNumNodes();
+    add(&n, sizeof(n));
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const float center[3] = { m_all_nodes[i]->getCenter().getX(),
+                                  m_all_nodes[i]->getCenter().getY(),
+                                  m_all_nodes[i]->getCenter().getZ() };
+        add(center, sizeof(center));
+        const std::vector<int> &adjacents = getNode(i)->getAdjacentNodes();
+        const unsigned int num_adjacents = (unsigned int)adjacents.size();
+        add(&num_adjacents, sizeof(num_adjacents));
+        if (num_adjacents > 0)
+            add(adjacents.data(), num_adjacents * sizeof(int));
+    }
+    return hash;
+}   // getGraphHash
+
+// ----------------------------------------------------------------------------
+/** Maps a file with precomputed shortest paths (written by savePaths()) into
+ *  memory. It is ignored if it was created for a different navmesh, or on
+ *  a platform with different byte order.
+ *  \param filename Name of the paths file.
+ *  \return True if the paths file is used.
+ */
+bool ArenaGraph::loadPaths(const std::string &filename)
+{
+    if (!m_paths_file.open(filename))
+        return false;
+
+    const unsigned int n = getNumNodes();
+    const uint8_t *data = (const uint8_t*)m_paths_file.getData();
+    uint32_t header[5];
+    if (m_paths_file.getSize() >= PATHS_HEADER_SIZE)
+        memcpy(header, data + sizeof(PATHS_MAGIC), sizeof(header));
+    if (m_paths_file.getSize() !=
+            PATHS_HEADER_SIZE + (size_t)n * n * (sizeof(float) +
+                                                 sizeof(int16_t)) ||
+        memcmp(data, PATHS_MAGIC, sizeof(PATHS_MAGIC)) != 0 ||
+        header[0] != PATHS_BYTE_ORDER || header[1] != PATHS_VERSION ||
+        header[2] != n || header[3] != getGraphHash())
+    {
+        Log::warn("ArenaGraph", "Ignoring outdated paths file '%s'.",
+                  filename.c_str());
+        m_paths_file.close();
+        return false;
+    }
+    m_distances = (const float*)(data + PATHS_HEADER_SIZE);
+    m_parents   = (const int16_t*)(data + PATHS_HEADER_SIZE +
+                                   (size_t)n * n * sizeof(float));
+    return true;
+}   // loadPaths
+
+// ----------------------------------------------------------------------------
+/** Saves the shortest paths, so they can be mapped into memory by
+ *  loadPaths() instead of being computed when the arena is loaded.
+ *  \param filename Name of the paths file.
+ *  \return True if the file was written successfully.
+ */
+bool ArenaGraph::savePaths(const std::string &filename) const
+{
+    const unsigned int n = getNumNodes();
+    const uint32_t header[5] = { PATHS_BYTE_ORDER, PATHS_VERSION, n,
+                                 getGraphHash(), 0 };
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    f.write(PATHS_MAGIC, sizeof(PATHS_MAGIC));
+    f.write((const char*)header, sizeof(header));
+    f.write((const char*)m_distances, (size_t)n * n * sizeof(float));
+    f.write((const char*)m_parents, (size_t)n * n * sizeof(int16_t));
+    f.close();
+    return !f.fail();
+}   // savePaths
+
+// ----------------------------------------------------------------------------
+/** Writes the paths file for all arenas with a navmesh. This is meant to be
+ *  used when packaging tracks, so that the paths don't need to be computed
+ *  each time an arena is loaded.
+ */
+void ArenaGraph::generatePathsFiles()
+{
+    for (unsigned int i = 0; i < track_manager->getNumberOfTracks(); i++)
+    {
+        Track *track = track_manager->getTrack(i);
+        if (track->isInternal() || !track->hasNavMesh())
+            continue;
+        const std::string navmesh = track->getTrackFile("navmesh.xml");
+        ArenaGraph ag(navmesh);
+        if (ag.m_paths_file.isOpen())
+        {
+            Log::info("ArenaGraph", "%s: paths file is up to date.",
+                      track->getIdent().c_str());
+            continue;
+        }
+        const std::string paths = getPathsFileName(navmesh);
+        if (ag.savePaths(paths))
+        {
+            Log::info("ArenaGraph", "%s: written %s for %d nodes.",
+                      track->getIdent().c_str(), paths.c_str(),
+                      ag.getNumNodes());
+        }
+        else
+            Log::error("ArenaGraph", "Can't write '%s'.", paths.c_str());
+    }
+}   // generatePathsFiles
+
 // ============================================================================
 /** Unit testing for arena graph distance and parent node computation.
  *  Instead of using hand-tuned test cases we use the tested, verified and
@@ -387,14 +575,31 @@ void ArenaGraph::unitTesting()
     Track *track = track_manager->getTrack("cave");
     std::string navmesh_file_name=track->getTrackFile("navmesh.xml");
 
-    double s = StkTime::getRealTime();
     ArenaGraph* ag = new ArenaGraph(navmesh_file_name);
+    // Make sure that the paths are computed, even if a paths file exists
+    double s = StkTime::getRealTime();
+    ag->buildGraph();
+    ag->computeAllPaths();
     double e = StkTime::getRealTime();
     Log::error("Time", "Dijkstra       %lf", e-s);
 
     // Save the Dijkstra results
-    std::vector< std::vector< float > > distance_matrix = ag->m_distance_matrix;
-    std::vector< std::vector< int16_t > > parent_node = ag->m_parent_node;
+    std::vector<float> distance_matrix = ag->m_distance_matrix;
+    std::vector<int16_t> parent_node = ag->m_parent_node;
+
+    // The paths must be identical after saving and loading them
+    const std::string paths_file =
+        file_manager->getUserConfigFile("unit-test.paths");
+    if (!ag->savePaths(paths_file) || !ag->loadPaths(paths_file) ||
+        memcmp(ag->m_distances, distance_matrix.data(),
+               distance_matrix.size() * sizeof(float)) != 0 ||
+        memcmp(ag->m_parents, parent_node.data(),
+               parent_node.size() * sizeof(int16_t)) != 0)
+    {
+        Log::error("ArenaGraph", "Saved and loaded paths are different.");
+    }
+    ag->m_paths_file.close();
+    file_manager->removeFile(paths_file);
     ag->buildGraph();
 
     // Now compute results with Floyd-Warshall
@@ -404,15 +609,17 @@ void ArenaGraph::unitTesting()
     Log::error("Time", "Floyd-Warshall %lf", e-s);
 
     int error_count = 0;
-    for(unsigned int i=0; i<ag->m_distance_matrix.size(); i++)
+    const unsigned int n = ag->getNumNodes();
+    for(unsigned int i=0; i<n; i++)
     {
-        for(unsigned int j=0; j<ag->m_distance_matrix[i].size(); j++)
+        for(unsigned int j=0; j<n; j++)
         {
-            if(ag->m_distance_matrix[i][j] - distance_matrix[i][j] > 0.001f)
+            if(ag->m_distance_matrix[i*n+j] - distance_matrix[i*n+j] > 0.001f)
             {
                 Log::error("ArenaGraph",
                            "Incorrect distance %d, %d: Dijkstra: %f F.W.: %f",
-                           i, j, distance_matrix[i][j], ag->m_distance_matrix[i][j]);
+                           i, j, distance_matrix[i*n+j],
+                           ag->m_distance_matrix[i*n+j]);
                 error_count++;
             }    // if distance is too different
 
@@ -424,7 +631,7 @@ void ArenaGraph::unitTesting()
             // debugging in the feature
 #undef TEST_PARENT_POLY_EVEN_THOUGH_MANY_FALSE_POSITIVES
 #ifdef TEST_PARENT_POLY_EVEN_THOUGH_MANY_FALSE_POSITIVES
-            if(ag->m_parent_node[i][j] != parent_node[i][j])
+            if(ag->m_parent_node[i*n+j] != parent_node[i*n+j])
             {
                 error_count++;
                 std::vector<int16_t> dijkstra_path = getPathFromTo(i, j, parent_node);
@@ -433,7 +640,7 @@ void ArenaGraph::unitTesting()
                 {
                     Log::error("ArenaGraph",
                                "Incorrect path length %d, %d: Dijkstra: %d F.W.: %d",
-                               i, j, parent_node[i][j], ag->m_parent_node[i][j]);
+                               i, j, parent_node[i*n+j], ag->m_parent_node[i*n+j]);
                     continue;
                 }
                 Log::error("ArenaGraph", "Path problems from %d to %d:",
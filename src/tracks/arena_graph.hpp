@@ -21,6 +21,7 @@
 
 #include "tracks/graph.hpp"
 #include "utils/cpp2011.hpp"
+#include "utils/mapped_file.hpp"
 
 #include <set>
 
@@ -34,11 +35,25 @@ class XMLNode;
 class ArenaGraph : public Graph
 {
 private:
-    /** The actual graph data structure, it is an adjacency matrix. */
-    std::vector<std::vector<float>> m_distance_matrix;
+    /** The actual graph data structure, it is an adjacency matrix, which
+     *  stores the shortest distance from i to j at index i*n+j once the
+     *  paths are computed. */
+    std::vector<float> m_distance_matrix;
 
     /** The matrix that is used to store computed shortest paths. */
-    std::vector<std::vector<int16_t>> m_parent_node;
+    std::vector<int16_t> m_parent_node;
+
+    /** Length of the edge to each adjacent node, in the same order as
+     *  ArenaNode::getAdjacentNodes(). */
+    std::vector<std::vector<float> > m_edge_lengths;
+
+    /** The precomputed paths file (see loadPaths()), if it exists. */
+    MappedFile m_paths_file;
+
+    /** The distances and parent nodes used, which are either in the
+     *  matrices above, or in the mapped paths file. */
+    const float   *m_distances;
+    const int16_t *m_parents;
 
     /** Used in soccer mode to colorize the goal lines in minimap. */
     std::set<int> m_red_node;
@@ -56,10 +71,20 @@ private:
     // ------------------------------------------------------------------------
     void computeDijkstra(int n);
     // ------------------------------------------------------------------------
+    void computeAllPaths();
+    // ------------------------------------------------------------------------
     void computeFloydWarshall();
     // ------------------------------------------------------------------------
+    uint32_t getGraphHash() const;
+    // ------------------------------------------------------------------------
+    bool loadPaths(const std::string &filename);
+    // ------------------------------------------------------------------------
+    bool savePaths(const std::string &filename) const;
+    // ------------------------------------------------------------------------
+    static std::string getPathsFileName(const std::string &navmesh);
+    // ------------------------------------------------------------------------
     static std::vector<int16_t> getPathFromTo(int from, int to,
-                     const std::vector< std::vector< int16_t > >& parent_node);
+                                 const std::vector<int16_t>& parent_node);
     // ------------------------------------------------------------------------
     virtual bool hasLapLine() const OVERRIDE                  { return false; }
     // ------------------------------------------------------------------------
@@ -70,6 +95,8 @@ public:
     // ------------------------------------------------------------------------
     static void unitTesting();
     // ------------------------------------------------------------------------
+    static void generatePathsFiles();
+    // ------------------------------------------------------------------------
     ArenaGraph(const std::string &navmesh, const XMLNode *node = NULL);
     // ------------------------------------------------------------------------
     virtual ~ArenaGraph() {}
@@ -77,14 +104,14 @@ public:
     ArenaNode* getNode(unsigned int i) const;
     // ------------------------------------------------------------------------
     /** Returns the next node on the shortest path from i to j.
-     *  Note: m_parent_node[j][i] contains the parent of i on path from j to i,
+     *  Note: m_parents[j*n+i] contains the parent of i on path from j to i,
      *  which is the next node on the path from i to j (undirected graph)
      */
     int getNextNode(int i, int j) const
     {
         if (i == Graph::UNKNOWN_SECTOR || j == Graph::UNKNOWN_SECTOR)
             return Graph::UNKNOWN_SECTOR;
-        return (int)(m_parent_node[j][i]);
+        return (int)(m_parents[j * getNumNodes() + i]);
     }
     // ------------------------------------------------------------------------
     /** Returns the distance between any two nodes */
@@ -92,7 +119,7 @@ public:
     {
         if (from == Graph::UNKNOWN_SECTOR || to == Graph::UNKNOWN_SECTOR)
             return 99999.0f;
-        return m_distance_matrix[from][to];
+        return m_distances[from * getNumNodes() + to];
     }
 
 };   // ArenaGraph
@@ -29,6 +29,23 @@
 #include "tracks/check_manager.hpp"
 #include "tracks/drive_node.hpp"
 #include "tracks/track.hpp"
+#include "tracks/track_manager.hpp"
+#include "utils/log.hpp"
+#include "utils/string_utils.hpp"
+
+#include <fstream>
+#include <string.h>
+
+namespace
+{
+    /** Identification of a paths file, see DriveGraph::loadPaths(). */
+    const char     PATHS_MAGIC[4] = { 'S', 'T', 'K', 'D' };
+    const uint32_t PATHS_BYTE_ORDER = 0x01020304;
+    const uint32_t PATHS_VERSION = 1;
+    /** Magic, byte order, version, number of nodes, successors and path
+     *  entries, graph hash, unused. */
+    const size_t   PATHS_HEADER_SIZE = 8 * sizeof(uint32_t);
+}
 
 // ----------------------------------------------------------------------------
 /** Constructor, loads the graph information for a given set of quads
@@ -167,7 +184,7 @@ void DriveGraph::load(const std::string &quad_file_name,
         // No graph file exist, assume a default loop X -> X+1
         // Set the default loop:
         setDefaultSuccessors();
-        computeDirectionData();
+        computePathTables(/*compute_distances*/false);
 
         if (m_all_nodes.size() > 0)
         {
@@ -245,8 +262,7 @@ void DriveGraph::load(const std::string &quad_file_name,
     delete xml;
 
     setDefaultSuccessors();
-    computeDistanceFromStart(getStartNode(), 0.0f);
-    computeDirectionData();
+    computePathTables(/*compute_distances*/true);
 
     // Define the track length as the maximum at the end of a quad
     // (i.e. distance_from_start + length till successor 0).
@@ -259,6 +275,7 @@ void DriveGraph::load(const std::string &quad_file_name,
             m_lap_length = l;
     }
 
+    createGrid();
     loadBoundingBoxNodes();
 
 }   // load
@@ -323,6 +340,61 @@ void DriveGraph::computeChecklineRequirements(DriveNode* node,
     }
 }   // computeChecklineRequirements
 
+// ----------------------------------------------------------------------------
+/** Sets up all data that is derived from the graph structure: the distance
+ *  of each node from the start, the direction data used by the AI, and the
+ *  paths to all nodes. They are mapped from a precomputed paths file if
+ *  an up to date one exists, otherwise they are computed.
+ *  \param compute_distances If the distances from start should be computed.
+ */
+void DriveGraph::computePathTables(bool compute_distances)
+{
+    const unsigned int num_nodes = getNumNodes();
+    m_edge_offsets.resize(num_nodes + 1);
+    m_edge_offsets[0] = 0;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        m_edge_offsets[i + 1] = m_edge_offsets[i] +
+                                getNode(i)->getNumberOfSuccessors();
+    }
+
+    if (loadPaths(getPathsFileName()))
+        return;
+
+    if (compute_distances)
+        computeDistanceFromStart(getStartNode(), 0.0f);
+    m_direction.resize(m_edge_offsets.back());
+    m_last_index_same_direction.resize(m_edge_offsets.back());
+    computeDirectionData();
+    computePathsToNodes();
+    setPathTables(m_path_to_node.data(), m_direction.data(),
+                  m_last_index_same_direction.data());
+}   // computePathTables
+
+// ----------------------------------------------------------------------------
+/** Sets the pointers of all nodes into the given path tables.
+ *  \param path_to_node The successors to use to reach each node, for each
+ *         node with more than one successor.
+ *  \param direction, last_index_same_direction The direction data of all
+ *         successors, indexed by m_edge_offsets.
+ */
+void DriveGraph::setPathTables(const int8_t *path_to_node,
+                               const uint8_t *direction,
+                               const uint32_t *last_index_same_direction)
+{
+    const unsigned int num_nodes = getNumNodes();
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        DriveNode *dn = getNode(i);
+        const bool has_paths = dn->getNumberOfSuccessors() > 1;
+        dn->setPathTables(has_paths ? path_to_node : NULL,
+                          direction + m_edge_offsets[i],
+                          last_index_same_direction + m_edge_offsets[i]);
+        if (has_paths)
+            path_to_node += num_nodes;
+    }
+}   // setPathTables
+
 // ----------------------------------------------------------------------------
 /** This function defines the "path-to-nodes" for each graph node that has
  *  more than one successor. The path-to-nodes indicates which successor to
@@ -335,15 +407,243 @@ void DriveGraph::computeChecklineRequirements(DriveNode* node,
  *  potentially be hidden they should not be used (unless necessary).
  *  Only graph nodes with more than one successor have this data structure
  *  (since on other graph nodes only one path can be used anyway, this
- *  saves some memory).
+ *  saves some memory). The paths of all these nodes are stored one after
+ *  the other in m_path_to_node.
+ */
+void DriveGraph::computePathsToNodes()
+{
+    const unsigned int num_nodes = getNumNodes();
+    m_path_to_node.clear();
+    std::vector<unsigned int> stack;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        DriveNode *dn = getNode(i);
+        if (dn->getNumberOfSuccessors() < 2)
+            continue;
+
+        // Initialise each drive node with -1, indicating that
+        // it hasn't been reached yet.
+        const size_t offset = m_path_to_node.size();
+        m_path_to_node.resize(offset + num_nodes, -1);
+        int8_t *path = m_path_to_node.data() + offset;
+
+        // Indicate that this node can be reached from this node by following
+        // successor 0 - just a dummy value that stops the search below.
+        path[i] = 0;
+
+        // A simple search is used to determine which successor to use to
+        // reach a certain drive node: each node gets the first successor
+        // from which it can be reached. Using Dijkstra's algorithm would
+        // give the shortest way to reach a certain node, but the shortest
+        // way might involve some shortcuts which are hidden, and should
+        // therefore not be used.
+        for (unsigned int s = 0; s < dn->getNumberOfSuccessors(); s++)
+        {
+            stack.push_back(dn->getSuccessor(s));
+            while (!stack.empty())
+            {
+                const unsigned int n = stack.back();
+                stack.pop_back();
+                if (path[n] > -1)
+                    continue;
+                path[n] = (int8_t)s;
+                const DriveNode *next = getNode(n);
+                for (unsigned int j = 0; j < next->getNumberOfSuccessors(); j++)
+                    stack.push_back(next->getSuccessor(j));
+            }
+        }
+#ifdef DEBUG
+        for (unsigned int j = 0; j < num_nodes; ++j)
+        {
+            if (path[j] == -1)
+                Log::warn("DriveGraph", "No path to node %d found on drive "
+                          "node %d.", j, i);
+        }
+#endif
+    }
+}   // computePathsToNodes
+
+// ----------------------------------------------------------------------------
+/** Returns the name of the file with the precomputed path tables, which is
+ *  stored next to the quad file (with a different name in reverse mode).
+ */
+std::string DriveGraph::getPathsFileName() const
+{
+    return StringUtils::removeExtension(m_quad_filename) +
+           (m_reverse ? "-reverse.paths" : ".paths");
+}   // getPathsFileName
+
+// ----------------------------------------------------------------------------
+/** Returns a hash (FNV-1a) of all data that the path tables depend on, used
+ *  to detect outdated paths files.
  */
-void DriveGraph::setupPaths()
+uint32_t DriveGraph::getGraphHash() const
 {
-    for(unsigned int i=0; i<getNumNodes(); i++)
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const void *data, size_t size)
     {
-        getNode(i)->setupPathsToNode();
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= ((const uint8_t*)data)[i];
+            hash *= 16777619u;
+        }
+    };
+    const unsigned int n = getNumNodes();
+    add(&n, sizeof(n));
+    const uint8_t reverse = m_reverse ? 1 : 0;
+    add(&reverse, sizeof(reverse));
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const DriveNode *dn = getNode(i);
+        const float points[9] =
+        {
+            dn->getCenter().getX(), dn->getCenter().getY(),
+            dn->getCenter().getZ(), dn->getNormal().getX(),
+            dn->getNormal().getY(), dn->getNormal().getZ(),
+            dn->getLowerCenter().getX(), dn->getLowerCenter().getY(),
+            dn->getLowerCenter().getZ()
+        };
+        add(points, sizeof(points));
+        const unsigned int num_successors = dn->getNumberOfSuccessors();
+        add(&num_successors, sizeof(num_successors));
+        for (unsigned int j = 0; j < num_successors; j++)
+        {
+            const unsigned int succ = dn->getSuccessor(j);
+            add(&succ, sizeof(succ));
+        }
+    }
+    return hash;
+}   // getGraphHash
+
+// ----------------------------------------------------------------------------
+/** Maps a file with precomputed path tables (written by savePaths()) into
+ *  memory, and sets the distances from start of all nodes. It is ignored if
+ *  it was created for a different graph, or on a platform with different
+ *  byte order.
+ *  \param filename Name of the paths file.
+ *  \return True if the paths file is used.
+ */
+bool DriveGraph::loadPaths(const std::string &filename)
+{
+    if (!m_paths_file.open(filename))
+        return false;
+
+    const unsigned int num_nodes = getNumNodes();
+    const uint32_t num_edges = m_edge_offsets.back();
+    uint32_t num_paths = 0;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        if (getNode(i)->getNumberOfSuccessors() > 1)
+            num_paths += num_nodes;
+    }
+
+    const uint8_t *data = (const uint8_t*)m_paths_file.getData();
+    uint32_t header[7];
+    if (m_paths_file.getSize() >= PATHS_HEADER_SIZE)
+        memcpy(header, data + sizeof(PATHS_MAGIC), sizeof(header));
+    if (m_paths_file.getSize() !=
+            PATHS_HEADER_SIZE + (size_t)num_nodes * sizeof(float) +
+            (size_t)num_edges * (sizeof(uint32_t) + sizeof(uint8_t)) +
+            num_paths ||
+        memcmp(data, PATHS_MAGIC, sizeof(PATHS_MAGIC)) != 0 ||
+        header[0] != PATHS_BYTE_ORDER || header[1] != PATHS_VERSION ||
+        header[2] != num_nodes || header[3] != num_edges ||
+        header[4] != num_paths || header[5] != getGraphHash())
+    {
+        Log::warn("DriveGraph", "Ignoring outdated paths file '%s'.",
+                  filename.c_str());
+        m_paths_file.close();
+        return false;
+    }
+
+    const uint8_t *p = data + PATHS_HEADER_SIZE;
+    const float *distances = (const float*)p;
+    for (unsigned int i = 0; i < num_nodes; i++)
+        getNode(i)->setDistanceFromStart(distances[i]);
+    p += num_nodes * sizeof(float);
+    const uint32_t *last_index = (const uint32_t*)p;
+    p += num_edges * sizeof(uint32_t);
+    const uint8_t *direction = p;
+    p += num_edges;
+    setPathTables((const int8_t*)p, direction, last_index);
+    return true;
+}   // loadPaths
+
+// ----------------------------------------------------------------------------
+/** Saves the path tables, so they can be mapped into memory by loadPaths()
+ *  instead of being computed when the track is loaded.
+ *  \param filename Name of the paths file.
+ *  \return True if the file was written successfully.
+ */
+bool DriveGraph::savePaths(const std::string &filename) const
+{
+    const unsigned int num_nodes = getNumNodes();
+    const uint32_t header[7] = { PATHS_BYTE_ORDER, PATHS_VERSION, num_nodes,
+                                 m_edge_offsets.back(),
+                                 (uint32_t)m_path_to_node.size(),
+                                 getGraphHash(), 0 };
+    std::vector<float> distances(num_nodes);
+    for (unsigned int i = 0; i < num_nodes; i++)
+        distances[i] = getNode(i)->getDistanceFromStart();
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    f.write(PATHS_MAGIC, sizeof(PATHS_MAGIC));
+    f.write((const char*)header, sizeof(header));
+    f.write((const char*)distances.data(), num_nodes * sizeof(float));
+    f.write((const char*)m_last_index_same_direction.data(),
+            m_last_index_same_direction.size() * sizeof(uint32_t));
+    f.write((const char*)m_direction.data(), m_direction.size());
+    f.write((const char*)m_path_to_node.data(), m_path_to_node.size());
+    f.close();
+    return !f.fail();
+}   // savePaths
+
+// ----------------------------------------------------------------------------
+/** Writes the paths files of all tracks with a drive graph, in both
+ *  directions if the track can be driven in reverse. This is meant to be
+ *  used when packaging tracks, so that the path tables don't need to be
+ *  computed each time a track is loaded.
+ */
+void DriveGraph::generatePathsFiles()
+{
+    const bool reverse_track = race_manager->getReverseTrack();
+    for (unsigned int i = 0; i < track_manager->getNumberOfTracks(); i++)
+    {
+        Track *track = track_manager->getTrack(i);
+        if (track->isInternal() || track->isArena() || track->isSoccer())
+            continue;
+        const std::string quads = track->getTrackFile("quads.xml");
+        if (!file_manager->fileExists(quads))
+            continue;
+        for (int reverse = 0; reverse < 2; reverse++)
+        {
+            if (reverse && !track->reverseAvailable())
+                continue;
+            // Quads can be ignored depending on the driving direction
+            race_manager->setReverseTrack(reverse == 1);
+            DriveGraph *dg = new DriveGraph(quads,
+                                            track->getTrackFile("graph.xml"),
+                                            reverse == 1);
+            const std::string paths = dg->getPathsFileName();
+            if (dg->m_paths_file.isOpen())
+            {
+                Log::info("DriveGraph", "%s: %s is up to date.",
+                          track->getIdent().c_str(), paths.c_str());
+            }
+            else if (dg->getNumNodes() > 0 && dg->savePaths(paths))
+            {
+                Log::info("DriveGraph", "%s: written %s for %d nodes.",
+                          track->getIdent().c_str(), paths.c_str(),
+                          dg->getNumNodes());
+            }
+            else if (dg->getNumNodes() > 0)
+                Log::error("DriveGraph", "Can't write '%s'.", paths.c_str());
+            // This deletes the graph
+            Graph::destroy();
+        }
     }
-}   // setupPaths
+    race_manager->setReverseTrack(reverse_track);
+}   // generatePathsFiles
 
 // -----------------------------------------------------------------------------
 /** This function sets a default successor for all graph nodes that currently
@@ -659,7 +959,8 @@ void DriveGraph::determineDirection(unsigned int current,
         rel_angle==0 ? DriveNode::DIR_STRAIGHT
                      : (rel_angle>0) ? DriveNode::DIR_RIGHT
                                      : DriveNode::DIR_LEFT;
-    getNode(current)->setDirectionData(succ_index, dir, next);
+    m_direction[m_edge_offsets[current] + succ_index] = (uint8_t)dir;
+    m_last_index_same_direction[m_edge_offsets[current] + succ_index] = next;
 }   // determineDirection
 
 
@@ -25,6 +25,7 @@
 #include "tracks/graph.hpp"
 #include "utils/aligned_array.hpp"
 #include "utils/cpp2011.hpp"
+#include "utils/mapped_file.hpp"
 
 #include "LinearMath/btTransform.h"
 
@@ -47,6 +48,22 @@ private:
     /** Wether the graph should be reverted or not */
     bool m_reverse;
 
+    /** Index of the first successor of each node in the tables that store
+     *  a value for each successor, with one more entry for the end of the
+     *  last node (i.e. compressed sparse row layout). */
+    std::vector<uint32_t> m_edge_offsets;
+
+    /** The path tables if they are computed when the graph is loaded (and
+     *  not mapped from a paths file): the direction and the last node with
+     *  the same direction for each successor, and for each node with more
+     *  than one successor which successor to use to reach each node. */
+    std::vector<uint8_t>  m_direction;
+    std::vector<uint32_t> m_last_index_same_direction;
+    std::vector<int8_t>   m_path_to_node;
+
+    /** The precomputed paths file (see loadPaths()), if it exists. */
+    MappedFile m_paths_file;
+
     // ------------------------------------------------------------------------
     void setDefaultSuccessors();
     // ------------------------------------------------------------------------
@@ -54,6 +71,21 @@ private:
     // ------------------------------------------------------------------------
     void computeDirectionData();
     // ------------------------------------------------------------------------
+    void computePathTables(bool compute_distances);
+    // ------------------------------------------------------------------------
+    void computePathsToNodes();
+    // ------------------------------------------------------------------------
+    void setPathTables(const int8_t *path_to_node, const uint8_t *direction,
+                       const uint32_t *last_index_same_direction);
+    // ------------------------------------------------------------------------
+    uint32_t getGraphHash() const;
+    // ------------------------------------------------------------------------
+    bool loadPaths(const std::string &filename);
+    // ------------------------------------------------------------------------
+    bool savePaths(const std::string &filename) const;
+    // ------------------------------------------------------------------------
+    std::string getPathsFileName() const;
+    // ------------------------------------------------------------------------
     void determineDirection(unsigned int current, unsigned int succ_index);
     // ------------------------------------------------------------------------
     float normalizeAngle(float f);
@@ -76,6 +108,8 @@ private:
 public:
     static DriveGraph* get()     { return dynamic_cast<DriveGraph*>(m_graph); }
     // ------------------------------------------------------------------------
+    static void generatePathsFiles();
+    // ------------------------------------------------------------------------
     DriveGraph(const std::string &quad_file_name,
                const std::string &graph_file_name, const bool reverse);
     // ------------------------------------------------------------------------
@@ -95,8 +129,6 @@ public:
     void updateDistancesForAllSuccessors(unsigned int indx, float delta,
                                          unsigned int count);
     // ------------------------------------------------------------------------
-    void setupPaths();
-    // ------------------------------------------------------------------------
     void computeChecklineRequirements();
     // ------------------------------------------------------------------------
     /** Return the distance to the j-th successor of node n. */
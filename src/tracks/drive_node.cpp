@@ -32,6 +32,9 @@ DriveNode::DriveNode(const Vec3 &p0, const Vec3 &p1, const Vec3 &p2,
 {
     m_ai_ignore           = ai_ignore;
     m_distance_from_start = -1.0f;
+    m_path_to_node        = NULL;
+    m_direction           = NULL;
+    m_last_index_same_direction = NULL;
 
     // The following values should depend on the actual orientation
     // of the quad. ATM we always assume that indices 0,1 are the lower end,
@@ -84,84 +87,6 @@ void DriveNode::addSuccessor(unsigned int to)
 
 }   // addSuccessor
 
-// ----------------------------------------------------------------------------
-/** If this node has more than one successor, it will set up a vector that
- *  contains the direction to use when a certain drive node X should be
- *  reached.
- */
-void DriveNode::setupPathsToNode()
-{
-    if(m_successor_nodes.size()<2) return;
-
-    const unsigned int num_nodes = DriveGraph::get()->getNumNodes();
-    m_path_to_node.resize(num_nodes);
-
-    // Initialise each drive node with -1, indicating that
-    // it hasn't been reached yet.
-    for(unsigned int i=0; i<num_nodes; i++)
-        m_path_to_node[i] = -1;
-
-    // Indicate that this node can be reached from this node by following
-    // successor 0 - just a dummy value that might only be used during the
-    // recursion below.
-    m_path_to_node[m_index] = 0;
-
-    // A simple depth first search is used to determine which successor to
-    // use to reach a certain drive node. Using Dijkstra's algorithm  would
-    // give the shortest way to reach a certain node, but the shortest way
-    // might involve some shortcuts which are hidden, and should therefore
-    // not be used.
-    for(unsigned int i=0; i<getNumberOfSuccessors(); i++)
-    {
-        DriveNode* dn = DriveGraph::get()->getNode(getSuccessor(i));
-        dn->markAllSuccessorsToUse(i, &m_path_to_node);
-    }
-#ifdef DEBUG
-    for(unsigned int i = 0; i < m_path_to_node.size(); ++i)
-    {
-        if(m_path_to_node[i] == -1)
-            Log::warn("DriveNode", "No path to node %d found on drive node %d.",
-                   i, m_index);
-    }
-#endif
-}   // setupPathsToNode
-
-// ----------------------------------------------------------------------------
-/** This function marks that the successor n should be used to reach this
- *  node. It then recursively (depth first) does the same for all its
- *  successors. Depth-first
- *  \param n The successor which should be used in m_path_node to reach
- *         this node.
- *  \param path_to_node The path-to-node data structure of the node for
- *         which the paths are currently determined.
- */
-void DriveNode::markAllSuccessorsToUse(unsigned int n,
-                                       PathToNodeVector *path_to_node)
-{
-    // End recursion if the path to this node has already been found.
-    if( (*path_to_node)[m_index] >-1) return;
-
-    (*path_to_node)[m_index] = n;
-    for(unsigned int i=0; i<getNumberOfSuccessors(); i++)
-    {
-        DriveNode* dn = DriveGraph::get()->getNode(getSuccessor(i));
-        dn->markAllSuccessorsToUse(n, path_to_node);
-    }
-}   // markAllSuccesorsToUse
-
-// ----------------------------------------------------------------------------
-void DriveNode::setDirectionData(unsigned int successor, DirectionType dir,
-                                 unsigned int last_node_index)
-{
-    if(m_direction.size()<successor+1)
-    {
-        m_direction.resize(successor+1);
-        m_last_index_same_direction.resize(successor+1);
-    }
-    m_direction[successor]                 = dir;
-    m_last_index_same_direction[successor] = last_node_index;
-}   // setDirectionData
-
 // ----------------------------------------------------------------------------
 void DriveNode::setChecklineRequirements(int latest_checkline)
 {
@@ -19,6 +19,7 @@
 #ifndef HEADER_DRIVE_NODE_HPP
 #define HEADER_DRIVE_NODE_HPP
 
+#include <stdint.h>
 #include <vector>
 
 #include "tracks/quad.hpp"
@@ -69,21 +70,21 @@ private:
     /** A vector from the center of the quad to the right edge. */
     Vec3 m_center_to_right;
 
-    typedef std::vector<int> PathToNodeVector;
-    /** This vector is only used if the drive node has more than one
-     *  successor. In this case m_path_to_node[X] will contain the index
-     *  of the successor to use in order to reach drive node X for this
-     *  drive nodes.  */
-    PathToNodeVector  m_path_to_node;
+    /** This is only used if the drive node has more than one successor
+     *  (otherwise it is NULL). In this case m_path_to_node[X] will contain
+     *  the index of the successor to use in order to reach drive node X for
+     *  this drive node. It points into the path tables of the drive graph. */
+    const int8_t *m_path_to_node;
 
-    /** The direction for each of the successors. */
-    std::vector<DirectionType>  m_direction;
+    /** The direction (a DirectionType) for each of the successors, which
+     *  points into the path tables of the drive graph. */
+    const uint8_t *m_direction;
 
     /** Stores for each successor the index of the last drive node that
      *  has the same direction (i.e. if index 0 curves left, this vector
      *  will store the index of the last drive node that is still turning
-     *  left. */
-    std::vector<unsigned int> m_last_index_same_direction;
+     *  left. It points into the path tables of the drive graph. */
+    const uint32_t *m_last_index_same_direction;
 
     /** A unit vector pointing from the center to the right side, orthogonal
      *  to the driving direction. */
@@ -96,11 +97,6 @@ private:
      */
    std::vector< int > m_checkline_requirements;
 
-
-    // ------------------------------------------------------------------------
-   void markAllSuccessorsToUse(unsigned int n,
-                                PathToNodeVector *m_path_to_node);
-
 public:
                  DriveNode(const Vec3 &p0, const Vec3 &p1, const Vec3 &p2,
                            const Vec3 &p3, const Vec3 &normal,
@@ -111,12 +107,18 @@ public:
     // ------------------------------------------------------------------------
     void         addSuccessor (unsigned int to);
     // ------------------------------------------------------------------------
-    void         setupPathsToNode();
-    // ------------------------------------------------------------------------
     void         setChecklineRequirements(int latest_checkline);
     // ------------------------------------------------------------------------
-    void         setDirectionData(unsigned int successor, DirectionType dir,
-                                  unsigned int last_node_index);
+    /** Sets the pointers into the path tables of the drive graph, see
+     *  DriveGraph::setPathTables(). */
+    void         setPathTables(const int8_t *path_to_node,
+                               const uint8_t *direction,
+                               const uint32_t *last_index_same_direction)
+    {
+        m_path_to_node              = path_to_node;
+        m_direction                 = direction;
+        m_last_index_same_direction = last_index_same_direction;
+    }   // setPathTables
     // ------------------------------------------------------------------------
     /** Returns the number of successors. */
     unsigned int getNumberOfSuccessors() const
@@ -173,7 +175,7 @@ public:
     {
         // If we have a path to node vector, use its information, otherwise
         // (i.e. there is only one successor anyway) use this one successor.
-        return m_path_to_node.size()>0 ? m_path_to_node[n] : 0;
+        return m_path_to_node ? m_path_to_node[n] : 0;
     }   // getSuccesorToReach
     // ------------------------------------------------------------------------
     /** Returns the checkline requirements of this drive node. */
@@ -184,7 +186,8 @@ public:
     void getDirectionData(unsigned int succ, DirectionType *dir,
                           unsigned int *last) const
     {
-        *dir = m_direction[succ];  *last = m_last_index_same_direction[succ];
+        *dir  = (DirectionType)m_direction[succ];
+        *last = m_last_index_same_direction[succ];
     }
     // ------------------------------------------------------------------------
     /** Returns a unit vector pointing to the right side of the quad. */
@@ -25,14 +25,22 @@
 #include "graphics/material_manager.hpp"
 #include "graphics/sp/sp_mesh.hpp"
 #include "graphics/sp/sp_mesh_buffer.hpp"
+#include "io/file_manager.hpp"
 #include "modes/profile_world.hpp"
 #include "race/race_manager.hpp"
+#include "tracks/arena_graph.hpp"
 #include "tracks/arena_node_3d.hpp"
+#include "tracks/drive_graph.hpp"
 #include "tracks/drive_node_2d.hpp"
 #include "tracks/drive_node_3d.hpp"
 #include "tracks/track.hpp"
+#include "tracks/track_manager.hpp"
 #include "utils/log.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <random>
+
 const int Graph::UNKNOWN_SECTOR = -1;
 const float Graph::MIN_HEIGHT_TESTING = -1.0f;
 const float Graph::MAX_HEIGHT_TESTING = 5.0f;
@@ -48,6 +56,12 @@ Graph::Graph()
     m_bb_min      = Vec3( 99999,  99999,  99999);
     m_bb_max      = Vec3(-99999, -99999, -99999);
     memset(m_bb_nodes, 0, 4 * sizeof(int));
+    m_grid_min_x     = 0;
+    m_grid_min_z     = 0;
+    m_grid_cell_size = 1.0f;
+    m_grid_width     = 0;
+    m_grid_height    = 0;
+    m_use_grid       = true;
 }  // Graph
 
 // -----------------------------------------------------------------------------
@@ -632,6 +646,33 @@ void Graph::findRoadSector(const Vec3& xyz, int *sector,
                             ? (unsigned int)all_sectors->size()
                             : (unsigned int)m_all_nodes.size();
     *sector = UNKNOWN_SECTOR;
+
+    if (!all_sectors && m_use_grid && !m_grid_cells.empty())
+    {
+        // Only the quads in the grid cell of xyz can contain the point. To
+        // get the same result as testing all quads, use the first matching
+        // quad in the order in which they would have been tested.
+        const int n = (int)m_all_nodes.size();
+        const int start = indx < n - 1 ? indx + 1 : 0;
+        int x, z;
+        if (!getGridCell(xyz, &x, &z))
+            return;
+        const unsigned int cell = z * m_grid_width + x;
+        int best_order = n;
+        for (unsigned int i = m_grid_cells[cell]; i < m_grid_cells[cell + 1];
+             i++)
+        {
+            const int q = m_grid_quads[i];
+            const int order = q >= start ? q - start : q - start + n;
+            if (order < best_order &&
+                getQuad(q)->pointInside(xyz, ignore_vertical))
+            {
+                best_order = order;
+                *sector    = q;
+            }
+        }
+        return;
+    }
     for(unsigned int i=0; i<max_count; i++)
     {
         if(all_sectors)
@@ -708,6 +749,72 @@ int Graph::findOutOfRoadSector(const Vec3& xyz, const int curr_sector,
     int   min_sector = UNKNOWN_SECTOR;
     float min_dist_2 = 999999.0f*999999.0f;
 
+    int x, z;
+    if (!all_sectors && m_use_grid && !m_grid_cells.empty() &&
+        getGridCell(xyz, &x, &z))
+    {
+        // Search the grid cells in rings around the cell of xyz. All quads
+        // not yet tested are at least r cells away, so the search can stop
+        // once a quad closer than that is found. As in the loop below, the
+        // height condition is used if possible (phase 0), and ties are
+        // resolved by the order in which the quads would have been tested.
+        const int n = getNumNodes();
+        const int start = current_sector + 1 == n ? 0 : current_sector + 1;
+        int   sector[2]     = { UNKNOWN_SECTOR, UNKNOWN_SECTOR };
+        float dist_2[2]     = { min_dist_2, min_dist_2 };
+        int   best_order[2] = { n, n };
+        const int max_r = std::max(m_grid_width, m_grid_height);
+        for (int r = 0; r <= max_r; r++)
+        {
+            const float ring_dist = (r - 1) * m_grid_cell_size;
+            if (r > 0 && sector[0] != UNKNOWN_SECTOR &&
+                dist_2[0] < ring_dist * ring_dist)
+                break;
+            for (int cz = z - r; cz <= z + r; cz++)
+            {
+                if (cz < 0 || cz >= m_grid_height) continue;
+                // Inner rows only have the two cells at the border
+                const int step = (cz == z - r || cz == z + r) ? 1 : 2 * r;
+                for (int cx = x - r; cx <= x + r; cx += std::max(step, 1))
+                {
+                    if (cx < 0 || cx >= m_grid_width) continue;
+                    const unsigned int cell = cz * m_grid_width + cx;
+                    for (unsigned int i = m_grid_cells[cell];
+                         i < m_grid_cells[cell + 1]; i++)
+                    {
+                        const int j = m_grid_quads[i];
+                        const Quad* q = getQuad(j);
+                        if (q->isIgnored())
+                            continue;
+                        const float d2 = q->getDistance2FromPoint(xyz);
+                        const int order = j >= start ? j - start
+                                                     : j - start + n;
+                        const float dist = xyz.getY() - q->getMinHeight();
+                        const bool height_ok = (dist < 5.0f && dist>-1.0f) ||
+                                               q->is3DQuad() ||
+                                               ignore_vertical;
+                        for (int phase = height_ok ? 0 : 1; phase < 2;
+                             phase++)
+                        {
+                            if (d2 < dist_2[phase] ||
+                                (d2 == dist_2[phase] &&
+                                 order < best_order[phase]))
+                            {
+                                dist_2[phase]     = d2;
+                                sector[phase]     = j;
+                                best_order[phase] = order;
+                            }
+                        }
+                    }   // for i in cell
+                }   // for cx
+            }   // for cz
+        }   // for r
+        min_sector = sector[0] != UNKNOWN_SECTOR ? sector[0] : sector[1];
+        if (min_sector == UNKNOWN_SECTOR)
+            Log::info("Graph", "unknown sector found.");
+        return min_sector;
+    }   // if grid can be used
+
     // If a kart is falling and in between (or too far below)
     // a driveline point it might not fulfill
     // the height condition. So we run the test twice: first with height
@@ -774,3 +881,241 @@ void Graph::loadBoundingBoxNodes()
     m_bb_nodes[3] = findOutOfRoadSector(Vec3(m_bb_max.x(), 0, m_bb_max.z()),
         -1/*curr_sector*/, NULL/*all_sectors*/, true/*ignore_vertical*/);
 }   // loadBoundingBoxNodes
+
+//-----------------------------------------------------------------------------
+/** Computes a 2d bounding rectangle (x/z plane) for a quad, which contains
+ *  all points for which pointInside() can be true, and its centre line used
+ *  by getDistance2FromPoint().
+ */
+void Graph::getQuadRect(const Quad *q, float *min_x, float *min_z,
+                        float *max_x, float *max_z) const
+{
+    *min_x = *max_x = (*q)[0].getX();
+    *min_z = *max_z = (*q)[0].getZ();
+    for (int i = 1; i < 4; i++)
+    {
+        *min_x = std::min(*min_x, (*q)[i].getX());
+        *max_x = std::max(*max_x, (*q)[i].getX());
+        *min_z = std::min(*min_z, (*q)[i].getZ());
+        *max_z = std::max(*max_z, (*q)[i].getZ());
+    }
+    // A 3d quad tests a box which extends 5 units along the normal (see
+    // BoundingBox3D), and is not necessarily planar. For 2d quads only
+    // allow for rounding errors of the centre line.
+    const float margin = q->is3DQuad() ? 6.0f : 0.01f;
+    *min_x -= margin;
+    *min_z -= margin;
+    *max_x += margin;
+    *max_z += margin;
+}   // getQuadRect
+
+//-----------------------------------------------------------------------------
+/** Determines the grid cell of a point.
+ *  \return False if the point is outside of the grid.
+ */
+bool Graph::getGridCell(const Vec3 &xyz, int *x, int *z) const
+{
+    const float fx = (xyz.getX() - m_grid_min_x) / m_grid_cell_size;
+    const float fz = (xyz.getZ() - m_grid_min_z) / m_grid_cell_size;
+    // Also handles NAN coordinates
+    if (!(fx >= 0 && fz >= 0 && fx < m_grid_width && fz < m_grid_height))
+        return false;
+    *x = (int)fx;
+    *z = (int)fz;
+    return true;
+}   // getGridCell
+
+//-----------------------------------------------------------------------------
+/** Creates the 2d grid used by findRoadSector() and findOutOfRoadSector().
+ *  Must be called once all quads are created. The cell size is the average
+ *  size of a quad, so that a cell usually only contains a few quads.
+ */
+void Graph::createGrid()
+{
+    m_grid_cells.clear();
+    m_grid_quads.clear();
+    if (m_all_nodes.empty())
+        return;
+
+    std::vector<float> rects(m_all_nodes.size() * 4);
+    float min_x = 999999.0f, min_z = 999999.0f;
+    float max_x = -999999.0f, max_z = -999999.0f;
+    float total_size = 0;
+    for (unsigned int i = 0; i < m_all_nodes.size(); i++)
+    {
+        float *r = &rects[i * 4];
+        getQuadRect(m_all_nodes[i], &r[0], &r[1], &r[2], &r[3]);
+        min_x = std::min(min_x, r[0]);
+        min_z = std::min(min_z, r[1]);
+        max_x = std::max(max_x, r[2]);
+        max_z = std::max(max_z, r[3]);
+        total_size += std::max(r[2] - r[0], r[3] - r[1]);
+    }
+
+    m_grid_min_x     = min_x;
+    m_grid_min_z     = min_z;
+    m_grid_cell_size = std::max(total_size / m_all_nodes.size(), 1.0f);
+    // Limit the memory used for huge tracks with tiny quads
+    while (((max_x - min_x) / m_grid_cell_size + 1.0f) *
+           ((max_z - min_z) / m_grid_cell_size + 1.0f) > 256.0f * 256.0f)
+        m_grid_cell_size *= 2.0f;
+    m_grid_width  = (int)((max_x - min_x) / m_grid_cell_size) + 1;
+    m_grid_height = (int)((max_z - min_z) / m_grid_cell_size) + 1;
+
+    // First count the quads in each cell, then store the quad indices
+    const int num_cells = m_grid_width * m_grid_height;
+    m_grid_cells.resize(num_cells + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (unsigned int i = 0; i < m_all_nodes.size(); i++)
+        {
+            const float *r = &rects[i * 4];
+            int x0, z0, x1, z1;
+            getGridCell(Vec3(r[0], 0, r[1]), &x0, &z0);
+            if (!getGridCell(Vec3(r[2], 0, r[3]), &x1, &z1))
+            {
+                // The maximum can be exactly on the border of the grid
+                x1 = m_grid_width - 1;
+                z1 = m_grid_height - 1;
+            }
+            for (int z = z0; z <= z1; z++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    const int cell = z * m_grid_width + x;
+                    if (pass == 0)
+                        m_grid_cells[cell + 1]++;
+                    else
+                        m_grid_quads[m_grid_cells[cell]++] = i;
+                }
+            }
+        }   // for i < m_all_nodes.size()
+
+        if (pass == 0)
+        {
+            for (int i = 0; i < num_cells; i++)
+                m_grid_cells[i + 1] += m_grid_cells[i];
+            m_grid_quads.resize(m_grid_cells[num_cells]);
+        }
+        else
+        {
+            // Filling moved each start index to the start of the next cell
+            for (int i = num_cells; i > 0; i--)
+                m_grid_cells[i] = m_grid_cells[i - 1];
+            m_grid_cells[0] = 0;
+        }
+    }   // for pass
+
+    Log::debug("Graph", "Created %dx%d grid with cell size %f for %d quads, "
+               "%d entries.", m_grid_width, m_grid_height, m_grid_cell_size,
+               getNumNodes(), (int)m_grid_quads.size());
+}   // createGrid
+
+//-----------------------------------------------------------------------------
+/** Compares findRoadSector() and findOutOfRoadSector() with and without the
+ *  grid for all tracks, using random points on the quads and in the bounding
+ *  box of each track. Each query is done without a previous sector, so the
+ *  fast path of testing the previous quad first is not used. Any different
+ *  result is reported as an error.
+ */
+void Graph::benchmark()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    const int num_points = 20000;
+    for (unsigned int i = 0; i < track_manager->getNumberOfTracks(); i++)
+    {
+        Track *track = track_manager->getTrack(i);
+        if (track->isInternal())
+            continue;
+        Graph *graph = NULL;
+        if (track->isArena() || track->isSoccer())
+        {
+            if (!track->hasNavMesh())
+                continue;
+            graph = new ArenaGraph(track->getTrackFile("navmesh.xml"));
+            setGraph(graph);
+        }
+        else
+        {
+            if (!file_manager->fileExists(track->getTrackFile("quads.xml")))
+                continue;
+            // The constructor sets the graph
+            graph = new DriveGraph(track->getTrackFile("quads.xml"),
+                                   track->getTrackFile("graph.xml"), false);
+        }
+        if (graph->getNumNodes() == 0)
+        {
+            destroy();
+            continue;
+        }
+
+        std::mt19937 random(i);
+        std::uniform_real_distribution<float> offset(-3.0f, 3.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Vec3> points;
+        for (int j = 0; j < num_points; j++)
+        {
+            if (j % 2 == 0)
+            {
+                // Close to a quad
+                const Vec3 &c = graph->getQuad(random() % graph->getNumNodes())
+                                ->getCenter();
+                points.push_back(c + Vec3(offset(random), unit(random),
+                                          offset(random)));
+            }
+            else
+            {
+                const Vec3 &min = graph->m_bb_min;
+                const Vec3 &max = graph->m_bb_max;
+                points.push_back(Vec3(
+                    min.getX() + unit(random) * (max.getX() - min.getX()),
+                    min.getY() + unit(random) * (max.getY() - min.getY()),
+                    min.getZ() + unit(random) * (max.getZ() - min.getZ())));
+            }
+        }
+
+        std::vector<int> road[2], out_of_road[2];
+        Clock::duration road_time[2], out_of_road_time[2];
+        for (int use_grid = 0; use_grid < 2; use_grid++)
+        {
+            graph->m_use_grid = use_grid == 1;
+            Clock::time_point start = Clock::now();
+            for (const Vec3 &p : points)
+            {
+                int sector = UNKNOWN_SECTOR;
+                graph->findRoadSector(p, &sector);
+                road[use_grid].push_back(sector);
+            }
+            Clock::time_point end = Clock::now();
+            road_time[use_grid] = end - start;
+            for (const Vec3 &p : points)
+                out_of_road[use_grid].push_back(graph->findOutOfRoadSector(p));
+            out_of_road_time[use_grid] = Clock::now() - end;
+        }
+
+        int errors = 0;
+        for (int j = 0; j < num_points; j++)
+        {
+            if (road[0][j] != road[1][j] || out_of_road[0][j] !=
+                out_of_road[1][j])
+                errors++;
+        }
+        auto us = [num_points](Clock::duration d)
+        {
+            return std::chrono::duration<double, std::micro>(d).count() /
+                   num_points;
+        };
+        Log::info("Graph", "%-20s %5d quads: findRoadSector %.3f -> %.3f us, "
+                  "findOutOfRoadSector %.3f -> %.3f us.",
+                  track->getIdent().c_str(), graph->getNumNodes(),
+                  us(road_time[0]), us(road_time[1]),
+                  us(out_of_road_time[0]), us(out_of_road_time[1]));
+        if (errors > 0)
+        {
+            Log::error("Graph", "%s: %d of %d points have a different sector "
+                       "with the grid.", track->getIdent().c_str(), errors,
+                       num_points);
+        }
+        destroy();
+    }   // for i < getNumberOfTracks
+}   // benchmark
@@ -66,6 +66,8 @@ protected:
     // ------------------------------------------------------------------------
     /** Map 4 bounding box points to 4 closest graph nodes. */
     void loadBoundingBoxNodes();
+    // ------------------------------------------------------------------------
+    void createGrid();
 
 private:
     /** The 2d bounding box, used for hashing. */
@@ -75,6 +77,26 @@ private:
     /** The 4 closest graph nodes to the bounding box. */
     int m_bb_nodes[4];
 
+    /** A 2d grid (x/z plane) over the bounding rectangles of all quads,
+     *  used to avoid testing all quads in findRoadSector() and
+     *  findOutOfRoadSector(). The quads of cell i are stored in
+     *  m_grid_quads from index m_grid_cells[i] to m_grid_cells[i+1]. */
+    std::vector<unsigned int> m_grid_cells;
+    std::vector<int> m_grid_quads;
+
+    /** Minimum x/z coordinates of the grid. */
+    float m_grid_min_x, m_grid_min_z;
+
+    /** Size of a (square) grid cell. */
+    float m_grid_cell_size;
+
+    /** Number of cells in x and z direction. */
+    int m_grid_width, m_grid_height;
+
+    /** Can be set to false to test all quads (as without grid), used to
+     *  compare results and performance. */
+    bool m_use_grid;
+
     /** The node of the graph mesh. */
     scene::ISceneNode *m_node;
 
@@ -106,6 +128,11 @@ private:
     virtual bool hasLapLine() const = 0;
     // ------------------------------------------------------------------------
     virtual void differentNodeColor(int n, video::SColor* c) const = 0;
+    // ------------------------------------------------------------------------
+    void getQuadRect(const Quad *q, float *min_x, float *min_z,
+                     float *max_x, float *max_z) const;
+    // ------------------------------------------------------------------------
+    bool getGridCell(const Vec3 &xyz, int *x, int *z) const;
 
 public:
     static const int UNKNOWN_SECTOR;
@@ -113,6 +140,8 @@ public:
     static const float MIN_HEIGHT_TESTING;
     static const float MAX_HEIGHT_TESTING;
     // ------------------------------------------------------------------------
+    static void benchmark();
+    // ------------------------------------------------------------------------
     /** Returns the one instance of this object. It is possible that there
      *  is no instance created (e.g. arena without navmesh) so we don't assert
      *  that an instance exist. */
@@ -89,9 +89,15 @@
 #include <ISceneManager.h>
 #include <SMeshBuffer.h>
 
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <sstream>
+#include <string.h>
+#include <sys/stat.h>
 #include <wchar.h>
 
 using namespace irr;
@@ -133,6 +139,12 @@ Track::Track(const std::string &filename)
     m_version               = 0;
     m_track_mesh            = NULL;
     m_gfx_effect_mesh       = NULL;
+    m_physics_cache_loaded  = false;
+    m_physics_cache_key     = 0;
+    m_main_track_triangles  = 0;
+    m_main_gfx_triangles    = 0;
+    m_cached_bvh_triangles  = 0;
+    m_cached_bvh_hash       = 0;
     m_internal              = false;
     m_enable_auto_rescue    = true;  // Below set to false in arenas
     m_enable_push_back      = true;
@@ -370,6 +382,7 @@ void Track::cleanup()
 
     delete m_gfx_effect_mesh;
     m_gfx_effect_mesh = NULL;
+    m_physics_cache_loaded = false;
 
 #ifndef SERVER_ONLY
     if (CVS->isGLSL())
@@ -799,7 +812,6 @@ void Track::loadDriveGraph(unsigned int mode_id, const bool reverse)
 
     // setGraph is done in DriveGraph constructor
     assert(DriveGraph::get());
-    DriveGraph::get()->setupPaths();
 #ifdef DEBUG
     for(unsigned int i=0; i<DriveGraph::get()->getNumNodes(); i++)
     {
@@ -910,10 +922,23 @@ void Track::createPhysicsModel(unsigned int main_track_count)
         uploadNodeVertexBuffer(m_all_nodes[i]);
     }
     main_loop->renderGUI(5580);
+    // The cached bvh can only be used if the same objects were added to
+    // the main track model
+    bool save_cache = !m_physics_cache_file.empty() && !m_physics_cache_loaded;
+    if (m_physics_cache_loaded &&
+        (m_track_mesh->getNumTriangles() != m_cached_bvh_triangles ||
+         m_track_mesh->hashVertices(m_main_track_triangles) !=
+             m_cached_bvh_hash))
+    {
+        m_track_mesh->setSerializedBvh(std::vector<char>());
+        save_cache = true;
+    }
     m_track_mesh->createPhysicalBody(m_friction);
     main_loop->renderGUI(5585);
     m_gfx_effect_mesh->createCollisionShape();
     main_loop->renderGUI(5590);
+    if (save_cache)
+        savePhysicsCache();
 
 }   // createPhysicsModel
 
@@ -1150,6 +1175,242 @@ void Track::convertTrackToBullet(scene::ISceneNode *node)
 
 }   // convertTrackToBullet
 
+// ----------------------------------------------------------------------------
+namespace
+{
+    /** Identification of a physics cache file. */
+    const char     PHYSICS_CACHE_MAGIC[4] = { 'S', 'T', 'K', 'B' };
+    const uint32_t PHYSICS_CACHE_BYTE_ORDER = 0x01020304;
+    const uint32_t PHYSICS_CACHE_VERSION = 1;
+
+    // ------------------------------------------------------------------------
+    void writeString(std::ostream &out, const std::string &s)
+    {
+        const uint32_t size = (uint32_t)s.size();
+        out.write((const char*)&size, sizeof(size));
+        out.write(s.data(), size);
+    }   // writeString
+
+    // ------------------------------------------------------------------------
+    bool readString(std::istream &in, std::string *s)
+    {
+        uint32_t size = 0;
+        in.read((char*)&size, sizeof(size));
+        if (!in.good() || size > 65536)
+            return false;
+        s->resize(size);
+        in.read(&(*s)[0], size);
+        return in.good();
+    }   // readString
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Returns a hash (FNV-1a) of the names, sizes and modification times of
+ *  all files which the physics data of the main track model depends on,
+ *  i.e. the models and xml files of the track and the shared materials.
+ *  The file contents are not read, so the key is cheap to compute on each
+ *  track load.
+ */
+uint64_t Track::getPhysicsCacheKey() const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void *data, size_t size)
+    {
+        const uint8_t *bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    const uint32_t scalar_size = sizeof(btScalar);
+    add(&scalar_size, sizeof(scalar_size));
+    add(&stk_config->m_smooth_angle_limit,
+        sizeof(stk_config->m_smooth_angle_limit));
+    add(m_ident.data(), m_ident.size());
+
+    std::set<std::string> files;
+    file_manager->listFiles(files, m_root);
+    std::vector<std::string> paths;
+    for (const std::string &file : files)
+    {
+        const std::string ext = StringUtils::toLowerCase(
+            StringUtils::getExtension(file));
+        if (ext == "spm" || ext == "b3d" || ext == "xml")
+            paths.push_back(m_root + file);
+    }
+    paths.push_back(file_manager->getAsset(FileManager::TEXTURE,
+                                           "materials.xml"));
+
+    for (const std::string &path : paths)
+    {
+        struct stat file_stat;
+        if (file_manager->isDirectory(path) ||
+            stat(path.c_str(), &file_stat) != 0)
+            continue;
+        const int64_t size = (int64_t)file_stat.st_size;
+        const int64_t mtime = (int64_t)file_stat.st_mtime;
+        add(path.data(), path.size());
+        add(&size, sizeof(size));
+        add(&mtime, sizeof(mtime));
+    }
+    return hash;
+}   // getPhysicsCacheKey
+
+// ----------------------------------------------------------------------------
+/** Loads the triangles of the main track model and the bvh of the track
+ *  mesh from the physics cache, if it was written for the current track
+ *  files.
+ *  \return True if the cache was used.
+ */
+bool Track::loadPhysicsCache()
+{
+    std::ifstream in(m_physics_cache_file.c_str(),
+                     std::ios::in | std::ios::binary);
+    if (!in.good())
+        return false;
+
+    char magic[4];
+    uint32_t byte_order = 0, version = 0;
+    uint64_t key = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&byte_order, sizeof(byte_order));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&key, sizeof(key));
+    if (!in.good() ||
+        memcmp(magic, PHYSICS_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        byte_order != PHYSICS_CACHE_BYTE_ORDER ||
+        version != PHYSICS_CACHE_VERSION || key != m_physics_cache_key)
+    {
+        Log::info("track", "Physics cache of '%s' is outdated.",
+                  m_ident.c_str());
+        return false;
+    }
+
+    // The materials are stored by name, make sure that the same materials
+    // are found again
+    uint32_t num_materials = 0;
+    in.read((char*)&num_materials, sizeof(num_materials));
+    std::vector<const Material*> materials;
+    for (uint32_t i = 0; i < num_materials && in.good(); i++)
+    {
+        std::string name, full_path, uv_two, shader;
+        if (!readString(in, &name) || !readString(in, &full_path) ||
+            !readString(in, &uv_two) || !readString(in, &shader))
+            break;
+        const Material *m = material_manager->getMaterialSPM(
+            full_path.empty() ? name : full_path, uv_two, shader);
+        if (!m || m->getTexFname() != name ||
+            m->getTexFullPath() != full_path ||
+            m->getUVTwoTexture() != uv_two)
+        {
+            Log::info("track", "Material '%s' of physics cache not found.",
+                      name.c_str());
+            return false;
+        }
+        materials.push_back(m);
+    }
+
+    uint32_t num_track = 0, num_gfx = 0, bvh_size = 0;
+    in.read((char*)&num_track, sizeof(num_track));
+    in.read((char*)&num_gfx, sizeof(num_gfx));
+    bool success = in.good() && materials.size() == num_materials &&
+        m_track_mesh->readTriangles(in, num_track, materials) &&
+        m_gfx_effect_mesh->readTriangles(in, num_gfx, materials);
+
+    std::vector<char> bvh;
+    in.read((char*)&m_cached_bvh_triangles, sizeof(m_cached_bvh_triangles));
+    in.read((char*)&m_cached_bvh_hash, sizeof(m_cached_bvh_hash));
+    in.read((char*)&bvh_size, sizeof(bvh_size));
+    if (success && in.good())
+    {
+        bvh.resize(bvh_size);
+        in.read(bvh.data(), bvh_size);
+    }
+    if (!success || !in.good())
+    {
+        Log::warn("track", "Invalid physics cache '%s'.",
+                  m_physics_cache_file.c_str());
+        // Discard partially read triangles
+        delete m_track_mesh;
+        delete m_gfx_effect_mesh;
+        m_track_mesh      = new TriangleMesh(/*can_be_transformed*/false);
+        m_gfx_effect_mesh = new TriangleMesh(/*can_be_transformed*/false);
+        return false;
+    }
+    m_track_mesh->setSerializedBvh(bvh);
+    return true;
+}   // loadPhysicsCache
+
+// ----------------------------------------------------------------------------
+/** Writes the triangles of the main track model and the bvh of the track
+ *  mesh to the physics cache, so that loadPhysicsCache() can use them the
+ *  next time this track is loaded.
+ */
+void Track::savePhysicsCache() const
+{
+    std::vector<char> bvh;
+    if (!m_track_mesh->serializeBvh(&bvh))
+        return;
+
+    std::map<const Material*, int> material_index;
+    std::vector<const Material*> materials;
+    const TriangleMesh *meshes[2] = { m_track_mesh, m_gfx_effect_mesh };
+    const unsigned int counts[2] = { m_main_track_triangles,
+                                     m_main_gfx_triangles };
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        for (unsigned int j = 0; j < counts[i]; j++)
+        {
+            const Material *m = meshes[i]->getMaterial(j);
+            if (material_index.find(m) == material_index.end())
+            {
+                material_index[m] = (int)materials.size();
+                materials.push_back(m);
+            }
+        }
+    }
+
+    std::ofstream out(m_physics_cache_file.c_str(),
+                      std::ios::out | std::ios::binary);
+    const uint32_t num_materials = (uint32_t)materials.size();
+    out.write(PHYSICS_CACHE_MAGIC, sizeof(PHYSICS_CACHE_MAGIC));
+    out.write((const char*)&PHYSICS_CACHE_BYTE_ORDER,
+              sizeof(PHYSICS_CACHE_BYTE_ORDER));
+    out.write((const char*)&PHYSICS_CACHE_VERSION,
+              sizeof(PHYSICS_CACHE_VERSION));
+    out.write((const char*)&m_physics_cache_key, sizeof(m_physics_cache_key));
+    out.write((const char*)&num_materials, sizeof(num_materials));
+    for (const Material *m : materials)
+    {
+        writeString(out, m->getTexFname());
+        writeString(out, m->getTexFullPath());
+        writeString(out, m->getUVTwoTexture());
+        writeString(out, m->getShaderName());
+    }
+    out.write((const char*)counts, sizeof(counts));
+    m_track_mesh->writeTriangles(out, m_main_track_triangles,
+                                 material_index);
+    m_gfx_effect_mesh->writeTriangles(out, m_main_gfx_triangles,
+                                      material_index);
+
+    const uint32_t bvh_triangles = m_track_mesh->getNumTriangles();
+    const uint64_t bvh_hash =
+        m_track_mesh->hashVertices(m_main_track_triangles);
+    const uint32_t bvh_size = (uint32_t)bvh.size();
+    out.write((const char*)&bvh_triangles, sizeof(bvh_triangles));
+    out.write((const char*)&bvh_hash, sizeof(bvh_hash));
+    out.write((const char*)&bvh_size, sizeof(bvh_size));
+    out.write(bvh.data(), bvh.size());
+    out.close();
+    if (out.fail())
+    {
+        Log::warn("track", "Can't write physics cache '%s'.",
+                  m_physics_cache_file.c_str());
+        file_manager->removeFile(m_physics_cache_file);
+    }
+}   // savePhysicsCache
+
 // ----------------------------------------------------------------------------
 
 void Track::loadMinimap()
@@ -1469,11 +1730,24 @@ bool Track::loadMainTrack(const XMLNode &root)
 
     }   // for i
 
+    // The overworld challenge orbs depend on the player, so they are not
+    // cached
+    m_physics_cache_file = "";
+    m_physics_cache_loaded = false;
+    if (m_challenges.empty())
+    {
+        m_physics_cache_file = file_manager->getCachedPhysicsDir() +
+                               m_ident + ".physics";
+        m_physics_cache_key = getPhysicsCacheKey();
+        m_physics_cache_loaded = loadPhysicsCache();
+    }
+
     // This will (at this stage) only convert the main track model.
     for(unsigned int i=0; i<m_all_nodes.size(); i++)
     {
         main_loop->renderGUI(4350, i, m_all_nodes.size());
-        convertTrackToBullet(m_all_nodes[i]);
+        if (!m_physics_cache_loaded)
+            convertTrackToBullet(m_all_nodes[i]);
         main_loop->renderGUI(4360, i, m_all_nodes.size());
         uploadNodeVertexBuffer(m_all_nodes[i]);
         main_loop->renderGUI(4400, i, m_all_nodes.size());
@@ -1487,6 +1761,8 @@ bool Track::loadMainTrack(const XMLNode &root)
     {
         Log::fatal("track", "m_track_mesh == NULL, cannot loadMainTrack\n");
     }
+    m_main_track_triangles = m_track_mesh->getNumTriangles();
+    m_main_gfx_triangles   = m_gfx_effect_mesh->getNumTriangles();
 
     m_gfx_effect_mesh->createCollisionShape();
     scene_node->setMaterialFlag(video::EMF_LIGHTING, true);
@@ -2712,8 +2988,11 @@ void Track::itemCommand(const XMLNode *node)
 }   // itemCommand
 
 // ----------------------------------------------------------------------------
-
-std::vector< std::vector<float> > Track::buildHeightMap()
+/** Returns the height of the track at HEIGHT_MAP_RESOLUTION^2 points.
+ *  \param pool The worker pool to cast the rays with, or NULL to cast them
+ *         in the calling thread.
+ */
+std::vector< std::vector<float> > Track::buildHeightMap(WorkerPool* pool)
 {
     std::vector< std::vector<float> > out(HEIGHT_MAP_RESOLUTION);
 
@@ -2724,29 +3003,44 @@ std::vector< std::vector<float> > Track::buildHeightMap()
     const float x_step = x_len/HEIGHT_MAP_RESOLUTION;
     const float z_step = z_len/HEIGHT_MAP_RESOLUTION;
 
-    btVector3 hitpoint;
-    const Material* material;
-    btVector3 normal;
+    // Collect all rays first, so that they can be cast as one batch
+    const unsigned int num_rays = HEIGHT_MAP_RESOLUTION*HEIGHT_MAP_RESOLUTION;
+    std::vector<btVector3> from(num_rays), to(num_rays), hitpoint(num_rays);
+    std::vector<const Material*> material(num_rays);
+    std::unique_ptr<bool[]> hit(new bool[num_rays]);
 
     for (int i=0; i<HEIGHT_MAP_RESOLUTION; i++)
     {
-        out[i].resize(HEIGHT_MAP_RESOLUTION);
         float z = m_aabb_min.getZ();
 
         for (int j=0; j<HEIGHT_MAP_RESOLUTION; j++)
         {
-            btVector3 pos(x, 100.0f, z);
-            btVector3 to = pos;
-            to.setY(-100000.f);
-
-            m_track_mesh->castRay(pos, to, &hitpoint, &material, &normal);
+            btVector3 &pos = from[i*HEIGHT_MAP_RESOLUTION + j];
+            pos.setValue(x, 100.0f, z);
+            to[i*HEIGHT_MAP_RESOLUTION + j] = btVector3(x, -100000.f, z);
             z += z_step;
-
-            out[i][j] = hitpoint.getY();
         }   // j<HEIGHT_MAP_RESOLUTION
         x += x_step;
     }
 
+    m_track_mesh->castRays(num_rays, from.data(), to.data(), hit.get(),
+                           hitpoint.data(), material.data(), /*normal*/NULL,
+                           /*interpolate_normal*/false, pool);
+
+    // If a ray does not hit the track, the height of the previous ray
+    // is used.
+    float height = 0.0f;
+    for (int i=0; i<HEIGHT_MAP_RESOLUTION; i++)
+    {
+        out[i].resize(HEIGHT_MAP_RESOLUTION);
+        for (int j=0; j<HEIGHT_MAP_RESOLUTION; j++)
+        {
+            if (hit[i*HEIGHT_MAP_RESOLUTION + j])
+                height = hitpoint[i*HEIGHT_MAP_RESOLUTION + j].getY();
+            out[i][j] = height;
+        }
+    }
+
     return out;
 }   // buildHeightMap
 
@@ -2771,65 +3065,92 @@ const core::vector3df& Track::getSunRotation()
  *  \param k The kart to project downward.
  *  \return True of the kart is on terrain.
  */
-
 bool Track::findGround(AbstractKart *kart)
 {
-    const Vec3 &xyz = kart->getXYZ();
-    Vec3 down = kart->getTrans().getBasis() * Vec3(0, -10000.0f, 0);
-
-    // Material and hit point are not needed;
-    const Material *m;
-    Vec3 hit_point, normal;
-    bool over_ground = m_track_mesh->castRay(xyz, down, &hit_point,
-                                             &m, &normal);
-
-    // Now also raycast against all track objects (that are driveable). If
-    // there should be a closer result (than the one against the main track
-    // mesh), its data will be returned.
-    // From TerrainInfo::update
-    bool over_driveable = m_track_object_manager->castRay(xyz, down,
-        &hit_point, &m, &normal, /*interpolate*/false);
-
-    if (!over_ground && !over_driveable)
-    {
-        Log::warn("physics", "Kart at (%f %f %f) can not be dropped.",
-                  xyz.getX(),xyz.getY(),xyz.getZ());
-        return false;
-    }
+    return findGround(std::vector<AbstractKart*>(1, kart))[0];
+}   // findGround
 
-    // Check if the material the kart is about to be placed on would trigger
-    // a reset. If so, this is not a valid position.
-    if(m && m->isDriveReset())
-    {
-        Log::warn("physics","Kart at (%f %f %f) over reset terrain '%s'",
-                   xyz.getX(),xyz.getY(),xyz.getZ(),
-                   m->getTexFname().c_str());
-        return false;
-    }
+//-----------------------------------------------------------------------------
+/** Determines for a set of karts if they are over ground, and projects
+ *  them onto the ground. The rays against the main track mesh are cast as
+ *  one batch.
+ *  \param karts The karts to project downward.
+ *  \return For each kart true if it is on terrain.
+ */
+std::vector<bool> Track::findGround(const std::vector<AbstractKart*> &karts)
+{
+    const unsigned int num_karts = (unsigned int)karts.size();
+    std::vector<btVector3> from(num_karts), down(num_karts),
+                           hit_points(num_karts), normals(num_karts);
+    std::vector<const Material*> materials(num_karts);
+    std::unique_ptr<bool[]> over_ground(new bool[num_karts]);
+    for (unsigned int i = 0; i < num_karts; i++)
+    {
+        from[i] = karts[i]->getXYZ();
+        down[i] = karts[i]->getTrans().getBasis() * Vec3(0, -10000.0f, 0);
+    }
+    m_track_mesh->castRays(num_karts, from.data(), down.data(),
+                           over_ground.get(), hit_points.data(),
+                           materials.data(), normals.data());
+
+    std::vector<bool> result(num_karts, false);
+    for (unsigned int i = 0; i < num_karts; i++)
+    {
+        AbstractKart *kart = karts[i];
+        const Vec3 &xyz = kart->getXYZ();
+        const Material *m = materials[i];
+        Vec3 hit_point = hit_points[i], normal = normals[i];
+
+        // Now also raycast against all track objects (that are driveable).
+        // If there should be a closer result (than the one against the main
+        // track mesh), its data will be returned.
+        // From TerrainInfo::update
+        bool over_driveable = m_track_object_manager->castRay(xyz, down[i],
+            &hit_point, &m, &normal, /*interpolate*/false);
+
+        if (!over_ground[i] && !over_driveable)
+        {
+            Log::warn("physics", "Kart at (%f %f %f) can not be dropped.",
+                      xyz.getX(),xyz.getY(),xyz.getZ());
+            continue;
+        }
 
-    // See if the kart is too high above the ground - it would drop
-    // too long.
-    if(xyz.getY() - hit_point.getY() > 5)
-    {
-        Log::warn("physics",
-                  "Kart at (%f %f %f) is too high above ground at (%f %f %f)",
-                  xyz.getX(),xyz.getY(),xyz.getZ(),
-                  hit_point.getX(),hit_point.getY(),hit_point.getZ());
-        return false;
-    }
+        // Check if the material the kart is about to be placed on would
+        // trigger a reset. If so, this is not a valid position.
+        if(m && m->isDriveReset())
+        {
+            Log::warn("physics","Kart at (%f %f %f) over reset terrain '%s'",
+                       xyz.getX(),xyz.getY(),xyz.getZ(),
+                       m->getTexFname().c_str());
+            continue;
+        }
 
-    btTransform t = kart->getBody()->getCenterOfMassTransform();
-    // The computer offset is slightly too large, it should take
-    // the default suspension rest instead of suspension rest (i.e. the
-    // length of the suspension with the weight of the kart resting on
-    // it). On the other hand this initial bouncing looks nice imho
-    // - so I'll leave it in for now.
-    float offset = kart->getKartProperties()->getSuspensionRest();
-    t.setOrigin(hit_point + normal * offset);
-    kart->getBody()->setCenterOfMassTransform(t);
-    kart->setTrans(t);
+        // See if the kart is too high above the ground - it would drop
+        // too long.
+        if(xyz.getY() - hit_point.getY() > 5)
+        {
+            Log::warn("physics",
+                      "Kart at (%f %f %f) is too high above ground at "
+                      "(%f %f %f)",
+                      xyz.getX(),xyz.getY(),xyz.getZ(),
+                      hit_point.getX(),hit_point.getY(),hit_point.getZ());
+            continue;
+        }
 
-    return true;
+        btTransform t = kart->getBody()->getCenterOfMassTransform();
+        // The computer offset is slightly too large, it should take
+        // the default suspension rest instead of suspension rest (i.e. the
+        // length of the suspension with the weight of the kart resting on
+        // it). On the other hand this initial bouncing looks nice imho
+        // - so I'll leave it in for now.
+        float offset = kart->getKartProperties()->getSuspensionRest();
+        t.setOrigin(hit_point + normal * offset);
+        kart->getBody()->setCenterOfMassTransform(t);
+        kart->setTrans(t);
+        result[i] = true;
+    }   // for i < num_karts
+
+    return result;
 }   // findGround
 
 //-----------------------------------------------------------------------------
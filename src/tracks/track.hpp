@@ -55,6 +55,7 @@ class RenderTarget;
 class TrackObject;
 class TrackObjectManager;
 class TriangleMesh;
+class WorkerPool;
 class XMLNode;
 
 const int HEIGHT_MAP_RESOLUTION = 256;
@@ -197,6 +198,23 @@ private:
      *  allowing the kart to drive in/partly under water), but the
      *  actual surface position is needed for the water splash effect. */
     TriangleMesh*            m_gfx_effect_mesh;
+    /** Name of the file in which the physics data of the main track model
+     *  is cached, empty if it is not cached (e.g. in the overworld, where
+     *  the challenge orbs depend on the player). */
+    std::string              m_physics_cache_file;
+    /** Hash of all files the cached physics data depends on. */
+    uint64_t                 m_physics_cache_key;
+    /** True if the triangles of the main track model were loaded from the
+     *  physics cache, so the main track model is not converted. */
+    bool                     m_physics_cache_loaded;
+    /** Number of triangles in m_track_mesh and m_gfx_effect_mesh which
+     *  belong to the main track model. */
+    unsigned int             m_main_track_triangles;
+    unsigned int             m_main_gfx_triangles;
+    /** Number of triangles of the track mesh and hash of the vertices added
+     *  after the main track model, for which the cached bvh was built. */
+    unsigned int             m_cached_bvh_triangles;
+    uint64_t                 m_cached_bvh_hash;
     /** Minimum coordinates of this track. */
     Vec3                     m_aabb_min;
     /** Maximum coordinates of this track. */
@@ -402,6 +420,9 @@ private:
     void loadCurves(const XMLNode &node);
     void handleSky(const XMLNode &root, const std::string &filename);
     void freeCachedMeshVertexBuffer();
+    uint64_t getPhysicsCacheKey() const;
+    bool loadPhysicsCache();
+    void savePhysicsCache() const;
 public:
 
     /** Static function to get the current track. NULL if no current
@@ -445,8 +466,9 @@ public:
     void               loadTrackModel  (bool reverse_track = false,
                                         unsigned int mode_id=0);
     bool findGround(AbstractKart *kart);
+    std::vector<bool> findGround(const std::vector<AbstractKart*> &karts);
 
-    std::vector< std::vector<float> > buildHeightMap();
+    std::vector< std::vector<float> > buildHeightMap(WorkerPool* pool = NULL);
     void               drawMiniMap(const core::rect<s32>& dest_rect) const;
     void               updateMiniMapScale();
     // ------------------------------------------------------------------------
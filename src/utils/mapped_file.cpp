@@ -0,0 +1,126 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "utils/mapped_file.hpp"
+
+#include "utils/log.hpp"
+#include "utils/string_utils.hpp"
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------
+MappedFile::MappedFile()
+{
+    m_data    = NULL;
+    m_size    = 0;
+#ifdef WIN32
+    m_file    = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#endif
+}   // MappedFile
+
+// ----------------------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+    close();
+}   // ~MappedFile
+
+// ----------------------------------------------------------------------------
+/** Maps a file into memory. A file already mapped by this object is closed.
+ *  \param filename Name of the file.
+ *  \return True if the file was mapped, false if it doesn't exist, is empty
+ *          or can't be mapped.
+ */
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+#ifdef WIN32
+    m_file = CreateFileW(StringUtils::utf8ToWide(filename).c_str(),
+                         GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping)
+        m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data)
+    {
+        Log::warn("MappedFile", "Can't map '%s'.", filename.c_str());
+        close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after closing the file descriptor
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        Log::warn("MappedFile", "Can't map '%s'.", filename.c_str());
+        return false;
+    }
+    m_data = data;
+    m_size = (size_t)st.st_size;
+#endif
+    return true;
+}   // open
+
+// ----------------------------------------------------------------------------
+/** Unmaps the file (if any). All pointers into the data become invalid.
+ */
+void MappedFile::close()
+{
+#ifdef WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_file    = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#else
+    if (m_data)
+        munmap(const_cast<void*>(m_data), m_size);
+#endif
+    m_data = NULL;
+    m_size = 0;
+}   // close
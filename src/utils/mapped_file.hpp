@@ -0,0 +1,65 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_MAPPED_FILE_HPP
+#define HEADER_MAPPED_FILE_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <stddef.h>
+#include <string>
+
+/** A read-only file which is mapped into memory, so that large precomputed
+ *  data (e.g. path tables) can be used without reading and copying it at
+ *  load time, and the pages are shared between several processes (e.g.
+ *  servers) using the same file.
+ * \ingroup utils
+ */
+class MappedFile : public NoCopy
+{
+private:
+    /** Pointer to the mapped data, or NULL if no file is mapped. */
+    const void *m_data;
+
+    /** Size of the mapped data. */
+    size_t m_size;
+
+#ifdef WIN32
+    /** The handles of the file and the mapping. */
+    void *m_file;
+    void *m_mapping;
+#endif
+
+public:
+     MappedFile();
+    ~MappedFile();
+    bool open(const std::string &filename);
+    void close();
+    // ------------------------------------------------------------------------
+    /** Returns true if a file is mapped. */
+    bool isOpen() const                               { return m_data != NULL; }
+    // ------------------------------------------------------------------------
+    /** Returns the mapped data. */
+    const void* getData() const                                { return m_data; }
+    // ------------------------------------------------------------------------
+    /** Returns the size of the mapped data. */
+    size_t getSize() const                                     { return m_size; }
+};   // MappedFile
+
+#endif
@@ -28,6 +28,7 @@
 #include "io/file_manager.hpp"
 #include "utils/string_utils.hpp"
 #include "utils/vs.hpp"
+#include "utils/worker_pool.hpp"
 
 #include <algorithm>
 #include <fstream>
@@ -48,6 +49,11 @@ Profiler profiler;
 // The width of the profiler corresponds to TIME_DRAWN_MS milliseconds
 #define TIME_DRAWN_MS 30.0f 
 
+// Maximum number of threads that can use profiler markers: the main,
+// network and listener threads and other helper threads, plus the threads
+// of the physics and scene worker pools which use one thread per core
+#define MAX_THREADS (16 + 2 * (int)WorkerPool::getDefaultNumThreads())
+
 // --- Begin portable precise timer ---
 #ifdef WIN32
     #define WIN32_LEAN_AND_MEAN
@@ -89,6 +95,9 @@ Profiler::Profiler()
     m_current_frame       = 0;
     m_has_wrapped_around  = false;
     m_threads_used = 1;
+    m_trace_capture.store(false);
+    m_max_trace_events    = 0;
+    m_trace_start         = 0.0;
 }   // Profile
 
 //-----------------------------------------------------------------------------
@@ -102,7 +111,6 @@ Profiler::~Profiler()
  *  graphics). */
 void Profiler::init()
 {
-    const int MAX_THREADS = 10;
     m_all_threads_data.resize(MAX_THREADS);
     m_thread_mapping.resize(MAX_THREADS);
 
@@ -115,7 +123,9 @@ void Profiler::init()
 /** Returns a unique index for a thread. If the calling thread is not yet in
  *  the mapping, it will assign a new unique id to this thread. This function
  *  is NOT thread-safe and must be called from a properly protected code
- *  section. */
+ *  section.
+ *  \return The index, or -1 if more than MAX_THREADS threads use markers
+ *          (the events of this thread are then ignored). */
 int Profiler::getThreadID()
 {
     pthread_t thread = pthread_self();
@@ -131,8 +141,19 @@ int Profiler::getThreadID()
         i++;
     }   // for i <m_threads_used
 
-    assert(m_threads_used < (int)m_thread_mapping.size());
+    if (m_threads_used >= (int)m_thread_mapping.size())
+        return -1;
     m_thread_mapping[m_threads_used] = thread;
+    std::string &name = m_all_threads_data[m_threads_used].m_name;
+#if defined(__linux__) && defined(__GLIBC__) && defined(__GLIBC_MINOR__) && \
+    (__GLIBC__ > 2 || __GLIBC_MINOR__ > 11)
+    // Use the name set with VS::setThreadName, if any
+    char thread_name[16];
+    if (pthread_getname_np(thread, thread_name, sizeof(thread_name)) == 0)
+        name = thread_name;
+#endif
+    if (name.empty())
+        name = "Thread " + StringUtils::toString(m_threads_used);
     m_threads_used++;
 
     return m_threads_used - 1;
@@ -142,26 +163,34 @@ int Profiler::getThreadID()
 /// Push a new marker that starts now
 void Profiler::pushCPUMarker(const char* name, const video::SColor& colour)
 {
-    // Don't do anything when disabled or frozen
-    if (!UserConfigParams::m_profiler_enabled ||
-         m_freeze_state == FROZEN || m_freeze_state == WAITING_FOR_UNFREEZE )
+    // Don't do anything when disabled or frozen (unless a trace is captured)
+    if (!m_trace_capture.load() &&
+        (!UserConfigParams::m_profiler_enabled ||
+         m_freeze_state == FROZEN || m_freeze_state == WAITING_FOR_UNFREEZE))
         return;
 
     // We need to look before getting the thread id (since this might
     // be a new thread which changes the structure).
     m_lock.lock();
     int thread_id = getThreadID();
+    if (thread_id < 0)
+    {
+        m_lock.unlock();
+        return;
+    }
 
     ThreadData &td = m_all_threads_data[thread_id];
     AllEventData::iterator i = td.m_all_event_data.find(name);
-    double  start = getTimeMilliseconds() - m_time_last_sync;
+    double  now   = getTimeMilliseconds();
+    double  start = now - m_time_last_sync;
     if (i != td.m_all_event_data.end())
     {
         i->second.setStart(m_current_frame, start, (int)td.m_event_stack.size());
     }
     else
     {
-        EventData ed(colour, m_max_frames);
+        EventData ed(colour, m_max_frames, (int)m_trace_names.size());
+        m_trace_names.push_back(name);
         ed.setStart(m_current_frame, start, (int)td.m_event_stack.size());
         td.m_all_event_data[name] = ed;
         // Ordered headings is used to determine the order in which the
@@ -171,6 +200,7 @@ void Profiler::pushCPUMarker(const char* name, const video::SColor& colour)
         td.m_ordered_headings.push_back(name);
     }
     td.m_event_stack.push_back(name);
+    td.m_start_stack.push_back(now);
     m_lock.unlock();
 }   // pushCPUMarker
 
@@ -178,14 +208,20 @@ void Profiler::pushCPUMarker(const char* name, const video::SColor& colour)
 /// Stop the last pushed marker
 void Profiler::popCPUMarker()
 {
-    // Don't do anything when disabled or frozen
-    if( !UserConfigParams::m_profiler_enabled ||
-        m_freeze_state == FROZEN || m_freeze_state == WAITING_FOR_UNFREEZE )
+    // Don't do anything when disabled or frozen (unless a trace is captured)
+    if (!m_trace_capture.load() &&
+        (!UserConfigParams::m_profiler_enabled ||
+         m_freeze_state == FROZEN || m_freeze_state == WAITING_FOR_UNFREEZE))
         return;
     double now = getTimeMilliseconds();
 
     m_lock.lock();
     int thread_id = getThreadID();
+    if (thread_id < 0)
+    {
+        m_lock.unlock();
+        return;
+    }
     ThreadData &td = m_all_threads_data[thread_id];
 
     // When the profiler gets enabled (which happens in the middle of the
@@ -200,9 +236,23 @@ void Profiler::popCPUMarker()
     assert(td.m_event_stack.size() > 0);
 
     const std::string &name = td.m_event_stack.back();
-    td.m_all_event_data[name].setEnd(m_current_frame, now - m_time_last_sync);
+    EventData &ed = td.m_all_event_data[name];
+    ed.setEnd(m_current_frame, now - m_time_last_sync);
+
+    if (m_trace_capture.load())
+    {
+        TraceEvent te;
+        te.m_start  = td.m_start_stack.back();
+        te.m_end    = now;
+        te.m_name   = ed.getTraceName();
+        te.m_thread = thread_id;
+        if (m_trace_events.size() >= m_max_trace_events)
+            m_trace_events.pop_front();
+        m_trace_events.push_back(te);
+    }
 
     td.m_event_stack.pop_back();
+    td.m_start_stack.pop_back();
     m_lock.unlock();
 }   // popCPUMarker
 
@@ -327,7 +377,7 @@ void Profiler::draw()
     // Use this thread to compute start and end time. All other
     // threads might have 'unfinished' events, or multiple identical events
     // in this frame (i.e. start time would be incorrect).
-    int thread_id = getThreadID();
+    int thread_id = std::max(getThreadID(), 0);
     AllEventData &aed = m_all_threads_data[thread_id].m_all_event_data;
     AllEventData::iterator j;
     for (j = aed.begin(); j != aed.end(); ++j)
@@ -591,3 +641,146 @@ void Profiler::writeToFile()
     m_lock.unlock();
 
 }   // writeFile
+
+//-----------------------------------------------------------------------------
+/** Resets the accumulated time of all events, see getTotals().
+ */
+void Profiler::resetTotals()
+{
+    m_lock.lock();
+    for (int i = 0; i < m_threads_used; i++)
+    {
+        AllEventData &aed = m_all_threads_data[i].m_all_event_data;
+        for (AllEventData::iterator j = aed.begin(); j != aed.end(); ++j)
+            j->second.resetTotal();
+    }
+    m_lock.unlock();
+}   // resetTotals
+
+//-----------------------------------------------------------------------------
+/** Returns the accumulated time (in ms) of each event since the last call
+ *  to resetTotals(), summed over all threads. Unlike the buffered frames
+ *  this is not limited to the last m_max_frames frames, so it can be used
+ *  to get a breakdown of a long running benchmark.
+ *  \param totals Map from event name to time, the times are added to the
+ *         values already in the map.
+ */
+void Profiler::getTotals(std::map<std::string, double> *totals)
+{
+    m_lock.lock();
+    for (int i = 0; i < m_threads_used; i++)
+    {
+        AllEventData &aed = m_all_threads_data[i].m_all_event_data;
+        for (AllEventData::iterator j = aed.begin(); j != aed.end(); ++j)
+            (*totals)[j->first] += j->second.getTotal();
+    }
+    m_lock.unlock();
+}   // getTotals
+
+//-----------------------------------------------------------------------------
+/** Starts recording all events of all threads for a trace, which can be
+ *  written with writeTrace(). This does not need the on-screen profiler to
+ *  be enabled, so it can be used on a server without graphics to find the
+ *  reason of tick spikes. Only the last max_events events are kept, so the
+ *  capture can run for a long time with bounded memory.
+ *  \param max_events Maximum number of events to keep.
+ */
+void Profiler::startTraceCapture(size_t max_events)
+{
+    m_lock.lock();
+    if (m_all_threads_data.empty())
+    {
+        // Not initialised without graphics. Don't register the calling
+        // thread (this is not necessarily the main thread), all threads
+        // are added the first time they use a marker.
+        m_all_threads_data.resize(MAX_THREADS);
+        m_thread_mapping.resize(MAX_THREADS);
+        m_threads_used = 0;
+    }
+    if (!UserConfigParams::m_profiler_enabled)
+    {
+        // Events started before a previous capture was stopped were never
+        // finished, and pops for events started before now must be ignored
+        for (int i = 0; i < m_threads_used; i++)
+        {
+            m_all_threads_data[i].m_event_stack.clear();
+            m_all_threads_data[i].m_start_stack.clear();
+        }
+    }
+    m_max_trace_events = std::max(max_events, (size_t)1);
+    m_trace_events     = RingBuffer<TraceEvent>(m_max_trace_events);
+    m_trace_start      = getTimeMilliseconds();
+    m_trace_capture.store(true);
+    m_lock.unlock();
+}   // startTraceCapture
+
+//-----------------------------------------------------------------------------
+/** Stops recording events for a trace. The events recorded so far are kept
+ *  and can still be written with writeTrace().
+ */
+void Profiler::stopTraceCapture()
+{
+    m_trace_capture.store(false);
+}   // stopTraceCapture
+
+//-----------------------------------------------------------------------------
+/** Writes the recorded events in the Chrome trace event format, which can be
+ *  loaded in chrome://tracing or Perfetto. The events are copied first, so
+ *  the file is not written while holding the lock (which would block all
+ *  threads using markers).
+ *  \param filename Name of the file to write.
+ *  \return True if the file was written successfully.
+ */
+bool Profiler::writeTrace(const std::string &filename)
+{
+    m_lock.lock();
+    std::vector<TraceEvent> events;
+    events.reserve(m_trace_events.size());
+    for (size_t i = 0; i < m_trace_events.size(); i++)
+        events.push_back(m_trace_events[i]);
+    std::vector<std::string> names = m_trace_names;
+    std::vector<std::string> thread_names;
+    for (int i = 0; i < m_threads_used; i++)
+        thread_names.push_back(m_all_threads_data[i].m_name);
+    const double trace_start = m_trace_start;
+    m_lock.unlock();
+
+    // Event and thread names are used as JSON strings
+    auto escape = [](const std::string &s)
+    {
+        std::string result;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            if ((unsigned char)c >= 0x20)
+                result += c;
+        }
+        return result;
+    };
+
+    std::ofstream f(filename.c_str());
+    f.setf(std::ios::fixed, std::ios::floatfield);
+    f.precision(3);
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (unsigned int i = 0; i < thread_names.size(); i++)
+    {
+        f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+          << i << ",\"args\":{\"name\":\"" << escape(thread_names[i])
+          << "\"}},\n";
+    }
+    // Timestamps and durations are in microseconds
+    for (const TraceEvent &te : events)
+    {
+        f << "{\"name\":\"" << escape(names[te.m_name])
+          << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << te.m_thread
+          << ",\"ts\":" << (te.m_start - trace_start) * 1000.0
+          << ",\"dur\":" << (te.m_end - te.m_start) * 1000.0 << "},\n";
+    }
+    // A final event (without trailing comma) marking the time of the dump
+    f << "{\"name\":\"dump\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,"
+      << "\"ts\":" << (getTimeMilliseconds() - trace_start) * 1000.0
+      << "}\n]}\n";
+    f.close();
+    return !f.fail();
+}   // writeTrace
@@ -18,12 +18,14 @@
 #ifndef PROFILER_HPP
 #define PROFILER_HPP
 
+#include "utils/ring_buffer.hpp"
 #include "utils/synchronised.hpp"
 
 #include <irrlicht.h>
 #include <pthread.h>
 
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <list>
 #include <map>
@@ -170,12 +172,21 @@ private:
         /** Vector of all buffered markers. */
         std::vector<Marker> m_all_markers;
 
+        /** Accumulated duration of this event since the last resetTotal(),
+         *  independent of the size of the buffer. */
+        double m_total;
+
+        /** Index of the name of this event in m_trace_names. */
+        int m_trace_name;
+
     public:
-        EventData() {}
-        EventData(video::SColor colour, int max_size)
+        EventData() { m_total = 0; m_trace_name = 0; }
+        EventData(video::SColor colour, int max_size, int trace_name)
         {
             m_all_markers.resize(max_size);
-            m_colour = colour;
+            m_colour     = colour;
+            m_total      = 0;
+            m_trace_name = trace_name;
         }   // EventData
         // --------------------------------------------------------------------
         /** Records the start of an event for a given frame. */
@@ -189,6 +200,7 @@ private:
         void setEnd(size_t frame, double end)
         {
             assert(frame < m_all_markers.capacity());
+            m_total += end - m_all_markers[frame].getStart();
             m_all_markers[frame].setEnd(end);
         }   // setEnd
         // --------------------------------------------------------------------
@@ -198,8 +210,27 @@ private:
         /** Returns the colour for this event. */
         video::SColor getColour() const { return m_colour;  }
         // --------------------------------------------------------------------
+        /** Returns the accumulated duration of this event. */
+        double getTotal() const { return m_total; }
+        // --------------------------------------------------------------------
+        void resetTotal() { m_total = 0; }
+        // --------------------------------------------------------------------
+        int getTraceName() const { return m_trace_name; }
     };   // EventData
 
+    // ========================================================================
+    /** One complete event in the trace capture, see startTraceCapture(). */
+    struct TraceEvent
+    {
+        /** Absolute start and end time of the event (in ms). */
+        double m_start;
+        double m_end;
+        /** Index of the name of the event in m_trace_names. */
+        int    m_name;
+        /** The profiler thread id of the event. */
+        int    m_thread;
+    };   // TraceEvent
+
     // ========================================================================
     /** The mapping of event names to the corresponding EventData. */
     typedef std::map<std::string, EventData> AllEventData;
@@ -209,6 +240,13 @@ private:
         /** Stack of events to detect nesting. */
         std::vector< std::string > m_event_stack;
 
+        /** Absolute start time of each event in m_event_stack, used for
+         *  the trace capture. */
+        std::vector<double> m_start_stack;
+
+        /** Name of the thread, shown in the trace. */
+        std::string m_name;
+
         /** This stores the event names in the order in which they occur.
         *  This means that 'outer' events occur here before any child
         *  events. This list is then used to determine the order in which the
@@ -272,6 +310,23 @@ private:
 
     FreezeState     m_freeze_state;
 
+    /** True while all finished events are recorded in m_trace_events. This
+     *  works independently of the on-screen profiler, so it can also be
+     *  used on servers without graphics. */
+    std::atomic<bool> m_trace_capture;
+
+    /** The last m_max_trace_events finished events of all threads. */
+    RingBuffer<TraceEvent> m_trace_events;
+
+    /** Maximum number of events kept in m_trace_events. */
+    size_t m_max_trace_events;
+
+    /** Time at which the trace capture was started. */
+    double m_trace_start;
+
+    /** Names of all events, indexed by EventData::getTraceName(). */
+    std::vector<std::string> m_trace_names;
+
 private:
     int  getThreadID();
     void drawBackground();
@@ -288,9 +343,17 @@ public:
     void     draw();
     void     onClick(const core::vector2di& mouse_pos);
     void     writeToFile();
+    void     resetTotals();
+    void     getTotals(std::map<std::string, double> *totals);
+    void     startTraceCapture(size_t max_events);
+    void     stopTraceCapture();
+    bool     writeTrace(const std::string &filename);
 
     // ------------------------------------------------------------------------
     bool isFrozen() const { return m_freeze_state == FROZEN; }
+    // ------------------------------------------------------------------------
+    /** Returns true if events are recorded for a trace. */
+    bool isTraceCapturing() const { return m_trace_capture.load(); }
 
 };
 
@@ -0,0 +1,194 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_RING_BUFFER_HPP
+#define HEADER_RING_BUFFER_HPP
+
+#include <assert.h>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+/** A double ended queue stored in one contiguous array, which grows if
+ *  necessary. Elements are usually added at the end and removed at the
+ *  front (both O(1)), but can also be inserted anywhere, which moves all
+ *  later elements.
+ *  An iterator stores the position of an element since the ring buffer was
+ *  created, so it stays valid if elements are added or removed in front of
+ *  it (except for insert() before the iterator, which moves the element to
+ *  the next position).
+ */
+template<typename T>
+class RingBuffer
+{
+public:
+    class iterator
+    {
+    private:
+        friend class RingBuffer;
+
+        RingBuffer* m_ring;
+
+        /** Position of the element since the ring buffer was created. */
+        size_t m_index;
+
+        /** Position of the element relative to the current front, so
+         *  that comparisons work if m_index wraps around. */
+        size_t offset() const { return m_index - m_ring->m_first; }
+    public:
+        iterator() : m_ring(NULL), m_index(0) {}
+        iterator(RingBuffer* ring, size_t index)
+            : m_ring(ring), m_index(index) {}
+        // --------------------------------------------------------------------
+        T& operator*() const                 { return m_ring->at(m_index); }
+        T* operator->() const               { return &m_ring->at(m_index); }
+        iterator& operator++()                { m_index++; return *this; }
+        iterator& operator--()                { m_index--; return *this; }
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            m_index++;
+            return old;
+        }
+        iterator operator--(int)
+        {
+            iterator old = *this;
+            m_index--;
+            return old;
+        }
+        iterator operator+(ptrdiff_t n) const
+                                  { return iterator(m_ring, m_index + n); }
+        iterator operator-(ptrdiff_t n) const
+                                  { return iterator(m_ring, m_index - n); }
+        ptrdiff_t operator-(const iterator& other) const
+                            { return (ptrdiff_t)(m_index - other.m_index); }
+        bool operator==(const iterator& other) const
+                                         { return m_index == other.m_index; }
+        bool operator!=(const iterator& other) const
+                                         { return m_index != other.m_index; }
+        bool operator<(const iterator& other) const
+                                       { return offset() < other.offset(); }
+    };   // iterator
+    typedef iterator const_iterator;
+
+private:
+    /** The elements, the size is always a power of two. */
+    std::vector<T> m_data;
+
+    /** Position of the first element since the ring buffer was created. */
+    size_t m_first;
+
+    /** Number of elements. */
+    size_t m_size;
+
+    // ------------------------------------------------------------------------
+    T& at(size_t index)         { return m_data[index & (m_data.size() - 1)]; }
+    // ------------------------------------------------------------------------
+    /** Doubles the capacity, elements keep their positions. */
+    void grow()
+    {
+        std::vector<T> data(m_data.size() * 2);
+        for (size_t i = m_first; i != m_first + m_size; i++)
+            data[i & (data.size() - 1)] = std::move(at(i));
+        m_data.swap(data);
+    }   // grow
+
+public:
+    RingBuffer(size_t capacity = 64) : m_first(0), m_size(0)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n *= 2;
+        m_data.resize(n);
+    }   // RingBuffer
+    // ------------------------------------------------------------------------
+    iterator begin()                        { return iterator(this, m_first); }
+    // ------------------------------------------------------------------------
+    iterator end()                { return iterator(this, m_first + m_size); }
+    // ------------------------------------------------------------------------
+    /** Const versions, used to compare iterators in const functions. */
+    const_iterator begin() const
+                   { return iterator(const_cast<RingBuffer*>(this), m_first); }
+    // ------------------------------------------------------------------------
+    const_iterator end() const
+        { return iterator(const_cast<RingBuffer*>(this), m_first + m_size); }
+    // ------------------------------------------------------------------------
+    size_t size() const                                    { return m_size; }
+    // ------------------------------------------------------------------------
+    bool empty() const                                { return m_size == 0; }
+    // ------------------------------------------------------------------------
+    T& front()                      { assert(m_size > 0); return at(m_first); }
+    // ------------------------------------------------------------------------
+    T& back()
+    {
+        assert(m_size > 0);
+        return at(m_first + m_size - 1);
+    }   // back
+    // ------------------------------------------------------------------------
+    /** Returns the n-th element counted from the front. */
+    T& operator[](size_t n)
+    {
+        assert(n < m_size);
+        return at(m_first + n);
+    }   // operator[]
+    // ------------------------------------------------------------------------
+    /** Removes all elements. Iterators to removed elements are not reused,
+     *  so the old end() iterator stays equal to the new end(). */
+    void clear()
+    {
+        for (size_t i = m_first; i != m_first + m_size; i++)
+            at(i) = T();
+        m_first += m_size;
+        m_size = 0;
+    }   // clear
+    // ------------------------------------------------------------------------
+    void push_back(const T& t)
+    {
+        if (m_size == m_data.size())
+            grow();
+        at(m_first + m_size) = t;
+        m_size++;
+    }   // push_back
+    // ------------------------------------------------------------------------
+    void pop_front()
+    {
+        assert(m_size > 0);
+        at(m_first) = T();
+        m_first++;
+        m_size--;
+    }   // pop_front
+    // ------------------------------------------------------------------------
+    /** Inserts an element before the given position, and moves all later
+     *  elements by one. The cost is linear in the number of later elements.
+     *  \return Iterator to the inserted element.
+     */
+    iterator insert(iterator pos, const T& t)
+    {
+        assert(pos.m_ring == this && pos.offset() <= m_size);
+        if (m_size == m_data.size())
+            grow();
+        for (size_t i = m_first + m_size; i != pos.m_index; i--)
+            at(i) = std::move(at(i - 1));
+        at(pos.m_index) = t;
+        m_size++;
+        return pos;
+    }   // insert
+
+};   // RingBuffer
+
+#endif
@@ -0,0 +1,141 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "utils/worker_pool.hpp"
+
+// ----------------------------------------------------------------------------
+/** Creates the worker threads.
+ *  \param num_threads Total number of threads that execute jobs, including
+ *         the thread calling run(). A value of 0 or 1 creates no threads,
+ *         all jobs are then executed by the calling thread.
+ */
+WorkerPool::WorkerPool(unsigned int num_threads)
+{
+    m_job          = NULL;
+    m_count        = 0;
+    m_next_index   = 0;
+    m_busy_workers = 0;
+    m_generation   = 0;
+    m_quit         = false;
+    for (unsigned int i = 1; i < num_threads; i++)
+        m_threads.emplace_back(&WorkerPool::workerLoop, this, i);
+}   // WorkerPool
+
+// ----------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_start_cv.notify_all();
+    for (std::thread &t : m_threads)
+        t.join();
+}   // ~WorkerPool
+
+// ----------------------------------------------------------------------------
+/** Returns the number of threads to use by default, which is the number of
+ *  hardware threads (but at least one).
+ */
+unsigned int WorkerPool::getDefaultNumThreads()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}   // getDefaultNumThreads
+
+// ----------------------------------------------------------------------------
+/** Executes job for all indices 0 ... count-1 and waits till all are done.
+ *  Must only be called from one thread at a time.
+ *  \param count Number of indices.
+ *  \param job The function to execute for each index.
+ */
+void WorkerPool::run(unsigned int count, const Job &job)
+{
+    if (count == 0)
+        return;
+
+    // Waking up the workers is not worth it for a single index
+    if (m_threads.empty() || count == 1)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            job(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job          = &job;
+        m_count        = count;
+        m_next_index   = 0;
+        m_busy_workers = (unsigned int)m_threads.size();
+        m_generation++;
+    }
+    m_start_cv.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [this]() { return m_busy_workers == 0; });
+    m_job = NULL;
+}   // run
+
+// ----------------------------------------------------------------------------
+/** Processes indices of the current job until none are left.
+ *  \param thread Number of the executing thread.
+ */
+void WorkerPool::work(unsigned int thread)
+{
+    while (true)
+    {
+        unsigned int index = m_next_index.fetch_add(1);
+        if (index >= m_count)
+            return;
+        (*m_job)(index, thread);
+    }
+}   // work
+
+// ----------------------------------------------------------------------------
+/** The main loop of a worker thread: waits for a job, helps to execute it,
+ *  and signals the calling thread when done.
+ *  \param thread Number of this thread.
+ */
+void WorkerPool::workerLoop(unsigned int thread)
+{
+    unsigned int generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start_cv.wait(lock, [this, generation]()
+                {
+                    return m_quit || m_generation != generation;
+                });
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+
+        work(thread);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy_workers--;
+        if (m_busy_workers == 0)
+            m_done_cv.notify_one();
+    }
+}   // workerLoop
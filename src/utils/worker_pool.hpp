@@ -0,0 +1,94 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_WORKER_POOL_HPP
+#define HEADER_WORKER_POOL_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A small pool of worker threads which is used to execute a function for
+ *  a range of indices in parallel, e.g. once per physics step. The calling
+ *  thread takes part in the work, and run() only returns once all indices
+ *  were processed, so no additional synchronisation is necessary to access
+ *  the results. The order in which indices are processed, and the thread
+ *  used for an index, is undefined.
+ * \ingroup utils
+ */
+class WorkerPool : public NoCopy
+{
+public:
+    /** The function executed for each index. The second parameter is the
+     *  number of the thread executing the job (0 is the calling thread,
+     *  and it is always smaller than getNumThreads()), which can be used
+     *  to access per-thread scratch data. */
+    typedef std::function<void(unsigned int index, unsigned int thread)> Job;
+
+private:
+    /** The worker threads (the calling thread is not included). */
+    std::vector<std::thread> m_threads;
+
+    /** Protects all data below except m_next_index. */
+    std::mutex m_mutex;
+
+    /** Used to wake up the workers when a new job is available. */
+    std::condition_variable m_start_cv;
+
+    /** Used to signal the calling thread that all workers are done. */
+    std::condition_variable m_done_cv;
+
+    /** The job currently executed. */
+    const Job *m_job;
+
+    /** Number of indices of the current job. */
+    unsigned int m_count;
+
+    /** The next index to be processed. */
+    std::atomic<unsigned int> m_next_index;
+
+    /** Number of workers which have not yet finished the current job. */
+    unsigned int m_busy_workers;
+
+    /** Incremented for each job, so workers can detect a new job. */
+    unsigned int m_generation;
+
+    /** Set when the pool is destroyed. */
+    bool m_quit;
+
+    void workerLoop(unsigned int thread);
+    void work(unsigned int thread);
+
+public:
+             WorkerPool(unsigned int num_threads);
+            ~WorkerPool();
+    void     run(unsigned int count, const Job &job);
+    static unsigned int getDefaultNumThreads();
+    // ------------------------------------------------------------------------
+    /** Returns the number of threads, including the calling thread. */
+    unsigned int getNumThreads() const
+                                { return (unsigned int)m_threads.size() + 1; }
+};   // WorkerPool
+
+#endif
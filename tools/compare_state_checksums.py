@@ -0,0 +1,162 @@
+#!/usr/bin/env python
+
+# Compares the state checksums written with --state-checksums=file by a
+# server and a client, and prints for each race the first time and rewinder
+# at which the states differ.
+
+from __future__ import print_function
+
+import sys
+
+# Must match RewinderName in src/network/rewinder.hpp
+REWINDER_NAMES = { 0x01: "item manager",
+                   0x02: "kart",
+                   0x03: "red flag",
+                   0x04: "blue flag",
+                   0x05: "cake",
+                   0x06: "bowling ball",
+                   0x07: "plunger",
+                   0x08: "rubber ball",
+                   0x09: "physical object" }
+
+def usage():
+    print("Usage:")
+    print("compare_state_checksums.py [-i] [-x uid] [-r s:c] server-file "
+          "client-file")
+    print("Each race in the files starts with a line 'race <number> <track>',")
+    print("followed by lines with a time in ticks and a")
+    print("'unique identity:checksum' pair for each rewinder. Races with the")
+    print("same number are compared.")
+    print("  -i      Ignore rewinders which are only in one of the files.")
+    print("  -x uid  Ignore the rewinder with the given unique identity (hex),")
+    print("          can be used several times.")
+    print("  -r s:c  Only compare race s of the server with race c of the")
+    print("          client, e.g. if the client joined the server later.")
+    sys.exit(1)
+
+# -----------------------------------------------------------------------------
+def readFile(name):
+    """Returns a dictionary of race number to a tuple of the track and a
+    dictionary of time to a dictionary of rewinder to checksum."""
+    result = {}
+    race = (None, {})
+    f = open(name, "r")
+    for line in f:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "race":
+            race = (" ".join(fields[2:]), {})
+            result[int(fields[1])] = race
+            continue
+        rewinders = {}
+        for pair in fields[1:]:
+            uid, checksum = pair.split(":")
+            rewinders[uid] = checksum
+        race[1][int(fields[0])] = rewinders
+    f.close()
+    return result
+
+# -----------------------------------------------------------------------------
+def describe(uid):
+    """Converts the hex unique identity of a rewinder into a readable name."""
+    data = bytearray.fromhex(uid)
+    if not data:
+        return uid
+    name = REWINDER_NAMES.get(data[0], "unknown rewinder %d" % data[0])
+    if len(data) > 1:
+        name += " " + " ".join(["%d" % i for i in data[1:]])
+    return "%s (%s)" % (name, uid)
+
+# -----------------------------------------------------------------------------
+def compareRace(server, client, ignore_missing, excluded):
+    """Compares the checksums of one race, returns 1 if they differ."""
+    common = sorted(set(server.keys()) & set(client.keys()))
+    if not common:
+        print("The race has no state time in common.")
+        return 1
+
+    for ticks in common:
+        s = server[ticks]
+        c = client[ticks]
+        different = []
+        for uid in sorted(set(s.keys()) | set(c.keys())):
+            if uid in excluded:
+                continue
+            if uid not in c or uid not in s:
+                if not ignore_missing:
+                    different.append("%s is only on the %s" %
+                        (describe(uid), "server" if uid in s else "client"))
+            elif s[uid] != c[uid]:
+                different.append("%s differs" % describe(uid))
+        if different:
+            print("First difference at ticks %d (%d states compared "
+                  "before):" % (ticks, common.index(ticks)))
+            for d in different:
+                print("   " + d)
+            return 1
+
+    print("All %d states from ticks %d to %d are identical." %
+          (len(common), common[0], common[-1]))
+    return 0
+
+# -----------------------------------------------------------------------------
+def main(argv):
+    ignore_missing = False
+    excluded = set()
+    races = None
+    files = []
+    i = 0
+    while i < len(argv):
+        if argv[i] == "-i":
+            ignore_missing = True
+        elif argv[i] == "-x" and i + 1 < len(argv):
+            excluded.add(argv[i + 1].lower())
+            i += 1
+        elif argv[i] == "-r" and i + 1 < len(argv):
+            try:
+                s, c = argv[i + 1].split(":")
+                races = [(int(s), int(c))]
+            except ValueError:
+                usage()
+            i += 1
+        elif argv[i].startswith("-"):
+            usage()
+        else:
+            files.append(argv[i])
+        i += 1
+    if len(files) != 2:
+        usage()
+
+    server = readFile(files[0])
+    client = readFile(files[1])
+    if races is None:
+        races = [(r, r) for r in sorted(set(server.keys()) &
+                                        set(client.keys()))]
+    if not races:
+        print("The files have no race in common.")
+        return 1
+
+    result = 0
+    for s, c in races:
+        if s not in server or c not in client:
+            print("Race %d of the %s is missing." %
+                  ((s, "server") if s not in server else (c, "client")))
+            result = 1
+            continue
+        server_track, server_states = server[s]
+        client_track, client_states = client[c]
+        print("Race %d (%s) of the server, race %d (%s) of the client:" %
+              (s, server_track, c, client_track))
+        if server_track != client_track:
+            print("   The tracks differ.")
+            result = 1
+            continue
+        if compareRace(server_states, client_states, ignore_missing,
+                       excluded) != 0:
+            result = 1
+    return result
+
+# -----------------------------------------------------------------------------
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))